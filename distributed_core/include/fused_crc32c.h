@@ -0,0 +1,42 @@
+#ifndef FUSED_CRC32C_H
+#define FUSED_CRC32C_H
+
+/*
+ * CRC32C (Castagnoli), the checksum storage nodes keep per block of file
+ * data, shared by the nodes and the clients that verify what they read.
+ *
+ * The SSE4.2 crc32 instruction is used on CPUs that have it, a
+ * slice-by-8 table loop elsewhere; both give the same results.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Extend a checksum with len more bytes; start from 0.
+ * crc32c(crc32c(0, a, n), b, m) is the checksum of a followed by b.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* Whether crc32c() runs on the SSE4.2 instruction */
+bool crc32c_hardware(void);
+
+/*
+ * Check data against per-block checksums.
+ * crcs[i] covers data[i * block, min((i + 1) * block, len)).
+ * Returns the index of the first block that does not match, or -1.
+ */
+ssize_t crc32c_verify_blocks(const void *data, size_t len, const uint32_t *crcs, size_t n,
+                             uint32_t block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FUSED_CRC32C_H */
@@ -0,0 +1,92 @@
+#ifndef FUSED_LOG_H
+#define FUSED_LOG_H
+
+/*
+ * Leveled, asynchronous logging shared by every FUSED binary.
+ *
+ * Each thread formats its messages into its own lock-free ring; a background
+ * writer drains all rings to stderr in batches, so logging never takes a
+ * lock shared with other request threads and never blocks on the terminal.
+ * A full ring drops messages (the writer reports how many) instead of
+ * stalling the caller. Until fused_log_init() runs, and after
+ * fused_log_shutdown(), messages are written synchronously.
+ *
+ * Levels are filtered twice: statements below FUSED_LOG_COMPILE_LEVEL are
+ * compiled out, the rest are checked against the runtime level (taken from
+ * the FUSED_LOG_LEVEL environment variable at init, default "info").
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Log levels */
+typedef enum {
+    FUSED_LOG_DEBUG = 0,
+    FUSED_LOG_INFO = 1,
+    FUSED_LOG_WARN = 2,
+    FUSED_LOG_ERROR = 3,
+    FUSED_LOG_OFF = 4
+} fused_log_level_t;
+
+#ifndef FUSED_LOG_COMPILE_LEVEL
+#define FUSED_LOG_COMPILE_LEVEL FUSED_LOG_DEBUG
+#endif
+
+#define FUSED_LOG_MSG_MAX 240           // Longer messages are truncated
+#define FUSED_LOG_RING_SLOTS 512        // Per-thread ring capacity (power of two)
+#define FUSED_LOG_FLUSH_INTERVAL_MS 20  // Writer wake-up period when idle
+
+/* Current runtime level; read on every log statement */
+extern int fused_log_level;
+
+/* Lifecycle: start/stop the background writer (safe to call repeatedly) */
+int fused_log_init(const char *component);
+void fused_log_shutdown(void);
+
+/* Runtime level control */
+void fused_log_set_level(fused_log_level_t level);
+fused_log_level_t fused_log_parse_level(const char *name, fused_log_level_t fallback);
+
+/* Drain every ring now (used before exit and by tests) */
+void fused_log_flush(void);
+
+/* Enqueue one message; prefer the log_* macros, which filter by level first */
+void fused_log_write(fused_log_level_t level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Rate limiter state for one call site; see log_ratelimited() */
+int fused_log_ratelimit_pass(uint64_t *next_ns, uint32_t interval_ms);
+
+static inline int fused_log_enabled(fused_log_level_t level) {
+    return level >= FUSED_LOG_COMPILE_LEVEL &&
+           (int)level >= __atomic_load_n(&fused_log_level, __ATOMIC_RELAXED);
+}
+
+#define FUSED_LOG_AT(level, ...)                         \
+    do {                                                 \
+        if (fused_log_enabled(level))                    \
+            fused_log_write((level), __VA_ARGS__);       \
+    } while (0)
+
+#define log_debug(...) FUSED_LOG_AT(FUSED_LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  FUSED_LOG_AT(FUSED_LOG_INFO, __VA_ARGS__)
+#define log_warn(...)  FUSED_LOG_AT(FUSED_LOG_WARN, __VA_ARGS__)
+#define log_error(...) FUSED_LOG_AT(FUSED_LOG_ERROR, __VA_ARGS__)
+
+/* Emit at most one message per interval_ms from this call site */
+#define log_ratelimited(level, interval_ms, ...)                            \
+    do {                                                                    \
+        static uint64_t fused_log_next_ns_;                                 \
+        if (fused_log_enabled(level) &&                                     \
+            fused_log_ratelimit_pass(&fused_log_next_ns_, (interval_ms)))   \
+            fused_log_write((level), __VA_ARGS__);                          \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FUSED_LOG_H */
@@ -50,6 +50,14 @@ typedef struct {
     uint64_t bytes_transferred;     // Bytes read/written
 } storage_response_t;
 
+/* Block checksums of a stored range */
+typedef struct {
+    uint64_t length;                // Bytes from the offset they were taken over
+    uint32_t block_size;            // Bytes per checksum, 0 = the node keeps none
+    uint32_t *crcs;                 // CRC32C of each block; the last may be partial
+    uint32_t count;
+} storage_checksums_t;
+
 /* Storage Interface Manager */
 typedef struct {
     // Available storage nodes
@@ -161,6 +169,20 @@ int storage_interface_read(storage_interface_t *iface, uint32_t node_id,
                            const char *file_id, uint64_t offset, uint64_t length,
                            storage_response_t *response);
 
+/**
+ * Fetch the block checksums of a range instead of its data
+ * @param iface Storage interface
+ * @param node_id Source storage node ID
+ * @param file_id File identifier
+ * @param offset Offset to start at, a multiple of the node's block size
+ * @param length Length of the range
+ * @param checksums Output checksums; free with storage_checksums_free()
+ * @return 0 on success, -1 on error (also for nodes without checksums)
+ */
+int storage_interface_checksums(storage_interface_t *iface, uint32_t node_id,
+                                const char *file_id, uint64_t offset, uint64_t length,
+                                storage_checksums_t *checksums);
+
 /**
  * Delete data from a storage node
  * @param iface Storage interface
@@ -216,4 +238,9 @@ int storage_interface_get_healthy_nodes(storage_interface_t *iface,
  */
 void storage_response_free(storage_response_t *response);
 
+/**
+ * Free storage checksums resources
+ */
+void storage_checksums_free(storage_checksums_t *checksums);
+
 #endif /* STORAGE_INTERFACE_H */
@@ -0,0 +1,101 @@
+#include "fused_crc32c.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u         // Castagnoli, bit-reversed
+
+typedef uint32_t (*crc_fn_t)(uint32_t crc, const unsigned char *p, size_t len);
+
+static struct {
+    pthread_once_t once;
+    crc_fn_t fn;
+    uint32_t table[8][256];             // table[k][b]: b followed by k zero bytes
+} g_crc = {
+    .once = PTHREAD_ONCE_INIT,
+};
+
+/* Table loop, eight bytes per step; crc is the inverted running value */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word ^= crc;
+        crc = g_crc.table[7][word & 0xff] ^ g_crc.table[6][(word >> 8) & 0xff] ^
+              g_crc.table[5][(word >> 16) & 0xff] ^ g_crc.table[4][(word >> 24) & 0xff] ^
+              g_crc.table[3][(word >> 32) & 0xff] ^ g_crc.table[2][(word >> 40) & 0xff] ^
+              g_crc.table[1][(word >> 48) & 0xff] ^ g_crc.table[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len-- > 0)
+        crc = g_crc.table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#endif
+
+static void crc_setup(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t c = b;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        g_crc.table[0][b] = c;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = g_crc.table[k - 1][b];
+            g_crc.table[k][b] = (prev >> 8) ^ g_crc.table[0][prev & 0xff];
+        }
+    }
+
+    g_crc.fn = crc32c_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        g_crc.fn = crc32c_hw;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    pthread_once(&g_crc.once, crc_setup);
+    return ~g_crc.fn(~crc, (const unsigned char *)buf, len);
+}
+
+bool crc32c_hardware(void) {
+    pthread_once(&g_crc.once, crc_setup);
+    return g_crc.fn != crc32c_sw;
+}
+
+ssize_t crc32c_verify_blocks(const void *data, size_t len, const uint32_t *crcs, size_t n,
+                             uint32_t block) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < n; i++) {
+        size_t start = i * (size_t)block;
+        if (start >= len)
+            return (ssize_t)i;
+        size_t end = start + block < len ? start + block : len;
+        if (crc32c(0, p + start, end - start) != crcs[i])
+            return (ssize_t)i;
+    }
+    return -1;
+}
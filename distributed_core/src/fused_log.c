@@ -0,0 +1,324 @@
+#include "fused_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define LOG_BATCH_SIZE 65536
+#define LOG_LINE_MAX (FUSED_LOG_MSG_MAX + 96)
+
+/* One formatted message waiting for the writer */
+typedef struct {
+    uint64_t ts_ns;                 // Wall-clock time of the call
+    uint32_t level;
+    uint32_t len;                   // Bytes used in msg
+    char msg[FUSED_LOG_MSG_MAX];
+} log_record_t;
+
+/*
+ * Single-producer/single-consumer ring: only the owning thread advances
+ * head, only the writer advances tail.
+ */
+typedef struct log_ring {
+    log_record_t slots[FUSED_LOG_RING_SLOTS];
+    uint64_t head;                  // Next slot the owner fills
+    uint64_t tail;                  // Next slot the writer drains
+    uint64_t dropped;               // Messages lost to a full ring
+    int orphaned;                   // Owner thread has exited
+    struct log_ring *next;          // Registry of all rings
+} log_ring_t;
+
+static struct {
+    pthread_mutex_t lock;           // Guards the registry and the writer state
+    pthread_cond_t wake;
+    log_ring_t *rings;
+    pthread_t writer;
+    int running;                    // Writer thread active (read lock-free)
+    pthread_once_t key_once;
+    pthread_key_t key;              // Orphans a ring when its thread exits
+    char component[32];
+    char batch[LOG_BATCH_SIZE];     // Writer output buffer
+    size_t batch_len;
+} g_log = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .key_once = PTHREAD_ONCE_INIT,
+    .component = "fused",
+};
+
+int fused_log_level = FUSED_LOG_INFO;
+
+static __thread log_ring_t *t_ring;
+
+static const char *level_name(uint32_t level) {
+    static const char *names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+    return level < sizeof(names) / sizeof(names[0]) ? names[level] : "?";
+}
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Write a whole buffer to stderr, retrying short writes */
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDERR_FILENO, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+/* Render "date time.ms LEVEL component: message\n" into out */
+static size_t format_line(char *out, size_t cap, uint64_t ts_ns, uint32_t level,
+                          const char *msg, uint32_t len) {
+    time_t secs = (time_t)(ts_ns / 1000000000ull);
+    unsigned ms = (unsigned)(ts_ns / 1000000ull % 1000);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    int n = snprintf(out, cap, "%s.%03u %-5s %s: %.*s\n", stamp, ms, level_name(level),
+                     g_log.component, (int)len, msg);
+    if (n < 0)
+        return 0;
+    return (size_t)n < cap ? (size_t)n : cap - 1;
+}
+
+/* Append to the writer batch; caller holds g_log.lock */
+static void batch_append(const char *line, size_t len) {
+    if (g_log.batch_len + len > sizeof(g_log.batch)) {
+        write_all(g_log.batch, g_log.batch_len);
+        g_log.batch_len = 0;
+    }
+    memcpy(g_log.batch + g_log.batch_len, line, len);
+    g_log.batch_len += len;
+}
+
+/* Move every pending record of one ring into the batch; caller holds g_log.lock */
+static void drain_ring(log_ring_t *ring) {
+    char line[LOG_LINE_MAX];
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    for (; tail != head; tail++) {
+        const log_record_t *rec = &ring->slots[tail & (FUSED_LOG_RING_SLOTS - 1)];
+        batch_append(line, format_line(line, sizeof(line), rec->ts_ns, rec->level,
+                                       rec->msg, rec->len));
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        char msg[64];
+        int len = snprintf(msg, sizeof(msg), "%llu log messages dropped (ring full)",
+                           (unsigned long long)dropped);
+        batch_append(line, format_line(line, sizeof(line), now_ns(CLOCK_REALTIME),
+                                       FUSED_LOG_WARN, msg, (uint32_t)len));
+    }
+}
+
+/* Drain all rings and free those whose thread is gone; caller holds g_log.lock */
+static void drain_all(void) {
+    log_ring_t **link = &g_log.rings;
+    while (*link) {
+        log_ring_t *ring = *link;
+        drain_ring(ring);
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail) {
+            *link = ring->next;
+            free(ring);
+            continue;
+        }
+        link = &ring->next;
+    }
+    if (g_log.batch_len > 0) {
+        write_all(g_log.batch, g_log.batch_len);
+        g_log.batch_len = 0;
+    }
+}
+
+static void ring_orphan(void *arg) {
+    log_ring_t *ring = (log_ring_t *)arg;
+    __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+
+    // With no writer running nobody else would reclaim it
+    pthread_mutex_lock(&g_log.lock);
+    if (!g_log.running)
+        drain_all();
+    pthread_mutex_unlock(&g_log.lock);
+}
+
+static void key_create(void) {
+    pthread_key_create(&g_log.key, ring_orphan);
+}
+
+/* First message from a thread: allocate and register its ring */
+static log_ring_t *ring_register(void) {
+    log_ring_t *ring = (log_ring_t *)calloc(1, sizeof(log_ring_t));
+    if (!ring)
+        return NULL;
+
+    pthread_once(&g_log.key_once, key_create);
+    pthread_setspecific(g_log.key, ring);
+
+    pthread_mutex_lock(&g_log.lock);
+    ring->next = g_log.rings;
+    g_log.rings = ring;
+    pthread_mutex_unlock(&g_log.lock);
+
+    t_ring = ring;
+    return ring;
+}
+
+static void *writer_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_log.lock);
+    while (g_log.running) {
+        drain_all();
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += FUSED_LOG_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&g_log.wake, &g_log.lock, &deadline);
+    }
+    drain_all();
+    pthread_mutex_unlock(&g_log.lock);
+    return NULL;
+}
+
+/* Start the background writer; component prefixes every line */
+int fused_log_init(const char *component) {
+    pthread_mutex_lock(&g_log.lock);
+    if (component)
+        snprintf(g_log.component, sizeof(g_log.component), "%s", component);
+
+    fused_log_set_level(fused_log_parse_level(getenv("FUSED_LOG_LEVEL"), FUSED_LOG_INFO));
+
+    if (g_log.running) {
+        pthread_mutex_unlock(&g_log.lock);
+        return 0;
+    }
+
+    __atomic_store_n(&g_log.running, 1, __ATOMIC_RELEASE);
+    int rc = pthread_create(&g_log.writer, NULL, writer_thread, NULL);
+    if (rc != 0) {
+        __atomic_store_n(&g_log.running, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&g_log.lock);
+        return -rc;
+    }
+    pthread_mutex_unlock(&g_log.lock);
+    return 0;
+}
+
+/* Stop the writer after a final drain; later messages are written directly */
+void fused_log_shutdown(void) {
+    pthread_mutex_lock(&g_log.lock);
+    if (!g_log.running) {
+        pthread_mutex_unlock(&g_log.lock);
+        return;
+    }
+    __atomic_store_n(&g_log.running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&g_log.wake);
+    pthread_mutex_unlock(&g_log.lock);
+
+    pthread_join(g_log.writer, NULL);
+
+    // Catch messages enqueued while the writer was finishing
+    fused_log_flush();
+}
+
+void fused_log_flush(void) {
+    pthread_mutex_lock(&g_log.lock);
+    drain_all();
+    pthread_mutex_unlock(&g_log.lock);
+}
+
+void fused_log_set_level(fused_log_level_t level) {
+    __atomic_store_n(&fused_log_level, (int)level, __ATOMIC_RELAXED);
+}
+
+/* Map "debug", "info", "warn", "error" or "off" to a level */
+fused_log_level_t fused_log_parse_level(const char *name, fused_log_level_t fallback) {
+    if (!name)
+        return fallback;
+    if (strcasecmp(name, "debug") == 0)
+        return FUSED_LOG_DEBUG;
+    if (strcasecmp(name, "info") == 0)
+        return FUSED_LOG_INFO;
+    if (strcasecmp(name, "warn") == 0 || strcasecmp(name, "warning") == 0)
+        return FUSED_LOG_WARN;
+    if (strcasecmp(name, "error") == 0)
+        return FUSED_LOG_ERROR;
+    if (strcasecmp(name, "off") == 0)
+        return FUSED_LOG_OFF;
+    return fallback;
+}
+
+void fused_log_write(fused_log_level_t level, const char *fmt, ...) {
+    va_list args;
+    log_ring_t *ring = NULL;
+
+    if (__atomic_load_n(&g_log.running, __ATOMIC_ACQUIRE))
+        ring = t_ring ? t_ring : ring_register();
+
+    if (!ring) {
+        // No writer: format and write the line directly
+        char msg[FUSED_LOG_MSG_MAX];
+        char line[LOG_LINE_MAX];
+        va_start(args, fmt);
+        int len = vsnprintf(msg, sizeof(msg), fmt, args);
+        va_end(args);
+        if (len < 0)
+            return;
+        if (len >= (int)sizeof(msg))
+            len = sizeof(msg) - 1;
+        write_all(line, format_line(line, sizeof(line), now_ns(CLOCK_REALTIME), level,
+                                    msg, (uint32_t)len));
+        return;
+    }
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= FUSED_LOG_RING_SLOTS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    log_record_t *rec = &ring->slots[head & (FUSED_LOG_RING_SLOTS - 1)];
+    rec->ts_ns = now_ns(CLOCK_REALTIME);
+    rec->level = level;
+    va_start(args, fmt);
+    int len = vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+    va_end(args);
+    if (len < 0)
+        len = 0;
+    rec->len = len < (int)sizeof(rec->msg) ? (uint32_t)len : sizeof(rec->msg) - 1;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Let one caller through per interval_ms; others return 0 */
+int fused_log_ratelimit_pass(uint64_t *next_ns, uint32_t interval_ms) {
+    uint64_t now = now_ns(CLOCK_MONOTONIC);
+    uint64_t next = __atomic_load_n(next_ns, __ATOMIC_RELAXED);
+    if (now < next)
+        return 0;
+    return __atomic_compare_exchange_n(next_ns, &next, now + (uint64_t)interval_ms * 1000000ull,
+                                       0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
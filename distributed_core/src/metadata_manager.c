@@ -1,4 +1,5 @@
 #include "metadata_manager.h"
+#include "fused_log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -66,7 +67,7 @@ metadata_manager_t *metadata_manager_init(const char *wal_path) {
     strncpy(mgr->wal_path, wal_path, sizeof(mgr->wal_path) - 1);
     mgr->wal_fd = open(wal_path, O_RDWR | O_CREAT | O_APPEND, 0644);
     if (mgr->wal_fd < 0) {
-        perror("Failed to open WAL file");
+        log_error("Failed to open WAL file: %s", strerror(errno));
         free(mgr->hash_map);
         free(mgr);
         return NULL;
@@ -82,7 +83,7 @@ metadata_manager_t *metadata_manager_init(const char *wal_path) {
     
     // Replay WAL for recovery
     if (wal_replay(mgr) != 0) {
-        fprintf(stderr, "Warning: WAL replay failed\n");
+        log_warn("WAL replay failed");
     }
     
     return mgr;
@@ -346,7 +347,7 @@ uint64_t wal_append(metadata_manager_t *mgr, wal_op_type_t op_type,
     
     // CRITICAL: fsync to ensure durability
     if (fsync(mgr->wal_fd) != 0) {
-        perror("fsync failed");
+        log_error("fsync failed: %s", strerror(errno));
         pthread_mutex_unlock(&mgr->wal_lock);
         return UINT64_MAX;
     }
@@ -388,8 +389,8 @@ int wal_replay(metadata_manager_t *mgr) {
         // Verify checksum
         uint32_t checksum = metadata_crc32(wal_entry.data, wal_entry.data_len);
         if (checksum != wal_entry.checksum) {
-            fprintf(stderr, "WAL corruption detected at LSN %" PRIu64 "\n", 
-                   wal_entry.log_sequence_number);
+            log_error("WAL corruption detected at LSN %" PRIu64,
+                      wal_entry.log_sequence_number);
             free(wal_entry.data);
             continue;
         }
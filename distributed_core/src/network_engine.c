@@ -1,4 +1,5 @@
 #include "network_engine.h"
+#include "fused_log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -100,19 +101,19 @@ int network_set_socket_options(int fd) {
     
     // Enable TCP keepalive
     if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval)) < 0) {
-        perror("setsockopt SO_KEEPALIVE failed");
+        log_error("setsockopt SO_KEEPALIVE failed: %s", strerror(errno));
         return -1;
     }
     
     // Disable Nagle's algorithm for low latency
     if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0) {
-        perror("setsockopt TCP_NODELAY failed");
+        log_error("setsockopt TCP_NODELAY failed: %s", strerror(errno));
         return -1;
     }
     
     // Allow address reuse
     if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
-        perror("setsockopt SO_REUSEADDR failed");
+        log_error("setsockopt SO_REUSEADDR failed: %s", strerror(errno));
         return -1;
     }
     
@@ -160,7 +161,7 @@ static void *network_event_loop(void *arg) {
         
         if (ret < 0) {
             if (errno == EINTR) continue;
-            perror("poll failed");
+            log_error("poll failed: %s", strerror(errno));
             break;
         }
         
@@ -175,7 +176,7 @@ static void *network_event_loop(void *arg) {
                                   (struct sockaddr *)&client_addr, &client_len);
             
             if (client_fd < 0) {
-                perror("accept failed");
+                log_error("accept failed: %s", strerror(errno));
             } else {
                 network_set_nonblocking(client_fd);
                 network_set_socket_options(client_fd);
@@ -190,8 +191,8 @@ static void *network_event_loop(void *arg) {
                 pthread_mutex_unlock(&engine->inbound_lock);
                 
                 if (client_fd >= 0) {
-                    printf("Accepted connection from %s:%d\n",
-                           inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+                    log_info("Accepted connection from %s:%d",
+                             inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
                 }
             }
         }
@@ -320,7 +321,7 @@ int network_engine_start(network_engine_t *engine) {
     // Create listening socket
     engine->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (engine->listen_fd < 0) {
-        perror("socket failed");
+        log_error("socket failed: %s", strerror(errno));
         return -1;
     }
     
@@ -336,14 +337,14 @@ int network_engine_start(network_engine_t *engine) {
     
     if (bind(engine->listen_fd, (struct sockaddr *)&server_addr, 
             sizeof(server_addr)) < 0) {
-        perror("bind failed");
+        log_error("bind failed: %s", strerror(errno));
         close(engine->listen_fd);
         return -1;
     }
     
     // Listen for connections
     if (listen(engine->listen_fd, MAX_PENDING_CONNECTIONS) < 0) {
-        perror("listen failed");
+        log_error("listen failed: %s", strerror(errno));
         close(engine->listen_fd);
         return -1;
     }
@@ -351,13 +352,13 @@ int network_engine_start(network_engine_t *engine) {
     // Start event loop thread
     engine->running = true;
     if (pthread_create(&engine->event_thread, NULL, network_event_loop, engine) != 0) {
-        perror("pthread_create failed");
+        log_error("pthread_create failed: %s", strerror(errno));
         engine->running = false;
         close(engine->listen_fd);
         return -1;
     }
     
-    printf("Network engine listening on port %d\n", engine->listen_port);
+    log_info("Network engine listening on port %d", engine->listen_port);
     
     return 0;
 }
@@ -395,7 +396,7 @@ int network_engine_add_peer(network_engine_t *engine, uint32_t node_id,
     
     // Attempt to connect
     if (network_connect_peer(peer) == 0) {
-        printf("Connected to peer %u at %s:%d\n", node_id, ip_address, port);
+        log_info("Connected to peer %u at %s:%d", node_id, ip_address, port);
     }
     
     engine->num_peers++;
@@ -473,7 +474,7 @@ int network_engine_send(network_engine_t *engine, uint32_t peer_id,
     pthread_rwlock_unlock(&engine->peers_lock);
     
     if (sent < 0) {
-        perror("send failed");
+        log_error("send failed: %s", strerror(errno));
         pthread_rwlock_wrlock(&engine->peers_lock);
         if (peer->socket_fd >= 0) {
             close(peer->socket_fd);
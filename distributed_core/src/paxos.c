@@ -1,4 +1,5 @@
 #include "paxos.h"
+#include "fused_log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -77,7 +78,7 @@ paxos_node_t *paxos_init(uint32_t node_id, uint32_t total_nodes,
                          int (*persist_cb)(uint64_t, void*, size_t),
                          void (*apply_cb)(uint64_t, void*, size_t)) {
     if (total_nodes < 3 || total_nodes % 2 == 0) {
-        fprintf(stderr, "Paxos requires odd number of nodes >= 3\n");
+        log_error("Paxos requires odd number of nodes >= 3");
         return NULL;
     }
     
@@ -173,7 +174,7 @@ int paxos_propose(paxos_node_t *node, void *value, size_t value_len) {
     }
 
     if (!node->broadcast_callback) {
-        fprintf(stderr, "Paxos broadcast callback not configured\n");
+        log_error("Paxos broadcast callback not configured");
         return -1;
     }
     
@@ -213,7 +214,7 @@ int paxos_propose(paxos_node_t *node, void *value, size_t value_len) {
     }
     
     if (!proposal) {
-        fprintf(stderr, "No free proposal slots\n");
+        log_error("No free proposal slots");
         return -1;
     }
 
@@ -1,4 +1,5 @@
 #include "storage_interface.h"
+#include "fused_log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -83,8 +84,8 @@ int storage_interface_register_node(storage_interface_t *iface, uint32_t node_id
     
     pthread_rwlock_unlock(&iface->nodes_lock);
     
-    printf("Registered storage node %u at %s:%d (capacity: %" PRIu64 " bytes)\n",
-           node_id, ip_address, port, capacity);
+    log_info("Registered storage node %u at %s:%d (capacity: %" PRIu64 " bytes)",
+             node_id, ip_address, port, capacity);
     
     return 0;
 }
@@ -184,11 +185,11 @@ int storage_interface_select_nodes(storage_interface_t *iface, uint64_t file_siz
 
 /* Helper: Connect to storage node */
 static int connect_to_storage_node(const char *ip_address, uint16_t port) {
-    printf("[Connect] Attempting to connect to %s:%u\n", ip_address, port);
+    log_debug("[Connect] Attempting to connect to %s:%u", ip_address, port);
     
     int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (sock_fd < 0) {
-        perror("socket failed");
+        log_error("socket failed: %s", strerror(errno));
         return -1;
     }
     
@@ -216,7 +217,7 @@ static int connect_to_storage_node(const char *ip_address, uint16_t port) {
     hints.ai_socktype = SOCK_STREAM;
     
     int getaddr_result = getaddrinfo(ip_address, NULL, &hints, &result);
-    printf("[Connect] getaddrinfo returned %d for %s\n", getaddr_result, ip_address);
+    log_debug("[Connect] getaddrinfo returned %d for %s", getaddr_result, ip_address);
     
     if (getaddr_result == 0) {
         // Successfully resolved hostname
@@ -224,27 +225,26 @@ static int connect_to_storage_node(const char *ip_address, uint16_t port) {
         server_addr.sin_addr = addr_in->sin_addr;
         char resolved_ip[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &server_addr.sin_addr, resolved_ip, INET_ADDRSTRLEN);
-        printf("[Connect] Resolved %s to %s\n", ip_address, resolved_ip);
+        log_debug("[Connect] Resolved %s to %s", ip_address, resolved_ip);
         freeaddrinfo(result);
     } else {
         // Fall back to inet_pton for IP addresses
-        printf("[Connect] Trying inet_pton for %s\n", ip_address);
+        log_debug("[Connect] Trying inet_pton for %s", ip_address);
         if (inet_pton(AF_INET, ip_address, &server_addr.sin_addr) <= 0) {
-            fprintf(stderr, "Failed to resolve address: %s\n", ip_address);
+            log_error("Failed to resolve address: %s", ip_address);
             close(sock_fd);
             return -1;
         }
     }
     
-    printf("[Connect] Calling connect() to %s:%u...\n", ip_address, port);
+    log_debug("[Connect] Calling connect() to %s:%u...", ip_address, port);
     if (connect(sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("connect failed");
-        printf("[Connect] connect() failed with errno=%d\n", errno);
+        log_error("[Connect] connect() to %s:%u failed: %s", ip_address, port, strerror(errno));
         close(sock_fd);
         return -1;
     }
     
-    printf("[Connect] Successfully connected!\n");
+    log_debug("[Connect] Successfully connected!");
     return sock_fd;
 }
 
@@ -259,12 +259,8 @@ int storage_interface_write(storage_interface_t *iface, uint32_t node_id,
     
     memset(response, 0, sizeof(storage_response_t));
     
-    printf("[StorageInterface] Write request: node_id=%u, file_id=%s\n", node_id, file_id);
-    printf("[StorageInterface] Registered nodes: ");
-    for (uint32_t i = 0; i < iface->num_nodes; i++) {
-        printf("%u ", iface->nodes[i].node_id);
-    }
-    printf("\n");
+    log_debug("[StorageInterface] Write request: node_id=%u, file_id=%s (%u nodes registered)",
+              node_id, file_id, iface->num_nodes);
     
     // Find storage node
     storage_node_info_t *node = storage_interface_get_node(iface, node_id);
@@ -272,11 +268,11 @@ int storage_interface_write(storage_interface_t *iface, uint32_t node_id,
         response->status = -1;
         snprintf(response->error_msg, sizeof(response->error_msg), 
                 "Storage node %u not found", node_id);
-        printf("[StorageInterface] Storage node %u not found!\n", node_id);
+        log_warn("[StorageInterface] Storage node %u not found!", node_id);
         return -1;
     }
     
-    printf("[StorageInterface] Found node %u at %s:%u\n", node_id, node->ip_address, node->port);
+    log_debug("[StorageInterface] Found node %u at %s:%u", node_id, node->ip_address, node->port);
     
     // Connect to storage node
     int sock_fd = connect_to_storage_node(node->ip_address, node->port);
@@ -284,7 +280,7 @@ int storage_interface_write(storage_interface_t *iface, uint32_t node_id,
         response->status = -1;
         snprintf(response->error_msg, sizeof(response->error_msg),
                 "Failed to connect to storage node %u", node_id);
-        printf("[StorageInterface] Failed to connect to %s:%u\n", node->ip_address, node->port);
+        log_warn("[StorageInterface] Failed to connect to %s:%u", node->ip_address, node->port);
         return -1;
     }
     
@@ -422,6 +418,85 @@ int storage_interface_read(storage_interface_t *iface, uint32_t node_id,
     return 0;
 }
 
+/* Fetch block checksums from storage node */
+int storage_interface_checksums(storage_interface_t *iface, uint32_t node_id,
+                                const char *file_id, uint64_t offset, uint64_t length,
+                                storage_checksums_t *checksums) {
+    if (!iface || !file_id || !checksums) {
+        return -1;
+    }
+
+    memset(checksums, 0, sizeof(storage_checksums_t));
+
+    storage_node_info_t *node = storage_interface_get_node(iface, node_id);
+    if (!node) {
+        return -1;
+    }
+
+    int sock_fd = connect_to_storage_node(node->ip_address, node->port);
+    if (sock_fd < 0) {
+        return -1;
+    }
+
+    char request_header[256];
+    int header_len = snprintf(request_header, sizeof(request_header),
+                             "CRCS|%s|%lu|%lu\n", file_id, offset, length);
+    if (send(sock_fd, request_header, header_len, 0) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+
+    // "OK|length|block_size|count\n", then count checksums in network order
+    char header[128];
+    size_t used = 0;
+    while (used < sizeof(header) - 1) {
+        ssize_t received = recv(sock_fd, header + used, 1, 0);
+        if (received <= 0 || header[used++] == '\n') {
+            break;
+        }
+    }
+    header[used] = '\0';
+
+    uint64_t covered;
+    uint32_t block_size, count;
+    if (sscanf(header, "OK|%" SCNu64 "|%" SCNu32 "|%" SCNu32, &covered, &block_size,
+               &count) != 3) {
+        // Nodes from before checksums answer "ERROR|Unknown command"
+        log_debug("[StorageInterface] No checksums from node %u: %s", node_id, header);
+        close(sock_fd);
+        return -1;
+    }
+
+    uint32_t *crcs = (uint32_t *)malloc(count ? count * sizeof(uint32_t) : 1);
+    if (!crcs) {
+        close(sock_fd);
+        return -1;
+    }
+    size_t want = count * sizeof(uint32_t);
+    size_t total_received = 0;
+    while (total_received < want) {
+        ssize_t received = recv(sock_fd, (char *)crcs + total_received,
+                                want - total_received, 0);
+        if (received <= 0) {
+            free(crcs);
+            close(sock_fd);
+            return -1;
+        }
+        total_received += received;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        crcs[i] = ntohl(crcs[i]);
+    }
+
+    checksums->length = covered;
+    checksums->block_size = block_size;
+    checksums->crcs = crcs;
+    checksums->count = count;
+
+    close(sock_fd);
+    return 0;
+}
+
 /* Delete data from storage node */
 int storage_interface_delete(storage_interface_t *iface, uint32_t node_id,
                              const char *file_id, storage_response_t *response) {
@@ -573,6 +648,14 @@ int storage_interface_get_healthy_nodes(storage_interface_t *iface,
 }
 
 /* Free storage response */
+void storage_checksums_free(storage_checksums_t *checksums) {
+    if (checksums) {
+        free(checksums->crcs);
+        checksums->crcs = NULL;
+        checksums->count = 0;
+    }
+}
+
 void storage_response_free(storage_response_t *response) {
     if (response && response->data) {
         free(response->data);
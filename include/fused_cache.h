@@ -0,0 +1,77 @@
+/**
+ * @file fused_cache.h
+ * @brief Kernel caching policy shared by both FUSE frontends
+ *
+ * The policy decides how long the kernel may trust attributes and name
+ * lookups, and which open handles keep their page cache. Completed videos
+ * (no handle open for writing) are opened with keep_cache, so repeated
+ * plays are served from the page cache. Handles of a file that is still
+ * being uploaded start from an empty cache. When a file that may be cached
+ * grows again, its attributes are invalidated so the kernel sees the new
+ * size and drops the stale pages.
+ *
+ * Everything is tunable with mount options (-o attr_timeout=, ...), which
+ * both frontends strip from the command line before libfuse sees it.
+ *
+ * Built against libfuse 3 (make FUSE=3), init also negotiates readdirplus,
+ * parallel directory operations and, on request, the kernel's writeback
+ * cache. The low-level frontend additionally opens completed files in
+ * passthrough mode, so the kernel reads them from the backing file itself.
+ * Capabilities the kernel or library lacks are turned off in the policy.
+ */
+
+#ifndef FUSED_CACHE_H
+#define FUSED_CACHE_H
+
+#include "fused_fs.h"
+
+#define CACHE_DEFAULT_ATTR_TIMEOUT 5.0      /* Seconds attributes stay valid */
+#define CACHE_DEFAULT_ENTRY_TIMEOUT 10.0    /* Seconds name lookups stay valid */
+#define CACHE_DEFAULT_NEGATIVE_TIMEOUT 1.0  /* Seconds a missing name stays cached */
+
+/**
+ * @brief Caching policy, filled from mount options before mounting
+ */
+typedef struct {
+    double attr_timeout;        // Kernel attribute cache lifetime
+    double entry_timeout;       // Kernel dentry cache lifetime
+    double negative_timeout;    // Lifetime of cached ENOENT lookups, 0 = none
+    int keep_cache;             // keep_cache on read-only opens of completed files
+    int direct_io_writes;       // Bypass the page cache on handles open for writing
+    int writeback_cache;        // Kernel buffers writes and sends them back in pages
+    int passthrough;            // Kernel reads completed files from the backing file
+} fused_cache_policy_t;
+
+extern fused_cache_policy_t g_cache_policy;
+
+/**
+ * @brief Called when an inode the kernel may cache has grown
+ * Must not wait on the kernel's page cache: it runs inside write handlers.
+ */
+typedef void (*fused_cache_inval_fn)(uint64_t ino);
+
+/**
+ * @brief Consume the caching mount options from args into g_cache_policy
+ * @return 0 on success, -1 on a malformed option
+ */
+int fused_cache_parse_args(struct fuse_args *args);
+
+/**
+ * @brief Forward the timeouts to the high-level library's own options
+ * @return 0 on success, -1 on allocation failure
+ */
+int fused_cache_lib_args(struct fuse_args *args);
+
+/**
+ * @brief Negotiate the kernel features the policy relies on in init
+ * Big writes, async reads and data invalidation; with libfuse 3 also
+ * readdirplus, parallel directory operations and the writeback cache.
+ * Clears writeback_cache when the kernel does not offer it.
+ */
+void fused_cache_conn_init(struct fuse_conn_info *conn);
+
+/* Invalidation hook; the low-level frontend installs one, NULL = none */
+void fused_cache_set_invalidator(fused_cache_inval_fn fn);
+void fused_cache_invalidate(uint64_t ino);
+
+#endif /* FUSED_CACHE_H */
@@ -0,0 +1,106 @@
+/**
+ * @file fused_cold.h
+ * @brief Seekable compressed storage for cold backing files
+ *
+ * With -o cold_compress (FUSED_COLD_COMPRESS=1 where there is no mount), a
+ * background thread looks for regular files in their own backing file that
+ * nobody has appended to or read for FUSED_COLD_AGE seconds and that no
+ * handle has open. Each one is rewritten as inode_<N>.z: a header, an index
+ * of frames, then the data in independent COLD_FRAME_SIZE frames aligned to
+ * the file offset, each deflated, or kept as is when that does not shrink
+ * it. A read decodes only the frames it touches.
+ *
+ * Before compressing, COLD_SAMPLES windows spread over the file are
+ * sampled. Data whose byte entropy is above COLD_MAX_ENTROPY, such as
+ * encoded video, is left alone, as is a file that compresses by less than
+ * an eighth. Such files are not sampled again until they grow.
+ *
+ * The inode's backing_path names the .z file while compressed, and its
+ * table record carries ITABLE_REC_COMPRESSED. The new file is synced before
+ * the record, and the record before the old file is removed, so a crash
+ * leaves one complete copy that the record names; the loader removes the
+ * other after an unclean shutdown. Appending to a compressed file first
+ * writes its data back out in plain form.
+ */
+
+#ifndef FUSED_COLD_H
+#define FUSED_COLD_H
+
+#include "fused_fs.h"
+
+#define COLD_SUFFIX ".z"
+#define COLD_MAGIC "FUSEDCZ1"
+#define COLD_FRAME_SIZE (64u << 10)         /* Uncompressed bytes per frame, aligned to the file offset */
+#define COLD_MIN_SIZE (16u << 10)           /* Smaller files are not worth an index */
+#define COLD_DEFAULT_AGE 86400              /* Seconds without appends or reads */
+#define COLD_SCAN_MS 60000                  /* Transcoder wakeup interval */
+#define COLD_SAMPLES 16                     /* Windows sampled for entropy */
+#define COLD_SAMPLE_SIZE 4096               /* Bytes per window */
+#define COLD_MAX_ENTROPY 7.5                /* Bits per byte above which data is left alone */
+#define COLD_LEVEL 6                        /* zlib compression level */
+
+/**
+ * @brief Counters since startup; read with cold_get_stats()
+ */
+typedef struct {
+    uint64_t files;             // Files transcoded
+    uint64_t bytes_in;          // Their uncompressed size
+    uint64_t bytes_out;         // Their size on disk, index included
+    uint64_t skipped_entropy;   // Files left alone because the samples looked random
+    uint64_t skipped_ratio;     // Files left alone because they hardly shrank
+    uint64_t thawed;            // Files written back out for an append
+} cold_stats_t;
+
+/* Mount options [no_]cold_compress; env FUSED_COLD_COMPRESS when not given */
+int cold_parse_args(struct fuse_args *args);
+
+/* Lifecycle: read the configuration and start the transcoder / stop it and
+ * release the frame indexes */
+int cold_init(void);
+void cold_stop(void);
+void cold_destroy(void);
+
+/**
+ * @brief Override the configuration (tests)
+ * @param age seconds without appends or reads before a file is cold
+ */
+void cold_configure(bool enabled, uint32_t age);
+
+/**
+ * @brief Run one transcoding pass now instead of waiting for the thread
+ * @return files transcoded
+ */
+int cold_scan(void);
+
+/**
+ * @brief Take up a compressed file at load: read its index and size
+ * Points backing_path, still the plain name, at the .z file.
+ * @param ino the inode number its record names, not yet published
+ * @return 0, or negative errno if the file is missing or damaged
+ */
+int cold_load(fused_inode_t *inode, uint64_t ino);
+
+/**
+ * @brief Read a range of a compressed file
+ * @pre inode is share-locked, compressed, and the range is below its size
+ * @return 0, or negative errno
+ */
+int cold_read(fused_inode_t *inode, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief Write a compressed file back out in plain form, before an append
+ * Takes the inode's write lock; returns at once for a plain file.
+ * @pre the caller holds no lock on the inode
+ * @return 0, or negative errno
+ */
+int cold_thaw(fused_inode_t *inode);
+
+/**
+ * @brief Free an inode's frame index, before its slot is reused
+ * @pre the inode is write-locked, or no longer reachable
+ */
+void cold_discard(fused_inode_t *inode);
+
+void cold_get_stats(cold_stats_t *stats);
+
+#endif /* FUSED_COLD_H */
@@ -0,0 +1,67 @@
+/**
+ * @file fused_crc.h
+ * @brief CRC32C of file data per block, kept up to date as files grow
+ *
+ * Every regular file carries one CRC32C (fused_crc32c.h) per
+ * CRC_BLOCK_SIZE block, aligned to the file offset, so a reader holding a
+ * block and its checksum can tell whether the stored bytes are the ones
+ * that were written. inode_block_crcs() hands them out; the RPC Get call
+ * returns them alongside the data.
+ *
+ * A block's checksum is a running one: appends extend it with the bytes
+ * they bring, under the inode's append lock, while the bytes are still in
+ * memory. A block records how much of it is summed, and an append that
+ * does not continue right there leaves the block behind: spliced writes,
+ * whose data never reaches user space, writes past EOF, and every file
+ * loaded at mount. Such blocks are summed from the stored bytes the first
+ * time their checksums are asked for, and kept up to date from then on.
+ * Checksums are not persisted.
+ *
+ * The blocks of a file live in a table indexed by inode slot, next to the
+ * slab rather than in it, so inodes stay the same size.
+ */
+
+#ifndef FUSED_CRC_H
+#define FUSED_CRC_H
+
+#include "fused_fs.h"
+#include "fused_crc32c.h"
+
+#define CRC_BLOCK_SIZE (64u << 10)          /* Bytes per checksum, aligned to the file offset */
+
+/**
+ * @brief One block's checksum
+ */
+typedef struct {
+    uint32_t crc;           // CRC32C of the first len bytes of the block
+    uint32_t len;           // Bytes summed so far
+} crc_block_t;
+
+/**
+ * @brief A file's blocks, with room for a file of size bytes
+ * Blocks nobody has summed yet have len 0.
+ * @pre the inode's append lock is held; the blocks are valid while it is
+ * @return the blocks, or NULL without memory
+ */
+crc_block_t *crc_reserve(fused_inode_t *inode, off_t size);
+
+/**
+ * @brief Account for an append of len bytes of buf at offset
+ * Blocks the append continues are extended; the rest are left behind.
+ * @pre the inode's append lock is held
+ */
+void crc_note_append(fused_inode_t *inode, const char *buf, size_t len, off_t offset);
+
+/**
+ * @brief Free an inode's checksums, before its slot is reused
+ * @pre the inode is write-locked, or no longer reachable
+ */
+void crc_discard(fused_inode_t *inode);
+
+/**
+ * @brief Release the table
+ * @pre every inode's checksums were discarded
+ */
+void crc_destroy(void);
+
+#endif /* FUSED_CRC_H */
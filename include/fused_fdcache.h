@@ -0,0 +1,57 @@
+/**
+ * @file fused_fdcache.h
+ * @brief Cache of open backing-file descriptors keyed by inode number
+ *
+ * The data path pins a descriptor with fd_cache_get() and unpins it with
+ * fd_cache_put(). Open files keep their descriptor pinned from open/create
+ * until release; unpinned descriptors stay open on an LRU list bounded by
+ * FD_CACHE_MAX_IDLE so repeated RPC reads of idle files avoid reopening.
+ */
+
+#ifndef FUSED_FDCACHE_H
+#define FUSED_FDCACHE_H
+
+#include <stdint.h>
+
+#define FD_CACHE_MAX_IDLE 128      /* Unpinned descriptors kept open */
+#define FD_CACHE_INITIAL_BUCKETS 64
+
+/* Lifecycle */
+int fd_cache_init(void);
+void fd_cache_destroy(void);
+
+/**
+ * @brief Pin the backing descriptor of an inode, opening it on a miss
+ * @param flags extra open(2) flags for a miss, e.g. O_CREAT | O_TRUNC
+ * @return file descriptor, or negative errno
+ */
+int fd_cache_get(uint64_t ino, const char *backing_path, int flags);
+
+/**
+ * @brief Unpin a descriptor obtained with fd_cache_get()
+ */
+void fd_cache_put(uint64_t ino);
+
+/**
+ * @brief Close and forget an inode's descriptor (file deleted)
+ * A pinned descriptor stays open until its last fd_cache_put(), so a
+ * zero-copy reply still being spliced from it reads the deleted data;
+ * fd_cache_get() no longer returns it.
+ */
+void fd_cache_drop(uint64_t ino);
+
+/**
+ * @brief Close and forget an inode's descriptor unless it is pinned
+ * @return 0, or -EBUSY while an open handle or a reader holds it
+ */
+int fd_cache_drop_idle(uint64_t ino);
+
+/**
+ * @brief Move a cached descriptor to another file, keeping its pins
+ * For data that moved to a new file while handles are open; nothing is
+ * opened when the inode has no descriptor cached.
+ * @return 0, or negative errno with the old descriptor kept
+ */
+int fd_cache_reopen(uint64_t ino, const char *backing_path);
+
+#endif /* FUSED_FDCACHE_H */
@@ -9,12 +9,23 @@
 #ifndef FUSED_FS_H
 #define FUSED_FS_H
 
+/* make FUSE=3 builds against libfuse 3 and defines FUSED_FUSE3 */
+#ifdef FUSED_FUSE3
+#define FUSE_USE_VERSION 35
+#else
 #define FUSE_USE_VERSION 26
+#endif
 #define MAX_PATH 256
-#define MAX_CHILDREN 256
-#define MAX_INODES 1024
+#define INODE_CHUNK_SHIFT 10                  /* 1024 inodes per slab chunk */
+#define INODE_CHUNK_SIZE (1u << INODE_CHUNK_SHIFT)
+#define INODE_SLOT_MASK 0xFFFFFFFFull          /* ino = generation << 32 | (slot + 1) */
+#define INODE_MAX_CHUNKS (1u << 14)            /* Fixed chunk directory: 16M inodes */
 #define FUSE_ROOT_ID 1
 #define MAX_NAME 256
+#define FUSED_BACKING_DIR "/tmp/fused_backing"
+#define DIR_INITIAL_ENTRIES 8                  /* First dirent allocation of a directory */
+#define DIR_INDEX_TOMBSTONE UINT32_MAX
+#define DIR_FIRST_COOKIE 3                     /* Readdir offsets 1 and 2 are "." and ".." */
 
 #include <fuse.h>
 #include <stdio.h>
@@ -31,12 +42,70 @@
 #include <sys/types.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include "fused_log.h"
 
 /**
- * @brief Minimal inode structure
+ * @brief One directory entry; the name lives in the directory's string arena
+ */
+typedef struct {
+    uint64_t ino;           // Child inode number (0 = removed, a hole)
+    uint64_t cookie;        // Readdir offset, stable for the entry's lifetime
+    uint32_t name_off;      // Offset of the NUL-terminated name in names
+    uint32_t hash;          // Cached name hash
+} fused_dirent_t;
+
+/**
+ * @brief Variable-length directory contents, allocated only for directories
+ *
+ * Entries stay in insertion order, so cookies ascend and a listing can
+ * resume from any offset. Removal leaves a hole, and holes are squeezed out
+ * once they make up half of the used entries.
  */
 typedef struct {
-    uint64_t ino;           // Unique inode number
+    fused_dirent_t *entries;    // Entries in cookie order, holes included
+    uint32_t n_entries;         // Number of live entries
+    uint32_t n_used;            // Entries in use, live or holes
+    uint64_t next_cookie;       // Cookie of the next inserted entry
+    uint32_t entries_capacity;  // Allocated entries
+    char *names;                // String arena holding entry names
+    uint32_t names_len;         // Bytes used in the arena
+    uint32_t names_capacity;    // Allocated arena bytes
+    uint32_t names_dead;        // Arena bytes owned by removed entries
+    uint32_t *index;            // Open-addressed name hash: entry slot + 1, 0 = empty
+    uint32_t index_slots;       // Size of index (power of two)
+    uint32_t index_tombstones;  // Deleted markers left in index
+} fused_dir_t;
+
+static inline const char *dirent_name(const fused_dir_t *dir, const fused_dirent_t *entry)
+{
+    return dir->names + entry->name_off;
+}
+
+/**
+ * @brief Fields that change under a shared inode lock (size, timestamps)
+ * and the inode number checked by lock-free lookups are accessed atomically.
+ */
+#define INODE_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define INODE_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+/**
+ * @brief Minimal inode structure
+ *
+ * Locking: lock is held shared for reads and appends and exclusive for
+ * metadata and namespace changes; for a directory it also guards dirents.
+ * Appends to one file are serialized by append_lock, so readers of a file
+ * that is being uploaded are never blocked. Locks are taken parent before
+ * child. Slab memory is never freed, so a stale pointer stays safe to lock
+ * and ino reads 0 (or a newer generation) once the inode is gone.
+ *
+ * size counts appends still held in the write-back buffer; durable counts
+ * the bytes that have reached the backing file.
+ */
+typedef struct fused_inode {
+    pthread_rwlock_t lock;          // Inode (and directory contents) lock
+    pthread_mutex_t append_lock;    // Serializes appenders
+    uint64_t ino;           // Unique inode number (0 = free slot)
+    uint32_t generation;    // Bumped each time the slot is reused
     mode_t mode;            // File type (S_IFREG/S_IFDIR) + permissions
     uid_t uid;              // Owner user ID
     gid_t gid;              // Owner group ID
@@ -45,37 +114,142 @@ typedef struct {
     time_t mtime;           // Last modification time
     time_t ctime;           // Last status change time
     
-    int n_children;
-    char child_names[MAX_CHILDREN][MAX_PATH];
-    uint64_t child_inodes[MAX_CHILDREN];
+    fused_dir_t *dirents;   // Directory contents (NULL for regular files)
+    uint64_t nlookup;       // Kernel lookup references (low-level frontend)
+    bool unlinked;          // Removed from the namespace, freed at nlookup 0
+    bool sparse;            // Backing file has holes from writes past EOF
+    bool kcached;           // Opened with keep_cache since the last append (atomic)
+    bool compressed;        // Data is in framed compressed form, see fused_cold.h (atomic)
+    uint32_t writers;       // Open handles that may append (atomic)
+    struct seg_map *seg_map;    // Extents when the data lives in segments, else NULL
+
+    /* Write-back buffer (fused_wbuf.c), guarded by append_lock */
+    off_t durable;          // Bytes in the backing file; buffered data goes here
+    char *wb_data;          // Buffered appends, NULL when none
+    size_t wb_len;          // Bytes buffered
+    size_t wb_cap;          // Bytes allocated
+    uint64_t wb_dirty_ms;   // When the buffer became dirty (monotonic)
+    struct fused_inode *wb_prev;
+    struct fused_inode *wb_next;
+    bool wb_queued;         // On the flusher's dirty list (guarded by its lock)
+    bool wb_ingest;         // wb_data is laid out for O_DIRECT (direct ingest)
+
+    uint32_t dir_version;   // Bumped when entries are added or removed (atomic)
     
     char backing_path[MAX_PATH];
 } fused_inode_t;
 
+static inline off_t inode_size(const fused_inode_t *inode)
+{
+    return INODE_LOAD(inode->size);
+}
+
+/**
+ * @brief FNV-1a hash that guards records on disk (inode table, segments)
+ */
+static inline uint32_t fused_checksum(const void *data, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)data; len > 0; p++, len--)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 /**
  * @brief Global filesystem state
  */
 typedef struct {
-    fused_inode_t inodes[MAX_INODES];  // Fixed-size inode table
-    int n_inodes;                       // Number of allocated inodes
+    fused_inode_t *inode_chunks[INODE_MAX_CHUNKS]; // Slab chunks, never moved or freed
+    uint32_t n_chunks;                  // Chunks allocated
+    uint32_t n_slots;                   // Slots ever handed out (high-water mark)
+    uint32_t *free_slots;               // Stack of released slots for reuse
+    uint32_t n_free;                    // Entries on the free stack
+    uint32_t free_capacity;             // Capacity of the free stack
+    int n_inodes;                       // Number of live inodes
+    pthread_mutex_t alloc_lock;         // Guards the slab and free stack
+    pthread_mutex_t rename_lock;        // Held by ops that lock two directories
     char backing_dir[MAX_PATH];         // Where backing files live
 } fused_state_t;
 
+/**
+ * @brief Per-inode pointers kept next to the slab rather than in it
+ * Indexed by slot like the slab; a chunk of entries is allocated the first
+ * time one of its slots needs an entry. Modules that track something for
+ * some inodes use one instead of growing fused_inode_t.
+ */
+typedef struct {
+    pthread_mutex_t lock;               // Guards allocation of chunks
+    void **chunks[INODE_MAX_CHUNKS];    // Per slab chunk, one entry per slot
+} slot_table_t;
+
+#define SLOT_TABLE_INIT { .lock = PTHREAD_MUTEX_INITIALIZER }
+
+/**
+ * @brief A background thread that runs a pass every interval_ms until stopped
+ */
+typedef struct {
+    pthread_mutex_t lock;               // Guards running
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool running;
+    uint32_t interval_ms;
+    int (*pass)(void);
+} periodic_t;
+
+#define PERIODIC_INIT(ms, fn) \
+    { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, \
+      .interval_ms = (ms), .pass = (fn) }
+
+/**
+ * @brief Directory filler of the path API, in its libfuse 2 form
+ * The libfuse 3 frontend adapts it; the core and its callers use this one.
+ */
+typedef int (*fused_fill_dir_t)(void *buf, const char *name, const struct stat *st, off_t off);
+
 /* Function prototypes */
 
 /* Initialization and cleanup */
 void *fused_init(struct fuse_conn_info *conn);
 void fused_destroy(void *private_data);
+int fused_state_init(const char *backing_dir);
+void fused_state_destroy(void);
+
+/* FUSED_* settings; component prefixes the warning for an invalid value */
+size_t fused_env_size(const char *component, const char *name, size_t fallback);
+
+/**
+ * @brief The entry of an inode number's slot
+ * @param create allocate the slot's chunk if it has none yet
+ * @return the entry, or NULL if there is none (or no memory, or ino is 0)
+ */
+void **slot_table_entry(slot_table_t *table, uint64_t ino, bool create);
+
+/* Release the chunks; every entry must have been freed by its owner */
+void slot_table_destroy(slot_table_t *table);
+
+/* Start the thread / stop it and wait for a pass in progress */
+int periodic_start(periodic_t *periodic);
+void periodic_stop(periodic_t *periodic);
 
 /* File operations */
 int fused_getattr(const char *path, struct stat *stbuf);
-int fused_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+int fused_readdir(const char *path, void *buf, fused_fill_dir_t filler,
                   off_t offset, struct fuse_file_info *fi);
 int fused_open(const char *path, struct fuse_file_info *fi);
+int fused_release(const char *path, struct fuse_file_info *fi);
+int fused_flush(const char *path, struct fuse_file_info *fi);
+int fused_fsync(const char *path, int datasync, struct fuse_file_info *fi);
 int fused_read(const char *path, char *buf, size_t size, off_t offset,
                struct fuse_file_info *fi);
+int fused_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+                   off_t offset, struct fuse_file_info *fi);
 int fused_write(const char *path, const char *buf, size_t size, off_t offset,
                 struct fuse_file_info *fi);
+int fused_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                    struct fuse_file_info *fi);
 int fused_create(const char *path, mode_t mode, struct fuse_file_info *fi);
 int fused_mkdir(const char *path, mode_t mode);
 int fused_rmdir(const char *path);
@@ -83,14 +257,56 @@ int fused_rename(const char *from, const char *to);
 int fused_utimens(const char *path, const struct timespec tv[2]);
 int fused_unlink(const char *path);
 
+/* Inode-level operations (shared by the path and low-level frontends) */
+void inode_stat(fused_inode_t *inode, struct stat *stbuf);
+int inode_open(fused_inode_t *inode, struct fuse_file_info *fi);
+void inode_open_cache(fused_inode_t *inode, struct fuse_file_info *fi);
+void inode_release(uint64_t ino, int flags);
+int inode_read(fused_inode_t *inode, char *buf, size_t size, off_t offset);
+ssize_t inode_read_fd(fused_inode_t *inode, size_t size, off_t offset, int *fd);
+int inode_write(fused_inode_t *inode, const char *buf, size_t size, off_t offset);
+int inode_write_buf(fused_inode_t *inode, struct fuse_bufvec *bufv, off_t offset);
+int inode_flush(fused_inode_t *inode);
+int inode_fsync(fused_inode_t *inode, int datasync);
+int inode_block_crcs(fused_inode_t *inode, off_t offset, off_t *end, uint32_t *crcs,
+                     size_t max);
+int inode_create(fused_inode_t *parent, const char *name, mode_t mode,
+                 uid_t uid, gid_t gid, bool lookup_ref, fused_inode_t **out);
+int inode_mkdir(fused_inode_t *parent, const char *name, mode_t mode,
+                uid_t uid, gid_t gid, bool lookup_ref, fused_inode_t **out);
+int inode_unlink(fused_inode_t *parent, const char *name);
+int inode_rmdir(fused_inode_t *parent, const char *name);
+int inode_rename(fused_inode_t *src_parent, const char *src_name,
+                 fused_inode_t *dest_parent, const char *dest_name);
+void inode_utimens(fused_inode_t *inode, const struct timespec tv[2]);
+void inode_ref(fused_inode_t *inode);
+void inode_forget(fused_inode_t *inode, uint64_t nlookup);
+
+/* Inode locks, for callers that walk directory contents themselves */
+void inode_rdlock(fused_inode_t *inode);
+void inode_wrlock(fused_inode_t *inode);
+void inode_unlock(fused_inode_t *inode);
+
 /* Global state */
 extern fused_state_t *g_state;
 
-/* Helper function for logging */
-void log_message(const char *fmt, ...);
-
 /* Helper functions for RPC server */
 fused_inode_t* path_to_inode(const char *path);
 fused_inode_t* lookup_inode(uint64_t ino);
 
+/**
+ * @brief Receives one entry of a listing with the child's attributes
+ * @param next offset that resumes the listing after this entry
+ * @return nonzero to stop, e.g. when the reply buffer is full
+ */
+typedef int (*inode_dir_filler_t)(void *ctx, const char *name, const struct stat *st,
+                                  off_t next);
+int inode_readdir(fused_inode_t *dir, off_t offset, inode_dir_filler_t fill, void *ctx);
+
+/* Directory entry helpers */
+fused_inode_t *dir_lookup(fused_inode_t *dir, const char *name);
+fused_inode_t *dir_lookup_ref(fused_inode_t *dir, const char *name);
+int dir_add_entry(fused_inode_t *dir, const char *name, fused_inode_t *child);
+int dir_rm_entry(fused_inode_t *dir, const char *name, fused_inode_t *child);
+
 #endif /* FUSED_FS_H */
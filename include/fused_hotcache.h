@@ -0,0 +1,81 @@
+/**
+ * @file fused_hotcache.h
+ * @brief In-memory cache of hot file data, shared by every read path
+ *
+ * File data is cached in HC_BLOCK_SIZE blocks keyed by inode number and
+ * block index. Reads through inode_read() (FUSE copies and RPC Get alike)
+ * are answered from memory when every block they touch is cached, and
+ * fill the cache otherwise; the zero-copy path copies from memory instead
+ * of splicing only when the whole range is cached.
+ *
+ * Replacement is 2Q, so one pass over a large file cannot flush the
+ * blocks that are read again and again: a new block enters a FIFO (A1in)
+ * that holds a quarter of the capacity. Blocks pushed out of it leave only
+ * their key behind on a ghost list (A1out); a block read again while its
+ * ghost is remembered is hot and moves to the main LRU (Am).
+ *
+ * Appended bytes never change, so cached blocks stay valid as files grow.
+ * The block at EOF is cached with the bytes it had; a read that needs more
+ * of it is a miss and caches the longer block. Inode numbers carry the
+ * slot generation, so a recycled slot never sees the blocks of the file
+ * that had it before. Nothing looks those blocks up again, so they drift
+ * to the cold end of their queue and are evicted like any other.
+ *
+ * FUSED_HOTCACHE_SIZE sets the capacity in bytes; 0 turns the cache off.
+ */
+
+#ifndef FUSED_HOTCACHE_H
+#define FUSED_HOTCACHE_H
+
+#include "fused_fs.h"
+
+#define HC_BLOCK_SIZE (64u << 10)           /* Unit of caching, aligned to the file offset */
+#define HC_DEFAULT_SIZE (64u << 20)         /* Capacity for block data */
+#define HC_A1IN_PCT 25                      /* Share of the capacity for new blocks */
+#define HC_A1OUT_PCT 50                     /* Ghosts remembered, in % of the blocks that fit */
+
+/**
+ * @brief Counters since startup and occupancy; read with hotcache_get_stats()
+ */
+typedef struct {
+    uint64_t hits;          // Reads served entirely from memory
+    uint64_t misses;        // Reads that went to the segments or backing file
+    uint64_t promotions;    // Blocks found hot again through their ghost
+    uint64_t evictions;     // Blocks whose data was dropped to make room
+    uint64_t bytes;         // Block data held now
+    uint32_t blocks;        // Blocks holding data now
+} hotcache_stats_t;
+
+/* Lifecycle: read the configuration / drop every block */
+int hotcache_init(void);
+void hotcache_destroy(void);
+
+/**
+ * @brief Set the capacity in bytes (0 disables); drops every cached block
+ * @pre hotcache_init() has run
+ */
+void hotcache_configure(size_t capacity);
+
+bool hotcache_enabled(void);
+
+/**
+ * @brief Copy a range out of the cache if every block of it is cached
+ * Counts a hit or a miss.
+ * @return 0 if buf was filled, -ENOENT otherwise
+ */
+int hotcache_read(uint64_t ino, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief Whether a read of the range would be a hit; counts nothing
+ */
+bool hotcache_contains(uint64_t ino, size_t size, off_t offset);
+
+/**
+ * @brief Cache file data just read from storage
+ * @param offset block-aligned; the last block may be partial (EOF)
+ */
+void hotcache_insert(uint64_t ino, const char *buf, size_t size, off_t offset);
+
+void hotcache_get_stats(hotcache_stats_t *stats);
+
+#endif /* FUSED_HOTCACHE_H */
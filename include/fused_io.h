@@ -0,0 +1,35 @@
+/**
+ * @file fused_io.h
+ * @brief Backing-file reads, writes and syncs
+ *
+ * The data path reads, appends and syncs backing files through these
+ * wrappers of the system calls. They retry on EINTR and return negative
+ * errno, like the rest of the core, instead of -1 and errno.
+ */
+
+#ifndef FUSED_IO_H
+#define FUSED_IO_H
+
+#include "fused_fs.h"
+
+/**
+ * @brief Like pread(2)/pwrite(2), but return negative errno on failure
+ * A short count means the same as for the system calls.
+ */
+ssize_t io_pread(int fd, void *buf, size_t size, off_t offset);
+ssize_t io_pwrite(int fd, const void *buf, size_t size, off_t offset);
+
+/**
+ * @brief io_pread()/io_pwrite() until the whole range is done
+ * @return 0, or negative errno; -EIO if the file ends first
+ */
+int io_pread_full(int fd, void *buf, size_t size, off_t offset);
+int io_pwrite_full(int fd, const void *buf, size_t size, off_t offset);
+
+/**
+ * @brief fsync(2), or fdatasync(2) with datasync
+ * @return 0, or negative errno
+ */
+int io_fsync(int fd, bool datasync);
+
+#endif /* FUSED_IO_H */
@@ -0,0 +1,101 @@
+/**
+ * @file fused_itable.h
+ * @brief Persistent inode table, memory-mapped from the backing directory
+ *
+ * Every inode slot has a fixed-size record in ITABLE_FILE_NAME: inode
+ * number, generation, type, owner, timestamps and the (parent, name) pair
+ * that places it in the namespace. Directory contents are rebuilt from the
+ * parent links when the table is loaded; file sizes come from the backing
+ * files or the segments, so appends never touch the table.
+ *
+ * Each slot holds two copies of its record. An update overwrites the older
+ * copy and stamps it with a sequence number and checksum, so a crash in the
+ * middle of an update leaves the previous version readable. A rename is a
+ * single record update and therefore atomic.
+ *
+ * The file starts with a superblock describing the layout and whether the
+ * last shutdown was clean. Records reach the disk through normal page cache
+ * writeback, on fsync of the file they describe and on unmount.
+ */
+
+#ifndef FUSED_ITABLE_H
+#define FUSED_ITABLE_H
+
+#include "fused_fs.h"
+
+#define ITABLE_FILE_NAME ".fused_itable"
+#define ITABLE_MAGIC "FUSEDIT1"
+#define ITABLE_VERSION 2
+#define ITABLE_HEADER_SIZE 4096                     /* Superblock page */
+#define ITABLE_REC_SIZE 512                         /* One record copy, sector aligned */
+#define ITABLE_SLOT_SIZE (2 * ITABLE_REC_SIZE)
+#define ITABLE_CHUNK_BYTES ((size_t)INODE_CHUNK_SIZE * ITABLE_SLOT_SIZE)
+
+#define ITABLE_REC_SEGMENTS 0x1                     /* Data is in segments (fused_segment.h) */
+#define ITABLE_REC_COMPRESSED 0x2                   /* Data is in a .z file (fused_cold.h) */
+
+/**
+ * @brief One version of an inode slot
+ */
+typedef struct {
+    uint64_t seq;           // Update sequence; the newest valid copy wins
+    uint64_t ino;           // 0 = free slot
+    uint64_t parent;        // Parent directory (0 for the root)
+    uint64_t size;          // Bytes in the backing file (or segments) when written
+    int64_t atime;
+    int64_t mtime;
+    int64_t ctime;
+    uint32_t generation;    // Kept for free slots too, so inos are never reused
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t flags;         // ITABLE_REC_*
+    char name[MAX_NAME];    // Entry name in parent, NUL padded
+    uint32_t checksum;      // Over every byte before it
+} itable_rec_t;
+
+/* Lifecycle: map (creating if needed) and unmap the table */
+int itable_open(const char *backing_dir, bool *fresh);
+void itable_close(void);
+
+/**
+ * @brief Whether the previous user of the table unmapped it cleanly
+ * After a crash the loader also removes backing files no record names.
+ */
+bool itable_was_clean(void);
+
+/* Chunks the table file covers, and growing it to cover n_chunks */
+uint32_t itable_chunks(void);
+int itable_reserve(uint32_t n_chunks);
+
+/**
+ * @brief Read the current version of a slot
+ * @return 0, or -ENOENT if the slot was never written or both copies are damaged
+ */
+int itable_get(uint32_t slot, itable_rec_t *rec);
+
+/**
+ * @brief Record an inode under (parent, name), on create and rename
+ * @pre inode is write-locked
+ */
+void itable_put(const fused_inode_t *inode, uint64_t parent, const char *name);
+
+/**
+ * @brief Rewrite an inode's attributes, keeping its place in the namespace
+ * @pre inode is write-locked
+ */
+void itable_update(const fused_inode_t *inode);
+
+/**
+ * @brief Drop an inode from the namespace if it still lives at (parent, name)
+ * A rename has already moved the record, so removing the old name is a no-op.
+ */
+void itable_unlink(const fused_inode_t *inode, uint64_t parent, const char *name);
+
+/* Mark a slot free, remembering the generation its next inode will use */
+void itable_free(uint32_t slot, uint32_t generation);
+
+/* Write the records of an inode and its ancestors to disk (fsync) */
+int itable_sync(uint64_t ino);
+
+#endif /* FUSED_ITABLE_H */
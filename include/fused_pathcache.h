@@ -0,0 +1,89 @@
+/**
+ * @file fused_pathcache.h
+ * @brief Bounded cache of full path lookups, misses included
+ *
+ * path_to_inode() walks a path one directory at a time from the root. The
+ * cache remembers where each walk ended: the inode of the last component,
+ * or that it does not exist (a negative entry, which makes the existence
+ * check in front of every create cheap), together with the directory that
+ * holds the last component and that directory's dir_version.
+ *
+ * Nothing is invalidated eagerly. An entry is used only while
+ * - its directory is still the same live inode at the same dir_version,
+ *   which every add or remove of an entry bumps, so creates, unlinks and
+ *   renames of files make the entries below their directories stale;
+ * - the cache epoch is the one it was filled in. Renaming a directory
+ *   moves a whole subtree and bumps the epoch, which drops every entry at
+ *   once without visiting any of them.
+ * Removing a directory needs nothing: its entries name it by inode
+ * number, which never comes back.
+ *
+ * Entries live in PC_SETS sets of PC_WAYS, each set with its own lock,
+ * and the least recently used way of a set is replaced. Paths are
+ * compared in full, so two spellings of one path are separate entries.
+ * FUSED_PATH_CACHE=0 turns the cache off.
+ */
+
+#ifndef FUSED_PATHCACHE_H
+#define FUSED_PATHCACHE_H
+
+#include "fused_fs.h"
+
+#define PC_SETS 256                 /* Sets, each with its own lock */
+#define PC_WAYS 4                   /* Entries per set */
+
+typedef enum {
+    PC_MISS,                        // Unknown or stale: walk the path
+    PC_HIT,                         // The inode is known
+    PC_NEGATIVE,                    // The path is known not to exist
+} pathcache_result_t;
+
+/**
+ * @brief Counters since startup; read with pathcache_get_stats()
+ */
+typedef struct {
+    uint64_t hits;          // Lookups answered with an inode
+    uint64_t negative_hits; // Lookups answered with "does not exist"
+    uint64_t misses;        // Lookups that had to walk the path
+    uint64_t stale;         // Entries found out of date (counted as misses too)
+    uint64_t invalidations; // Epoch bumps by directory renames
+} pathcache_stats_t;
+
+/* Lifecycle: read the configuration and start empty / release the sets */
+void pathcache_init(void);
+void pathcache_destroy(void);
+
+/**
+ * @brief Turn the cache on or off (tests); forgets every entry
+ */
+void pathcache_configure(bool enabled);
+
+/**
+ * @brief The epoch to pass to pathcache_put(); read it before walking
+ */
+uint64_t pathcache_epoch(void);
+
+/**
+ * @brief Look a path up
+ * @param inode receives the inode on PC_HIT
+ */
+pathcache_result_t pathcache_get(const char *path, fused_inode_t **inode);
+
+/**
+ * @brief Remember where a walk of path ended
+ * @param inode the last component, NULL if it does not exist
+ * @param dir the directory that was searched for it
+ * @param version dir->dir_version read before searching dir
+ * @param epoch pathcache_epoch() read before the walk started
+ */
+void pathcache_put(const char *path, const fused_inode_t *inode, const fused_inode_t *dir,
+                   uint32_t version, uint64_t epoch);
+
+/**
+ * @brief Make every entry stale (a directory moved)
+ */
+void pathcache_invalidate(void);
+
+void pathcache_get_stats(pathcache_stats_t *stats);
+
+#endif /* FUSED_PATHCACHE_H */
@@ -0,0 +1,60 @@
+/**
+ * @file fused_prefetch.h
+ * @brief Sequential stream detector and read-ahead of backing files
+ *
+ * Every read is matched against the recently seen streams of its inode by
+ * offset: a read that starts where a stream left off continues it, so
+ * several viewers of one video are told apart without per-handle state.
+ * Once a stream has made PF_TRIGGER_READS sequential reads, a background
+ * thread asks the kernel to load the next window of the backing file into
+ * the page cache, which the zero-copy read path then splices from. Each
+ * time the reader reaches the second half of the prefetched range, the
+ * next window is issued at double the size, up to the maximum.
+ *
+ * The stream table has a fixed number of entries and the queue of pending
+ * windows is bounded, so tracking costs a fixed amount of memory; the
+ * prefetched pages are ordinary page cache and are reclaimed as such.
+ *
+ * FUSED_PREFETCH_WINDOW and FUSED_PREFETCH_MAX (bytes) override the first
+ * and the largest window; a maximum of 0 turns prefetching off.
+ */
+
+#ifndef FUSED_PREFETCH_H
+#define FUSED_PREFETCH_H
+
+#include "fused_fs.h"
+
+#define PF_DEFAULT_WINDOW (512u << 10)      /* First window of a stream */
+#define PF_DEFAULT_MAX (8u << 20)           /* Window growth stops here */
+#define PF_TRIGGER_READS 2                  /* Sequential reads before prefetching */
+#define PF_MATCH_SLACK (256 << 10)          /* Reordering tolerated by async reads */
+
+/**
+ * @brief Counters since startup; read with prefetch_get_stats()
+ */
+typedef struct {
+    uint64_t streams;       // Streams that turned out sequential
+    uint64_t windows;       // Windows queued for prefetch
+    uint64_t bytes;         // Bytes handed to the kernel for read-ahead
+    uint64_t hits;          // Reads that fell entirely inside prefetched ranges
+    uint64_t dropped;       // Windows not queued because the queue was full
+} prefetch_stats_t;
+
+/* Lifecycle: read the configuration and start/stop the prefetch thread */
+int prefetch_init(void);
+void prefetch_destroy(void);
+
+/**
+ * @brief Override the first and the largest window (max 0 disables)
+ */
+void prefetch_configure(size_t window, size_t max_window);
+
+/**
+ * @brief Feed a completed read to the detector, queueing read-ahead if due
+ * @param file_size size of the file when the read was served
+ */
+void prefetch_note_read(uint64_t ino, off_t offset, size_t size, off_t file_size);
+
+void prefetch_get_stats(prefetch_stats_t *stats);
+
+#endif /* FUSED_PREFETCH_H */
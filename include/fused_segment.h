@@ -0,0 +1,131 @@
+/**
+ * @file fused_segment.h
+ * @brief Log-structured segment store for file data
+ *
+ * With storage=segments, new regular files keep their data in large shared
+ * segment files (seg_<N> in the backing directory) instead of a backing
+ * file each. Every append becomes a record: a header naming the inode and
+ * the file offset, followed by the data. An inode's extent map points at
+ * its records, and ranges no record covers read as holes. The maps are not
+ * stored: mounting scans the segments and keeps the records of live
+ * inodes, so a crash loses at most the unsynced tail of the log.
+ *
+ * Appends go to one of SEG_HEADS active segments, picked by inode, so
+ * appenders to different files rarely wait for each other. A segment is
+ * synced and sealed once it reaches the target size. Records of deleted
+ * files become garbage; a background thread copies the live records of
+ * sealed segments that are mostly garbage into a segment of its own, then
+ * deletes them.
+ *
+ * Each inode's table record says which engine holds its data, so changing
+ * the option only affects files created afterwards. The engine is chosen
+ * with -o storage=files|segments, or FUSED_STORAGE where there is no mount
+ * (the RPC server); FUSED_SEG_SIZE overrides the segment size.
+ *
+ * With -o dedup (FUSED_DEDUP=1), whole SEG_CHUNK_SIZE chunks at aligned
+ * file offsets are stored once however many files hold them. A chunk is
+ * found by a 128-bit fingerprint and compared byte for byte before it is
+ * shared, so a fingerprint collision only costs the space saving.
+ */
+
+#ifndef FUSED_SEGMENT_H
+#define FUSED_SEGMENT_H
+
+#include "fused_fs.h"
+
+#define SEG_FILE_PREFIX "seg_"
+#define SEG_DEFAULT_SIZE (64u << 20)    /* Seal the active segment at this size */
+#define SEG_MAX_SEGMENTS (1u << 16)     /* Fixed segment directory */
+#define SEG_HEADS 4                     /* Active segments taking appends */
+#define SEG_COMPACT_LIVE_PCT 50         /* Compact sealed segments less live than this */
+#define SEG_COMPACT_MS 1000             /* Compactor wakeup interval */
+#define SEG_CHUNK_SIZE (64u << 10)      /* Dedup unit, aligned to the file offset */
+
+/**
+ * @brief Counters and occupancy; read with seg_get_stats()
+ */
+typedef struct {
+    uint32_t segments;      // Segment files in use
+    uint64_t bytes;         // Bytes in all segments, records and garbage
+    uint64_t live;          // Data bytes still referenced by some inode
+    uint64_t compacted;     // Segments reclaimed by compaction
+    uint32_t chunks;        // Distinct chunks stored
+    uint64_t chunk_bytes;   // Data bytes in those chunks
+    uint64_t chunk_ref_bytes;   // Data bytes files use through them
+    uint64_t dedup_hits;    // Appended chunks that were already stored
+    double dedup_ratio;     // chunk_ref_bytes / chunk_bytes, 1.0 without chunks
+} seg_stats_t;
+
+/* Mount options storage=files|segments and [no_]dedup; env FUSED_STORAGE
+ * and FUSED_DEDUP when not given */
+int seg_parse_args(struct fuse_args *args);
+
+/* Lifecycle: find existing segments / stop the compactor / sync and close */
+int seg_open(const char *backing_dir);
+void seg_stop_compaction(void);
+void seg_close(void);
+
+/**
+ * @brief Override the configuration (tests); size 0 keeps the current one
+ */
+void seg_configure(bool enabled, bool dedup, size_t segment_size);
+
+/* Whether files created now keep their data in segments */
+bool seg_enabled(void);
+
+/**
+ * @brief Give a new or loaded inode an empty extent map
+ * @pre inode is write-locked
+ * @return 0, or -ENOMEM
+ */
+int seg_attach(fused_inode_t *inode);
+
+/**
+ * @brief Rebuild the extent maps of loaded inodes, then start the compactor
+ * Sets their sizes; records of inodes that are gone count as garbage.
+ * Runs after seg_open() even when there was no table to load.
+ */
+int seg_load(void);
+
+/**
+ * @brief Append data at file offset offset as one record
+ * @pre inode is share-locked and its append_lock is held
+ * @return 0, or negative errno (nothing became visible)
+ */
+int seg_append(fused_inode_t *inode, const void *buf, size_t size, off_t offset);
+
+/**
+ * @brief Read a range, holes as zeros
+ * @pre inode is share-locked and the range is below durable
+ * @return 0, or negative errno
+ */
+int seg_read(fused_inode_t *inode, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief Bytes of data stored for an inode (st_blocks)
+ */
+uint64_t seg_bytes(fused_inode_t *inode);
+
+/**
+ * @brief Sync every segment holding data of an inode
+ * @pre inode is share-locked
+ */
+int seg_sync(fused_inode_t *inode);
+
+/**
+ * @brief Drop an inode's extent map
+ * @param garbage whether its records become garbage (inode deleted) or
+ *                stay live on disk (shutdown)
+ * @pre inode is write-locked, or nothing else uses the filesystem
+ */
+void seg_detach(fused_inode_t *inode, bool garbage);
+
+/**
+ * @brief Run one compaction pass now instead of waiting for the thread
+ * @return segments reclaimed
+ */
+int seg_compact(void);
+
+void seg_get_stats(seg_stats_t *stats);
+
+#endif /* FUSED_SEGMENT_H */
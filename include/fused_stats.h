@@ -0,0 +1,86 @@
+/**
+ * @file fused_stats.h
+ * @brief Per-operation counters and latency histograms
+ *
+ * The frontends time every request they serve and record it here: a
+ * count, the errors and a histogram of latencies in log2 buckets of
+ * nanoseconds. Recording takes no lock. Each thread adds to one of
+ * STATS_SHARDS copies of the counters, picked once per thread and aligned
+ * to cache lines, with relaxed atomics; readers add the shards up.
+ * Percentiles are the upper bound of the bucket they fall in, so they are
+ * at most twice the true value, and never above the maximum seen.
+ *
+ * The report can be read from the virtual file /.fused_stats in the
+ * mounted tree (it is not listed in the root directory) and from the
+ * Stats RPC of fused_rpc_server.
+ */
+
+#ifndef FUSED_STATS_H
+#define FUSED_STATS_H
+
+#include "fused_fs.h"
+#include <sys/stat.h>
+
+#define STATS_BUCKETS 40                    /* Bucket b: [2^b, 2^(b+1)) ns, the last is open */
+#define STATS_SHARDS 16                     /* Copies of the counters threads spread over */
+#define FUSED_STATS_NAME ".fused_stats"     /* Virtual file in the root directory */
+#define FUSED_STATS_INO INODE_SLOT_MASK     /* Its inode number, past every slot */
+
+typedef enum {
+    STATS_LOOKUP,           // Low-level frontend only
+    STATS_GETATTR,
+    STATS_READDIR,
+    STATS_OPEN,
+    STATS_READ,
+    STATS_WRITE,
+    STATS_CREATE,
+    STATS_MKDIR,
+    STATS_UNLINK,
+    STATS_RENAME,
+    STATS_OPS
+} stats_op_t;
+
+/**
+ * @brief One operation's totals since startup; filled by stats_summary()
+ */
+typedef struct {
+    uint64_t count;         // Requests recorded
+    uint64_t errors;        // Of those, failed ones
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+} stats_summary_t;
+
+/**
+ * @brief Monotonic timestamp to pass to stats_record()
+ */
+uint64_t stats_now(void);
+
+/**
+ * @brief Record one request that started at start and finished now
+ * @param rc its result, negative errno for a failure
+ * @return rc, so handlers can end with return stats_record(...)
+ */
+int stats_record(stats_op_t op, uint64_t start, int rc);
+
+const char *stats_op_name(stats_op_t op);
+
+void stats_summary(stats_op_t op, stats_summary_t *summary);
+
+/**
+ * @brief Zero every counter (tests); records racing with it may be lost
+ */
+void stats_reset(void);
+
+/**
+ * @brief Format the report, one line per operation
+ * @return the report's length; like snprintf(), truncated to fit size
+ */
+size_t stats_render(char *buf, size_t size);
+
+/* The virtual file: attributes, and its contents at offset from a fresh report */
+void stats_stat(struct stat *stbuf);
+int stats_read(char *buf, size_t size, off_t offset);
+
+#endif /* FUSED_STATS_H */
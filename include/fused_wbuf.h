@@ -0,0 +1,98 @@
+/**
+ * @file fused_wbuf.h
+ * @brief Per-inode write-back buffer that coalesces small appends
+ *
+ * Appends smaller than the threshold are copied into a buffer owned by the
+ * inode and written to the backing file as one sequential write when the
+ * buffer fills, when it has been dirty for the flush interval, or on
+ * flush/fsync/release. Reads that reach buffered bytes flush first. All
+ * buffers together are bounded by a memory budget; once it is used up,
+ * appends go straight to the backing file.
+ *
+ * Defaults can be overridden with FUSED_WB_THRESHOLD and FUSED_WB_BUDGET
+ * (bytes) and FUSED_WB_FLUSH_MS; a threshold of 0 disables buffering.
+ *
+ * Direct ingest (opt-in) keeps large uploads out of the page cache, where
+ * they would evict the data being played. Files that have reached the
+ * ingest size are staged in a larger buffer laid out at the file offset
+ * modulo WB_INGEST_ALIGN, so every whole aligned block can be written with
+ * O_DIRECT. Only the unaligned head and tail of a flush go through the
+ * page cache: while appends keep coming the tail stays buffered, and it is
+ * written out on flush/fsync/release or when it ages out. Enabled with -o
+ * direct_ingest (every file) or -o direct_ingest=<bytes>, or the
+ * FUSED_DIRECT_INGEST size where there is no mount. A backing filesystem
+ * without O_DIRECT gets buffered writes.
+ */
+
+#ifndef FUSED_WBUF_H
+#define FUSED_WBUF_H
+
+#include "fused_fs.h"
+
+#define WB_DEFAULT_THRESHOLD (1u << 20)     /* Per-inode buffer size */
+#define WB_DEFAULT_BUDGET (64u << 20)       /* All buffers together */
+#define WB_DEFAULT_FLUSH_MS 200             /* Max age of buffered data */
+#define WB_INGEST_BUFFER (4u << 20)         /* Per-inode buffer in ingest mode */
+#define WB_INGEST_ALIGN 4096u               /* O_DIRECT offset, size and memory alignment */
+#define WB_INGEST_OFF SIZE_MAX              /* Ingest size that turns direct ingest off */
+
+/**
+ * @brief Ingest counters since startup; read with wb_get_stats()
+ */
+typedef struct {
+    uint64_t direct_bytes;      // Written with O_DIRECT
+    uint64_t buffered_bytes;    // Unaligned heads/tails (and fallbacks) of ingest files
+} wb_stats_t;
+
+/* Mount options direct_ingest[=<bytes>]; env FUSED_DIRECT_INGEST when not given */
+int wb_parse_args(struct fuse_args *args);
+
+/* Lifecycle: read the configuration and start/stop the flusher thread */
+int wb_init(void);
+void wb_destroy(void);
+
+/**
+ * @brief Override the configuration (0 threshold disables buffering)
+ */
+void wb_configure(size_t threshold, size_t budget, uint32_t flush_ms);
+
+/**
+ * @brief Files from min_size bytes on are ingested with O_DIRECT
+ * @param min_size 0 for every file, WB_INGEST_OFF to turn ingest off
+ */
+void wb_configure_ingest(size_t min_size);
+
+/**
+ * @brief Reserve room for an append of size bytes at the end of the buffer
+ * Flushes whatever is buffered when the append does not fit. Fill the
+ * space and publish it with wb_commit().
+ * @pre inode is share-locked and its append_lock is held
+ * @param dst receives the space, or NULL when the append should bypass
+ *            the buffer (too large, buffering off or budget used up); the
+ *            buffer is empty in that case
+ * @return 0, or negative errno if buffered data could not be flushed
+ */
+int wb_reserve(fused_inode_t *inode, size_t size, char **dst);
+
+/**
+ * @brief Account size bytes written into space from wb_reserve()
+ * @pre inode is share-locked and its append_lock is held
+ */
+void wb_commit(fused_inode_t *inode, size_t size);
+
+/**
+ * @brief Write buffered data to the backing file and free the buffer
+ * @pre inode is share-locked and its append_lock is held
+ * @return 0, or negative errno (the data stays buffered)
+ */
+int wb_flush_locked(fused_inode_t *inode);
+
+/**
+ * @brief Drop buffered data without writing it (inode is being freed)
+ * @pre inode is write-locked
+ */
+void wb_discard(fused_inode_t *inode);
+
+void wb_get_stats(wb_stats_t *stats);
+
+#endif /* FUSED_WBUF_H */
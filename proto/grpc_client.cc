@@ -113,16 +113,22 @@ class GrpcClient {
     req.set_pathname(path);
 
     ReadDirectoryResponse resp;
-
-    ClientContext context;
-
-    Status status = stub_->ReadDirectory(&context, req, &resp);
-    int num_entries = resp.entries_size();
+    Status status;
+    int num_entries = 0;
+
+    // Follow the cursor until the server reports the end of the directory
+    do {
+      ClientContext context;
+      resp.Clear();
+      status = stub_->ReadDirectory(&context, req, &resp);
+      for (int i = 0; i < resp.entries_size(); i++){
+        cout << "Filename: " << resp.entries(i).name() << endl;
+      }
+      num_entries += resp.entries_size();
+      req.set_cookie(resp.next_cookie());
+    } while (status.ok() && resp.status_code() == 0 && !resp.eof());
     cout << "Found " << num_entries << " items." << endl;
-    for (int i = 0; i < num_entries; i++){
-      cout << "Filename: " << resp.entries(i).name() << endl;
-    }
-        
+
     cout << resp.error_message() << endl;
     return status;
 
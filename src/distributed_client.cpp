@@ -26,6 +26,8 @@ using fused::ReadDirectoryRequest;
 using fused::ReadDirectoryResponse;
 using fused::RmdirRequest;
 using fused::RmdirResponse;
+using fused::StatsRequest;
+using fused::StatsResponse;
 using fused::WriteRequest;
 using fused::WriteResponse;
 using grpc::Channel;
@@ -201,28 +203,51 @@ public:
         ReadDirectoryRequest request;
         request.set_pathname(path);
 
+        std::cout << "Directory listing for " << path << ":" << std::endl;
+
+        // Large directories come back in pages; follow the cursor to the end
         ReadDirectoryResponse response;
+        do {
+            response.Clear();
+            ClientContext context;
+            set_deadline(context);
+
+            Status status = stub_->ReadDirectory(&context, request, &response);
+
+            if (!status.ok()) {
+                std::cerr << "RPC failed: " << status.error_message() << std::endl;
+                return -1;
+            }
+
+            if (response.status_code() != 0) {
+                std::cerr << "ReadDirectory failed: " << response.error_message() << std::endl;
+                return response.status_code();
+            }
+
+            for (const auto& entry : response.entries()) {
+                std::cout << "  " << (entry.is_directory() ? "[DIR] " : "[FILE]")
+                         << entry.name() << " (" << entry.size() << " bytes)" << std::endl;
+            }
+            request.set_cookie(response.next_cookie());
+        } while (!response.eof());
+
+        return 0;
+    }
+
+    int ShowStats() {
+        StatsRequest request;
+        StatsResponse response;
         ClientContext context;
         set_deadline(context);
 
-        Status status = stub_->ReadDirectory(&context, request, &response);
+        Status status = stub_->Stats(&context, request, &response);
 
         if (!status.ok()) {
             std::cerr << "RPC failed: " << status.error_message() << std::endl;
             return -1;
         }
 
-        if (response.status_code() != 0) {
-            std::cerr << "ReadDirectory failed: " << response.error_message() << std::endl;
-            return response.status_code();
-        }
-
-        std::cout << "Directory listing for " << path << ":" << std::endl;
-        for (const auto& entry : response.entries()) {
-            std::cout << "  " << (entry.is_directory() ? "[DIR] " : "[FILE]") 
-                     << entry.name() << " (" << entry.size() << " bytes)" << std::endl;
-        }
-        
+        std::cout << response.report();
         return 0;
     }
 };
@@ -238,6 +263,7 @@ void print_usage(const char* prog) {
     std::cout << "  write <file_path> <text> [offset]          - Write text to file" << std::endl;
     std::cout << "  read <file_path> [offset] [size]           - Read file contents" << std::endl;
     std::cout << "  ls <directory_path>                        - List directory" << std::endl;
+    std::cout << "  stats                                      - Show server operation latencies" << std::endl;
     std::cout << std::endl;
     std::cout << "Examples:" << std::endl;
     std::cout << "  " << prog << " localhost:60051 mkdir / videos" << std::endl;
@@ -247,6 +273,7 @@ void print_usage(const char* prog) {
     std::cout << "  " << prog << " localhost:60051 write /videos/test.txt \"Hello World\"" << std::endl;
     std::cout << "  " << prog << " localhost:60051 read /videos/test.txt" << std::endl;
     std::cout << "  " << prog << " localhost:60051 ls /videos" << std::endl;
+    std::cout << "  " << prog << " localhost:60051 stats" << std::endl;
 }
 
 int main(int argc, char** argv) {
@@ -333,6 +360,9 @@ int main(int argc, char** argv) {
         }
         return client.ListDirectory(argv[3]);
     }
+    else if (command == "stats") {
+        return client.ShowStats();
+    }
     else {
         std::cerr << "Unknown command: " << command << std::endl;
         print_usage(argv[0]);
@@ -12,6 +12,7 @@
 #include <grpcpp/health_check_service_interface.h>
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include "filesystem.grpc.pb.h"
+#include <algorithm>
 #include <chrono>
 #include <unordered_map>
 #include <unordered_set>
@@ -21,6 +22,8 @@ extern "C" {
 #include "../distributed_core/include/metadata_manager.h"
 #include "../distributed_core/include/network_engine.h"
 #include "../distributed_core/include/storage_interface.h"
+#include "../distributed_core/include/fused_log.h"
+#include "../distributed_core/include/fused_crc32c.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -106,6 +109,85 @@ bool is_direct_child_path(const std::string &dir_path, const std::string &candid
     return true;
 }
 
+#define FRONTEND_CRC_ALIGN (64u << 10)  // Storage nodes checksum blocks of this size
+
+/**
+ * Read a range from one replica, checked against the block checksums that
+ * a majority of replicas agree on, instead of comparing the data of a
+ * majority. The range is widened to whole blocks for the checksums.
+ * Returns false when no majority has checksums in common (storage nodes
+ * without checksums, or replicas that differ) or no replica's data
+ * matches them; the caller then falls back to comparing data.
+ */
+static bool read_verified(const metadata_entry_t *entry, uint64_t offset, uint64_t size,
+                          std::string &out) {
+    uint64_t start = offset - offset % FRONTEND_CRC_ALIGN;
+    uint64_t end = (offset + size + FRONTEND_CRC_ALIGN - 1) / FRONTEND_CRC_ALIGN * FRONTEND_CRC_ALIGN;
+    uint32_t quorum_required = (entry->num_storage_nodes / 2) + 1;
+
+    // Replicas voting for the same length and checksums, keyed by both
+    std::unordered_map<std::string, std::vector<uint32_t>> votes;
+    std::string winner;
+    for (uint32_t i = 0; i < entry->num_storage_nodes && winner.empty(); i++) {
+        uint32_t node_id = entry->storage_nodes[i];
+        if (node_id == 0) {
+            continue;
+        }
+
+        storage_checksums_t sums;
+        if (storage_interface_checksums(g_storage, node_id, entry->file_id,
+                                        start, end - start, &sums) != 0) {
+            continue;
+        }
+        if (sums.block_size > 0 && (uint64_t)sums.count * sums.block_size >= sums.length) {
+            std::string key((const char *)&sums.length, sizeof(sums.length));
+            key.append((const char *)&sums.block_size, sizeof(sums.block_size));
+            key.append((const char *)sums.crcs, sums.count * sizeof(uint32_t));
+            std::vector<uint32_t> &voters = votes[key];
+            voters.push_back(node_id);
+            if (voters.size() >= quorum_required) {
+                winner = key;
+            }
+        }
+        storage_checksums_free(&sums);
+    }
+    if (winner.empty()) {
+        return false;
+    }
+
+    uint64_t length;
+    uint32_t block_size;
+    memcpy(&length, winner.data(), sizeof(length));
+    memcpy(&block_size, winner.data() + sizeof(length), sizeof(block_size));
+    const uint32_t *crcs = (const uint32_t *)(winner.data() + sizeof(length) + sizeof(block_size));
+    size_t count = (winner.size() - sizeof(length) - sizeof(block_size)) / sizeof(uint32_t);
+
+    uint64_t skip = offset - start;
+    if (length <= skip) {
+        out.clear();
+        return true;
+    }
+
+    for (uint32_t node_id : votes[winner]) {
+        storage_response_t replica_resp{};
+        int read_result = storage_interface_read(g_storage, node_id, entry->file_id,
+                                                 start, length, &replica_resp);
+        bool ok = read_result == 0 && replica_resp.status == 0 && replica_resp.data &&
+                  replica_resp.data_len == length &&
+                  crc32c_verify_blocks(replica_resp.data, length, crcs, count, block_size) < 0;
+        if (ok) {
+            out.assign((const char *)replica_resp.data + skip, std::min(size, length - skip));
+        } else {
+            log_warn("[Frontend] Replica on node %u does not match the agreed checksums", node_id);
+        }
+        storage_response_free(&replica_resp);
+        if (ok) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * Generate unique file ID using UUID
  */
@@ -189,8 +271,8 @@ bool commit_metadata_with_paxos(const metadata_entry_t *entry, const char *opera
     free(serialized);
 
     if (paxos_result != 0) {
-        printf("[Frontend] Paxos proposal failed during %s\n",
-               operation ? operation : "operation");
+        log_warn("[Frontend] Paxos proposal failed during %s",
+                 operation ? operation : "operation");
         return false;
     }
 
@@ -202,7 +284,7 @@ bool commit_metadata_with_paxos(const metadata_entry_t *entry, const char *opera
  */
 extern "C" {
     int persist_wal(uint64_t seq, void *value, size_t len) {
-        printf("[Paxos] Persisting sequence %lu (%zu bytes)\n", seq, len);
+        log_debug("[Paxos] Persisting sequence %lu (%zu bytes)", seq, len);
         if (!g_metadata || !value || len == 0) {
             return -1;
         }
@@ -239,7 +321,7 @@ extern "C" {
     }
 
     void apply_state_machine(uint64_t seq, void *value, size_t len) {
-        printf("[Paxos] Applying sequence %lu to state machine (%zu bytes)\n", seq, len);
+        log_debug("[Paxos] Applying sequence %lu to state machine (%zu bytes)", seq, len);
         if (!g_metadata || !value || len == 0) {
             return;
         }
@@ -257,8 +339,8 @@ extern "C" {
 
     void handle_network_message(uint32_t sender_id, message_type_t type,
                                const uint8_t *payload, size_t payload_len, void *ctx) {
-        printf("[Network] Message from node %u, type %d, length %zu\n",
-               sender_id, type, payload_len);
+        log_debug("[Network] Message from node %u, type %d, length %zu",
+                  sender_id, type, payload_len);
         
         if (type == MSG_TYPE_PAXOS && ctx) {
             paxos_node_t *paxos = (paxos_node_t *)ctx;
@@ -327,7 +409,7 @@ public:
             return Status::OK;
         }
 
-        printf("[Frontend] Create: %s (mode=0%o)\n", full_path.c_str(), mode);
+        log_debug("[Frontend] Create: %s (mode=0%o)", full_path.c_str(), mode);
 
         pthread_mutex_lock(&g_coordinator_lock);
 
@@ -384,7 +466,7 @@ public:
         pthread_mutex_unlock(&g_coordinator_lock);
 
         response->set_status_code(0);
-        printf("[Frontend] Create success: %s -> %s\n", full_path.c_str(), file_id.c_str());
+        log_debug("[Frontend] Create success: %s -> %s", full_path.c_str(), file_id.c_str());
         
         return Status::OK;
     }
@@ -423,7 +505,7 @@ public:
             return Status::OK;
         }
 
-        printf("[Frontend] Mkdir: %s (mode=0%o)\n", full_path.c_str(), mode);
+        log_debug("[Frontend] Mkdir: %s (mode=0%o)", full_path.c_str(), mode);
 
         pthread_mutex_lock(&g_coordinator_lock);
 
@@ -454,7 +536,7 @@ public:
         pthread_mutex_unlock(&g_coordinator_lock);
 
         response->set_status_code(0);
-        printf("[Frontend] Mkdir success: %s\n", full_path.c_str());
+        log_debug("[Frontend] Mkdir success: %s", full_path.c_str());
         
         return Status::OK;
     }
@@ -474,7 +556,7 @@ public:
             return Status::OK;
         }
 
-        printf("[Frontend] Remove: path=%s\n", path.c_str());
+        log_debug("[Frontend] Remove: path=%s", path.c_str());
 
         pthread_mutex_lock(&g_coordinator_lock);
 
@@ -514,7 +596,7 @@ public:
                 pthread_mutex_unlock(&g_coordinator_lock);
                 response->set_status_code(-EIO);
                 response->set_error_message("Delete quorum not reached");
-                printf("[Frontend] Remove failed: quorum %u/%u\n", success_count, entry->num_storage_nodes);
+                log_warn("[Frontend] Remove failed: quorum %u/%u", success_count, entry->num_storage_nodes);
                 return Status::OK;
             }
         }
@@ -536,7 +618,7 @@ public:
 
         pthread_mutex_unlock(&g_coordinator_lock);
         response->set_status_code(0);
-        printf("[Frontend] Remove success: %s\n", path.c_str());
+        log_debug("[Frontend] Remove success: %s", path.c_str());
         return Status::OK;
     }
 
@@ -555,7 +637,7 @@ public:
             return Status::OK;
         }
 
-        printf("[Frontend] Rmdir: path=%s\n", path.c_str());
+        log_debug("[Frontend] Rmdir: path=%s", path.c_str());
 
         pthread_mutex_lock(&g_coordinator_lock);
 
@@ -598,7 +680,7 @@ public:
 
         pthread_mutex_unlock(&g_coordinator_lock);
         response->set_status_code(0);
-        printf("[Frontend] Rmdir success: %s\n", path.c_str());
+        log_debug("[Frontend] Rmdir success: %s", path.c_str());
         return Status::OK;
     }
 
@@ -614,8 +696,8 @@ public:
         const std::string &data = request->data();
         off_t offset = request->offset();
 
-        printf("[Frontend] Write: path=%s, size=%zu, offset=%ld\n",
-               path.c_str(), data.size(), offset);
+        log_debug("[Frontend] Write: path=%s, size=%zu, offset=%ld",
+                  path.c_str(), data.size(), offset);
 
         pthread_mutex_lock(&g_coordinator_lock);
 
@@ -691,7 +773,7 @@ public:
                         storage_response_t cleanup_resp{};
                         (void)storage_interface_delete(g_storage, node_id, entry->file_id, &cleanup_resp);
                     }
-                    printf("[Frontend] Write rollback attempted on replicas for %s\n", path.c_str());
+                    log_warn("[Frontend] Write rollback attempted on replicas for %s", path.c_str());
                 }
 
                 response->set_bytes_written(0);
@@ -700,19 +782,19 @@ public:
                     rollback_safe
                         ? "Write quorum reached but metadata consensus failed (rollback attempted)"
                         : "Write quorum reached but metadata consensus failed");
-                printf("[Frontend] Write failed: metadata consensus failure\n");
+                log_warn("[Frontend] Write failed: metadata consensus failure");
                 pthread_mutex_unlock(&g_coordinator_lock);
                 return Status::OK;
             }
 
             response->set_bytes_written(bytes_written);
             response->set_status_code(0);
-            printf("[Frontend] Write success: quorum %u/%u\n", success_count, entry->num_storage_nodes);
+            log_debug("[Frontend] Write success: quorum %u/%u", success_count, entry->num_storage_nodes);
         } else {
             response->set_bytes_written(0);
             response->set_status_code(-EIO);
             response->set_error_message("Write quorum not reached");
-            printf("[Frontend] Write failed: quorum %u/%u\n", success_count, entry->num_storage_nodes);
+            log_warn("[Frontend] Write failed: quorum %u/%u", success_count, entry->num_storage_nodes);
         }
 
         pthread_mutex_unlock(&g_coordinator_lock);
@@ -729,8 +811,8 @@ public:
         off_t offset = request->offset();
         size_t size = request->size();
 
-        printf("[Frontend] Get: path=%s, offset=%ld, size=%zu\n",
-               path.c_str(), offset, size);
+        log_debug("[Frontend] Get: path=%s, offset=%ld, size=%zu",
+                  path.c_str(), offset, size);
 
         pthread_mutex_lock(&g_coordinator_lock);
 
@@ -784,7 +866,7 @@ public:
                     grpc::Status peer_status = stub->Get(&forward_ctx, forward_req, &forward_resp);
                     if (peer_status.ok() && forward_resp.status_code() == 0) {
                         response->CopyFrom(forward_resp);
-                        printf("[Frontend] Get served via peer frontend-%d\n", peer_id);
+                        log_debug("[Frontend] Get served via peer frontend-%d", peer_id);
                         return Status::OK;
                     }
                 }
@@ -810,6 +892,19 @@ public:
             return Status::OK;
         }
 
+        // 3. One copy checked against checksums a majority agrees on
+        std::string verified;
+        if (read_verified(entry, offset, size, verified)) {
+            response->set_data(verified.data(), verified.size());
+            response->set_bytes_read(verified.size());
+            response->set_status_code(0);
+            log_debug("[Frontend] Get success: checksums of %u replicas agree",
+                      (entry->num_storage_nodes / 2) + 1);
+            pthread_mutex_unlock(&g_coordinator_lock);
+            return Status::OK;
+        }
+
+        // Otherwise compare the data itself
         uint32_t quorum_required = (entry->num_storage_nodes / 2) + 1;
         std::unordered_map<std::string, uint32_t> value_counts;
         std::string quorum_value;
@@ -848,12 +943,12 @@ public:
             response->set_data(quorum_value.data(), quorum_value.size());
             response->set_bytes_read(quorum_value.size());
             response->set_status_code(0);
-            printf("[Frontend] Get success: quorum %u/%u\n", quorum_required, entry->num_storage_nodes);
+            log_debug("[Frontend] Get success: quorum %u/%u", quorum_required, entry->num_storage_nodes);
         } else {
             response->set_bytes_read(0);
             response->set_status_code(-EIO);
             response->set_error_message("Read quorum not reached");
-            printf("[Frontend] Get failed: read quorum not reached\n");
+            log_warn("[Frontend] Get failed: read quorum not reached");
         }
 
         pthread_mutex_unlock(&g_coordinator_lock);
@@ -870,7 +965,7 @@ public:
 
         std::string path = trim_trailing_slash(normalize_path(request->pathname()));
 
-        printf("[Frontend] ReadDirectory: path=%s\n", path.c_str());
+        log_debug("[Frontend] ReadDirectory: path=%s", path.c_str());
 
         pthread_mutex_lock(&g_coordinator_lock);
 
@@ -918,8 +1013,10 @@ public:
             }
         }
 
+        // The metadata map has no stable order to page through; answer in one page
+        response->set_eof(true);
         response->set_status_code(0);
-        printf("[Frontend] ReadDirectory success: %d entries\n", entry_count);
+        log_debug("[Frontend] ReadDirectory success: %d entries", entry_count);
 
         pthread_mutex_unlock(&g_coordinator_lock);
         return Status::OK;
@@ -942,51 +1039,48 @@ bool initialize_distributed_system(uint32_t node_id, uint16_t listen_port,
                                    uint32_t total_nodes, const char** peer_addrs,
                                    int num_peers) {
     
-    printf("=== Initializing Distributed Frontend ===\n");
-    printf("Node ID: %u\n", node_id);
-    printf("Listen Port: %u\n", listen_port);
-    printf("Total Nodes: %u\n", total_nodes);
-    printf("==========================================\n\n");
+    log_info("Initializing distributed frontend: node %u, listen port %u, %u nodes",
+             node_id, listen_port, total_nodes);
 
     // 1. Initialize Paxos
     g_paxos = paxos_init(node_id, total_nodes, persist_wal, apply_state_machine);
     if (!g_paxos) {
-        fprintf(stderr, "Failed to initialize Paxos\n");
+        log_error("Failed to initialize Paxos");
         return false;
     }
-    printf("[Paxos] Initialized (quorum: %u)\n", g_paxos->quorum_size);
+    log_info("[Paxos] Initialized (quorum: %u)", g_paxos->quorum_size);
 
     // 2. Initialize Metadata Manager
     char wal_path[256];
     snprintf(wal_path, sizeof(wal_path), "/tmp/frontend_wal_node%u.dat", node_id);
     g_metadata = metadata_manager_init(wal_path);
     if (!g_metadata) {
-        fprintf(stderr, "Failed to initialize Metadata Manager\n");
+        log_error("Failed to initialize Metadata Manager");
         paxos_destroy(g_paxos);
         return false;
     }
-    printf("[Metadata] Initialized (WAL: %s)\n", wal_path);
+    log_info("[Metadata] Initialized (WAL: %s)", wal_path);
 
     // 3. Initialize Network Engine
     g_network = network_engine_init(node_id, listen_port, 
                                     handle_network_message, g_paxos);
     if (!g_network) {
-        fprintf(stderr, "Failed to initialize Network Engine\n");
+        log_error("Failed to initialize Network Engine");
         metadata_manager_destroy(g_metadata);
         paxos_destroy(g_paxos);
         return false;
     }
-    printf("[Network] Initialized\n");
+    log_info("[Network] Initialized");
 
     // 4. Start Network Engine
     if (network_engine_start(g_network) != 0) {
-        fprintf(stderr, "Failed to start Network Engine\n");
+        log_error("Failed to start Network Engine");
         network_engine_destroy(g_network);
         metadata_manager_destroy(g_metadata);
         paxos_destroy(g_paxos);
         return false;
     }
-    printf("[Network] Started on port %u\n", listen_port);
+    log_info("[Network] Started on port %u", listen_port);
 
     paxos_set_broadcast_callback(g_paxos, paxos_broadcast_message, g_network);
 
@@ -997,12 +1091,12 @@ bool initialize_distributed_system(uint32_t node_id, uint16_t listen_port,
         if (parsed_timeout >= 1000 && parsed_timeout <= 60000) {
             proposal_timeout_ms = (uint32_t)parsed_timeout;
         } else {
-            printf("[Paxos] Ignoring invalid PAXOS_PROPOSAL_TIMEOUT_MS=%s (using %u ms)\n",
-                   proposal_timeout_env, proposal_timeout_ms);
+            log_warn("[Paxos] Ignoring invalid PAXOS_PROPOSAL_TIMEOUT_MS=%s (using %u ms)",
+                     proposal_timeout_env, proposal_timeout_ms);
         }
     }
     paxos_set_proposal_timeout(g_paxos, proposal_timeout_ms);
-    printf("[Paxos] Proposal timeout set to %u ms\n", proposal_timeout_ms);
+    log_info("[Paxos] Proposal timeout set to %u ms", proposal_timeout_ms);
 
     // 5. Add peer metadata nodes
     for (int i = 0; i < num_peers; i++) {
@@ -1012,20 +1106,20 @@ bool initialize_distributed_system(uint32_t node_id, uint16_t listen_port,
         
         if (sscanf(peer_addrs[i], "%u@%[^:]:%hu", &peer_id, peer_ip, &peer_port) == 3) {
             network_engine_add_peer(g_network, peer_id, peer_ip, peer_port);
-            printf("[Network] Added peer %u at %s:%u\n", peer_id, peer_ip, peer_port);
+            log_info("[Network] Added peer %u at %s:%u", peer_id, peer_ip, peer_port);
         }
     }
 
     // 6. Initialize Storage Interface
     g_storage = storage_interface_init(MAX_STORAGE_NODES);
     if (!g_storage) {
-        fprintf(stderr, "Failed to initialize Storage Interface\n");
+        log_error("Failed to initialize Storage Interface");
         network_engine_destroy(g_network);
         metadata_manager_destroy(g_metadata);
         paxos_destroy(g_paxos);
         return false;
     }
-    printf("[Storage] Initialized\n");
+    log_info("[Storage] Initialized");
 
     // 7. Register storage nodes (from environment or config)
     // Default: 3 storage nodes
@@ -1042,7 +1136,7 @@ bool initialize_distributed_system(uint32_t node_id, uint16_t listen_port,
             if (sscanf(token, "%[^:]:%hu", ip, &port) == 2) {
                 storage_interface_register_node(g_storage, storage_id++, 
                                               ip, port, 1ULL * 1024 * 1024 * 1024); // 1GB
-                printf("[Storage] Registered node %u at %s:%u\n", storage_id - 1, ip, port);
+                log_info("[Storage] Registered node %u at %s:%u", storage_id - 1, ip, port);
             }
             token = strtok(nullptr, " ");
         }
@@ -1052,10 +1146,10 @@ bool initialize_distributed_system(uint32_t node_id, uint16_t listen_port,
         storage_interface_register_node(g_storage, 101, "storage-node-1", 9000, 1ULL * 1024 * 1024 * 1024);
         storage_interface_register_node(g_storage, 102, "storage-node-2", 9000, 1ULL * 1024 * 1024 * 1024);
         storage_interface_register_node(g_storage, 103, "storage-node-3", 9000, 1ULL * 1024 * 1024 * 1024);
-        printf("[Storage] Registered 3 default storage nodes\n");
+        log_info("[Storage] Registered 3 default storage nodes");
     }
 
-    printf("\n=== Initialization Complete ===\n\n");
+    log_info("Initialization complete");
     return true;
 }
 
@@ -1063,27 +1157,27 @@ bool initialize_distributed_system(uint32_t node_id, uint16_t listen_port,
  * Cleanup all components
  */
 void cleanup_distributed_system() {
-    printf("\n=== Shutting Down ===\n");
+    log_info("Shutting down");
     
     if (g_storage) {
         storage_interface_destroy(g_storage);
-        printf("[Storage] Destroyed\n");
+        log_info("[Storage] Destroyed");
     }
     if (g_network) {
         network_engine_stop(g_network);
         network_engine_destroy(g_network);
-        printf("[Network] Destroyed\n");
+        log_info("[Network] Destroyed");
     }
     if (g_metadata) {
         metadata_manager_destroy(g_metadata);
-        printf("[Metadata] Destroyed\n");
+        log_info("[Metadata] Destroyed");
     }
     if (g_paxos) {
         paxos_destroy(g_paxos);
-        printf("[Paxos] Destroyed\n");
+        log_info("[Paxos] Destroyed");
     }
     
-    printf("=== Shutdown Complete ===\n");
+    log_info("Shutdown complete");
 }
 
 /**
@@ -1100,7 +1194,7 @@ void RunServer(const std::string &server_address) {
     builder.RegisterService(&service);
 
     std::unique_ptr<Server> server(builder.BuildAndStart());
-    std::cout << "[Frontend] gRPC server listening on " << server_address << std::endl;
+    log_info("[Frontend] gRPC server listening on %s", server_address.c_str());
 
     // Keep server running
     while (running) {
@@ -1114,10 +1208,6 @@ void RunServer(const std::string &server_address) {
  * Main entry point
  */
 int main(int argc, char **argv) {
-    // Disable output buffering
-    setvbuf(stdout, nullptr, _IONBF, 0);
-    setvbuf(stderr, nullptr, _IONBF, 0);
-
     // Parse arguments
     if (argc < 4) {
         fprintf(stderr, "Usage: %s <node_id> <listen_port> <total_nodes> [peer1 peer2 ...]\n", argv[0]);
@@ -1132,6 +1222,8 @@ int main(int argc, char **argv) {
     const char** peer_addrs = (const char**)(argv + 4);
     int num_peers = argc - 4;
 
+    fused_log_init("frontend");
+
     // Set up signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -1139,7 +1231,8 @@ int main(int argc, char **argv) {
     // Initialize distributed system components
     if (!initialize_distributed_system(node_id, listen_port, total_nodes, 
                                        peer_addrs, num_peers)) {
-        fprintf(stderr, "Failed to initialize distributed system\n");
+        log_error("Failed to initialize distributed system");
+        fused_log_shutdown();
         return 1;
     }
 
@@ -1152,6 +1245,7 @@ int main(int argc, char **argv) {
 
     // Cleanup
     cleanup_distributed_system();
+    fused_log_shutdown();
 
     return 0;
 }
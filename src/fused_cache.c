@@ -0,0 +1,125 @@
+/**
+ * @file fused_cache.c
+ * @brief Kernel caching policy: mount options, init negotiation, invalidation
+ */
+
+#include "fused_fs.h"
+#include "fused_cache.h"
+
+fused_cache_policy_t g_cache_policy = {
+    .attr_timeout = CACHE_DEFAULT_ATTR_TIMEOUT,
+    .entry_timeout = CACHE_DEFAULT_ENTRY_TIMEOUT,
+    .negative_timeout = CACHE_DEFAULT_NEGATIVE_TIMEOUT,
+    .keep_cache = 1,
+    .direct_io_writes = 0,
+    .writeback_cache = 0,
+    .passthrough = 1,
+};
+
+static fused_cache_inval_fn g_invalidator;
+
+#define CACHE_OPT(templ, field, value) \
+    { templ, offsetof(fused_cache_policy_t, field), value }
+
+static const struct fuse_opt cache_opts[] = {
+    CACHE_OPT("attr_timeout=%lf", attr_timeout, 0),
+    CACHE_OPT("entry_timeout=%lf", entry_timeout, 0),
+    CACHE_OPT("negative_timeout=%lf", negative_timeout, 0),
+    CACHE_OPT("keep_cache", keep_cache, 1),
+    CACHE_OPT("no_keep_cache", keep_cache, 0),
+    CACHE_OPT("direct_io_writes", direct_io_writes, 1),
+    CACHE_OPT("writeback_cache", writeback_cache, 1),
+    CACHE_OPT("no_passthrough", passthrough, 0),
+    FUSE_OPT_END
+};
+
+int fused_cache_parse_args(struct fuse_args *args)
+{
+    if (fuse_opt_parse(args, &g_cache_policy, cache_opts, NULL) != 0)
+    {
+        return -1;
+    }
+    if (g_cache_policy.attr_timeout < 0 || g_cache_policy.entry_timeout < 0 ||
+        g_cache_policy.negative_timeout < 0)
+    {
+        log_error("cache: timeouts must not be negative");
+        return -1;
+    }
+    return 0;
+}
+
+int fused_cache_lib_args(struct fuse_args *args)
+{
+    char opt[128];
+    snprintf(opt, sizeof(opt), "-oattr_timeout=%g,entry_timeout=%g,negative_timeout=%g",
+             g_cache_policy.attr_timeout, g_cache_policy.entry_timeout,
+             g_cache_policy.negative_timeout);
+    return fuse_opt_add_arg(args, opt);
+}
+
+void fused_cache_conn_init(struct fuse_conn_info *conn)
+{
+#ifdef FUSED_FUSE3
+    // Big writes and async reads are on by default in libfuse 3 (-o sync_read
+    // turns the latter off). Listings carry full attributes, so the kernel
+    // can fill its attribute cache from them instead of a getattr per entry
+    conn->want |= conn->capable & (FUSE_CAP_READDIRPLUS | FUSE_CAP_READDIRPLUS_AUTO);
+
+    // Directories are locked per inode: lookups and creates in one
+    // directory need not be serialized by the kernel
+    conn->want |= conn->capable & FUSE_CAP_PARALLEL_DIROPS;
+
+    // Pages written back after a partial page was already sent resend its
+    // head; inode_write() accepts those bytes when they are unchanged
+    if (g_cache_policy.writeback_cache && (conn->capable & FUSE_CAP_WRITEBACK_CACHE))
+    {
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+    }
+    else if (g_cache_policy.writeback_cache)
+    {
+        log_warn("cache: the kernel does not offer writeback_cache; ignoring it");
+        g_cache_policy.writeback_cache = 0;
+    }
+#else
+    // Without big_writes the kernel splits every write into single pages;
+    // max_write itself is left to -o max_write (libfuse caps it at 128 KiB)
+    conn->want |= conn->capable & FUSE_CAP_BIG_WRITES;
+
+    // Readahead of one video may then issue several reads at once; -o sync_read
+    // clears async_read before init runs
+    if (conn->async_read)
+    {
+        conn->want |= conn->capable & FUSE_CAP_ASYNC_READ;
+    }
+
+    if (g_cache_policy.writeback_cache)
+    {
+        log_warn("cache: writeback_cache needs a libfuse 3 build; ignoring it");
+        g_cache_policy.writeback_cache = 0;
+    }
+#endif
+
+    // Drop cached pages whenever a refreshed size or mtime shows a change
+    conn->want |= conn->capable & FUSE_CAP_AUTO_INVAL_DATA;
+
+    log_info("cache: max_write=%u max_readahead=%u attr_timeout=%g entry_timeout=%g "
+             "negative_timeout=%g keep_cache=%d direct_io_writes=%d writeback_cache=%d",
+             conn->max_write, conn->max_readahead, g_cache_policy.attr_timeout,
+             g_cache_policy.entry_timeout, g_cache_policy.negative_timeout,
+             g_cache_policy.keep_cache, g_cache_policy.direct_io_writes,
+             g_cache_policy.writeback_cache);
+}
+
+void fused_cache_set_invalidator(fused_cache_inval_fn fn)
+{
+    __atomic_store_n(&g_invalidator, fn, __ATOMIC_RELEASE);
+}
+
+void fused_cache_invalidate(uint64_t ino)
+{
+    fused_cache_inval_fn fn = __atomic_load_n(&g_invalidator, __ATOMIC_ACQUIRE);
+    if (fn)
+    {
+        fn(ino);
+    }
+}
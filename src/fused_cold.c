@@ -0,0 +1,604 @@
+/**
+ * @file fused_cold.c
+ * @brief Framed compressed files: the transcoder, range reads and thawing
+ *
+ * Locking: the transcoder reads a cold file through a descriptor of its
+ * own without holding the inode lock, then takes the write lock and swaps
+ * files only if the inode is still the one it read, at the same size and
+ * with no descriptor pinned. A compressed file never changes, so readers
+ * need nothing beyond the shared inode lock to use its frame index.
+ */
+
+#include "fused_fs.h"
+#include "fused_cold.h"
+#include "fused_fdcache.h"
+#include "fused_io.h"
+#include "fused_itable.h"
+#include "fused_crc32c.h"
+#include <math.h>
+#include <zlib.h>
+
+#define COLD_FRAME_DEFLATE 0x1      // Frame is deflated, else stored as is
+
+/**
+ * @brief Header at the start of a .z file; the index follows it directly
+ */
+typedef struct {
+    char magic[8];          // COLD_MAGIC
+    uint64_t size;          // Uncompressed bytes
+    uint32_t frame_size;    // Uncompressed bytes per frame, the last one excepted
+    uint32_t n_frames;
+    uint32_t reserved;
+    uint32_t checksum;      // CRC32C of every header byte before it, then the index
+} cold_hdr_t;
+
+_Static_assert(sizeof(cold_hdr_t) == 32, "cold header layout changed");
+
+typedef struct {
+    uint64_t off;           // Where the frame starts in the .z file
+    uint32_t len;           // Bytes stored
+    uint32_t flags;         // COLD_FRAME_*
+} cold_frame_t;
+
+/**
+ * @brief What the transcoder knows about a file
+ * A compressed file has its frames; a file that was not worth compressing
+ * only remembers the size it had then.
+ */
+typedef struct {
+    off_t size;             // Uncompressed bytes, or the size sampling rejected
+    uint32_t n_frames;      // 0 = rejected, not compressed
+    cold_frame_t frames[];
+} cold_file_t;
+
+typedef struct {
+    int enabled;            // -1 = not given
+    bool resolved;          // Applied once; tests reconfigure across restarts
+} cold_opts_t;
+
+static cold_opts_t g_cold_opts = { .enabled = -1 };
+
+static const struct fuse_opt cold_opts[] = {
+    { "cold_compress", offsetof(cold_opts_t, enabled), 1 },
+    { "no_cold_compress", offsetof(cold_opts_t, enabled), 0 },
+    FUSE_OPT_END
+};
+
+static int scan_pass(void);
+
+static struct {
+    pthread_mutex_t scan_lock;      // One pass at a time
+    slot_table_t files;             // cold_file_t of inodes looked at
+    bool enabled;
+    uint32_t age;
+    periodic_t transcoder;
+    cold_stats_t stats;
+} g_cold = {
+    .scan_lock = PTHREAD_MUTEX_INITIALIZER,
+    .files = SLOT_TABLE_INIT,
+    .age = COLD_DEFAULT_AGE,
+    .transcoder = PERIODIC_INIT(COLD_SCAN_MS, scan_pass),
+};
+
+static void count(uint64_t *counter, uint64_t n)
+{
+    __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+static uint32_t n_frames(off_t size)
+{
+    return (uint32_t)((size + COLD_FRAME_SIZE - 1) / COLD_FRAME_SIZE);
+}
+
+static uint32_t index_checksum(const cold_hdr_t *hdr, const cold_frame_t *frames)
+{
+    uint32_t crc = crc32c(0, hdr, offsetof(cold_hdr_t, checksum));
+    return crc32c(crc, frames, hdr->n_frames * sizeof(cold_frame_t));
+}
+
+/**
+ * @brief Order-0 entropy, in bits per byte, of windows spread over a file
+ */
+static double sample_entropy(int fd, off_t size)
+{
+    uint64_t counts[256] = {0};
+    uint64_t total = 0;
+    unsigned char window[COLD_SAMPLE_SIZE];
+
+    off_t span = size > COLD_SAMPLE_SIZE ? size - COLD_SAMPLE_SIZE : 0;
+    for (int i = 0; i < COLD_SAMPLES; i++)
+    {
+        off_t offset = span * i / (COLD_SAMPLES - 1);
+        ssize_t n = pread(fd, window, sizeof(window), offset);
+        for (ssize_t j = 0; j < n; j++)
+            counts[window[j]]++;
+        total += n > 0 ? (uint64_t)n : 0;
+    }
+
+    double entropy = 0.0;
+    for (int b = 0; b < 256 && total > 0; b++)
+    {
+        if (counts[b] == 0)
+            continue;
+        double p = (double)counts[b] / (double)total;
+        entropy -= p * log2(p);
+    }
+    return entropy;
+}
+
+/**
+ * @brief Write the first size bytes of src to path in framed form
+ * @param out receives the frame index
+ * @return 0; -E2BIG when the result would save less than an eighth; or
+ *         negative errno. path is removed unless it succeeds.
+ */
+static int encode(int src, off_t size, const char *path, cold_file_t **out)
+{
+    cold_hdr_t hdr = {
+        .size = (uint64_t)size,
+        .frame_size = COLD_FRAME_SIZE,
+        .n_frames = n_frames(size),
+    };
+    memcpy(hdr.magic, COLD_MAGIC, sizeof(hdr.magic));
+
+    cold_file_t *file = malloc(sizeof(*file) + hdr.n_frames * sizeof(cold_frame_t));
+    char *raw = malloc(COLD_FRAME_SIZE);
+    uLong bound = compressBound(COLD_FRAME_SIZE);
+    Bytef *packed = malloc(bound);
+    int dst = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int rc = file && raw && packed ? 0 : -ENOMEM;
+    if (rc == 0 && dst < 0)
+        rc = -errno;
+
+    off_t pos = sizeof(hdr) + hdr.n_frames * sizeof(cold_frame_t);
+    for (uint32_t i = 0; rc == 0 && i < hdr.n_frames; i++)
+    {
+        off_t offset = (off_t)i * COLD_FRAME_SIZE;
+        size_t len = size - offset < COLD_FRAME_SIZE ? (size_t)(size - offset) : COLD_FRAME_SIZE;
+        rc = io_pread_full(src, raw, len, offset);
+        if (rc != 0)
+            break;
+
+        // A frame that deflate cannot shrink is stored as is
+        uLongf packed_len = bound;
+        cold_frame_t *frame = &file->frames[i];
+        frame->off = pos;
+        frame->flags = 0;
+        frame->len = len;
+        const void *data = raw;
+        if (compress2(packed, &packed_len, (const Bytef *)raw, len, COLD_LEVEL) == Z_OK &&
+            packed_len < len)
+        {
+            frame->flags = COLD_FRAME_DEFLATE;
+            frame->len = packed_len;
+            data = packed;
+        }
+        rc = io_pwrite_full(dst, data, frame->len, pos);
+        pos += frame->len;
+    }
+    if (rc == 0 && pos > size - size / 8)
+        rc = -E2BIG;
+    if (rc == 0)
+    {
+        hdr.checksum = index_checksum(&hdr, file->frames);
+        rc = io_pwrite_full(dst, &hdr, sizeof(hdr), 0);
+    }
+    if (rc == 0)
+        rc = io_pwrite_full(dst, file->frames, hdr.n_frames * sizeof(cold_frame_t), sizeof(hdr));
+    if (rc == 0 && fdatasync(dst) != 0)
+        rc = -errno;
+
+    if (dst >= 0)
+        close(dst);
+    if (rc != 0 && dst >= 0)
+        unlink(path);
+    free(raw);
+    free(packed);
+    if (rc != 0)
+    {
+        free(file);
+        return rc;
+    }
+    file->size = size;
+    file->n_frames = hdr.n_frames;
+    *out = file;
+    return 0;
+}
+
+/**
+ * @brief Whether a file looks cold and is worth a look
+ * @pre inode is share-locked
+ */
+static bool is_cold(const fused_inode_t *inode, time_t now, uint32_t age)
+{
+    off_t size = inode_size(inode);
+    time_t mtime = INODE_LOAD(inode->mtime);
+    time_t atime = INODE_LOAD(inode->atime);
+    time_t last = mtime > atime ? mtime : atime;
+    if (inode->ino == 0 || !S_ISREG(inode->mode) || inode->seg_map || inode->compressed ||
+        size < COLD_MIN_SIZE || INODE_LOAD(inode->durable) != size || now - last < age ||
+        __atomic_load_n(&inode->writers, __ATOMIC_SEQ_CST) != 0)
+        return false;
+
+    void **entry = slot_table_entry(&g_cold.files, inode->ino, false);
+    const cold_file_t *known = entry ? *entry : NULL;
+    return !known || known->size != size;
+}
+
+/**
+ * @brief Switch an inode to the file encode() wrote, if nothing changed
+ * Records the .z file in the table before removing the old one.
+ * @param file the frame index, or NULL to remember that size was rejected
+ * @return 1 if the inode is compressed now, else 0
+ */
+static int install(fused_inode_t *inode, uint64_t ino, off_t size, const char *path,
+                   cold_file_t *file)
+{
+    inode_wrlock(inode);
+    bool same = inode->ino == ino && inode_size(inode) == size && !inode->compressed &&
+                INODE_LOAD(inode->durable) == size && inode->wb_len == 0 &&
+                __atomic_load_n(&inode->writers, __ATOMIC_SEQ_CST) == 0;
+    void **entry = same ? slot_table_entry(&g_cold.files, ino, true) : NULL;
+
+    if (!file)
+    {
+        cold_file_t *rejected = entry ? calloc(1, sizeof(*rejected)) : NULL;
+        if (rejected)
+        {
+            rejected->size = size;
+            free(*entry);
+            *entry = rejected;
+        }
+        inode_unlock(inode);
+        return 0;
+    }
+
+    // A pinned descriptor belongs to an open handle, whose reads may be
+    // spliced from it after the inode lock is dropped
+    if (!entry || fd_cache_drop_idle(ino) != 0)
+    {
+        inode_unlock(inode);
+        unlink(path);
+        free(file);
+        return 0;
+    }
+
+    char plain[MAX_PATH];
+    memcpy(plain, inode->backing_path, sizeof(plain));
+    free(*entry);
+    *entry = file;
+    snprintf(inode->backing_path, MAX_PATH, "%s", path);
+    INODE_STORE(inode->compressed, true);
+    itable_update(inode);
+    int rc = itable_sync(ino);
+    if (rc == 0)
+        unlink(plain);
+    else
+        log_warn("cold: keeping %s, the table did not sync: %s", plain, strerror(-rc));
+    inode_unlock(inode);
+    return 1;
+}
+
+/**
+ * @brief Compress one file if it is cold and compresses well
+ * @return 1 if it was compressed, else 0
+ */
+static int freeze(fused_inode_t *inode, time_t now, uint32_t age)
+{
+    inode_rdlock(inode);
+    if (!is_cold(inode, now, age))
+    {
+        inode_unlock(inode);
+        return 0;
+    }
+    uint64_t ino = inode->ino;
+    off_t size = inode_size(inode);
+    char path[MAX_PATH];
+    int len = snprintf(path, sizeof(path), "%s" COLD_SUFFIX, inode->backing_path);
+    int src = len < (int)sizeof(path) ? open(inode->backing_path, O_RDONLY | O_CLOEXEC) : -1;
+    inode_unlock(inode);
+    if (src < 0)
+        return 0;
+
+    // Appended bytes never change, so the first size bytes can be read unlocked
+    cold_file_t *file = NULL;
+    int rc = -E2BIG;
+    double entropy = sample_entropy(src, size);
+    if (entropy > COLD_MAX_ENTROPY)
+        count(&g_cold.stats.skipped_entropy, 1);
+    else
+        rc = encode(src, size, path, &file);
+    close(src);
+
+    if (rc == -E2BIG && entropy <= COLD_MAX_ENTROPY)
+        count(&g_cold.stats.skipped_ratio, 1);
+    if (rc != 0 && rc != -E2BIG)
+    {
+        log_ratelimited(FUSED_LOG_WARN, 1000, "cold: cannot compress inode %lu: %s", ino,
+                        strerror(-rc));
+        return 0;
+    }
+    if (install(inode, ino, size, path, file) == 0)
+        return 0;
+
+    struct stat st;
+    uint64_t stored = stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    count(&g_cold.stats.files, 1);
+    count(&g_cold.stats.bytes_in, size);
+    count(&g_cold.stats.bytes_out, stored);
+    log_debug("cold: compressed inode %lu from %ld to %lu bytes", ino, (long)size,
+              (unsigned long)stored);
+    return 1;
+}
+
+/* A pass of the transcoder, unless compression was turned off since */
+static int scan_pass(void)
+{
+    return __atomic_load_n(&g_cold.enabled, __ATOMIC_RELAXED) ? cold_scan() : 0;
+}
+
+int cold_scan(void)
+{
+    uint32_t age = __atomic_load_n(&g_cold.age, __ATOMIC_RELAXED);
+    time_t now = time(NULL);
+    int compressed = 0;
+
+    pthread_mutex_lock(&g_cold.scan_lock);
+    uint32_t n_slots = INODE_LOAD(g_state->n_slots);
+    for (uint32_t slot = 1; slot < n_slots; slot++)
+    {
+        fused_inode_t *inode = &g_state->inode_chunks[slot >> INODE_CHUNK_SHIFT]
+                                                     [slot & (INODE_CHUNK_SIZE - 1)];
+        if (INODE_LOAD(inode->ino) != 0)
+            compressed += freeze(inode, now, age);
+    }
+    pthread_mutex_unlock(&g_cold.scan_lock);
+    return compressed;
+}
+
+int cold_read(fused_inode_t *inode, char *buf, size_t size, off_t offset)
+{
+    void **entry = slot_table_entry(&g_cold.files, inode->ino, false);
+    const cold_file_t *file = entry ? *entry : NULL;
+    if (!file || file->n_frames == 0)
+        return -EIO;
+
+    int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+    if (fd < 0)
+    {
+        log_error("cold: failed to open %s", inode->backing_path);
+        return -EIO;
+    }
+
+    char *packed = NULL;
+    char *frame_buf = NULL;
+    int rc = 0;
+    while (rc == 0 && size > 0)
+    {
+        uint32_t i = offset / COLD_FRAME_SIZE;
+        off_t start = (off_t)i * COLD_FRAME_SIZE;
+        size_t frame_len = file->size - start < COLD_FRAME_SIZE ? (size_t)(file->size - start)
+                                                                : COLD_FRAME_SIZE;
+        size_t skip = offset - start;
+        size_t n = frame_len - skip < size ? frame_len - skip : size;
+        const cold_frame_t *frame = &file->frames[i];
+
+        if (!(frame->flags & COLD_FRAME_DEFLATE))
+        {
+            rc = io_pread_full(fd, buf, n, frame->off + skip);
+        }
+        else
+        {
+            // Whole frames are inflated in place, parts through a scratch frame
+            char *dst = skip == 0 && n == frame_len ? buf : frame_buf;
+            if (!packed)
+                packed = malloc(COLD_FRAME_SIZE);
+            if (!dst)
+                dst = frame_buf = malloc(COLD_FRAME_SIZE);
+            rc = packed && dst ? io_pread_full(fd, packed, frame->len, frame->off) : -ENOMEM;
+            uLongf out = frame_len;
+            if (rc == 0 && (uncompress((Bytef *)dst, &out, (const Bytef *)packed,
+                                       frame->len) != Z_OK || out != frame_len))
+            {
+                log_ratelimited(FUSED_LOG_ERROR, 1000, "cold: frame %u of %s is damaged", i,
+                                inode->backing_path);
+                rc = -EIO;
+            }
+            if (rc == 0 && dst != buf)
+                memcpy(buf, dst + skip, n);
+        }
+        buf += n;
+        offset += n;
+        size -= n;
+    }
+    fd_cache_put(inode->ino);
+    free(packed);
+    free(frame_buf);
+    return rc;
+}
+
+int cold_load(fused_inode_t *inode, uint64_t ino)
+{
+    char path[MAX_PATH];
+    if (snprintf(path, sizeof(path), "%s" COLD_SUFFIX, inode->backing_path) >= (int)sizeof(path))
+        return -ENAMETOOLONG;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    cold_hdr_t hdr;
+    struct stat st;
+    cold_file_t *file = NULL;
+    int rc = fstat(fd, &st) == 0 ? io_pread_full(fd, &hdr, sizeof(hdr), 0) : -errno;
+    if (rc == 0 && (memcmp(hdr.magic, COLD_MAGIC, sizeof(hdr.magic)) != 0 ||
+                    hdr.frame_size != COLD_FRAME_SIZE || hdr.size == 0 ||
+                    hdr.size > (uint64_t)INT64_MAX || hdr.n_frames != n_frames(hdr.size)))
+        rc = -EINVAL;
+    if (rc == 0)
+    {
+        file = malloc(sizeof(*file) + hdr.n_frames * sizeof(cold_frame_t));
+        rc = file ? io_pread_full(fd, file->frames, hdr.n_frames * sizeof(cold_frame_t),
+                              sizeof(hdr))
+                  : -ENOMEM;
+    }
+    if (rc == 0 && index_checksum(&hdr, file->frames) != hdr.checksum)
+        rc = -EINVAL;
+    for (uint32_t i = 0; rc == 0 && i < hdr.n_frames; i++)
+    {
+        const cold_frame_t *frame = &file->frames[i];
+        if (frame->len > COLD_FRAME_SIZE || frame->off + frame->len > (uint64_t)st.st_size)
+            rc = -EINVAL;
+    }
+    close(fd);
+
+    void **entry = rc == 0 ? slot_table_entry(&g_cold.files, ino, true) : NULL;
+    if (rc == 0 && !entry)
+        rc = -ENOMEM;
+    if (rc != 0)
+    {
+        free(file);
+        return rc;
+    }
+
+    file->size = hdr.size;
+    file->n_frames = hdr.n_frames;
+    free(*entry);
+    *entry = file;
+    memcpy(inode->backing_path, path, sizeof(path));
+    inode->compressed = true;
+    inode->size = hdr.size;
+    inode->durable = hdr.size;
+    inode->sparse = false;
+    return 0;
+}
+
+/**
+ * @brief Write a compressed file out in plain form and switch back to it
+ * @pre inode is write-locked and compressed
+ */
+static int thaw_locked(fused_inode_t *inode)
+{
+    char plain[MAX_PATH];
+    size_t len = strlen(inode->backing_path) - strlen(COLD_SUFFIX);
+    memcpy(plain, inode->backing_path, len);
+    plain[len] = '\0';
+
+    off_t size = inode_size(inode);
+    char *buf = malloc(COLD_FRAME_SIZE);
+    int dst = open(plain, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int rc = !buf ? -ENOMEM : dst < 0 ? -errno : 0;
+    for (off_t offset = 0; rc == 0 && offset < size; offset += COLD_FRAME_SIZE)
+    {
+        size_t n = size - offset < COLD_FRAME_SIZE ? (size_t)(size - offset) : COLD_FRAME_SIZE;
+        rc = cold_read(inode, buf, n, offset);
+        if (rc == 0)
+            rc = io_pwrite_full(dst, buf, n, offset);
+    }
+    if (rc == 0 && fdatasync(dst) != 0)
+        rc = -errno;
+    if (dst >= 0)
+        close(dst);
+    free(buf);
+
+    // Open handles keep their pins on the inode's descriptor, now the plain file
+    if (rc == 0)
+        rc = fd_cache_reopen(inode->ino, plain);
+    if (rc != 0)
+    {
+        if (dst >= 0)
+            unlink(plain);
+        log_error("cold: cannot write inode %lu back out: %s", inode->ino, strerror(-rc));
+        return rc;
+    }
+
+    char packed[MAX_PATH];
+    memcpy(packed, inode->backing_path, sizeof(packed));
+    memcpy(inode->backing_path, plain, sizeof(plain));
+    INODE_STORE(inode->compressed, false);
+    INODE_STORE(inode->sparse, false);
+    cold_discard(inode);
+    itable_update(inode);
+    rc = itable_sync(inode->ino);
+    if (rc == 0)
+        unlink(packed);
+    else
+        log_warn("cold: keeping %s, the table did not sync: %s", packed, strerror(-rc));
+    count(&g_cold.stats.thawed, 1);
+    return 0;
+}
+
+int cold_thaw(fused_inode_t *inode)
+{
+    if (!INODE_LOAD(inode->compressed))
+        return 0;
+
+    inode_wrlock(inode);
+    int rc = inode->ino != 0 && inode->compressed ? thaw_locked(inode) : 0;
+    inode_unlock(inode);
+    return rc;
+}
+
+void cold_discard(fused_inode_t *inode)
+{
+    void **entry = slot_table_entry(&g_cold.files, inode->ino, false);
+    if (entry)
+    {
+        free(*entry);
+        *entry = NULL;
+    }
+}
+
+int cold_parse_args(struct fuse_args *args)
+{
+    return fuse_opt_parse(args, &g_cold_opts, cold_opts, NULL);
+}
+
+void cold_configure(bool enabled, uint32_t age)
+{
+    __atomic_store_n(&g_cold.enabled, enabled, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_cold.age, age, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Read the configuration and start the transcoder when enabled
+ * @return 0 on success, negative errno on failure
+ */
+int cold_init(void)
+{
+    if (!g_cold_opts.resolved)
+    {
+        if (g_cold_opts.enabled < 0)
+            g_cold_opts.enabled = fused_env_size("cold", "FUSED_COLD_COMPRESS", 0) != 0;
+        cold_configure(g_cold_opts.enabled,
+                       (uint32_t)fused_env_size("cold", "FUSED_COLD_AGE", COLD_DEFAULT_AGE));
+        g_cold_opts.resolved = true;
+    }
+    if (!__atomic_load_n(&g_cold.enabled, __ATOMIC_RELAXED))
+        return 0;
+    return periodic_start(&g_cold.transcoder);
+}
+
+void cold_stop(void)
+{
+    periodic_stop(&g_cold.transcoder);
+}
+
+/**
+ * @brief Stop the transcoder and release the table
+ * @pre every inode's index was discarded
+ */
+void cold_destroy(void)
+{
+    cold_stop();
+    slot_table_destroy(&g_cold.files);
+}
+
+void cold_get_stats(cold_stats_t *stats)
+{
+    stats->files = __atomic_load_n(&g_cold.stats.files, __ATOMIC_RELAXED);
+    stats->bytes_in = __atomic_load_n(&g_cold.stats.bytes_in, __ATOMIC_RELAXED);
+    stats->bytes_out = __atomic_load_n(&g_cold.stats.bytes_out, __ATOMIC_RELAXED);
+    stats->skipped_entropy = __atomic_load_n(&g_cold.stats.skipped_entropy, __ATOMIC_RELAXED);
+    stats->skipped_ratio = __atomic_load_n(&g_cold.stats.skipped_ratio, __ATOMIC_RELAXED);
+    stats->thawed = __atomic_load_n(&g_cold.stats.thawed, __ATOMIC_RELAXED);
+}
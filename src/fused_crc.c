@@ -0,0 +1,80 @@
+/**
+ * @file fused_crc.c
+ * @brief Per-block checksums of file data, extended as files grow
+ */
+
+#include "fused_fs.h"
+#include "fused_crc.h"
+
+/**
+ * @brief The checksums of one file
+ */
+typedef struct {
+    size_t cap;                     // Blocks allocated
+    crc_block_t blocks[];
+} crc_file_t;
+
+static slot_table_t g_crc = SLOT_TABLE_INIT;    // crc_file_t of each inode
+
+crc_block_t *crc_reserve(fused_inode_t *inode, off_t size)
+{
+    void **entry = slot_table_entry(&g_crc, inode->ino, true);
+    if (!entry)
+        return NULL;
+
+    crc_file_t *file = *entry;
+    size_t needed = (size + CRC_BLOCK_SIZE - 1) / CRC_BLOCK_SIZE;
+    size_t old_cap = file ? file->cap : 0;
+    if (file && needed <= old_cap)
+        return file->blocks;
+
+    size_t cap = old_cap ? old_cap * 2 : 16;
+    if (cap < needed)
+        cap = needed;
+    file = realloc(file, sizeof(*file) + cap * sizeof(crc_block_t));
+    if (!file)
+        return NULL;
+
+    memset(file->blocks + old_cap, 0, (cap - old_cap) * sizeof(crc_block_t));
+    file->cap = cap;
+    *entry = file;
+    return file->blocks;
+}
+
+void crc_note_append(fused_inode_t *inode, const char *buf, size_t len, off_t offset)
+{
+    // Without memory the blocks stay behind, to be summed when asked for
+    crc_block_t *blocks = len > 0 ? crc_reserve(inode, offset + (off_t)len) : NULL;
+    if (!blocks)
+        return;
+
+    while (len > 0)
+    {
+        crc_block_t *block = &blocks[offset / CRC_BLOCK_SIZE];
+        uint32_t in_block = offset % CRC_BLOCK_SIZE;
+        size_t n = CRC_BLOCK_SIZE - in_block < len ? CRC_BLOCK_SIZE - in_block : len;
+        if (block->len == in_block)
+        {
+            block->crc = crc32c(block->crc, buf, n);
+            block->len += n;
+        }
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+void crc_discard(fused_inode_t *inode)
+{
+    void **entry = slot_table_entry(&g_crc, inode->ino, false);
+    if (entry)
+    {
+        free(*entry);
+        *entry = NULL;
+    }
+}
+
+void crc_destroy(void)
+{
+    slot_table_destroy(&g_crc);
+}
@@ -0,0 +1,325 @@
+/**
+ * @file fused_fdcache.c
+ * @brief Backing-file descriptor cache
+ */
+
+#include "fused_fs.h"
+#include "fused_fdcache.h"
+
+typedef struct fd_cache_entry {
+    uint64_t ino;                   // Inode the descriptor belongs to
+    int fd;                         // Open backing-file descriptor
+    int pins;                       // Open handles and in-flight I/O
+    bool dead;                      // Inode freed; closed at the last unpin
+    struct fd_cache_entry *next;    // Hash chain
+    struct fd_cache_entry *lru_prev;
+    struct fd_cache_entry *lru_next;
+} fd_cache_entry_t;
+
+static struct {
+    pthread_mutex_t lock;
+    fd_cache_entry_t **buckets;     // Chained hash table keyed by ino
+    uint32_t n_buckets;             // Power of two
+    uint32_t n_entries;
+    fd_cache_entry_t *lru_head;     // Most recently unpinned
+    fd_cache_entry_t *lru_tail;     // Next eviction candidate
+    uint32_t n_idle;                // Entries on the LRU list
+} g_fd_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint32_t fd_cache_bucket(uint64_t ino)
+{
+    // Fibonacci hashing spreads slot and generation bits alike
+    return (uint32_t)((ino * 0x9E3779B97F4A7C15ull) >> 32) & (g_fd_cache.n_buckets - 1);
+}
+
+static void lru_unlink(fd_cache_entry_t *entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        g_fd_cache.lru_head = entry->lru_next;
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        g_fd_cache.lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+    g_fd_cache.n_idle--;
+}
+
+static void lru_push_head(fd_cache_entry_t *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = g_fd_cache.lru_head;
+    if (g_fd_cache.lru_head)
+        g_fd_cache.lru_head->lru_prev = entry;
+    else
+        g_fd_cache.lru_tail = entry;
+    g_fd_cache.lru_head = entry;
+    g_fd_cache.n_idle++;
+}
+
+static fd_cache_entry_t *find_entry(uint64_t ino, fd_cache_entry_t ***link_out)
+{
+    fd_cache_entry_t **link = &g_fd_cache.buckets[fd_cache_bucket(ino)];
+    while (*link)
+    {
+        if ((*link)->ino == ino)
+        {
+            if (link_out)
+                *link_out = link;
+            return *link;
+        }
+        link = &(*link)->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Unhash, close and free an entry; caller removes it from the LRU
+ */
+static void remove_entry(fd_cache_entry_t *entry)
+{
+    fd_cache_entry_t **link;
+    if (find_entry(entry->ino, &link) == entry)
+    {
+        *link = entry->next;
+    }
+    close(entry->fd);
+    free(entry);
+    g_fd_cache.n_entries--;
+}
+
+/**
+ * @brief Double the bucket array once chains average more than one entry
+ */
+static void maybe_grow(void)
+{
+    if (g_fd_cache.n_entries < g_fd_cache.n_buckets)
+        return;
+
+    uint32_t old_buckets = g_fd_cache.n_buckets;
+    fd_cache_entry_t **old = g_fd_cache.buckets;
+    fd_cache_entry_t **buckets = calloc(old_buckets * 2, sizeof(*buckets));
+    if (!buckets)
+        return;
+
+    g_fd_cache.buckets = buckets;
+    g_fd_cache.n_buckets = old_buckets * 2;
+    for (uint32_t i = 0; i < old_buckets; i++)
+    {
+        fd_cache_entry_t *entry = old[i];
+        while (entry)
+        {
+            fd_cache_entry_t *next = entry->next;
+            uint32_t b = fd_cache_bucket(entry->ino);
+            entry->next = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    free(old);
+}
+
+/**
+ * @brief Allocate the hash table
+ * @return 0 on success, -ENOMEM on failure
+ */
+int fd_cache_init(void)
+{
+    pthread_mutex_lock(&g_fd_cache.lock);
+    if (!g_fd_cache.buckets)
+    {
+        g_fd_cache.buckets = calloc(FD_CACHE_INITIAL_BUCKETS, sizeof(fd_cache_entry_t *));
+        if (!g_fd_cache.buckets)
+        {
+            pthread_mutex_unlock(&g_fd_cache.lock);
+            return -ENOMEM;
+        }
+        g_fd_cache.n_buckets = FD_CACHE_INITIAL_BUCKETS;
+    }
+    pthread_mutex_unlock(&g_fd_cache.lock);
+    return 0;
+}
+
+/**
+ * @brief Close every cached descriptor and free the table
+ */
+void fd_cache_destroy(void)
+{
+    pthread_mutex_lock(&g_fd_cache.lock);
+    for (uint32_t i = 0; i < g_fd_cache.n_buckets; i++)
+    {
+        fd_cache_entry_t *entry = g_fd_cache.buckets[i];
+        while (entry)
+        {
+            fd_cache_entry_t *next = entry->next;
+            close(entry->fd);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(g_fd_cache.buckets);
+    g_fd_cache.buckets = NULL;
+    g_fd_cache.n_buckets = 0;
+    g_fd_cache.n_entries = 0;
+    g_fd_cache.lru_head = g_fd_cache.lru_tail = NULL;
+    g_fd_cache.n_idle = 0;
+    pthread_mutex_unlock(&g_fd_cache.lock);
+}
+
+static void entry_pin(fd_cache_entry_t *entry)
+{
+    if (entry->pins++ == 0)
+    {
+        lru_unlink(entry);
+    }
+}
+
+int fd_cache_get(uint64_t ino, const char *backing_path, int flags)
+{
+    pthread_mutex_lock(&g_fd_cache.lock);
+    if (!g_fd_cache.buckets)
+    {
+        pthread_mutex_unlock(&g_fd_cache.lock);
+        return -EIO;
+    }
+
+    fd_cache_entry_t *entry = find_entry(ino, NULL);
+    if (entry)
+    {
+        int fd = entry->dead ? -ENOENT : entry->fd;
+        if (!entry->dead)
+        {
+            entry_pin(entry);
+        }
+        pthread_mutex_unlock(&g_fd_cache.lock);
+        return fd;
+    }
+    pthread_mutex_unlock(&g_fd_cache.lock);
+
+    // Miss: open outside the lock; never O_APPEND, writes use explicit offsets
+    int fd = open(backing_path, O_RDWR | O_CLOEXEC | flags, 0644);
+    if (fd < 0)
+    {
+        int err = errno;
+        log_error("fd_cache: failed to open %s: %s", backing_path, strerror(err));
+        return -err;
+    }
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+    {
+        close(fd);
+        return -ENOMEM;
+    }
+    entry->ino = ino;
+    entry->fd = fd;
+    entry->pins = 1;
+
+    pthread_mutex_lock(&g_fd_cache.lock);
+    fd_cache_entry_t *winner = g_fd_cache.buckets ? find_entry(ino, NULL) : NULL;
+    if (winner || !g_fd_cache.buckets)
+    {
+        // Another thread cached this inode first (or the cache is gone)
+        int result = !winner ? -EIO : winner->dead ? -ENOENT : winner->fd;
+        if (result >= 0)
+        {
+            entry_pin(winner);
+        }
+        pthread_mutex_unlock(&g_fd_cache.lock);
+        close(fd);
+        free(entry);
+        return result;
+    }
+
+    maybe_grow();
+    uint32_t b = fd_cache_bucket(ino);
+    entry->next = g_fd_cache.buckets[b];
+    g_fd_cache.buckets[b] = entry;
+    g_fd_cache.n_entries++;
+
+    pthread_mutex_unlock(&g_fd_cache.lock);
+    return fd;
+}
+
+void fd_cache_put(uint64_t ino)
+{
+    pthread_mutex_lock(&g_fd_cache.lock);
+    fd_cache_entry_t *entry = g_fd_cache.buckets ? find_entry(ino, NULL) : NULL;
+    if (entry && entry->pins > 0 && --entry->pins == 0)
+    {
+        if (entry->dead)
+        {
+            // The inode was freed while this descriptor was pinned
+            remove_entry(entry);
+        }
+        else
+        {
+            lru_push_head(entry);
+        }
+
+        // Bound the number of idle descriptors; pinned ones are never evicted
+        while (g_fd_cache.n_idle > FD_CACHE_MAX_IDLE)
+        {
+            fd_cache_entry_t *victim = g_fd_cache.lru_tail;
+            lru_unlink(victim);
+            remove_entry(victim);
+        }
+    }
+    pthread_mutex_unlock(&g_fd_cache.lock);
+}
+
+void fd_cache_drop(uint64_t ino)
+{
+    pthread_mutex_lock(&g_fd_cache.lock);
+    fd_cache_entry_t *entry = g_fd_cache.buckets ? find_entry(ino, NULL) : NULL;
+    if (entry && entry->pins > 0)
+    {
+        // A zero-copy reply may still be spliced from it; the last unpin closes it
+        entry->dead = true;
+    }
+    else if (entry)
+    {
+        lru_unlink(entry);
+        remove_entry(entry);
+    }
+    pthread_mutex_unlock(&g_fd_cache.lock);
+}
+
+int fd_cache_drop_idle(uint64_t ino)
+{
+    pthread_mutex_lock(&g_fd_cache.lock);
+    fd_cache_entry_t *entry = g_fd_cache.buckets ? find_entry(ino, NULL) : NULL;
+    int rc = entry && entry->pins > 0 ? -EBUSY : 0;
+    if (entry && rc == 0)
+    {
+        lru_unlink(entry);
+        remove_entry(entry);
+    }
+    pthread_mutex_unlock(&g_fd_cache.lock);
+    return rc;
+}
+
+int fd_cache_reopen(uint64_t ino, const char *backing_path)
+{
+    int fd = open(backing_path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        int err = errno;
+        log_error("fd_cache: failed to open %s: %s", backing_path, strerror(err));
+        return -err;
+    }
+
+    pthread_mutex_lock(&g_fd_cache.lock);
+    fd_cache_entry_t *entry = g_fd_cache.buckets ? find_entry(ino, NULL) : NULL;
+    if (!entry || entry->dead)
+    {
+        // Nothing cached to swap; the next fd_cache_get() opens the new file
+        pthread_mutex_unlock(&g_fd_cache.lock);
+        close(fd);
+        return 0;
+    }
+    close(entry->fd);
+    entry->fd = fd;
+    pthread_mutex_unlock(&g_fd_cache.lock);
+    return 0;
+}
@@ -0,0 +1,424 @@
+/**
+ * @file fused_hotcache.c
+ * @brief 2Q block cache: shards, queues and replacement
+ *
+ * Blocks are spread over HC_SHARDS independent caches by a hash of their
+ * key, so readers of one popular file do not all wait for one lock. Each
+ * shard gets an equal part of the capacity and runs 2Q on its own.
+ */
+
+#include "fused_fs.h"
+#include "fused_hotcache.h"
+
+#define HC_SHARDS 16                // Independent caches, each with its own lock
+
+enum { HC_A1IN, HC_AM, HC_A1OUT, HC_QUEUES };
+
+typedef struct hc_block {
+    uint64_t ino;
+    uint64_t index;                 // Block number within the file
+    char *data;                     // NULL for ghosts
+    uint32_t len;                   // Bytes held; less than a block at EOF
+    uint8_t queue;                  // HC_A1IN, HC_AM or HC_A1OUT
+    struct hc_block *next;          // Hash chain
+    struct hc_block *q_prev;        // Towards the queue's head
+    struct hc_block *q_next;        // Towards the queue's tail
+} hc_block_t;
+
+typedef struct {
+    hc_block_t *head;               // Most recently added or used
+    hc_block_t *tail;               // Next to leave
+    uint32_t count;
+} hc_queue_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    hc_block_t **buckets;           // Chained hash table of every block, ghosts too
+    uint32_t n_buckets;             // Power of two
+    hc_queue_t queues[HC_QUEUES];
+    size_t bytes;                   // Data held by A1in and Am
+    size_t a1in_bytes;
+} hc_shard_t;
+
+static struct {
+    size_t capacity;                // Per shard; 0 = off (atomic)
+    uint32_t max_ghosts;            // Per shard (atomic)
+    hotcache_stats_t stats;         // Counters updated atomically
+    bool ready;
+    hc_shard_t shards[HC_SHARDS];
+} g_hc;
+
+static uint64_t block_hash(uint64_t ino, uint64_t index)
+{
+    uint64_t h = ino * 0x9E3779B97F4A7C15ull ^ index * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+static hc_shard_t *shard_for(uint64_t hash)
+{
+    return &g_hc.shards[(hash >> 48) % HC_SHARDS];
+}
+
+/**
+ * @pre the shard's lock is held
+ */
+static hc_block_t *find_block(hc_shard_t *shard, uint64_t hash, uint64_t ino, uint64_t index)
+{
+    hc_block_t *block = shard->buckets[hash & (shard->n_buckets - 1)];
+    while (block && (block->ino != ino || block->index != index))
+        block = block->next;
+    return block;
+}
+
+static void queue_unlink(hc_shard_t *shard, hc_block_t *block)
+{
+    hc_queue_t *q = &shard->queues[block->queue];
+    if (block->q_prev)
+        block->q_prev->q_next = block->q_next;
+    else
+        q->head = block->q_next;
+    if (block->q_next)
+        block->q_next->q_prev = block->q_prev;
+    else
+        q->tail = block->q_prev;
+    block->q_prev = block->q_next = NULL;
+    q->count--;
+}
+
+static void queue_push(hc_shard_t *shard, hc_block_t *block, uint8_t queue)
+{
+    hc_queue_t *q = &shard->queues[queue];
+    block->queue = queue;
+    block->q_prev = NULL;
+    block->q_next = q->head;
+    if (q->head)
+        q->head->q_prev = block;
+    else
+        q->tail = block;
+    q->head = block;
+    q->count++;
+}
+
+/**
+ * @brief Give up a block's data, counting it out of its queue's bytes
+ */
+static void release_data(hc_shard_t *shard, hc_block_t *block)
+{
+    if (!block->data)
+        return;
+    shard->bytes -= block->len;
+    if (block->queue == HC_A1IN)
+        shard->a1in_bytes -= block->len;
+    free(block->data);
+    block->data = NULL;
+}
+
+/**
+ * @brief Unhash, dequeue and free a block
+ */
+static void remove_block(hc_shard_t *shard, hc_block_t *block)
+{
+    hc_block_t **link = &shard->buckets[block_hash(block->ino, block->index) &
+                                        (shard->n_buckets - 1)];
+    while (*link != block)
+        link = &(*link)->next;
+    *link = block->next;
+    release_data(shard, block);
+    queue_unlink(shard, block);
+    free(block);
+}
+
+/**
+ * @brief Evict until the shard fits its capacity
+ * A1in gives up its oldest blocks while it holds more than its share,
+ * keeping their keys as ghosts; otherwise Am loses its least recent one.
+ */
+static void reclaim(hc_shard_t *shard, size_t capacity)
+{
+    while (shard->bytes > capacity)
+    {
+        hc_queue_t *main = &shard->queues[HC_AM];
+        hc_block_t *victim;
+        if (shard->a1in_bytes > capacity / 100 * HC_A1IN_PCT || !main->tail)
+        {
+            victim = shard->queues[HC_A1IN].tail;
+            release_data(shard, victim);
+            queue_unlink(shard, victim);
+            queue_push(shard, victim, HC_A1OUT);
+        }
+        else
+        {
+            victim = main->tail;
+            remove_block(shard, victim);
+        }
+        __atomic_add_fetch(&g_hc.stats.evictions, 1, __ATOMIC_RELAXED);
+    }
+
+    while (shard->queues[HC_A1OUT].count > __atomic_load_n(&g_hc.max_ghosts, __ATOMIC_RELAXED))
+        remove_block(shard, shard->queues[HC_A1OUT].tail);
+}
+
+/**
+ * @brief Drop every block and ghost of a shard
+ * @pre the shard's lock is held
+ */
+static void clear_shard(hc_shard_t *shard)
+{
+    for (int q = 0; q < HC_QUEUES; q++)
+    {
+        while (shard->queues[q].tail)
+            remove_block(shard, shard->queues[q].tail);
+    }
+}
+
+/**
+ * @brief Whether a cached block holds all of a range ending at end inside it
+ * @pre the shard's lock is held
+ */
+static bool block_covers(const hc_block_t *block, off_t end)
+{
+    off_t block_start = (off_t)block->index * HC_BLOCK_SIZE;
+    off_t want = end < block_start + HC_BLOCK_SIZE ? end : block_start + HC_BLOCK_SIZE;
+    return block->data && block_start + (off_t)block->len >= want;
+}
+
+int hotcache_read(uint64_t ino, char *buf, size_t size, off_t offset)
+{
+    if (!hotcache_enabled() || size == 0)
+        return -ENOENT;
+
+    off_t end = offset + (off_t)size;
+    for (off_t pos = offset; pos < end;)
+    {
+        uint64_t index = (uint64_t)pos / HC_BLOCK_SIZE;
+        uint64_t hash = block_hash(ino, index);
+        hc_shard_t *shard = shard_for(hash);
+        off_t block_end = (off_t)(index + 1) * HC_BLOCK_SIZE;
+        size_t n = (block_end < end ? block_end : end) - pos;
+
+        pthread_mutex_lock(&shard->lock);
+        hc_block_t *block = find_block(shard, hash, ino, index);
+        if (!block || !block_covers(block, end))
+        {
+            pthread_mutex_unlock(&shard->lock);
+            __atomic_add_fetch(&g_hc.stats.misses, 1, __ATOMIC_RELAXED);
+            return -ENOENT;
+        }
+        memcpy(buf + (pos - offset), block->data + (pos - (off_t)index * HC_BLOCK_SIZE), n);
+        // A1in is a FIFO; only blocks already known to be hot move
+        if (block->queue == HC_AM)
+        {
+            queue_unlink(shard, block);
+            queue_push(shard, block, HC_AM);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        pos += n;
+    }
+    __atomic_add_fetch(&g_hc.stats.hits, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+bool hotcache_contains(uint64_t ino, size_t size, off_t offset)
+{
+    if (!hotcache_enabled() || size == 0)
+        return false;
+
+    off_t end = offset + (off_t)size;
+    for (off_t pos = offset; pos < end;)
+    {
+        uint64_t index = (uint64_t)pos / HC_BLOCK_SIZE;
+        uint64_t hash = block_hash(ino, index);
+        hc_shard_t *shard = shard_for(hash);
+
+        pthread_mutex_lock(&shard->lock);
+        hc_block_t *block = find_block(shard, hash, ino, index);
+        bool covered = block && block_covers(block, end);
+        pthread_mutex_unlock(&shard->lock);
+        if (!covered)
+            return false;
+        pos = (off_t)(index + 1) * HC_BLOCK_SIZE;
+    }
+    return true;
+}
+
+/**
+ * @brief Cache one block, or the longer version of a cached EOF block
+ */
+static void insert_block(uint64_t ino, uint64_t index, const char *data, uint32_t len,
+                         size_t capacity)
+{
+    uint64_t hash = block_hash(ino, index);
+    hc_shard_t *shard = shard_for(hash);
+
+    pthread_mutex_lock(&shard->lock);
+    hc_block_t *block = find_block(shard, hash, ino, index);
+    if (block && block->data && block->len >= len)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    char *copy = malloc(len);
+    if (!copy)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+    memcpy(copy, data, len);
+
+    if (!block)
+    {
+        block = calloc(1, sizeof(*block));
+        if (!block)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            free(copy);
+            return;
+        }
+        block->ino = ino;
+        block->index = index;
+        hc_block_t **bucket = &shard->buckets[hash & (shard->n_buckets - 1)];
+        block->next = *bucket;
+        *bucket = block;
+        queue_push(shard, block, HC_A1IN);
+    }
+    else if (block->queue == HC_A1OUT)
+    {
+        // Read again after leaving A1in: hot
+        queue_unlink(shard, block);
+        queue_push(shard, block, HC_AM);
+        __atomic_add_fetch(&g_hc.stats.promotions, 1, __ATOMIC_RELAXED);
+    }
+    release_data(shard, block);
+
+    block->data = copy;
+    block->len = len;
+    shard->bytes += len;
+    if (block->queue == HC_A1IN)
+        shard->a1in_bytes += len;
+    reclaim(shard, capacity);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void hotcache_insert(uint64_t ino, const char *buf, size_t size, off_t offset)
+{
+    size_t capacity = __atomic_load_n(&g_hc.capacity, __ATOMIC_RELAXED);
+    if (capacity == 0)
+        return;
+
+    for (size_t done = 0; done < size; done += HC_BLOCK_SIZE)
+    {
+        size_t len = size - done < HC_BLOCK_SIZE ? size - done : HC_BLOCK_SIZE;
+        insert_block(ino, ((uint64_t)offset + done) / HC_BLOCK_SIZE, buf + done, (uint32_t)len,
+                     capacity);
+    }
+}
+
+bool hotcache_enabled(void)
+{
+    return __atomic_load_n(&g_hc.capacity, __ATOMIC_RELAXED) != 0;
+}
+
+void hotcache_configure(size_t capacity)
+{
+    size_t shard_capacity = capacity / HC_SHARDS;
+    uint32_t fit = (uint32_t)(shard_capacity / HC_BLOCK_SIZE);
+    uint32_t max_ghosts = (uint32_t)((uint64_t)fit * HC_A1OUT_PCT / 100);
+    uint32_t n_buckets = 16;
+    while (n_buckets < fit + max_ghosts && n_buckets < (1u << 24))
+        n_buckets *= 2;
+
+    // Off while the shards are rebuilt, so no insert sees a bucket array change
+    __atomic_store_n(&g_hc.capacity, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < HC_SHARDS; i++)
+    {
+        hc_shard_t *shard = &g_hc.shards[i];
+        pthread_mutex_lock(&shard->lock);
+        clear_shard(shard);
+        hc_block_t **buckets = calloc(n_buckets, sizeof(*buckets));
+        if (buckets)
+        {
+            free(shard->buckets);
+            shard->buckets = buckets;
+            shard->n_buckets = n_buckets;
+        }
+        else
+        {
+            shard_capacity = 0;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    __atomic_store_n(&g_hc.max_ghosts, max_ghosts, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_hc.capacity, shard_capacity, __ATOMIC_RELAXED);
+}
+
+void hotcache_get_stats(hotcache_stats_t *stats)
+{
+    stats->hits = __atomic_load_n(&g_hc.stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&g_hc.stats.misses, __ATOMIC_RELAXED);
+    stats->promotions = __atomic_load_n(&g_hc.stats.promotions, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&g_hc.stats.evictions, __ATOMIC_RELAXED);
+    stats->bytes = 0;
+    stats->blocks = 0;
+    for (int i = 0; g_hc.ready && i < HC_SHARDS; i++)
+    {
+        hc_shard_t *shard = &g_hc.shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->bytes += shard->bytes;
+        stats->blocks += shard->queues[HC_A1IN].count + shard->queues[HC_AM].count;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/**
+ * @brief Read the configuration from the environment
+ * @return 0 on success, negative errno on failure
+ */
+int hotcache_init(void)
+{
+    for (int i = 0; i < HC_SHARDS; i++)
+    {
+        pthread_mutex_init(&g_hc.shards[i].lock, NULL);
+        memset(g_hc.shards[i].queues, 0, sizeof(g_hc.shards[i].queues));
+        g_hc.shards[i].buckets = NULL;
+        g_hc.shards[i].n_buckets = 0;
+        g_hc.shards[i].bytes = g_hc.shards[i].a1in_bytes = 0;
+    }
+    g_hc.ready = true;
+
+    size_t capacity = fused_env_size("hotcache", "FUSED_HOTCACHE_SIZE", HC_DEFAULT_SIZE);
+    hotcache_configure(capacity);
+    if (capacity && !hotcache_enabled())
+    {
+        hotcache_destroy();
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * @brief Free every block; the cache is off until the next hotcache_init()
+ */
+void hotcache_destroy(void)
+{
+    if (!g_hc.ready)
+        return;
+
+    __atomic_store_n(&g_hc.capacity, 0, __ATOMIC_RELAXED);
+    g_hc.ready = false;
+    for (int i = 0; i < HC_SHARDS; i++)
+    {
+        hc_shard_t *shard = &g_hc.shards[i];
+        pthread_mutex_lock(&shard->lock);
+        if (shard->buckets)
+            clear_shard(shard);
+        free(shard->buckets);
+        shard->buckets = NULL;
+        shard->n_buckets = 0;
+        pthread_mutex_unlock(&shard->lock);
+        pthread_mutex_destroy(&shard->lock);
+    }
+}
@@ -0,0 +1,58 @@
+/**
+ * @file fused_io.c
+ * @brief Backing-file reads, writes and syncs with negative-errno results
+ */
+
+#include "fused_fs.h"
+#include "fused_io.h"
+
+ssize_t io_pread(int fd, void *buf, size_t size, off_t offset)
+{
+    ssize_t n;
+    do
+    {
+        n = pread(fd, buf, size, offset);
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -errno : n;
+}
+
+ssize_t io_pwrite(int fd, const void *buf, size_t size, off_t offset)
+{
+    ssize_t n;
+    do
+    {
+        n = pwrite(fd, buf, size, offset);
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -errno : n;
+}
+
+int io_fsync(int fd, bool datasync)
+{
+    return (datasync ? fdatasync(fd) : fsync(fd)) == 0 ? 0 : -errno;
+}
+
+int io_pread_full(int fd, void *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = io_pread(fd, (char *)buf + done, size - done, offset + done);
+        if (n <= 0)
+            return n < 0 ? (int)n : -EIO;
+        done += n;
+    }
+    return 0;
+}
+
+int io_pwrite_full(int fd, const void *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = io_pwrite(fd, (const char *)buf + done, size - done, offset + done);
+        if (n <= 0)
+            return n < 0 ? (int)n : -EIO;
+        done += n;
+    }
+    return 0;
+}
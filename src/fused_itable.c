@@ -0,0 +1,436 @@
+/**
+ * @file fused_itable.c
+ * @brief Persistent inode table: superblock, double-buffered slot records
+ */
+
+#include "fused_fs.h"
+#include "fused_itable.h"
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ITABLE_LOCK_STRIPES 64      // Record updates of slots sharing a stripe serialize
+
+/**
+ * @brief Superblock; clean sits after the checksum so it can flip in place
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t rec_size;
+    uint32_t chunk_slots;           // INODE_CHUNK_SIZE the file was laid out with
+    uint32_t checksum;              // Over every byte before it
+    uint32_t clean;                 // Last shutdown unmapped the table
+} itable_super_t;
+
+typedef union {
+    itable_rec_t rec;
+    char pad[ITABLE_REC_SIZE];
+} itable_copy_t;
+
+_Static_assert(sizeof(itable_rec_t) <= ITABLE_REC_SIZE, "record does not fit its copy");
+_Static_assert(sizeof(itable_super_t) <= ITABLE_HEADER_SIZE, "superblock too large");
+
+static struct {
+    int fd;
+    char *base;                     // Reserved for INODE_MAX_CHUNKS, mapped to the file
+    size_t map_len;
+    uint32_t n_chunks;              // Chunks covered by the file
+    uint64_t seq;                   // Last sequence number handed out
+    bool was_clean;
+    pthread_mutex_t grow_lock;
+    pthread_mutex_t locks[ITABLE_LOCK_STRIPES];
+} g_itable = {
+    .fd = -1,
+    .grow_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static itable_super_t *super(void)
+{
+    return (itable_super_t *)g_itable.base;
+}
+
+static itable_copy_t *slot_copies(uint32_t slot)
+{
+    return (itable_copy_t *)(g_itable.base + ITABLE_HEADER_SIZE +
+                             (size_t)slot * ITABLE_SLOT_SIZE);
+}
+
+static bool copy_valid(const itable_rec_t *rec)
+{
+    return rec->seq != 0 &&
+           rec->checksum == fused_checksum(rec, offsetof(itable_rec_t, checksum));
+}
+
+/**
+ * @brief Index of the newest valid copy of a slot, or -1
+ */
+static int current_copy(const itable_copy_t *copies)
+{
+    bool valid0 = copy_valid(&copies[0].rec);
+    bool valid1 = copy_valid(&copies[1].rec);
+    if (valid0 && valid1)
+        return copies[1].rec.seq > copies[0].rec.seq;
+    return valid0 ? 0 : valid1 ? 1 : -1;
+}
+
+static pthread_mutex_t *slot_lock(uint32_t slot)
+{
+    return &g_itable.locks[slot % ITABLE_LOCK_STRIPES];
+}
+
+static bool slot_mapped(uint32_t slot)
+{
+    return g_itable.base && slot < __atomic_load_n(&g_itable.n_chunks, __ATOMIC_ACQUIRE) *
+                                       INODE_CHUNK_SIZE;
+}
+
+/**
+ * @brief Write a new version of a slot over its older copy
+ * @pre the slot's stripe lock is held
+ */
+static void write_rec(uint32_t slot, itable_rec_t *rec)
+{
+    itable_copy_t *copies = slot_copies(slot);
+    int target = current_copy(copies) == 0 ? 1 : 0;
+
+    rec->seq = __atomic_add_fetch(&g_itable.seq, 1, __ATOMIC_RELAXED);
+    rec->checksum = fused_checksum(rec, offsetof(itable_rec_t, checksum));
+    memcpy(&copies[target].rec, rec, sizeof(*rec));
+}
+
+static uint32_t ino_slot(uint64_t ino)
+{
+    return (uint32_t)((ino & INODE_SLOT_MASK) - 1);
+}
+
+/* Copy the inode's attributes into a record; parent and name are left alone */
+static void fill_attrs(itable_rec_t *rec, const fused_inode_t *inode)
+{
+    rec->ino = inode->ino;
+    rec->generation = inode->generation;
+    rec->mode = inode->mode;
+    rec->uid = inode->uid;
+    rec->gid = inode->gid;
+    rec->flags = (inode->seg_map ? ITABLE_REC_SEGMENTS : 0) |
+                 (inode->compressed ? ITABLE_REC_COMPRESSED : 0);
+    rec->size = (uint64_t)INODE_LOAD(inode->durable);
+    rec->atime = INODE_LOAD(inode->atime);
+    rec->mtime = INODE_LOAD(inode->mtime);
+    rec->ctime = INODE_LOAD(inode->ctime);
+}
+
+/**
+ * @brief Check the superblock of an existing table
+ * @return 0, or -EINVAL if the file is not a table this build can use
+ */
+static int check_super(const char *path)
+{
+    const itable_super_t *sb = super();
+    if (memcmp(sb->magic, ITABLE_MAGIC, sizeof(sb->magic)) != 0 ||
+        sb->checksum != fused_checksum(sb, offsetof(itable_super_t, checksum)))
+    {
+        log_error("itable: %s is not an inode table or its superblock is damaged", path);
+        return -EINVAL;
+    }
+    if (sb->version != ITABLE_VERSION || sb->rec_size != ITABLE_REC_SIZE ||
+        sb->chunk_slots != INODE_CHUNK_SIZE)
+    {
+        log_error("itable: %s has an incompatible layout (version %u)", path, sb->version);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void init_super(void)
+{
+    itable_super_t *sb = super();
+    memset(sb, 0, sizeof(*sb));
+    memcpy(sb->magic, ITABLE_MAGIC, sizeof(sb->magic));
+    sb->version = ITABLE_VERSION;
+    sb->rec_size = ITABLE_REC_SIZE;
+    sb->chunk_slots = INODE_CHUNK_SIZE;
+    sb->checksum = fused_checksum(sb, offsetof(itable_super_t, checksum));
+}
+
+static void unmap_table(void)
+{
+    munmap(g_itable.base, g_itable.map_len);
+    close(g_itable.fd);
+    for (int i = 0; i < ITABLE_LOCK_STRIPES; i++)
+    {
+        pthread_mutex_destroy(&g_itable.locks[i]);
+    }
+    g_itable.base = NULL;
+    g_itable.fd = -1;
+    g_itable.n_chunks = 0;
+}
+
+static void set_clean(bool clean)
+{
+    __atomic_store_n(&super()->clean, clean ? 1u : 0u, __ATOMIC_RELEASE);
+    msync(g_itable.base, ITABLE_HEADER_SIZE, MS_SYNC);
+}
+
+/**
+ * @brief Map the table in backing_dir, creating an empty one if missing
+ * The file is locked so a second process cannot mount the same directory.
+ * @param fresh set when the table was just created
+ * @return 0 on success, negative errno on failure
+ */
+int itable_open(const char *backing_dir, bool *fresh)
+{
+    char path[MAX_PATH + 32];
+    snprintf(path, sizeof(path), "%s/%s", backing_dir, ITABLE_FILE_NAME);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        int err = errno;
+        log_error("itable: cannot open %s: %s", path, strerror(err));
+        return -err;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        log_error("itable: %s is in use by another process", path);
+        close(fd);
+        return -EBUSY;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    *fresh = st.st_size == 0;
+    if (*fresh && ftruncate(fd, ITABLE_HEADER_SIZE) != 0)
+    {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    if (!*fresh && st.st_size < ITABLE_HEADER_SIZE)
+    {
+        log_error("itable: %s is truncated", path);
+        close(fd);
+        return -EINVAL;
+    }
+
+    // Reserve address space for the largest table so records never move
+    size_t map_len = ITABLE_HEADER_SIZE + (size_t)INODE_MAX_CHUNKS * ITABLE_CHUNK_BYTES;
+    char *base = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE,
+                      fd, 0);
+    if (base == MAP_FAILED)
+    {
+        int err = errno;
+        log_error("itable: cannot map %s: %s", path, strerror(err));
+        close(fd);
+        return -err;
+    }
+
+    g_itable.fd = fd;
+    g_itable.base = base;
+    g_itable.map_len = map_len;
+    g_itable.seq = 0;
+    for (int i = 0; i < ITABLE_LOCK_STRIPES; i++)
+    {
+        pthread_mutex_init(&g_itable.locks[i], NULL);
+    }
+
+    if (*fresh)
+    {
+        init_super();
+        g_itable.n_chunks = 0;
+        g_itable.was_clean = true;
+        fsync(fd);
+    }
+    else
+    {
+        int rc = check_super(path);
+        if (rc != 0)
+        {
+            unmap_table();
+            return rc;
+        }
+        // A crash while growing may leave a partial chunk; it holds no records
+        g_itable.n_chunks = (uint32_t)((st.st_size - ITABLE_HEADER_SIZE) / ITABLE_CHUNK_BYTES);
+        g_itable.was_clean = super()->clean != 0;
+
+        // Continue the sequence after the newest record on disk
+        for (uint32_t slot = 0; slot < g_itable.n_chunks * INODE_CHUNK_SIZE; slot++)
+        {
+            const itable_copy_t *copies = slot_copies(slot);
+            int cur = current_copy(copies);
+            if (cur >= 0 && copies[cur].rec.seq > g_itable.seq)
+                g_itable.seq = copies[cur].rec.seq;
+        }
+    }
+
+    // Until itable_close() runs, a restart has to treat this as a crash
+    set_clean(false);
+    return 0;
+}
+
+/**
+ * @brief Write everything out, mark the table clean and unmap it
+ */
+void itable_close(void)
+{
+    if (!g_itable.base)
+        return;
+
+    // Records first: clean must not reach the disk before them
+    size_t used = ITABLE_HEADER_SIZE + (size_t)g_itable.n_chunks * ITABLE_CHUNK_BYTES;
+    msync(g_itable.base, used, MS_SYNC);
+    fsync(g_itable.fd);
+    set_clean(true);
+    unmap_table();
+}
+
+bool itable_was_clean(void)
+{
+    return g_itable.was_clean;
+}
+
+uint32_t itable_chunks(void)
+{
+    return __atomic_load_n(&g_itable.n_chunks, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Grow the file so it covers n_chunks slab chunks
+ * New space reads as zeroes, i.e. slots that were never written.
+ * @return 0 on success, negative errno on failure
+ */
+int itable_reserve(uint32_t n_chunks)
+{
+    if (!g_itable.base)
+        return 0;
+
+    pthread_mutex_lock(&g_itable.grow_lock);
+    int rc = 0;
+    if (n_chunks > g_itable.n_chunks)
+    {
+        off_t len = ITABLE_HEADER_SIZE + (off_t)n_chunks * ITABLE_CHUNK_BYTES;
+        if (ftruncate(g_itable.fd, len) != 0)
+        {
+            rc = -errno;
+            log_error("itable: cannot grow to %u chunks: %s", n_chunks, strerror(-rc));
+        }
+        else
+        {
+            __atomic_store_n(&g_itable.n_chunks, n_chunks, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&g_itable.grow_lock);
+    return rc;
+}
+
+int itable_get(uint32_t slot, itable_rec_t *rec)
+{
+    if (!slot_mapped(slot))
+        return -ENOENT;
+
+    pthread_mutex_lock(slot_lock(slot));
+    const itable_copy_t *copies = slot_copies(slot);
+    int cur = current_copy(copies);
+    if (cur >= 0)
+    {
+        memcpy(rec, &copies[cur].rec, sizeof(*rec));
+    }
+    pthread_mutex_unlock(slot_lock(slot));
+    return cur >= 0 ? 0 : -ENOENT;
+}
+
+void itable_put(const fused_inode_t *inode, uint64_t parent, const char *name)
+{
+    uint32_t slot = ino_slot(inode->ino);
+    if (!slot_mapped(slot))
+        return;
+
+    itable_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    fill_attrs(&rec, inode);
+    rec.parent = parent;
+    snprintf(rec.name, sizeof(rec.name), "%s", name);
+
+    pthread_mutex_lock(slot_lock(slot));
+    write_rec(slot, &rec);
+    pthread_mutex_unlock(slot_lock(slot));
+}
+
+void itable_update(const fused_inode_t *inode)
+{
+    uint32_t slot = ino_slot(inode->ino);
+    if (!slot_mapped(slot))
+        return;
+
+    pthread_mutex_lock(slot_lock(slot));
+    const itable_copy_t *copies = slot_copies(slot);
+    int cur = current_copy(copies);
+    // Only inodes in the namespace have a record to update
+    if (cur >= 0 && copies[cur].rec.ino == inode->ino)
+    {
+        itable_rec_t rec = copies[cur].rec;
+        fill_attrs(&rec, inode);
+        write_rec(slot, &rec);
+    }
+    pthread_mutex_unlock(slot_lock(slot));
+}
+
+void itable_unlink(const fused_inode_t *inode, uint64_t parent, const char *name)
+{
+    uint32_t slot = ino_slot(inode->ino);
+    if (!slot_mapped(slot))
+        return;
+
+    pthread_mutex_lock(slot_lock(slot));
+    const itable_copy_t *copies = slot_copies(slot);
+    int cur = current_copy(copies);
+    if (cur >= 0 && copies[cur].rec.ino == inode->ino && copies[cur].rec.parent == parent &&
+        strcmp(copies[cur].rec.name, name) == 0)
+    {
+        itable_rec_t rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.generation = inode->generation;
+        write_rec(slot, &rec);
+    }
+    pthread_mutex_unlock(slot_lock(slot));
+}
+
+void itable_free(uint32_t slot, uint32_t generation)
+{
+    if (!slot_mapped(slot))
+        return;
+
+    itable_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.generation = generation;
+
+    pthread_mutex_lock(slot_lock(slot));
+    write_rec(slot, &rec);
+    pthread_mutex_unlock(slot_lock(slot));
+}
+
+int itable_sync(uint64_t ino)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+    // Walk up to the root; the hop bound only guards against damaged links
+    for (int hops = 0; ino != 0 && hops < MAX_PATH; hops++)
+    {
+        uint32_t slot = ino_slot(ino);
+        itable_rec_t rec;
+        if (itable_get(slot, &rec) != 0 || rec.ino != ino)
+            return 0;
+
+        // Both copies share one page: slots are aligned to their size
+        uintptr_t start = (uintptr_t)slot_copies(slot) & ~(page - 1);
+        if (msync((void *)start, page, MS_SYNC) != 0)
+            return -errno;
+        ino = rec.parent;
+    }
+    return 0;
+}
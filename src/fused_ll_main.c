@@ -0,0 +1,877 @@
+/**
+ * @file fused_ll_main.c
+ * @brief Low-level (inode-based) FUSE frontend for ShortsFS
+ *
+ * Every request arrives keyed by the inode numbers handed out in
+ * fused_inode_t, so lookups resolve one component against its parent and
+ * the data path never walks a path string. The kernel's lookup count is
+ * tracked per inode; unlinked inodes live until their final forget.
+ *
+ * Built against libfuse 3, listings are also answered with readdirplus, and
+ * read-only opens of completed files are handed to the kernel in
+ * passthrough mode, so their reads never come back to this process.
+ */
+
+#define _GNU_SOURCE             // RENAME_NOREPLACE
+
+#include "fused_fs.h"
+#include "fused_cache.h"
+#include "fused_fdcache.h"
+#include "fused_itable.h"
+#include "fused_segment.h"
+#include "fused_stats.h"
+#include "fused_wbuf.h"
+#include "fused_cold.h"
+#include <fuse_lowlevel.h>
+
+/* Where invalidation notices go: the session in libfuse 3, else the channel */
+#ifdef FUSED_FUSE3
+typedef struct fuse_session ll_notify_t;
+#else
+typedef struct fuse_chan ll_notify_t;
+#endif
+
+/* Set before requests are served */
+static ll_notify_t *g_ll_notify;
+static struct fuse_session *g_ll_session;
+
+/* The filesystem state could not be set up; the loop stops at once */
+static bool g_ll_init_failed;
+
+/* Error the current request was answered with, for its latency record */
+static __thread int t_ll_err;
+
+static void ll_reply_err(fuse_req_t req, int err)
+{
+    t_ll_err = err;
+    fuse_reply_err(req, err);
+}
+
+/**
+ * @brief Fill a lookup reply for an inode
+ */
+static void fill_entry(fused_inode_t *inode, struct fuse_entry_param *e)
+{
+    memset(e, 0, sizeof(*e));
+    e->ino = inode->ino;
+    e->generation = inode->generation;
+    inode_stat(inode, &e->attr);
+    e->attr_timeout = g_cache_policy.attr_timeout;
+    e->entry_timeout = g_cache_policy.entry_timeout;
+}
+
+/**
+ * @brief Make the kernel refetch attributes of an inode that grew
+ * Only attributes: invalidating pages here could wait on pages the kernel
+ * keeps locked for the write being served. The kernel drops stale pages
+ * itself once it sees the new size.
+ */
+static void ll_invalidate(uint64_t ino)
+{
+    if (g_ll_notify)
+    {
+        fuse_lowlevel_notify_inval_inode(g_ll_notify, ino, -1, 0);
+    }
+}
+
+static void fused_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    (void)userdata;
+
+    fused_log_init("fused-ll");
+
+    if (fused_state_init(FUSED_BACKING_DIR) != 0)
+    {
+        // Requests would find no state, so unmount instead of serving them
+        log_error("ll: failed to initialize filesystem state");
+        g_ll_init_failed = true;
+        fuse_session_exit(g_ll_session);
+        return;
+    }
+
+    // Splice read replies from backing files into /dev/fuse and write data
+    // from the request pipe into backing files when the kernel allows it
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE |
+                                   FUSE_CAP_SPLICE_READ);
+    fused_cache_conn_init(conn);
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    // The kernel refuses passthrough together with the writeback cache
+    if (g_cache_policy.passthrough && !g_cache_policy.writeback_cache &&
+        (conn->capable & FUSE_CAP_PASSTHROUGH))
+        conn->want |= FUSE_CAP_PASSTHROUGH;
+    else
+        g_cache_policy.passthrough = 0;
+#else
+    g_cache_policy.passthrough = 0;
+#endif
+    log_info("ll: passthrough=%d", g_cache_policy.passthrough);
+
+    fused_cache_set_invalidator(ll_invalidate);
+    log_info("Filesystem initialized (low-level)");
+}
+
+static void fused_ll_destroy(void *userdata)
+{
+    (void)userdata;
+
+    log_info("Filesystem destroyed (low-level)");
+    fused_cache_set_invalidator(NULL);
+    fused_state_destroy();
+    fused_log_shutdown();
+}
+
+static void fused_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    fused_inode_t *dir = lookup_inode(parent);
+    if (!dir)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+    if (!S_ISDIR(dir->mode))
+    {
+        ll_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    if (parent == FUSE_ROOT_ID && strcmp(name, FUSED_STATS_NAME) == 0)
+    {
+        // Not cached: its size changes with every request
+        memset(&e, 0, sizeof(e));
+        e.ino = FUSED_STATS_INO;
+        stats_stat(&e.attr);
+        fuse_reply_entry(req, &e);
+        return;
+    }
+
+    // Referenced under the directory lock, before an unlink could free it
+    fused_inode_t *inode = dir_lookup_ref(dir, name);
+    if (!inode)
+    {
+        if (g_cache_policy.negative_timeout > 0)
+        {
+            // ino 0 lets the kernel cache the miss
+            memset(&e, 0, sizeof(e));
+            e.entry_timeout = g_cache_policy.negative_timeout;
+            fuse_reply_entry(req, &e);
+            return;
+        }
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    fill_entry(inode, &e);
+    fuse_reply_entry(req, &e);
+}
+
+static void fused_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    fused_inode_t *inode = lookup_inode(ino);
+    if (inode)
+    {
+        inode_forget(inode, nlookup);
+    }
+    fuse_reply_none(req);
+}
+
+static void fused_ll_forget_multi(fuse_req_t req, size_t count,
+                                  struct fuse_forget_data *forgets)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        fused_inode_t *inode = lookup_inode(forgets[i].ino);
+        if (inode)
+        {
+            inode_forget(inode, forgets[i].nlookup);
+        }
+    }
+    fuse_reply_none(req);
+}
+
+static void fused_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    (void)fi;
+
+    struct stat stbuf;
+    if (ino == FUSED_STATS_INO)
+    {
+        stats_stat(&stbuf);
+        fuse_reply_attr(req, &stbuf, 0);
+        return;
+    }
+
+    fused_inode_t *inode = lookup_inode(ino);
+    if (!inode)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    inode_stat(inode, &stbuf);
+    fuse_reply_attr(req, &stbuf, g_cache_policy.attr_timeout);
+}
+
+/**
+ * @brief Change attributes: timestamps, mode and owner; never the size
+ */
+static void fused_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                             int to_set, struct fuse_file_info *fi)
+{
+    (void)fi;
+
+    fused_inode_t *inode = lookup_inode(ino);
+    if (!inode)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    // Append-only: truncation is never allowed
+    if ((to_set & FUSE_SET_ATTR_SIZE) && attr->st_size != inode_size(inode))
+    {
+        ll_reply_err(req, EPERM);
+        return;
+    }
+
+    inode_wrlock(inode);
+    if (to_set & FUSE_SET_ATTR_MODE)
+        inode->mode = (inode->mode & S_IFMT) | (attr->st_mode & 07777);
+    if (to_set & FUSE_SET_ATTR_UID)
+        inode->uid = attr->st_uid;
+    if (to_set & FUSE_SET_ATTR_GID)
+        inode->gid = attr->st_gid;
+    if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+        itable_update(inode);
+    inode_unlock(inode);
+
+    struct timespec tv[2];
+    tv[0].tv_sec = attr->st_atime;
+    tv[0].tv_nsec = (to_set & FUSE_SET_ATTR_ATIME_NOW) ? UTIME_NOW
+                    : (to_set & FUSE_SET_ATTR_ATIME)   ? 0
+                                                       : UTIME_OMIT;
+    tv[1].tv_sec = attr->st_mtime;
+    tv[1].tv_nsec = (to_set & FUSE_SET_ATTR_MTIME_NOW) ? UTIME_NOW
+                    : (to_set & FUSE_SET_ATTR_MTIME)   ? 0
+                                                       : UTIME_OMIT;
+    inode_utimens(inode, tv);
+
+    struct stat stbuf;
+    inode_stat(inode, &stbuf);
+    fuse_reply_attr(req, &stbuf, g_cache_policy.attr_timeout);
+}
+
+/**
+ * @brief Packs inode_readdir() entries into a readdir reply buffer
+ */
+typedef struct {
+    fuse_req_t req;
+    char *buf;
+    size_t size;
+    size_t used;
+} ll_dir_buf_t;
+
+static int ll_dir_fill(void *ctx, const char *name, const struct stat *st, off_t next)
+{
+    ll_dir_buf_t *db = ctx;
+    size_t len = fuse_add_direntry(db->req, db->buf + db->used, db->size - db->used,
+                                   name, st, next);
+    if (len > db->size - db->used)
+        return 1;
+    db->used += len;
+    return 0;
+}
+
+#ifdef FUSED_FUSE3
+/**
+ * @brief Like ll_dir_fill(), with the attributes the kernel caches
+ * Every entry but "." and ".." counts as a lookup of its inode.
+ * @pre inode_readdir() holds the directory lock, keeping children alive
+ */
+static int ll_dir_fill_plus(void *ctx, const char *name, const struct stat *st, off_t next)
+{
+    ll_dir_buf_t *db = ctx;
+    fused_inode_t *inode = NULL;
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.attr = *st;
+    if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+        inode = lookup_inode(st->st_ino);
+    if (inode)
+    {
+        e.ino = st->st_ino;
+        e.generation = st->st_ino >> 32;
+        e.attr_timeout = g_cache_policy.attr_timeout;
+        e.entry_timeout = g_cache_policy.entry_timeout;
+    }
+
+    size_t len = fuse_add_direntry_plus(db->req, db->buf + db->used, db->size - db->used,
+                                        name, &e, next);
+    if (len > db->size - db->used)
+        return 1;
+    db->used += len;
+    if (inode)
+        inode_ref(inode);
+    return 0;
+}
+#endif
+
+/**
+ * @brief Answer a listing request with the entries after off that fit
+ */
+static void ll_list_dir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                        inode_dir_filler_t fill)
+{
+    fused_inode_t *dir = lookup_inode(ino);
+    if (!dir)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    ll_dir_buf_t db = {req, malloc(size), size, 0};
+    if (!db.buf)
+    {
+        ll_reply_err(req, ENOMEM);
+        return;
+    }
+
+    // off is the cookie of the last entry the kernel received
+    int rc = inode_readdir(dir, off, fill, &db);
+    // The slot may have been reused by another inode since lookup_inode()
+    if (rc == 0 && INODE_LOAD(dir->ino) != ino)
+        rc = -ENOENT;
+    if (rc != 0)
+        ll_reply_err(req, -rc);
+    else
+        fuse_reply_buf(req, db.buf, db.used);
+    free(db.buf);
+}
+
+static void fused_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                             struct fuse_file_info *fi)
+{
+    (void)fi;
+    ll_list_dir(req, ino, size, off, ll_dir_fill);
+}
+
+#ifdef FUSED_FUSE3
+static void fused_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                                 struct fuse_file_info *fi)
+{
+    (void)fi;
+    ll_list_dir(req, ino, size, off, ll_dir_fill_plus);
+}
+#endif
+
+#ifdef FUSE_CAP_PASSTHROUGH
+/**
+ * @brief Let the kernel read a completed file straight from its backing file
+ * Only for read-only handles of files nobody is appending to, with all
+ * their bytes in a plain backing file of their own. Reads through such a handle
+ * bypass this process, and so the hot cache and the stats report.
+ * @return the backing id to close once the open is answered, or 0
+ */
+static int ll_passthrough_open(fuse_req_t req, fused_inode_t *inode, struct fuse_file_info *fi)
+{
+    if (!__atomic_load_n(&g_cache_policy.passthrough, __ATOMIC_RELAXED) ||
+        (fi->flags & O_ACCMODE) != O_RDONLY)
+        return 0;
+
+    int backing_id = 0;
+    inode_rdlock(inode);
+    if (inode->ino != 0 && !inode->seg_map && !inode->compressed &&
+        __atomic_load_n(&inode->writers, __ATOMIC_SEQ_CST) == 0 &&
+        INODE_LOAD(inode->durable) == inode_size(inode))
+    {
+        // inode_open() pinned the descriptor already; this only borrows it
+        int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+        if (fd >= 0)
+        {
+            backing_id = fuse_passthrough_open(req, fd);
+            fd_cache_put(inode->ino);
+        }
+    }
+    inode_unlock(inode);
+
+    if (backing_id < 0)
+    {
+        // Registering backing files needs CAP_SYS_ADMIN; stop trying
+        log_warn("ll: passthrough unavailable (%s); serving reads here",
+                 strerror(-backing_id));
+        __atomic_store_n(&g_cache_policy.passthrough, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    if (backing_id > 0)
+        fi->backing_id = backing_id;
+    return backing_id;
+}
+#endif
+
+static void fused_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    if (ino == FUSED_STATS_INO)
+    {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        {
+            ll_reply_err(req, EACCES);
+            return;
+        }
+        // Read to EOF every time, whatever size the kernel last saw
+        fi->direct_io = 1;
+        fi->fh = ino;
+        fuse_reply_open(req, fi);
+        return;
+    }
+
+    fused_inode_t *inode = lookup_inode(ino);
+    if (!inode)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = inode_open(inode, fi);
+    if (rc != 0)
+    {
+        ll_reply_err(req, -rc);
+        return;
+    }
+
+    fi->fh = inode->ino;
+#ifdef FUSE_CAP_PASSTHROUGH
+    // The opened file holds its own reference to the backing file, so the
+    // id is only needed until the reply is in
+    int backing_id = ll_passthrough_open(req, inode, fi);
+    fuse_reply_open(req, fi);
+    if (backing_id > 0)
+        fuse_passthrough_close(req, backing_id);
+#else
+    fuse_reply_open(req, fi);
+#endif
+}
+
+static void fused_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    if (ino != FUSED_STATS_INO)
+        inode_release(fi->fh, fi->flags);
+    ll_reply_err(req, 0);
+}
+
+static void fused_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    (void)fi;
+
+    fused_inode_t *inode = lookup_inode(ino);
+    ll_reply_err(req, inode ? -inode_flush(inode) : ino == FUSED_STATS_INO ? 0 : ENOENT);
+}
+
+static void fused_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                           struct fuse_file_info *fi)
+{
+    (void)fi;
+
+    fused_inode_t *inode = lookup_inode(ino);
+    ll_reply_err(req, inode ? -inode_fsync(inode, datasync) : ENOENT);
+}
+
+static void fused_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                          struct fuse_file_info *fi)
+{
+    (void)fi;
+
+    fused_inode_t *inode = NULL;
+    if (ino != FUSED_STATS_INO)
+    {
+        inode = lookup_inode(ino);
+        if (!inode)
+        {
+            ll_reply_err(req, ENOENT);
+            return;
+        }
+    }
+
+    // Reply with the backing file range; libfuse splices it when it can
+    int fd = -1;
+    ssize_t len = inode ? inode_read_fd(inode, size, off, &fd) : -EOPNOTSUPP;
+    if (len == -EOPNOTSUPP)
+    {
+        // Segmented file, hot data or the stats file: copy through memory
+        char *mem = malloc(size ? size : 1);
+        if (!mem)
+            len = -ENOMEM;
+        else if (inode)
+            len = inode_read(inode, mem, size, off);
+        else
+            len = stats_read(mem, size, off);
+        if (len < 0)
+            ll_reply_err(req, -len);
+        else
+            fuse_reply_buf(req, mem, len);
+        free(mem);
+        return;
+    }
+    if (len < 0)
+    {
+        ll_reply_err(req, -len);
+        return;
+    }
+
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(len);
+    if (len > 0)
+    {
+        bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        bufv.buf[0].fd = fd;
+        bufv.buf[0].pos = off;
+    }
+    fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
+}
+
+static void fused_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                           off_t off, struct fuse_file_info *fi)
+{
+    (void)fi;
+
+    fused_inode_t *inode = lookup_inode(ino);
+    if (!inode)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = inode_write(inode, buf, size, off);
+    if (rc < 0)
+        ll_reply_err(req, -rc);
+    else
+        fuse_reply_write(req, rc);
+}
+
+static void fused_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
+                               off_t off, struct fuse_file_info *fi)
+{
+    (void)fi;
+
+    fused_inode_t *inode = lookup_inode(ino);
+    if (!inode)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = inode_write_buf(inode, bufv, off);
+    if (rc < 0)
+        ll_reply_err(req, -rc);
+    else
+        fuse_reply_write(req, rc);
+}
+
+static void fused_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                            mode_t mode, struct fuse_file_info *fi)
+{
+    fused_inode_t *dir = lookup_inode(parent);
+    if (!dir)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    const struct fuse_ctx *ctx = fuse_req_ctx(req);
+    fused_inode_t *inode;
+    int rc = inode_create(dir, name, mode, ctx->uid, ctx->gid, true, &inode);
+    if (rc != 0)
+    {
+        ll_reply_err(req, -rc);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    fill_entry(inode, &e);
+    inode_open_cache(inode, fi);
+    fi->fh = inode->ino;
+    fuse_reply_create(req, &e, fi);
+}
+
+static void fused_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    fused_inode_t *dir = lookup_inode(parent);
+    if (!dir)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+
+    const struct fuse_ctx *ctx = fuse_req_ctx(req);
+    fused_inode_t *inode;
+    int rc = inode_mkdir(dir, name, mode, ctx->uid, ctx->gid, true, &inode);
+    if (rc != 0)
+    {
+        ll_reply_err(req, -rc);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    fill_entry(inode, &e);
+    fuse_reply_entry(req, &e);
+}
+
+static void fused_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    fused_inode_t *dir = lookup_inode(parent);
+    ll_reply_err(req, dir ? -inode_unlink(dir, name) : ENOENT);
+}
+
+static void fused_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    fused_inode_t *dir = lookup_inode(parent);
+    ll_reply_err(req, dir ? -inode_rmdir(dir, name) : ENOENT);
+}
+
+static void fused_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                            fuse_ino_t newparent, const char *newname, unsigned int flags)
+{
+    // Renames never replace an existing name, so RENAME_NOREPLACE holds anyway
+    if (flags & ~RENAME_NOREPLACE)
+    {
+        ll_reply_err(req, EINVAL);
+        return;
+    }
+
+    fused_inode_t *src = lookup_inode(parent);
+    fused_inode_t *dest = lookup_inode(newparent);
+    if (!src || !dest)
+    {
+        ll_reply_err(req, ENOENT);
+        return;
+    }
+    ll_reply_err(req, -inode_rename(src, name, dest, newname));
+}
+
+/*
+ * Timed entry points for the operations in the stats report: each runs its
+ * handler and records it with the error the handler replied with.
+ */
+
+static uint64_t ll_begin(void)
+{
+    t_ll_err = 0;
+    return stats_now();
+}
+
+static void ll_end(stats_op_t op, uint64_t start)
+{
+    stats_record(op, start, -t_ll_err);
+}
+
+static void timed_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    uint64_t start = ll_begin();
+    fused_ll_lookup(req, parent, name);
+    ll_end(STATS_LOOKUP, start);
+}
+
+static void timed_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_getattr(req, ino, fi);
+    ll_end(STATS_GETATTR, start);
+}
+
+static void timed_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                          struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_readdir(req, ino, size, off, fi);
+    ll_end(STATS_READDIR, start);
+}
+
+#ifdef FUSED_FUSE3
+static void timed_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                              struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_readdirplus(req, ino, size, off, fi);
+    ll_end(STATS_READDIR, start);
+}
+#endif
+
+static void timed_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_open(req, ino, fi);
+    ll_end(STATS_OPEN, start);
+}
+
+static void timed_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                       struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_read(req, ino, size, off, fi);
+    ll_end(STATS_READ, start);
+}
+
+static void timed_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                        off_t off, struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_write(req, ino, buf, size, off, fi);
+    ll_end(STATS_WRITE, start);
+}
+
+static void timed_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
+                            off_t off, struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_write_buf(req, ino, bufv, off, fi);
+    ll_end(STATS_WRITE, start);
+}
+
+static void timed_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                         mode_t mode, struct fuse_file_info *fi)
+{
+    uint64_t start = ll_begin();
+    fused_ll_create(req, parent, name, mode, fi);
+    ll_end(STATS_CREATE, start);
+}
+
+static void timed_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    uint64_t start = ll_begin();
+    fused_ll_mkdir(req, parent, name, mode);
+    ll_end(STATS_MKDIR, start);
+}
+
+static void timed_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    uint64_t start = ll_begin();
+    fused_ll_unlink(req, parent, name);
+    ll_end(STATS_UNLINK, start);
+}
+
+#ifdef FUSED_FUSE3
+static void timed_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                         fuse_ino_t newparent, const char *newname, unsigned int flags)
+{
+    uint64_t start = ll_begin();
+    fused_ll_rename(req, parent, name, newparent, newname, flags);
+    ll_end(STATS_RENAME, start);
+}
+#else
+static void timed_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                         fuse_ino_t newparent, const char *newname)
+{
+    uint64_t start = ll_begin();
+    fused_ll_rename(req, parent, name, newparent, newname, 0);
+    ll_end(STATS_RENAME, start);
+}
+#endif
+
+/**
+ * @brief Low-level operations structure (append-only, optimized for shorts)
+ */
+static struct fuse_lowlevel_ops fused_ll_oper = {
+    .init         = fused_ll_init,
+    .destroy      = fused_ll_destroy,
+    .lookup       = timed_lookup,
+    .forget       = fused_ll_forget,
+    .forget_multi = fused_ll_forget_multi,
+    .getattr      = timed_getattr,
+    .setattr      = fused_ll_setattr,
+    .readdir      = timed_readdir,
+#ifdef FUSED_FUSE3
+    .readdirplus  = timed_readdirplus,
+#endif
+    .open         = timed_open,
+    .release      = fused_ll_release,
+    .flush        = fused_ll_flush,
+    .fsync        = fused_ll_fsync,
+    .read         = timed_read,
+    .write        = timed_write,
+    .write_buf    = timed_write_buf,
+    .create       = timed_create,
+    .mkdir        = timed_mkdir,
+    .unlink       = timed_unlink,
+    .rmdir        = fused_ll_rmdir,
+    .rename       = timed_rename,
+};
+
+/**
+ * @brief Main entry point
+ */
+#ifdef FUSED_FUSE3
+int main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts = {0};
+    int err = -1;
+
+    if (fused_cache_parse_args(&args) == 0 && seg_parse_args(&args) == 0 &&
+        wb_parse_args(&args) == 0 && cold_parse_args(&args) == 0 &&
+        fuse_parse_cmdline(&args, &opts) == 0 &&
+        opts.mountpoint != NULL)
+    {
+        struct fuse_session *se = fuse_session_new(&args, &fused_ll_oper,
+                                                   sizeof(fused_ll_oper), NULL);
+        if (se != NULL)
+        {
+            if (fuse_set_signal_handlers(se) != -1)
+            {
+                if (fuse_session_mount(se, opts.mountpoint) == 0)
+                {
+                    g_ll_notify = se;
+                    g_ll_session = se;
+                    // Inode operations lock per inode, so serve requests in parallel
+                    struct fuse_loop_config config = {opts.clone_fd, opts.max_idle_threads};
+                    err = fuse_session_loop_mt(se, &config);
+                    g_ll_notify = NULL;
+                    fuse_session_unmount(se);
+                }
+                fuse_remove_signal_handlers(se);
+            }
+            fuse_session_destroy(se);
+        }
+    }
+
+    /* Cleanup */
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+    return err || g_ll_init_failed ? 1 : 0;
+}
+#else
+int main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_chan *ch;
+    char *mountpoint;
+    int err = -1;
+
+    if (fused_cache_parse_args(&args) == 0 && seg_parse_args(&args) == 0 &&
+        wb_parse_args(&args) == 0 && cold_parse_args(&args) == 0 &&
+        fuse_parse_cmdline(&args, &mountpoint, NULL, NULL) != -1 &&
+        (ch = fuse_mount(mountpoint, &args)) != NULL)
+    {
+        struct fuse_session *se = fuse_lowlevel_new(&args, &fused_ll_oper,
+                                                    sizeof(fused_ll_oper), NULL);
+        if (se != NULL)
+        {
+            if (fuse_set_signal_handlers(se) != -1)
+            {
+                fuse_session_add_chan(se, ch);
+                g_ll_notify = ch;
+                g_ll_session = se;
+                // Inode operations lock per inode, so serve requests in parallel
+                err = fuse_session_loop_mt(se);
+                fuse_remove_signal_handlers(se);
+                g_ll_notify = NULL;
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+
+    /* Cleanup */
+    fuse_opt_free_args(&args);
+    return err || g_ll_init_failed ? 1 : 0;
+}
+#endif
@@ -3,26 +3,103 @@
  * @brief Main entry point for ShortsFS - YouTube Shorts optimized filesystem
  */
 
+#define _GNU_SOURCE             // RENAME_NOREPLACE
+
 #include "fused_fs.h"
+#include "fused_cache.h"
+#include "fused_segment.h"
+#include "fused_wbuf.h"
+#include "fused_cold.h"
 #include <syslog.h>
 #include <unistd.h>
 
+#ifdef FUSED_FUSE3
+/*
+ * libfuse 3 passes a few more arguments than the path API of the core takes;
+ * these adapt them.
+ */
+
+static void *fused3_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+    // The timeouts in cfg come from the options fused_cache_lib_args() adds
+    (void)cfg;
+    return fused_init(conn);
+}
+
+static int fused3_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    (void)fi;
+    return fused_getattr(path, stbuf);
+}
+
+/**
+ * @brief Carries a libfuse 3 filler through fused_readdir()
+ */
+typedef struct {
+    void *buf;
+    fuse_fill_dir_t filler;
+    enum fuse_fill_dir_flags flags;
+} fused3_fill_t;
+
+static int fused3_fill(void *ctx, const char *name, const struct stat *st, off_t off)
+{
+    fused3_fill_t *fill = ctx;
+    return fill->filler(fill->buf, name, st, off, fill->flags);
+}
+
+static int fused3_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+                          struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    // Entries come with full attributes, which readdirplus hands to the kernel
+    fused3_fill_t fill = {buf, filler, (flags & FUSE_READDIR_PLUS) ? FUSE_FILL_DIR_PLUS : 0};
+    return fused_readdir(path, &fill, fused3_fill, offset, fi);
+}
+
+static int fused3_rename(const char *from, const char *to, unsigned int flags)
+{
+    // Renames never replace an existing name, so RENAME_NOREPLACE holds anyway
+    if (flags & ~RENAME_NOREPLACE)
+        return -EINVAL;
+    return fused_rename(from, to);
+}
+
+static int fused3_utimens(const char *path, const struct timespec tv[2],
+                          struct fuse_file_info *fi)
+{
+    (void)fi;
+    return fused_utimens(path, tv);
+}
+#endif
+
 /**
  * @brief FUSE operations structure (append-only, optimized for shorts)
  */
 static struct fuse_operations fused_oper = {
+#ifdef FUSED_FUSE3
+    .init       = fused3_init,
+    .getattr    = fused3_getattr,
+    .readdir    = fused3_readdir,
+    .rename     = fused3_rename,
+    .utimens    = fused3_utimens,
+#else
     .init       = fused_init,
-    .destroy    = fused_destroy,
     .getattr    = fused_getattr,
     .readdir    = fused_readdir,
+    .rename     = fused_rename,
+    .utimens    = fused_utimens,
+#endif
+    .destroy    = fused_destroy,
     .open       = fused_open,
+    .release    = fused_release,
+    .flush      = fused_flush,
+    .fsync      = fused_fsync,
     .read       = fused_read,
+    .read_buf   = fused_read_buf,
     .write      = fused_write,
+    .write_buf  = fused_write_buf,
     .create     = fused_create,
     .mkdir      = fused_mkdir,
     .rmdir      = fused_rmdir,
-    .rename     = fused_rename,
-    .utimens    = fused_utimens,
     .unlink     = fused_unlink,
 };
 /**
@@ -31,6 +108,16 @@ static struct fuse_operations fused_oper = {
 int main(int argc, char *argv[]) {
     int ret;
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    /* Caching and storage options; libfuse applies the timeouts for this frontend */
+    if (fused_cache_parse_args(&args) != 0 || seg_parse_args(&args) != 0 ||
+        wb_parse_args(&args) != 0 || cold_parse_args(&args) != 0 ||
+        fused_cache_lib_args(&args) != 0)
+    {
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
     /* Run FUSE */
     ret = fuse_main(args.argc, args.argv, &fused_oper, NULL);
     
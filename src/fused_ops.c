@@ -4,7 +4,20 @@
  */
 
 #include "fused_fs.h"
+#include "fused_fdcache.h"
+#include "fused_wbuf.h"
+#include "fused_cache.h"
+#include "fused_itable.h"
+#include "fused_prefetch.h"
+#include "fused_segment.h"
+#include "fused_hotcache.h"
+#include "fused_io.h"
+#include "fused_stats.h"
+#include "fused_pathcache.h"
+#include "fused_crc.h"
+#include "fused_cold.h"
 #include <stdint.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
@@ -15,10 +28,27 @@
 /* Forward declarations of static helper functions */
 static void init_root_inode(void);
 static void split_path(const char *path, char *parent_path, char *child_name);
+static fused_inode_t *resolve_parent(const char *path, char *name);
+static int ensure_inode_chunk(uint32_t slot);
 static fused_inode_t *alloc_inode(void);
 static void free_inode(fused_inode_t *inode);
-static int dir_add_entry(fused_inode_t *dir, const char *name, fused_inode_t *child);
-static int dir_rm_entry(fused_inode_t *dir, const char *name, fused_inode_t *child);
+static void push_free_slot(uint32_t slot);
+static int load_inode_table(void);
+static uint32_t dir_name_hash(const char *name);
+static int dir_alloc(fused_inode_t *inode);
+static int dir_insert(fused_dir_t *d, const char *name, uint64_t ino);
+static void dir_free(fused_inode_t *inode);
+static int dir_index_find(const fused_dir_t *dir, const char *name, uint32_t hash,
+                          uint32_t *index_slot);
+static void dir_index_insert(fused_dir_t *dir, uint32_t entry_slot);
+static int dir_index_rebuild(fused_dir_t *dir, uint32_t slots);
+static void dir_index_install(fused_dir_t *dir, uint32_t *index, uint32_t slots);
+static void dir_compact_names(fused_dir_t *dir);
+static void dir_compact_entries(fused_dir_t *dir);
+static uint32_t dir_seek(const fused_dir_t *dir, off_t offset);
+static fused_inode_t *dir_lookup_locked(fused_inode_t *dir, const char *name);
+static int dir_add_locked(fused_inode_t *dir, const char *name, fused_inode_t *child);
+static int dir_rm_locked(fused_inode_t *dir, const char *name, fused_inode_t *child);
 fused_inode_t *lookup_inode(uint64_t ino);
 static void generate_backing_path(fused_inode_t *inode, uint64_t ino);
 fused_inode_t *path_to_inode(const char *path);
@@ -31,23 +61,127 @@ fused_state_t *g_state = NULL;
  */
 void *fused_init(struct fuse_conn_info *conn)
 {
-    (void)conn;
+    // Threads started before fuse_main daemonizes would not survive the fork
+    fused_log_init("fused");
 
-    // Allocate global state
+    if (fused_state_init(FUSED_BACKING_DIR) != 0)
+    {
+        return NULL;
+    }
+
+    // Splice read replies from backing files into /dev/fuse and write data
+    // from the request pipe into backing files when the kernel allows it
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE |
+                                   FUSE_CAP_SPLICE_READ);
+    fused_cache_conn_init(conn);
+
+    log_info("Filesystem initialized");
+    return g_state;
+}
+
+/**
+ * @brief Allocate global state, the backing directory and the root inode
+ * @return 0 on success, negative errno on failure
+ */
+int fused_state_init(const char *backing_dir)
+{
     g_state = calloc(1, sizeof(fused_state_t));
     if (!g_state)
     {
-        return NULL;
+        return -ENOMEM;
     }
 
-    snprintf(g_state->backing_dir, MAX_PATH, "/tmp/fused_backing");
-    mkdir(g_state->backing_dir, 0755);
+    if (fd_cache_init() != 0)
+    {
+        free(g_state);
+        g_state = NULL;
+        return -ENOMEM;
+    }
+    int rc = wb_init();
+    if (rc == 0)
+    {
+        rc = prefetch_init();
+        if (rc != 0)
+            wb_destroy();
+    }
+    if (rc == 0)
+    {
+        rc = hotcache_init();
+        if (rc != 0)
+        {
+            prefetch_destroy();
+            wb_destroy();
+        }
+    }
+    if (rc != 0)
+    {
+        fd_cache_destroy();
+        free(g_state);
+        g_state = NULL;
+        return rc;
+    }
+    pthread_mutex_init(&g_state->alloc_lock, NULL);
+    pthread_mutex_init(&g_state->rename_lock, NULL);
+    pathcache_init();
+
+    snprintf(g_state->backing_dir, MAX_PATH, "%s", backing_dir);
+    bool fresh = false;
+    rc = 0;
+    if (mkdir(g_state->backing_dir, 0755) != 0 && errno != EEXIST)
+    {
+        rc = -errno;
+    }
+    else
+    {
+        rc = itable_open(g_state->backing_dir, &fresh);
+        if (rc == 0)
+        {
+            rc = seg_open(g_state->backing_dir);
+            if (rc != 0)
+                itable_close();
+        }
+    }
+    if (rc != 0)
+    {
+        hotcache_destroy();
+        prefetch_destroy();
+        wb_destroy();
+        fd_cache_destroy();
+        pathcache_destroy();
+        pthread_mutex_destroy(&g_state->alloc_lock);
+        pthread_mutex_destroy(&g_state->rename_lock);
+        free(g_state);
+        g_state = NULL;
+        return rc;
+    }
 
-    // Create root directory as inode 1
-    init_root_inode();
+    // A new table starts with the root directory as inode 1; an existing
+    // one brings back the namespace the last run left
+    if (fresh)
+    {
+        init_root_inode();
+        rc = lookup_inode(FUSE_ROOT_ID) ? 0 : -ENOMEM;
+    }
+    else
+    {
+        rc = load_inode_table();
+    }
+    if (rc == 0)
+    {
+        // Segmented files get their extents and sizes back from the log
+        rc = seg_load();
+    }
+    if (rc == 0)
+    {
+        rc = cold_init();
+    }
+    if (rc != 0)
+    {
+        fused_state_destroy();
+        return rc;
+    }
 
-    log_message("Filesystem initialized");
-    return g_state;
+    return 0;
 }
 
 /**
@@ -55,15 +189,26 @@ void *fused_init(struct fuse_conn_info *conn)
  */
 static void init_root_inode(void)
 {
-    fused_inode_t *root = &g_state->inodes[0];
-    root->ino = FUSE_ROOT_ID;
+    // First allocation always lands in slot 0 with generation 0, i.e. ino 1
+    fused_inode_t *root = alloc_inode();
+    if (!root)
+    {
+        return;
+    }
     root->mode = S_IFDIR | 0755;
     root->uid = getuid();
     root->gid = getgid();
     root->size = 4096;
     root->atime = root->mtime = root->ctime = time(NULL);
-    root->n_children = 0;
-    g_state->n_inodes = 1;
+    if (dir_alloc(root) != 0)
+    {
+        free_inode(root);
+    }
+    else
+    {
+        itable_put(root, 0, "");
+    }
+    inode_unlock(root);
 }
 
 /**
@@ -76,96 +221,302 @@ void fused_destroy(void *private_data)
     if (!g_state)
         return;
 
-    log_message("Filesystem destroyed");
+    log_info("Filesystem destroyed");
+
+    fused_state_destroy();
+    fused_log_shutdown();
+}
+
+/**
+ * @brief Write out buffered appends, close the inode table and release the slab
+ * Backing files and the table stay behind for the next fused_state_init().
+ * Must only run once no other thread uses the filesystem.
+ */
+void fused_state_destroy(void)
+{
+    if (!g_state)
+        return;
+
+    wb_destroy();
+    prefetch_destroy();
+    seg_stop_compaction();
+    cold_stop();
 
-    // Cleanup backing files
-    for (int i = 0; i < g_state->n_inodes; i++)
+    for (uint32_t slot = 0; slot < g_state->n_slots; slot++)
+    {
+        fused_inode_t *inode = &g_state->inode_chunks[slot >> INODE_CHUNK_SHIFT]
+                                                     [slot & (INODE_CHUNK_SIZE - 1)];
+        if (inode->ino != 0 && inode->unlinked)
+        {
+            // Removed while the kernel still referenced it; nothing names it,
+            // and its records are garbage to the next scan
+            if (!inode->seg_map)
+                unlink(inode->backing_path);
+        }
+        else if (inode->ino != 0 && inode->wb_len > 0)
+        {
+            inode_rdlock(inode);
+            pthread_mutex_lock(&inode->append_lock);
+            if (wb_flush_locked(inode) != 0)
+            {
+                log_error("destroy: lost buffered appends of inode %lu", inode->ino);
+            }
+            pthread_mutex_unlock(&inode->append_lock);
+            inode_unlock(inode);
+        }
+        wb_discard(inode);
+        crc_discard(inode);
+        cold_discard(inode);
+        seg_detach(inode, false);
+        dir_free(inode);
+    }
+    crc_destroy();
+    cold_destroy();
+    seg_close();
+    hotcache_destroy();
+    fd_cache_destroy();
+    itable_close();
+
+    for (uint32_t i = 0; i < g_state->n_chunks; i++)
     {
-        if (g_state->inodes[i].backing_path[0] != '\0')
+        for (uint32_t j = 0; j < INODE_CHUNK_SIZE; j++)
         {
-            unlink(g_state->inodes[i].backing_path);
+            pthread_rwlock_destroy(&g_state->inode_chunks[i][j].lock);
+            pthread_mutex_destroy(&g_state->inode_chunks[i][j].append_lock);
         }
+        free(g_state->inode_chunks[i]);
     }
-
+    free(g_state->free_slots);
+    pathcache_destroy();
+    pthread_mutex_destroy(&g_state->alloc_lock);
+    pthread_mutex_destroy(&g_state->rename_lock);
     free(g_state);
     g_state = NULL;
 }
 
-
 /**
- * @brief Get file attributes
+ * @brief Read a numeric setting from the environment
+ * @param component log prefix of the module asking, for the warning
+ * @return the value, or fallback if unset or not a number
  */
-int fused_getattr(const char *path, struct stat *stbuf)
+size_t fused_env_size(const char *component, const char *name, size_t fallback)
 {
-    memset(stbuf, 0, sizeof(struct stat));
+    const char *value = getenv(name);
+    if (!value || value[0] == '\0')
+        return fallback;
 
-    log_message("getattr: %s", path);
+    char *end;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    if (*end != '\0')
+    {
+        log_warn("%s: ignoring invalid %s=%s", component, name, value);
+        return fallback;
+    }
+    return parsed;
+}
 
-    fused_inode_t *inode = path_to_inode(path);
-    if (!inode)
+void **slot_table_entry(slot_table_t *table, uint64_t ino, bool create)
+{
+    if (ino == 0)
+        return NULL;
+
+    uint32_t slot = (uint32_t)((ino & INODE_SLOT_MASK) - 1);
+    uint32_t chunk = slot >> INODE_CHUNK_SHIFT;
+    void **entries = __atomic_load_n(&table->chunks[chunk], __ATOMIC_ACQUIRE);
+    if (!entries && create)
     {
-        return -ENOENT;
+        pthread_mutex_lock(&table->lock);
+        entries = table->chunks[chunk];
+        if (!entries)
+        {
+            entries = calloc(INODE_CHUNK_SIZE, sizeof(*entries));
+            __atomic_store_n(&table->chunks[chunk], entries, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&table->lock);
+    }
+    return entries ? &entries[slot & (INODE_CHUNK_SIZE - 1)] : NULL;
+}
+
+void slot_table_destroy(slot_table_t *table)
+{
+    for (uint32_t i = 0; i < INODE_MAX_CHUNKS; i++)
+    {
+        free(table->chunks[i]);
+        table->chunks[i] = NULL;
+    }
+}
+
+static void *periodic_thread(void *arg)
+{
+    periodic_t *periodic = arg;
+
+    pthread_mutex_lock(&periodic->lock);
+    while (periodic->running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += periodic->interval_ms / 1000;
+        deadline.tv_nsec += (long)(periodic->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&periodic->wake, &periodic->lock, &deadline);
+        if (!periodic->running)
+            break;
+
+        pthread_mutex_unlock(&periodic->lock);
+        periodic->pass();
+        pthread_mutex_lock(&periodic->lock);
+    }
+    pthread_mutex_unlock(&periodic->lock);
+    return NULL;
+}
+
+/**
+ * @return 0, or negative errno if the thread could not be created
+ */
+int periodic_start(periodic_t *periodic)
+{
+    pthread_mutex_lock(&periodic->lock);
+    periodic->running = true;
+    int rc = pthread_create(&periodic->thread, NULL, periodic_thread, periodic);
+    if (rc != 0)
+        periodic->running = false;
+    pthread_mutex_unlock(&periodic->lock);
+    return -rc;
+}
+
+void periodic_stop(periodic_t *periodic)
+{
+    pthread_mutex_lock(&periodic->lock);
+    if (!periodic->running)
+    {
+        pthread_mutex_unlock(&periodic->lock);
+        return;
     }
+    periodic->running = false;
+    pthread_cond_signal(&periodic->wake);
+    pthread_mutex_unlock(&periodic->lock);
+
+    pthread_join(periodic->thread, NULL);
+}
+
+
+/* ============================================================================
+ * Inode-level operations
+ * Shared by the path-based frontend below and the low-level frontend in
+ * fused_ll_main.c, which already holds inode numbers and skips resolution.
+ * Each operation takes the locks it needs; callers hold none.
+ * ========================================================================== */
+
+void inode_rdlock(fused_inode_t *inode)
+{
+    pthread_rwlock_rdlock(&inode->lock);
+}
 
+void inode_wrlock(fused_inode_t *inode)
+{
+    pthread_rwlock_wrlock(&inode->lock);
+}
+
+void inode_unlock(fused_inode_t *inode)
+{
+    pthread_rwlock_unlock(&inode->lock);
+}
+
+/**
+ * @brief Fill a stat buffer from an inode
+ */
+void inode_stat(fused_inode_t *inode, struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+
+    inode_rdlock(inode);
+
+    off_t size = inode_size(inode);
     stbuf->st_ino = inode->ino;
     stbuf->st_mode = inode->mode;
     stbuf->st_nlink = S_ISDIR(inode->mode) ? 2 : 1;
     stbuf->st_uid = inode->uid;
     stbuf->st_gid = inode->gid;
-    stbuf->st_size = inode->size;
-    stbuf->st_atime = inode->atime;
-    stbuf->st_mtime = inode->mtime;
-    stbuf->st_ctime = inode->ctime;
+    stbuf->st_size = size;
+    stbuf->st_atime = INODE_LOAD(inode->atime);
+    stbuf->st_mtime = INODE_LOAD(inode->mtime);
+    stbuf->st_ctime = INODE_LOAD(inode->ctime);
 
     stbuf->st_blksize = 4096;
-    stbuf->st_blocks = (inode->size + 511) / 512;
+    stbuf->st_blocks = (size + 511) / 512;
 
-    return 0;
+    // Files with holes and compressed files report what the backing file
+    // really allocates; segmented files what their extents hold
+    struct stat backing;
+    if (inode->seg_map)
+    {
+        stbuf->st_blocks = (seg_bytes(inode) + 511) / 512;
+    }
+    else if ((INODE_LOAD(inode->sparse) || inode->compressed) &&
+             stat(inode->backing_path, &backing) == 0)
+    {
+        stbuf->st_blocks = backing.st_blocks;
+    }
+
+    inode_unlock(inode);
 }
 
 /**
- * @brief Read directory contents
+ * @brief List a directory from offset, with each child's attributes
+ * Offsets are entry cookies, so a listing resumed at the offset of its last
+ * entry neither repeats nor skips entries that stayed in the directory.
+ * "." and ".." carry only their type and inode number.
+ * @return 0 on success, -ENOTDIR or -ENOENT if the directory is gone
  */
-int fused_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                  off_t offset, struct fuse_file_info *fi)
+int inode_readdir(fused_inode_t *dir, off_t offset, inode_dir_filler_t fill, void *ctx)
 {
-    (void)offset;
-    (void)fi;
-
-    log_message("readdir: %s", path);
-
-    fused_inode_t *dir = path_to_inode(path);
-    if (!dir)
-    {
-        return -ENOENT;
-    }
     if (!S_ISDIR(dir->mode))
     {
         return -ENOTDIR;
     }
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
 
-    for (int i = 0; i < dir->n_children; i++)
+    uint64_t ino = INODE_LOAD(dir->ino);
+    inode_rdlock(dir);
+    const fused_dir_t *d = dir->dirents;
+    if (ino == 0 || dir->ino != ino || !d)
     {
-        filler(buf, dir->child_names[i], NULL, 0);
+        inode_unlock(dir);
+        return -ENOENT;
     }
 
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_ino = ino;
+    st.st_mode = S_IFDIR;
+    bool full = (offset < 1 && fill(ctx, ".", &st, 1) != 0) ||
+                (offset < 2 && fill(ctx, "..", &st, 2) != 0);
+
+    for (uint32_t i = dir_seek(d, offset); !full && i < d->n_used; i++)
+    {
+        const fused_dirent_t *entry = &d->entries[i];
+        // Children cannot be freed while the directory lock is held
+        fused_inode_t *child = entry->ino ? lookup_inode(entry->ino) : NULL;
+        if (!child)
+            continue;
+
+        inode_stat(child, &st);
+        full = fill(ctx, dirent_name(d, entry), &st, (off_t)entry->cookie) != 0;
+    }
+    inode_unlock(dir);
     return 0;
 }
 
 /**
- * @brief Open a file
+ * @brief Open a regular file, enforcing append-only writes
+ * Pins the backing descriptor until inode_release() and sets the kernel
+ * caching flags in fi.
  */
-int fused_open(const char *path, struct fuse_file_info *fi)
+int inode_open(fused_inode_t *inode, struct fuse_file_info *fi)
 {
-    log_message("open: %s (flags: 0x%x)", path, fi->flags);
-
-    fused_inode_t *inode = path_to_inode(path);
-    if (!inode)
-    {
-        return -ENOENT;
-    }
     if (S_ISDIR(inode->mode))
     {
         return -EISDIR;
@@ -176,715 +527,2776 @@ int fused_open(const char *path, struct fuse_file_info *fi)
     {
         if (!(fi->flags & O_APPEND))
         {
-            log_message("open: REJECTED non-append write on %s", path);
+            log_ratelimited(FUSED_LOG_WARN, 1000,
+                            "open: REJECTED non-append write on inode %lu", inode->ino);
             return -EPERM;
         }
     }
 
-    fi->fh = inode->ino;
+    inode_rdlock(inode);
+    if (inode->ino == 0)
+    {
+        inode_unlock(inode);
+        return -ENOENT;
+    }
 
-    inode->atime = time(NULL);
+    // Keep the backing descriptor pinned until release
+    if (!inode->seg_map && fd_cache_get(inode->ino, inode->backing_path, 0) < 0)
+    {
+        inode_unlock(inode);
+        return -EIO;
+    }
+
+    INODE_STORE(inode->atime, time(NULL));
+    inode_open_cache(inode, fi);
+    inode_unlock(inode);
 
     return 0;
 }
 
 /**
- * @brief Read data from a file
+ * @brief Count a new handle and choose its kernel caching mode
+ * Read-only handles of a file nobody is writing keep the page cache across
+ * opens; appended data never changes, so only growth has to invalidate it.
+ * Called by inode_open() and, for the handle a create returns, by the
+ * frontends; inode_release() must get the same flags.
  */
-int fused_read(const char *path, char *buf, size_t size, off_t offset,
-               struct fuse_file_info *fi)
+void inode_open_cache(fused_inode_t *inode, struct fuse_file_info *fi)
 {
-    (void)path; // Use inode from file handle instead
-
-    log_message("read: inode=%lu, size=%zu, offset=%ld", fi->fh, size, offset);
-
-    // Get inode directly from file handle (set in fused_open)
-    fused_inode_t *inode = lookup_inode(fi->fh);
-    if (!inode)
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
     {
-        log_message("read: inode %lu not found", fi->fh);
-        return -ENOENT;
+        __atomic_add_fetch(&inode->writers, 1, __ATOMIC_SEQ_CST);
+        fi->keep_cache = 0;
+        fi->direct_io = g_cache_policy.direct_io_writes;
+        return;
     }
 
-    // Check if offset is beyond file size
-    if (offset >= inode->size)
+    fi->direct_io = 0;
+    fi->keep_cache = 0;
+    if (g_cache_policy.keep_cache)
     {
-        return 0;
+        // Publish kcached before checking for writers: a writer that opens
+        // concurrently then sees it on its next append and invalidates
+        __atomic_store_n(&inode->kcached, true, __ATOMIC_SEQ_CST);
+        fi->keep_cache = __atomic_load_n(&inode->writers, __ATOMIC_SEQ_CST) == 0;
     }
+}
 
-    // Calculate how much to read
-    size_t to_read = size;
-    if (offset + to_read > (size_t)inode->size)
+/**
+ * @brief Release an open file handle
+ * Writes out buffered appends, then unpins the backing descriptor.
+ * @param flags open flags of the handle, as passed to inode_open_cache()
+ */
+void inode_release(uint64_t ino, int flags)
+{
+    fused_inode_t *inode = lookup_inode(ino);
+    if (inode)
     {
-        to_read = inode->size - offset;
+        inode_flush(inode);
+        if ((flags & O_ACCMODE) != O_RDONLY && INODE_LOAD(inode->ino) == ino)
+        {
+            __atomic_sub_fetch(&inode->writers, 1, __ATOMIC_SEQ_CST);
+        }
     }
+    fd_cache_put(ino);
+}
+
+/**
+ * @brief Make sure a read ending at end finds its data in the backing file
+ * @pre inode is share-locked
+ * @return 0, or negative errno
+ */
+static int flush_for_read(fused_inode_t *inode, off_t end)
+{
+    if (end <= INODE_LOAD(inode->durable))
+        return 0;
 
-    // Open the backing file for reading
-    FILE *fp = fopen(inode->backing_path, "rb"); // Note: FILE will depend on how create is made
-    if (!fp)
+    pthread_mutex_lock(&inode->append_lock);
+    int rc = wb_flush_locked(inode);
+    pthread_mutex_unlock(&inode->append_lock);
+    return rc;
+}
+
+/**
+ * @brief Read file data from its segments, compressed frames or backing file
+ * @pre inode is share-locked and the range is below durable
+ * @return bytes read (fewer only if the backing file is short), or negative errno
+ */
+static ssize_t read_stored(fused_inode_t *inode, char *buf, size_t size, off_t offset)
+{
+    if (inode->seg_map || inode->compressed)
     {
-        log_message("read: failed to open backing file %s", inode->backing_path);
-        return -EIO;
+        int rc = inode->seg_map ? seg_read(inode, buf, size, offset)
+                                : cold_read(inode, buf, size, offset);
+        return rc == 0 ? (ssize_t)size : rc;
     }
 
-    // Seek to offset and read
-    if (fseek(fp, offset, SEEK_SET) != 0)
+    int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+    if (fd < 0)
     {
-        fclose(fp);
+        log_error("read: failed to open backing file %s", inode->backing_path);
         return -EIO;
     }
 
-    size_t bytes_read = fread(buf, 1, to_read, fp);
-    fclose(fp);
-
-    // Update access time
-    inode->atime = time(NULL);
-
-    log_message("read: successfully read %zu bytes from inode %lu", bytes_read, fi->fh);
-
+    // Positional read on the cached descriptor; loops only on short reads
+    size_t bytes_read = 0;
+    while (bytes_read < size)
+    {
+        ssize_t n = io_pread(fd, buf + bytes_read, size - bytes_read, offset + bytes_read);
+        if (n < 0)
+        {
+            fd_cache_put(inode->ino);
+            return -EIO;
+        }
+        if (n == 0)
+            break;
+        bytes_read += n;
+    }
+    fd_cache_put(inode->ino);
     return bytes_read;
 }
 
 /**
- * @brief Write data to a file
+ * @brief Serve a read from the hot cache, or read whole blocks and cache them
+ * A range that does not start and end on block boundaries (or at EOF) is
+ * widened to them through a bounce buffer.
+ * @pre inode is share-locked and the range is below its size
+ * @return bytes read, or negative errno
  */
-int fused_write(const char *path, const char *buf, size_t size, off_t offset,
-                struct fuse_file_info *fi)
+static ssize_t read_cached(fused_inode_t *inode, char *buf, size_t size, off_t offset)
 {
-    (void)path; // Use inode from file handle instead
+    if (hotcache_read(inode->ino, buf, size, offset) == 0)
+        return size;
 
-    log_message("write: inode=%lu, size=%zu, offset=%ld", fi->fh, size, offset);
+    off_t end = offset + (off_t)size;
+    if (flush_for_read(inode, end) != 0)
+        return -EIO;
 
-    // Get inode directly from file handle (set in fused_open)
-    fused_inode_t *inode = lookup_inode(fi->fh);
-    if (!inode)
+    // Past the request only what has left the write-back buffer is stored
+    off_t durable = INODE_LOAD(inode->durable);
+    off_t start = offset - offset % HC_BLOCK_SIZE;
+    off_t block_end = (end + HC_BLOCK_SIZE - 1) / HC_BLOCK_SIZE * HC_BLOCK_SIZE;
+    if (block_end > durable)
+        block_end = durable > end ? durable : end;
+    char *bounce = start == offset && block_end == end ? buf : malloc(block_end - start);
+    if (!bounce)
+        return read_stored(inode, buf, size, offset);
+
+    ssize_t n = read_stored(inode, bounce, block_end - start, start);
+    if (n >= 0)
     {
-        log_message("write: inode %lu not found", fi->fh);
-        return -ENOENT;
+        hotcache_insert(inode->ino, bounce, n, start);
+        n -= offset - start;
+        if (n < 0)
+            n = 0;
+        if ((size_t)n > size)
+            n = size;
+        if (bounce != buf)
+            memcpy(buf, bounce + (offset - start), n);
     }
+    if (bounce != buf)
+        free(bounce);
+    return n;
+}
 
-    // Enforce append-only: offset must be at end of file
-    if (offset < inode->size)
+/**
+ * @brief Read data from a regular file
+ * Runs under the shared inode lock, so reads of one file proceed in
+ * parallel with each other and with an append in progress.
+ * @return bytes read, or negative errno
+ */
+int inode_read(fused_inode_t *inode, char *buf, size_t size, off_t offset)
+{
+    inode_rdlock(inode);
+    if (inode->ino == 0)
     {
-        log_message("write: REJECTED - append-only mode, offset=%ld < size=%ld",
-                    offset, inode->size);
-        return -EPERM;
+        inode_unlock(inode);
+        return -ENOENT;
     }
 
-    // Open the backing file for writing (append mode)
-    FILE *fp = fopen(inode->backing_path, "ab"); // Note: FILE will depend on how create is made
-    if (!fp)
+    off_t file_size = inode_size(inode);
+
+    // Check if offset is beyond file size
+    if (offset >= file_size)
     {
-        log_message("write: failed to open backing file %s", inode->backing_path);
-        return -EIO;
+        inode_unlock(inode);
+        return 0;
     }
 
-    // If there's a gap between current size and offset, fill with zeros
-    if (offset > inode->size)
+    // Calculate how much to read
+    size_t to_read = size;
+    if (offset + to_read > (size_t)file_size)
     {
-        size_t gap = offset - inode->size;
-        char zero_buf[4096];
-        memset(zero_buf, 0, sizeof(zero_buf));
-
-        while (gap > 0)
-        {
-            size_t write_size = (gap > sizeof(zero_buf)) ? sizeof(zero_buf) : gap;
-            fwrite(zero_buf, 1, write_size, fp);
-            gap -= write_size;
-        }
+        to_read = file_size - offset;
     }
 
-    // Write the data
-    size_t bytes_written = fwrite(buf, 1, size, fp);
-    fclose(fp);
-
-    if (bytes_written != size)
+    ssize_t bytes_read;
+    if (hotcache_enabled())
+        bytes_read = read_cached(inode, buf, to_read, offset);
+    else if (flush_for_read(inode, offset + to_read) != 0)
+        // Appends still in the write-back buffer must reach the backing file
+        bytes_read = -EIO;
+    else
+        bytes_read = read_stored(inode, buf, to_read, offset);
+    if (bytes_read < 0)
     {
-        log_message("write: partial write - wrote %zu of %zu bytes", bytes_written, size);
-        return -EIO;
+        inode_unlock(inode);
+        return bytes_read;
     }
 
-    // Update inode metadata
-    inode->size = offset + bytes_written;
-    inode->mtime = time(NULL);
-    inode->ctime = time(NULL);
+    // Update access time
+    INODE_STORE(inode->atime, time(NULL));
 
-    log_message("write: successfully wrote %zu bytes to inode %lu (new size: %ld)",
-                bytes_written, fi->fh, inode->size);
+    log_debug("read: successfully read %zd bytes from inode %lu", bytes_read, inode->ino);
 
-    return bytes_written;
+    uint64_t ino = inode->ino;
+    bool plain = !inode->seg_map && !inode->compressed;
+    inode_unlock(inode);
+    if (plain)
+        prefetch_note_read(ino, offset, bytes_read, file_size);
+    return bytes_read;
 }
 
 /**
- * @brief Create a new file
+ * @brief Locate file data for a zero-copy read
+ * Clamps the request to the published size and returns the backing
+ * descriptor instead of copying. The caller's open handle keeps the
+ * descriptor pinned until release, and appended bytes never change, so
+ * the range stays valid after the inode lock is dropped.
+ * @param fd receives the backing descriptor when data is available
+ * @return bytes available at offset (0 at EOF), or negative errno;
+ *         -EOPNOTSUPP when the data is to be copied instead: segmented
+ *         files have no single descriptor, compressed files have to be
+ *         decoded, and hot data is in memory
  */
-int fused_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+ssize_t inode_read_fd(fused_inode_t *inode, size_t size, off_t offset, int *fd)
 {
-    fused_inode_t *existing = path_to_inode(path);
-    if (existing)
+    inode_rdlock(inode);
+    if (inode->ino == 0)
     {
-        return -EEXIST;
+        inode_unlock(inode);
+        return -ENOENT;
     }
-    char parent_path[MAX_PATH];
-    char child_name[MAX_NAME];
-    split_path(path, parent_path, child_name);
-
-    fused_inode_t *parent = path_to_inode(parent_path);
-
-    if (!parent || !S_ISDIR(parent->mode))
+    if (inode->seg_map || inode->compressed)
     {
-        return -ENOENT;
+        inode_unlock(inode);
+        return -EOPNOTSUPP;
     }
-    fused_inode_t *inode = alloc_inode();
-    if (!inode)
+
+    off_t file_size = inode_size(inode);
+    if (offset >= file_size)
     {
-        return -ENOMEM;
+        inode_unlock(inode);
+        return 0;
     }
-    // overwrite file type as 'regular'
-    inode->mode = S_IFREG | (mode & 0777);
-    struct fuse_context *ctx = fuse_get_context();
-    if (ctx)
+    if (offset + size > (size_t)file_size)
     {
-        inode->uid = ctx->uid;
-        inode->gid = ctx->gid;
+        size = file_size - offset;
     }
-    else
+    if (hotcache_contains(inode->ino, size, offset))
     {
-        inode->uid = getuid();
-        inode->gid = getgid();
+        inode_unlock(inode);
+        return -EOPNOTSUPP;
     }
-    inode->size = 0;
 
-    // accessed, modified, and created now
-    inode->atime = time(NULL);
-    inode->mtime = inode->atime;
-    inode->ctime = inode->atime;
+    if (flush_for_read(inode, offset + size) != 0)
+    {
+        inode_unlock(inode);
+        return -EIO;
+    }
 
-    // create backing file
-    FILE *fp = fopen(inode->backing_path, "wb");
-    if (!fp)
+    int backing_fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+    if (backing_fd < 0)
     {
-        free_inode(inode);
+        log_error("read_buf: failed to open backing file %s", inode->backing_path);
+        inode_unlock(inode);
         return -EIO;
     }
-    fclose(fp);
+    fd_cache_put(inode->ino);
 
-    int rc = dir_add_entry(parent, child_name, inode);
-    if (rc != 0)
+    INODE_STORE(inode->atime, time(NULL));
+    uint64_t ino = inode->ino;
+    inode_unlock(inode);
+    prefetch_note_read(ino, offset, size, file_size);
+
+    *fd = backing_fd;
+    return size;
+}
+
+/**
+ * @brief Grow the backing file to offset for a write past EOF
+ * The gap becomes a hole: extending the file allocates nothing and reads
+ * back as zeros, whatever the size of the gap.
+ * @pre append_lock is held and nothing is buffered
+ */
+static int extend_backing(fused_inode_t *inode, off_t offset)
+{
+    if (inode->seg_map)
     {
-        free_inode(inode);
-        return rc;
+        // No extent covers the gap, which is all a hole is in a segment
+        INODE_STORE(inode->durable, offset);
+        return 0;
     }
 
-    fi->fh = inode->ino;
+    int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+    if (fd < 0)
+    {
+        log_error("write: failed to open backing file %s", inode->backing_path);
+        return -EIO;
+    }
 
-    return 0;
+    int rc = 0;
+    if (ftruncate(fd, offset) != 0)
+    {
+        rc = -errno;
+        log_error("write: failed to extend %s to %ld: %s", inode->backing_path,
+                  offset, strerror(-rc));
+    }
+    fd_cache_put(inode->ino);
+
+    if (rc == 0)
+    {
+        INODE_STORE(inode->durable, offset);
+        INODE_STORE(inode->sparse, true);
+    }
+    return rc;
 }
 
 /**
- * @brief Update file timestamps (utimens)
+ * @brief Start an append: lock the inode, enforce append-only, open any gap
+ * A compressed file is written back out in plain form first.
+ * On success the inode is share-locked and its append lock is held;
+ * finish with append_end().
+ * @return 0, or negative errno with nothing held
  */
-int fused_utimens(const char *path, const struct timespec tv[2])
+static int append_begin(fused_inode_t *inode, off_t offset)
 {
-    log_message("utimens: %s", path);
-    
-    fused_inode_t *inode = path_to_inode(path);
-    if (!inode)
+    for (;;)
     {
+        int rc = cold_thaw(inode);
+        if (rc != 0)
+            return rc;
+        inode_rdlock(inode);
+        if (!inode->compressed)
+            break;
+        // Compressed again in between; only possible without an open handle
+        inode_unlock(inode);
+    }
+    if (inode->ino == 0)
+    {
+        inode_unlock(inode);
         return -ENOENT;
     }
-    
-    // Update access time (tv[0])
-    if (tv[0].tv_nsec == UTIME_NOW)
+    pthread_mutex_lock(&inode->append_lock);
+
+    off_t file_size = inode_size(inode);
+
+    // Enforce append-only: offset must be at end of file
+    if (offset < file_size)
     {
-        inode->atime = time(NULL);
+        log_ratelimited(FUSED_LOG_WARN, 1000,
+                        "write: REJECTED - append-only mode, offset=%ld < size=%ld",
+                        offset, file_size);
+        pthread_mutex_unlock(&inode->append_lock);
+        inode_unlock(inode);
+        return -EPERM;
     }
-    else if (tv[0].tv_nsec != UTIME_OMIT)
+
+    if (offset > file_size)
     {
-        inode->atime = tv[0].tv_sec;
+        // Buffered bytes belong before the hole
+        int rc = wb_flush_locked(inode);
+        if (rc == 0)
+            rc = extend_backing(inode, offset);
+        if (rc != 0)
+        {
+            pthread_mutex_unlock(&inode->append_lock);
+            inode_unlock(inode);
+            return rc;
+        }
     }
-    
-    // Update modification time (tv[1])
-    if (tv[1].tv_nsec == UTIME_NOW)
+
+    return 0;
+}
+
+/**
+ * @brief Finish an append started with append_begin()
+ * Publishes the new size, once the data is buffered or in the backing
+ * file, and drops the locks.
+ * @param written bytes appended at offset, 0 if the append failed
+ */
+static void append_end(fused_inode_t *inode, off_t offset, size_t written)
+{
+    uint64_t ino = inode->ino;
+    bool invalidate = false;
+    if (written > 0)
     {
-        inode->mtime = time(NULL);
+        time_t now = time(NULL);
+        INODE_STORE(inode->size, offset + (off_t)written);
+        INODE_STORE(inode->mtime, now);
+        INODE_STORE(inode->ctime, now);
+        invalidate = __atomic_load_n(&inode->kcached, __ATOMIC_SEQ_CST) &&
+                     __atomic_exchange_n(&inode->kcached, false, __ATOMIC_SEQ_CST);
+
+        log_debug("write: successfully wrote %zu bytes to inode %lu (new size: %ld)",
+                  written, ino, offset + (off_t)written);
     }
-    else if (tv[1].tv_nsec != UTIME_OMIT)
+
+    pthread_mutex_unlock(&inode->append_lock);
+    inode_unlock(inode);
+
+    // A reader may hold the old size and tail page with keep_cache; tell the
+    // kernel once per growth, outside our locks
+    if (invalidate)
     {
-        inode->mtime = tv[1].tv_sec;
+        fused_cache_invalidate(ino);
     }
-    
-    // Always update ctime when any metadata changes
-    inode->ctime = time(NULL);
-    
-    log_message("utimens: updated timestamps for %s (inode %lu)", path, inode->ino);
-    return 0;
 }
 
+/**
+ * @brief Pin the backing descriptor for a write that bypasses the buffer
+ * @pre append_begin() succeeded and wb_reserve() returned no space, so
+ *      nothing is buffered and durable equals offset
+ */
+static int append_fd(fused_inode_t *inode)
+{
+    int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+    if (fd < 0)
+    {
+        log_error("write: failed to open backing file %s", inode->backing_path);
+        return -EIO;
+    }
+    return fd;
+}
 
 /**
- * @brief Create a directory
+ * @brief Length of the head of a write that resends bytes the file holds
+ * With the kernel's writeback cache, a page that was written back while
+ * partly filled is sent again from its start once more of it is written.
+ * Those bytes must be the stored ones; changing them is still refused.
+ * @return bytes to skip, or negative errno
  */
-int fused_mkdir(const char *path, mode_t mode)
+static ssize_t resent_head(fused_inode_t *inode, const char *buf, size_t size, off_t offset)
 {
-    log_message("mkdir: %s", path);
+    off_t file_size = inode_size(inode);
+    if (!g_cache_policy.writeback_cache || offset >= file_size)
+        return 0;
 
-    // Check if directory already exists
-    fused_inode_t *existing = path_to_inode(path);
-    if (existing)
+    size_t len = (size_t)(file_size - offset) < size ? (size_t)(file_size - offset) : size;
+    char stored[4096];
+    for (size_t done = 0; done < len;)
     {
-        return -EEXIST;
+        size_t n = len - done < sizeof(stored) ? len - done : sizeof(stored);
+        int got = inode_read(inode, stored, n, offset + (off_t)done);
+        if (got < 0)
+            return got;
+        if ((size_t)got != n || memcmp(stored, buf + done, n) != 0)
+        {
+            log_ratelimited(FUSED_LOG_WARN, 1000,
+                            "write: REJECTED - rewrite changes stored data at offset %ld",
+                            (long)(offset + done));
+            return -EPERM;
+        }
+        done += n;
     }
+    return len;
+}
 
-    // Split path into parent and directory name
-    char parent_path[MAX_PATH];
-    char dir_name[MAX_NAME];
-    split_path(path, parent_path, dir_name);
+/**
+ * @brief Append data to a regular file
+ * Appenders are serialized by the inode's append lock; the new size is
+ * published only after the data is buffered or in the backing file.
+ * Small appends are coalesced in the write-back buffer.
+ * @return bytes written, or negative errno
+ */
+int inode_write(fused_inode_t *inode, const char *buf, size_t size, off_t offset)
+{
+    ssize_t resent = resent_head(inode, buf, size, offset);
+    if (resent != 0)
+    {
+        int rc = resent > 0 && (size_t)resent < size
+                     ? inode_write(inode, buf + resent, size - resent, offset + resent)
+                     : (int)resent;
+        return rc < 0 ? rc : (int)size;
+    }
 
-    // Get parent directory
-    fused_inode_t *parent = path_to_inode(parent_path);
-    if (!parent || !S_ISDIR(parent->mode))
+    int rc = append_begin(inode, offset);
+    if (rc != 0)
     {
-        return -ENOENT;
+        return rc;
     }
 
-    // Allocate new inode for directory
-    fused_inode_t *inode = alloc_inode();
-    if (!inode)
+    char *dst;
+    rc = wb_reserve(inode, size, &dst);
+    if (rc != 0)
     {
-        return -ENOMEM;
+        append_end(inode, offset, 0);
+        return rc;
+    }
+    if (dst)
+    {
+        memcpy(dst, buf, size);
+        wb_commit(inode, size);
+        crc_note_append(inode, buf, size, offset);
+        append_end(inode, offset, size);
+        return size;
     }
 
-    // Initialize directory inode
-    inode->mode = S_IFDIR | (mode & 0777);
-    struct fuse_context *ctx = fuse_get_context();
-    if (ctx)
+    if (inode->seg_map)
     {
-        inode->uid = ctx->uid;
-        inode->gid = ctx->gid;
+        rc = seg_append(inode, buf, size, offset);
+        if (rc == 0)
+        {
+            INODE_STORE(inode->durable, offset + (off_t)size);
+            crc_note_append(inode, buf, size, offset);
+        }
+        append_end(inode, offset, rc == 0 ? size : 0);
+        return rc == 0 ? (int)size : rc;
     }
-    else
+
+    int fd = append_fd(inode);
+    if (fd < 0)
     {
-        inode->uid = getuid();
-        inode->gid = getgid();
+        append_end(inode, offset, 0);
+        return fd;
+    }
+
+    // Write the data at the requested (end-of-file) offset
+    size_t bytes_written = 0;
+    while (bytes_written < size)
+    {
+        ssize_t n = io_pwrite(fd, buf + bytes_written, size - bytes_written,
+                              offset + bytes_written);
+        if (n <= 0)
+            break;
+        bytes_written += n;
+    }
+    fd_cache_put(inode->ino);
+
+    if (bytes_written != size)
+    {
+        log_warn("write: partial write - wrote %zu of %zu bytes", bytes_written, size);
+        append_end(inode, offset, 0);
+        return -EIO;
+    }
+
+    INODE_STORE(inode->durable, offset + (off_t)bytes_written);
+    crc_note_append(inode, buf, bytes_written, offset);
+    append_end(inode, offset, bytes_written);
+    return bytes_written;
+}
+
+/**
+ * @brief Append a FUSE buffer vector to a regular file
+ * Small appends are copied into the write-back buffer. Larger ones are
+ * copied with fuse_buf_copy() straight into the backing descriptor, so
+ * data arriving as a pipe from /dev/fuse is spliced without passing
+ * through user space. Segmented files take the data from memory, so those
+ * appends are staged in a temporary buffer.
+ * @return bytes written, or negative errno
+ */
+int inode_write_buf(fused_inode_t *inode, struct fuse_bufvec *bufv, off_t offset)
+{
+    size_t size = fuse_buf_size(bufv);
+
+    if (g_cache_policy.writeback_cache && offset < inode_size(inode))
+    {
+        // A page resent by the writeback cache: compare its head from memory
+        char *mem = malloc(size ? size : 1);
+        if (!mem)
+            return -ENOMEM;
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+        dst.buf[0].mem = mem;
+        ssize_t n = fuse_buf_copy(&dst, bufv, 0);
+        int rc = n == (ssize_t)size ? inode_write(inode, mem, size, offset)
+                                    : n < 0 ? (int)n : -EIO;
+        free(mem);
+        return rc;
     }
-    inode->size = 4096;
-    inode->atime = time(NULL);
-    inode->mtime = inode->atime;
-    inode->ctime = inode->atime;
-    inode->n_children = 0;
 
-    // Add directory entry to parent
-    int rc = dir_add_entry(parent, dir_name, inode);
+    int rc = append_begin(inode, offset);
     if (rc != 0)
     {
-        free_inode(inode);
         return rc;
     }
 
-    log_message("mkdir: created %s (inode %lu)", path, inode->ino);
-    return 0;
+    char *mem;
+    rc = wb_reserve(inode, size, &mem);
+    if (rc != 0)
+    {
+        append_end(inode, offset, 0);
+        return rc;
+    }
+
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    int fd = -1;
+    char *staged = NULL;
+    if (!mem && inode->seg_map)
+    {
+        mem = staged = malloc(size);
+        if (!staged)
+        {
+            append_end(inode, offset, 0);
+            return -ENOMEM;
+        }
+    }
+    if (mem)
+    {
+        dst.buf[0].mem = mem;
+    }
+    else
+    {
+        fd = append_fd(inode);
+        if (fd < 0)
+        {
+            append_end(inode, offset, 0);
+            return fd;
+        }
+        dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        dst.buf[0].fd = fd;
+        dst.buf[0].pos = offset;
+    }
+
+    ssize_t n = fuse_buf_copy(&dst, bufv, FUSE_BUF_SPLICE_NONBLOCK);
+    if (fd >= 0)
+        fd_cache_put(inode->ino);
+    if (n < 0 || (size_t)n != size)
+    {
+        log_warn("write_buf: partial write - wrote %zd of %zu bytes", n, size);
+        free(staged);
+        append_end(inode, offset, 0);
+        return n < 0 ? (int)n : -EIO;
+    }
+
+    if (staged)
+    {
+        rc = seg_append(inode, staged, n, offset);
+        if (rc == 0)
+            crc_note_append(inode, staged, n, offset);
+        free(staged);
+        if (rc != 0)
+        {
+            append_end(inode, offset, 0);
+            return rc;
+        }
+        INODE_STORE(inode->durable, offset + (off_t)n);
+    }
+    else if (mem)
+    {
+        wb_commit(inode, n);
+        crc_note_append(inode, mem, n, offset);
+    }
+    else
+    {
+        // Spliced data never reached memory; its blocks are summed when asked for
+        INODE_STORE(inode->durable, offset + (off_t)n);
+    }
+    append_end(inode, offset, n);
+    return n;
 }
 
 /**
- * @brief Remove a directory
- * @pre directory is empty
+ * @brief Write out an inode's buffered appends
+ * @return 0, or negative errno
  */
-int fused_rmdir(const char *path)
+int inode_flush(fused_inode_t *inode)
 {
-    log_message("rmdir: %s", path);
+    inode_rdlock(inode);
+    pthread_mutex_lock(&inode->append_lock);
+    int rc = inode->ino != 0 ? wb_flush_locked(inode) : -ENOENT;
+    pthread_mutex_unlock(&inode->append_lock);
+    inode_unlock(inode);
+    return rc;
+}
 
-    if (strcmp(path, "/") == 0)
-        return -EBUSY;
+/**
+ * @brief Bring a block's checksum up to block_end from the stored bytes
+ * @pre the inode is share-locked and its append lock is held
+ * @param stored scratch block, allocated on first use
+ */
+static int crc_catch_up(fused_inode_t *inode, crc_block_t *block, off_t start,
+                        off_t block_end, char **stored)
+{
+    if (block_end > INODE_LOAD(inode->durable))
+    {
+        int rc = wb_flush_locked(inode);
+        if (rc != 0)
+            return rc;
+    }
+    if (!*stored && !(*stored = malloc(CRC_BLOCK_SIZE)))
+        return -ENOMEM;
 
-    // find the target inode
-    fused_inode_t *inode = path_to_inode(path);
-    if (!inode)
-        return -ENOENT;
-    if (!S_ISDIR(inode->mode))
-        return -ENOTDIR;
-    if (inode->n_children > 0)
-        return -ENOTEMPTY;
+    off_t from = start + block->len;
+    ssize_t n = read_stored(inode, *stored, block_end - from, from);
+    if (n < 0)
+        return n;
+    if (n != block_end - from)
+        return -EIO;
+    block->crc = crc32c(block->crc, *stored, n);
+    block->len += n;
+    return 0;
+}
 
-    // find the parent to remove the reference
-    char path_copy[MAX_PATH];
-    strncpy(path_copy, path, MAX_PATH - 1);
-    path_copy[MAX_PATH - 1] = '\0';
-    char *last_slash = strrchr(path_copy, '/');
+/**
+ * @brief Checksums of the blocks that a read from offset to *end returns
+ * Blocks left behind by appends are summed from the stored bytes first.
+ * @param offset start of the read, a multiple of CRC_BLOCK_SIZE
+ * @param end in: end of the read; out: cut to the file size. Bytes below
+ *        it never change, so a read up to *end matches the checksums.
+ * @return checksums stored, at most max: one per CRC_BLOCK_SIZE from
+ *         offset, the last one partial only when *end is the file size;
+ *         or negative errno
+ */
+int inode_block_crcs(fused_inode_t *inode, off_t offset, off_t *end, uint32_t *crcs,
+                     size_t max)
+{
+    if (offset < 0 || offset % CRC_BLOCK_SIZE != 0)
+        return -EINVAL;
 
-    char *parent_path = (last_slash == path_copy) ? "/" : path_copy;
-    if (last_slash != path_copy)
-        *last_slash = '\0';
+    inode_rdlock(inode);
+    if (inode->ino == 0 || !S_ISREG(inode->mode))
+    {
+        int rc = inode->ino == 0 ? -ENOENT : -EISDIR;
+        inode_unlock(inode);
+        return rc;
+    }
+    pthread_mutex_lock(&inode->append_lock);
+
+    off_t size = inode_size(inode);
+    if (*end > size)
+        *end = size;
+
+    char *stored = NULL;
+    int n = 0;
+    crc_block_t *blocks = crc_reserve(inode, size);
+    int rc = blocks ? 0 : -ENOMEM;
+    for (off_t start = offset; rc == 0 && start < *end && (size_t)n < max;
+         start += CRC_BLOCK_SIZE)
+    {
+        // A block the read returns only part of cannot be checked
+        off_t block_end = start + CRC_BLOCK_SIZE < size ? start + CRC_BLOCK_SIZE : size;
+        if (block_end > *end)
+            break;
 
-    char *dir_name = last_slash + 1;
+        crc_block_t *block = &blocks[start / CRC_BLOCK_SIZE];
+        if (block->len < block_end - start)
+            rc = crc_catch_up(inode, block, start, block_end, &stored);
+        if (rc == 0)
+            crcs[n++] = block->crc;
+    }
 
-    fused_inode_t *parent = path_to_inode(parent_path);
-    if (!parent)
-        return -ENOENT;
+    pthread_mutex_unlock(&inode->append_lock);
+    inode_unlock(inode);
+    free(stored);
+    return rc != 0 ? rc : n;
+}
+
+/**
+ * @brief Write out buffered appends and sync the backing file
+ * @param datasync only sync file data, not metadata
+ * @return 0, or negative errno
+ */
+int inode_fsync(fused_inode_t *inode, int datasync)
+{
+    inode_rdlock(inode);
+    pthread_mutex_lock(&inode->append_lock);
 
-    // remove the name from parent's child_names array
-    bool found = false;
-    for (int i = 0; i < parent->n_children; i++)
+    int rc = inode->ino != 0 ? wb_flush_locked(inode) : -ENOENT;
+    if (rc == 0 && inode->seg_map)
+    {
+        rc = seg_sync(inode);
+    }
+    else if (rc == 0)
     {
-        if (strcmp(parent->child_names[i], dir_name) == 0)
+        int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+        if (fd < 0)
         {
-            for (int j = i; j < parent->n_children - 1; j++)
-            {
-                strncpy(parent->child_names[j],
-                        parent->child_names[j + 1],
-                        MAX_NAME);
+            rc = -EIO;
+        }
+        else
+        {
+            rc = io_fsync(fd, datasync);
+            fd_cache_put(inode->ino);
+        }
+    }
+    if (rc == 0)
+    {
+        // The data is only reachable through the file's and its ancestors' records
+        rc = itable_sync(inode->ino);
+    }
 
-                parent->child_inodes[j] =
-                    parent->child_inodes[j + 1];
-            }
+    pthread_mutex_unlock(&inode->append_lock);
+    inode_unlock(inode);
+    return rc;
+}
 
-            parent->n_children--;
-            found = true;
-            break;
+/**
+ * @brief Check that a directory inode is still live and holds a directory
+ * @pre dir is locked
+ */
+static int check_dir_locked(const fused_inode_t *dir)
+{
+    if (dir->ino == 0)
+    {
+        return -ENOENT;
+    }
+    if (!S_ISDIR(dir->mode))
+    {
+        return -ENOTDIR;
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether name can't be given to a new entry: it exists, or it is
+ *        the virtual stats file of the root directory
+ * @pre dir is locked
+ */
+static bool name_taken_locked(fused_inode_t *dir, const char *name)
+{
+    return dir_lookup_locked(dir, name) ||
+           (dir->ino == FUSE_ROOT_ID && strcmp(name, FUSED_STATS_NAME) == 0);
+}
+
+/**
+ * @brief Create a regular file in a directory
+ * The new file's backing descriptor is pinned; the caller owns one
+ * inode_release() for it.
+ * @param lookup_ref take a kernel lookup reference before the inode is
+ *        unlocked, so an unlink racing the reply cannot free it
+ * @param out receives the new inode
+ */
+int inode_create(fused_inode_t *parent, const char *name, mode_t mode,
+                 uid_t uid, gid_t gid, bool lookup_ref, fused_inode_t **out)
+{
+    inode_wrlock(parent);
+    int rc = check_dir_locked(parent);
+    if (rc != 0)
+    {
+        inode_unlock(parent);
+        return rc;
+    }
+    if (name_taken_locked(parent, name))
+    {
+        inode_unlock(parent);
+        return -EEXIST;
+    }
+
+    fused_inode_t *inode = alloc_inode();
+    if (!inode)
+    {
+        inode_unlock(parent);
+        return -ENOMEM;
+    }
+    // overwrite file type as 'regular'
+    inode->mode = S_IFREG | (mode & 0777);
+    inode->uid = uid;
+    inode->gid = gid;
+    inode->size = 0;
+
+    // accessed, modified, and created now
+    inode->atime = time(NULL);
+    inode->mtime = inode->atime;
+    inode->ctime = inode->atime;
+
+    // create backing file; its descriptor stays pinned until release.
+    // Segmented files only need an empty extent map
+    rc = seg_enabled() ? seg_attach(inode)
+                       : fd_cache_get(inode->ino, inode->backing_path, O_CREAT | O_TRUNC);
+    if (rc < 0)
+    {
+        free_inode(inode);
+        inode_unlock(inode);
+        inode_unlock(parent);
+        return rc == -ENOMEM ? rc : -EIO;
+    }
+
+    rc = dir_add_locked(parent, name, inode);
+    if (rc != 0)
+    {
+        free_inode(inode);
+        inode_unlock(inode);
+        inode_unlock(parent);
+        return rc;
+    }
+
+    if (lookup_ref)
+        inode->nlookup++;
+    inode_unlock(inode);
+    inode_unlock(parent);
+    *out = inode;
+    return 0;
+}
+
+/**
+ * @brief Create a directory inside a directory
+ * @param lookup_ref take a kernel lookup reference, as for inode_create()
+ * @param out receives the new inode
+ */
+int inode_mkdir(fused_inode_t *parent, const char *name, mode_t mode,
+                uid_t uid, gid_t gid, bool lookup_ref, fused_inode_t **out)
+{
+    inode_wrlock(parent);
+    int rc = check_dir_locked(parent);
+    if (rc != 0)
+    {
+        inode_unlock(parent);
+        return rc;
+    }
+    if (name_taken_locked(parent, name))
+    {
+        inode_unlock(parent);
+        return -EEXIST;
+    }
+
+    // Allocate new inode for directory
+    fused_inode_t *inode = alloc_inode();
+    if (!inode)
+    {
+        inode_unlock(parent);
+        return -ENOMEM;
+    }
+
+    // Initialize directory inode
+    inode->mode = S_IFDIR | (mode & 0777);
+    inode->uid = uid;
+    inode->gid = gid;
+    inode->size = 4096;
+    inode->atime = time(NULL);
+    inode->mtime = inode->atime;
+    inode->ctime = inode->atime;
+    if (dir_alloc(inode) != 0)
+    {
+        rc = -ENOMEM;
+    }
+    else
+    {
+        // Add directory entry to parent
+        rc = dir_add_locked(parent, name, inode);
+    }
+    if (rc != 0)
+    {
+        free_inode(inode);
+        inode_unlock(inode);
+        inode_unlock(parent);
+        return rc;
+    }
+
+    if (lookup_ref)
+        inode->nlookup++;
+    inode_unlock(inode);
+    inode_unlock(parent);
+    *out = inode;
+    return 0;
+}
+
+/**
+ * @brief Drop an inode that was just removed from the namespace
+ * Inodes the kernel still holds lookup references to (low-level frontend)
+ * are kept until the matching forget.
+ * @pre inode is write-locked
+ */
+static void release_unlinked(fused_inode_t *inode)
+{
+    if (inode->nlookup > 0)
+    {
+        inode->unlinked = true;
+        return;
+    }
+    free_inode(inode);
+}
+
+/**
+ * @brief Remove a regular file from a directory
+ */
+int inode_unlink(fused_inode_t *parent, const char *name)
+{
+    inode_wrlock(parent);
+    int rc = check_dir_locked(parent);
+    if (rc != 0)
+    {
+        inode_unlock(parent);
+        return rc;
+    }
+
+    fused_inode_t *inode = dir_lookup_locked(parent, name);
+    if (!inode)
+    {
+        inode_unlock(parent);
+        return -ENOENT;
+    }
+    if (S_ISDIR(inode->mode))
+    {
+        inode_unlock(parent);
+        return -EISDIR;
+    }
+
+    // Waits for in-flight reads and appends of the file to drain
+    inode_wrlock(inode);
+    rc = dir_rm_locked(parent, name, inode);
+    if (rc == 0)
+    {
+        release_unlinked(inode);
+    }
+    inode_unlock(inode);
+    inode_unlock(parent);
+    return rc;
+}
+
+/**
+ * @brief Remove an empty directory from a directory
+ */
+int inode_rmdir(fused_inode_t *parent, const char *name)
+{
+    // Locks parent and child directory; see inode_rename()
+    pthread_mutex_lock(&g_state->rename_lock);
+    inode_wrlock(parent);
+
+    int rc = check_dir_locked(parent);
+    fused_inode_t *inode = NULL;
+    if (rc == 0)
+    {
+        inode = dir_lookup_locked(parent, name);
+        if (!inode)
+            rc = -ENOENT;
+        else if (!S_ISDIR(inode->mode))
+            rc = -ENOTDIR;
+    }
+    if (rc == 0)
+    {
+        inode_wrlock(inode);
+        if (inode->dirents && inode->dirents->n_entries > 0)
+            rc = -ENOTEMPTY;
+        else
+            // remove the name from parent's directory entries
+            rc = dir_rm_locked(parent, name, inode);
+        if (rc == 0)
+            // delete inode
+            release_unlinked(inode);
+        inode_unlock(inode);
+    }
+
+    inode_unlock(parent);
+    pthread_mutex_unlock(&g_state->rename_lock);
+    return rc;
+}
+
+/**
+ * @brief Move an entry within a locked directory pair
+ * @pre src_parent and dest_parent are write-locked
+ */
+static int rename_locked(fused_inode_t *src_parent, const char *src_name,
+                         fused_inode_t *dest_parent, const char *dest_name)
+{
+    int rc = check_dir_locked(src_parent);
+    if (rc == 0)
+        rc = check_dir_locked(dest_parent);
+    if (rc != 0)
+        return rc;
+
+    fused_inode_t *inode = dir_lookup_locked(src_parent, src_name);
+    if (!inode)
+    {
+        return -ENOENT;
+    }
+    if (src_parent == dest_parent && strcmp(src_name, dest_name) == 0)
+    {
+        return 0;
+    }
+    if (name_taken_locked(dest_parent, dest_name))
+    {
+        return -EEXIST;
+    }
+    if (inode == dest_parent)
+    {
+        return -EINVAL;
+    }
+
+    // accessed, and modified now
+    inode_wrlock(inode);
+    time_t now = time(NULL);
+    INODE_STORE(inode->atime, now);
+    INODE_STORE(inode->mtime, now);
+
+    // Adding the new name moves the record, which commits the rename
+    rc = dir_add_locked(dest_parent, dest_name, inode);
+    if (rc == 0)
+    {
+        rc = dir_rm_locked(src_parent, src_name, inode);
+        if (rc != 0)
+        {
+            dir_rm_locked(dest_parent, dest_name, inode);
+            itable_put(inode, src_parent->ino, src_name);
+        }
+    }
+    // Cached paths below a moved directory still name its old place
+    if (rc == 0 && S_ISDIR(inode->mode))
+        pathcache_invalidate();
+    inode_unlock(inode);
+    return rc;
+}
+
+/**
+ * @brief Move an entry between (or within) directories
+ * The destination name must not exist. Only operations holding rename_lock
+ * lock two existing directories, and the pair is taken in address order.
+ */
+int inode_rename(fused_inode_t *src_parent, const char *src_name,
+                 fused_inode_t *dest_parent, const char *dest_name)
+{
+    if (src_parent == dest_parent)
+    {
+        inode_wrlock(src_parent);
+        int rc = rename_locked(src_parent, src_name, dest_parent, dest_name);
+        inode_unlock(src_parent);
+        return rc;
+    }
+
+    fused_inode_t *first = src_parent;
+    fused_inode_t *second = dest_parent;
+    if ((uintptr_t)second < (uintptr_t)first)
+    {
+        first = dest_parent;
+        second = src_parent;
+    }
+
+    pthread_mutex_lock(&g_state->rename_lock);
+    inode_wrlock(first);
+
+    // A stale pointer to a freed slot may be locked by a concurrent
+    // alloc_inode() that already holds another directory; back off
+    int rc = check_dir_locked(first);
+    if (rc == 0)
+    {
+        inode_wrlock(second);
+        rc = rename_locked(src_parent, src_name, dest_parent, dest_name);
+        inode_unlock(second);
+    }
+    inode_unlock(first);
+    pthread_mutex_unlock(&g_state->rename_lock);
+    return rc;
+}
+
+/**
+ * @brief Update inode timestamps; UTIME_NOW and UTIME_OMIT are honoured
+ */
+void inode_utimens(fused_inode_t *inode, const struct timespec tv[2])
+{
+    inode_wrlock(inode);
+
+    // Update access time (tv[0])
+    if (tv[0].tv_nsec == UTIME_NOW)
+    {
+        INODE_STORE(inode->atime, time(NULL));
+    }
+    else if (tv[0].tv_nsec != UTIME_OMIT)
+    {
+        INODE_STORE(inode->atime, tv[0].tv_sec);
+    }
+
+    // Update modification time (tv[1])
+    if (tv[1].tv_nsec == UTIME_NOW)
+    {
+        INODE_STORE(inode->mtime, time(NULL));
+    }
+    else if (tv[1].tv_nsec != UTIME_OMIT)
+    {
+        INODE_STORE(inode->mtime, tv[1].tv_sec);
+    }
+
+    // Always update ctime when any metadata changes
+    INODE_STORE(inode->ctime, time(NULL));
+
+    itable_update(inode);
+    inode_unlock(inode);
+}
+
+/**
+ * @brief Take a kernel lookup reference (low-level lookup/create/mkdir)
+ */
+void inode_ref(fused_inode_t *inode)
+{
+    inode_wrlock(inode);
+    if (inode->ino != 0)
+    {
+        inode->nlookup++;
+    }
+    inode_unlock(inode);
+}
+
+/**
+ * @brief Drop kernel lookup references; frees unlinked inodes at zero
+ */
+void inode_forget(fused_inode_t *inode, uint64_t nlookup)
+{
+    inode_wrlock(inode);
+    if (inode->ino != 0)
+    {
+        inode->nlookup = (nlookup >= inode->nlookup) ? 0 : inode->nlookup - nlookup;
+        if (inode->nlookup == 0 && inode->unlinked)
+        {
+            free_inode(inode);
+        }
+    }
+    inode_unlock(inode);
+}
+
+/* ============================================================================
+ * Path-based FUSE operations
+ * ========================================================================== */
+
+/**
+ * @brief Owner for new inodes: the FUSE caller, or this process outside FUSE
+ */
+static void caller_ids(uid_t *uid, gid_t *gid)
+{
+    struct fuse_context *ctx = fuse_get_context();
+    if (ctx)
+    {
+        *uid = ctx->uid;
+        *gid = ctx->gid;
+    }
+    else
+    {
+        *uid = getuid();
+        *gid = getgid();
+    }
+}
+
+/**
+ * @brief Whether a path names the virtual stats file
+ */
+static bool is_stats_path(const char *path)
+{
+    return path && path[0] == '/' && strcmp(path + 1, FUSED_STATS_NAME) == 0;
+}
+
+/**
+ * @brief Get file attributes
+ */
+int fused_getattr(const char *path, struct stat *stbuf)
+{
+    uint64_t start = stats_now();
+    memset(stbuf, 0, sizeof(struct stat));
+
+    log_debug("getattr: %s", path);
+
+    if (is_stats_path(path))
+    {
+        stats_stat(stbuf);
+        return stats_record(STATS_GETATTR, start, 0);
+    }
+
+    fused_inode_t *inode = path_to_inode(path);
+    if (!inode)
+    {
+        return stats_record(STATS_GETATTR, start, -ENOENT);
+    }
+
+    inode_stat(inode, stbuf);
+    return stats_record(STATS_GETATTR, start, 0);
+}
+
+/**
+ * @brief Adapts inode_readdir() to the path API's filler
+ */
+typedef struct {
+    void *buf;
+    fused_fill_dir_t filler;
+} readdir_fill_t;
+
+static int readdir_fill_path(void *ctx, const char *name, const struct stat *st, off_t next)
+{
+    readdir_fill_t *fill = ctx;
+    return fill->filler(fill->buf, name, st, next);
+}
+
+/**
+ * @brief Read directory contents
+ */
+int fused_readdir(const char *path, void *buf, fused_fill_dir_t filler,
+                  off_t offset, struct fuse_file_info *fi)
+{
+    (void)fi;
+    uint64_t start = stats_now();
+
+    log_debug("readdir: %s (offset %ld)", path, (long)offset);
+
+    fused_inode_t *dir = path_to_inode(path);
+    if (!dir)
+    {
+        return stats_record(STATS_READDIR, start, -ENOENT);
+    }
+
+    // Nonzero offsets let libfuse page the listing instead of buffering it all
+    readdir_fill_t ctx = {buf, filler};
+    return stats_record(STATS_READDIR, start,
+                        inode_readdir(dir, offset, readdir_fill_path, &ctx));
+}
+
+/**
+ * @brief Open a file
+ */
+int fused_open(const char *path, struct fuse_file_info *fi)
+{
+    uint64_t start = stats_now();
+    log_debug("open: %s (flags: 0x%x)", path, fi->flags);
+
+    if (is_stats_path(path))
+    {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        {
+            return stats_record(STATS_OPEN, start, -EACCES);
+        }
+        // Its size changes with every request; read it to EOF every time
+        fi->direct_io = 1;
+        fi->fh = FUSED_STATS_INO;
+        return stats_record(STATS_OPEN, start, 0);
+    }
+
+    fused_inode_t *inode = path_to_inode(path);
+    if (!inode)
+    {
+        return stats_record(STATS_OPEN, start, -ENOENT);
+    }
+
+    int rc = inode_open(inode, fi);
+    if (rc != 0)
+    {
+        return stats_record(STATS_OPEN, start, rc);
+    }
+
+    fi->fh = inode->ino;
+    return stats_record(STATS_OPEN, start, 0);
+}
+
+/**
+ * @brief Release an open file, unpinning its backing descriptor
+ */
+int fused_release(const char *path, struct fuse_file_info *fi)
+{
+    (void)path;
+
+    if (fi->fh != FUSED_STATS_INO)
+        inode_release(fi->fh, fi->flags);
+    return 0;
+}
+
+/**
+ * @brief Write out buffered appends when a file descriptor is closed
+ */
+int fused_flush(const char *path, struct fuse_file_info *fi)
+{
+    (void)path;
+
+    if (fi->fh == FUSED_STATS_INO)
+    {
+        return 0;
+    }
+    fused_inode_t *inode = lookup_inode(fi->fh);
+    if (!inode)
+    {
+        return -ENOENT;
+    }
+    return inode_flush(inode);
+}
+
+/**
+ * @brief Write out buffered appends and sync the backing file
+ */
+int fused_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    (void)path;
+
+    fused_inode_t *inode = lookup_inode(fi->fh);
+    if (!inode)
+    {
+        return -ENOENT;
+    }
+    return inode_fsync(inode, datasync);
+}
+
+/**
+ * @brief Read data from a file
+ */
+int fused_read(const char *path, char *buf, size_t size, off_t offset,
+               struct fuse_file_info *fi)
+{
+    (void)path; // Use inode from file handle instead
+
+    uint64_t start = stats_now();
+    log_debug("read: inode=%lu, size=%zu, offset=%ld", fi->fh, size, offset);
+
+    if (fi->fh == FUSED_STATS_INO)
+    {
+        return stats_record(STATS_READ, start, stats_read(buf, size, offset));
+    }
+
+    // Get inode directly from file handle (set in fused_open)
+    fused_inode_t *inode = lookup_inode(fi->fh);
+    if (!inode)
+    {
+        log_warn("read: inode %lu not found", fi->fh);
+        return stats_record(STATS_READ, start, -ENOENT);
+    }
+
+    return stats_record(STATS_READ, start, inode_read(inode, buf, size, offset));
+}
+
+/**
+ * @brief Read data from a file without copying it through user space
+ * Returns a buffer that points at the backing file, so libfuse can splice
+ * from the page cache straight into /dev/fuse.
+ */
+int fused_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+                   off_t offset, struct fuse_file_info *fi)
+{
+    (void)path; // Use inode from file handle instead
+
+    uint64_t start = stats_now();
+    log_debug("read_buf: inode=%lu, size=%zu, offset=%ld", fi->fh, size, offset);
+
+    fused_inode_t *inode = NULL;
+    if (fi->fh != FUSED_STATS_INO)
+    {
+        inode = lookup_inode(fi->fh);
+        if (!inode)
+        {
+            log_warn("read_buf: inode %lu not found", fi->fh);
+            return stats_record(STATS_READ, start, -ENOENT);
+        }
+    }
+
+    struct fuse_bufvec *src = malloc(sizeof(struct fuse_bufvec));
+    if (!src)
+    {
+        return stats_record(STATS_READ, start, -ENOMEM);
+    }
+
+    int fd = -1;
+    ssize_t len = inode ? inode_read_fd(inode, size, offset, &fd) : -EOPNOTSUPP;
+    if (len == -EOPNOTSUPP)
+    {
+        // Nothing to splice from, hot data already in memory or the stats
+        // file: copy it into a buffer, which libfuse frees
+        char *mem = malloc(size ? size : 1);
+        if (!mem)
+            len = -ENOMEM;
+        else if (inode)
+            len = inode_read(inode, mem, size, offset);
+        else
+            len = stats_read(mem, size, offset);
+        if (len < 0)
+        {
+            free(mem);
+            free(src);
+            return stats_record(STATS_READ, start, len);
+        }
+        *src = FUSE_BUFVEC_INIT(len);
+        src->buf[0].mem = mem;
+        *bufp = src;
+        return stats_record(STATS_READ, start, 0);
+    }
+    if (len < 0)
+    {
+        free(src);
+        return stats_record(STATS_READ, start, len);
+    }
+
+    *src = FUSE_BUFVEC_INIT(len);
+    if (len > 0)
+    {
+        src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        src->buf[0].fd = fd;
+        src->buf[0].pos = offset;
+    }
+
+    *bufp = src;
+    return stats_record(STATS_READ, start, 0);
+}
+
+/**
+ * @brief Write data to a file
+ */
+int fused_write(const char *path, const char *buf, size_t size, off_t offset,
+                struct fuse_file_info *fi)
+{
+    (void)path; // Use inode from file handle instead
+
+    uint64_t start = stats_now();
+    log_debug("write: inode=%lu, size=%zu, offset=%ld", fi->fh, size, offset);
+
+    // Get inode directly from file handle (set in fused_open)
+    fused_inode_t *inode = lookup_inode(fi->fh);
+    if (!inode)
+    {
+        log_warn("write: inode %lu not found", fi->fh);
+        return stats_record(STATS_WRITE, start, -ENOENT);
+    }
+
+    return stats_record(STATS_WRITE, start, inode_write(inode, buf, size, offset));
+}
+
+/**
+ * @brief Append a FUSE buffer (possibly a pipe from /dev/fuse) to a file
+ */
+int fused_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                    struct fuse_file_info *fi)
+{
+    (void)path; // Use inode from file handle instead
+
+    uint64_t start = stats_now();
+    log_debug("write_buf: inode=%lu, size=%zu, offset=%ld", fi->fh,
+              fuse_buf_size(buf), offset);
+
+    fused_inode_t *inode = lookup_inode(fi->fh);
+    if (!inode)
+    {
+        log_warn("write_buf: inode %lu not found", fi->fh);
+        return stats_record(STATS_WRITE, start, -ENOENT);
+    }
+
+    return stats_record(STATS_WRITE, start, inode_write_buf(inode, buf, offset));
+}
+
+/**
+ * @brief Create a new file
+ */
+int fused_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    uint64_t start = stats_now();
+    char child_name[MAX_NAME];
+    fused_inode_t *parent = resolve_parent(path, child_name);
+    if (!parent)
+    {
+        return stats_record(STATS_CREATE, start, child_name[0] ? -ENOENT : -EEXIST);
+    }
+
+    uid_t uid;
+    gid_t gid;
+    caller_ids(&uid, &gid);
+
+    fused_inode_t *inode;
+    int rc = inode_create(parent, child_name, mode, uid, gid, false, &inode);
+    if (rc != 0)
+    {
+        return stats_record(STATS_CREATE, start, rc);
+    }
+
+    inode_open_cache(inode, fi);
+    fi->fh = inode->ino;
+
+    return stats_record(STATS_CREATE, start, 0);
+}
+
+/**
+ * @brief Update file timestamps (utimens)
+ */
+int fused_utimens(const char *path, const struct timespec tv[2])
+{
+    log_debug("utimens: %s", path);
+    
+    fused_inode_t *inode = path_to_inode(path);
+    if (!inode)
+    {
+        return -ENOENT;
+    }
+    
+    inode_utimens(inode, tv);
+    
+    log_debug("utimens: updated timestamps for %s (inode %lu)", path, inode->ino);
+    return 0;
+}
+
+
+/**
+ * @brief Create a directory
+ */
+int fused_mkdir(const char *path, mode_t mode)
+{
+    uint64_t start = stats_now();
+    log_debug("mkdir: %s", path);
+
+    // The parent and the new name; an existing name fails under its lock
+    char dir_name[MAX_NAME];
+    fused_inode_t *parent = resolve_parent(path, dir_name);
+    if (!parent)
+    {
+        return stats_record(STATS_MKDIR, start, dir_name[0] ? -ENOENT : -EEXIST);
+    }
+
+    uid_t uid;
+    gid_t gid;
+    caller_ids(&uid, &gid);
+
+    fused_inode_t *inode;
+    int rc = inode_mkdir(parent, dir_name, mode, uid, gid, false, &inode);
+    if (rc != 0)
+    {
+        return stats_record(STATS_MKDIR, start, rc);
+    }
+
+    log_debug("mkdir: created %s (inode %lu)", path, inode->ino);
+    return stats_record(STATS_MKDIR, start, 0);
+}
+
+/**
+ * @brief Remove a directory
+ * @pre directory is empty
+ */
+int fused_rmdir(const char *path)
+{
+    log_debug("rmdir: %s", path);
+
+    if (strcmp(path, "/") == 0)
+        return -EBUSY;
+
+    // find the parent to remove the reference
+    char dir_name[MAX_NAME];
+    fused_inode_t *parent = resolve_parent(path, dir_name);
+    if (!parent)
+        return -ENOENT;
+
+    int rc = inode_rmdir(parent, dir_name);
+    if (rc != 0)
+        return rc;
+
+    log_debug("rmdir: successfully removed %s", path);
+    return 0;
+}
+
+/**
+ * @brief Rename a file or directory
+ */
+int fused_rename(const char *from, const char *to)
+{
+    uint64_t start = stats_now();
+    if (strcmp(from, to) == 0)
+    {
+        return stats_record(STATS_RENAME, start, 0);
+    }
+
+    char src_name[MAX_NAME];
+    char dest_name[MAX_NAME];
+    fused_inode_t *src_parent = resolve_parent(from, src_name);
+    fused_inode_t *dest_parent = resolve_parent(to, dest_name);
+    if (!src_parent || !dest_parent)
+    {
+        return stats_record(STATS_RENAME, start, -ENOENT);
+    }
+
+    return stats_record(STATS_RENAME, start,
+                        inode_rename(src_parent, src_name, dest_parent, dest_name));
+}
+
+/**
+ * @brief Called to remove a file
+ */
+int fused_unlink(const char* path)
+{
+    uint64_t start = stats_now();
+    char child_name[MAX_NAME];
+    fused_inode_t *parent = resolve_parent(path, child_name);
+    if (!parent)
+    {
+        return stats_record(STATS_UNLINK, start, -ENOENT);
+    }
+
+    return stats_record(STATS_UNLINK, start, inode_unlink(parent, child_name));
+}
+
+/**
+ * @brief Find inode by inode number
+ * The low 32 bits of ino index the slab directly; the high 32 bits must
+ * match the slot's generation, so handles to freed or reused slots miss.
+ * Takes no lock: chunks are published before n_slots and never move.
+ */
+fused_inode_t *lookup_inode(uint64_t ino)
+{
+    uint64_t slot = (ino & INODE_SLOT_MASK) - 1;
+    if (!g_state || ino == 0 || slot >= INODE_LOAD(g_state->n_slots))
+    {
+        return NULL;
+    }
+
+    fused_inode_t *inode = &g_state->inode_chunks[slot >> INODE_CHUNK_SHIFT]
+                                                 [slot & (INODE_CHUNK_SIZE - 1)];
+    if (INODE_LOAD(inode->ino) != ino)
+    {
+        return NULL;
+    }
+    return inode;
+}
+
+/**
+ * @brief Generate backing file path for an inode
+ */
+static void generate_backing_path(fused_inode_t *inode, uint64_t ino)
+{
+    snprintf(inode->backing_path, MAX_PATH, "%s/inode_%lu",
+             g_state->backing_dir, ino);
+}
+
+/**
+ * @brief Resolve path to inode
+ * Walks from the root unless the path cache knows the answer, and tells the
+ * cache where the walk ended, also when the last component is missing.
+ */
+fused_inode_t *path_to_inode(const char *path)
+{
+    if (strcmp(path, "/") == 0)
+    {
+        return lookup_inode(FUSE_ROOT_ID);
+    }
+
+    fused_inode_t *cached = NULL;
+    switch (pathcache_get(path, &cached))
+    {
+    case PC_HIT:
+        return cached;
+    case PC_NEGATIVE:
+        return NULL;
+    case PC_MISS:
+        break;
+    }
+
+    uint64_t epoch = pathcache_epoch();
+    fused_inode_t *current = lookup_inode(FUSE_ROOT_ID);
+    if (!current)
+        return NULL;
+
+    char path_copy[MAX_PATH];
+    strncpy(path_copy, path, MAX_PATH - 1);
+    path_copy[MAX_PATH - 1] = '\0';
+
+    char *saveptr;
+    char *token = strtok_r(path_copy + 1, "/", &saveptr); // Skip leading '/'
+    fused_inode_t *dir = NULL;
+    uint32_t version = 0;
+
+    while (token != NULL)
+    {
+        if (!S_ISDIR(current->mode))
+        {
+            return NULL;
+        }
+
+        // The version read before the search vouches for its result
+        dir = current;
+        version = __atomic_load_n(&dir->dir_version, __ATOMIC_ACQUIRE);
+
+        // Hashed lookup of the child with matching name
+        current = dir_lookup(dir, token);
+        token = strtok_r(NULL, "/", &saveptr);
+        if (!current)
+        {
+            // Only a missing last component makes a negative entry
+            if (!token)
+                pathcache_put(path, NULL, dir, version, epoch);
+            return NULL;
+        }
+    }
+
+    if (dir)
+        pathcache_put(path, current, dir, version, epoch);
+    return current;
+}
+
+/**
+ * @brief Split a path and resolve its parent directory in one step
+ * @param name receives the last component, empty for "/"
+ * @return the parent, or NULL if it is missing, not a directory, or path is "/"
+ */
+static fused_inode_t *resolve_parent(const char *path, char *name)
+{
+    char parent_path[MAX_PATH];
+    split_path(path, parent_path, name);
+    if (name[0] == '\0')
+        return NULL;
+
+    fused_inode_t *parent = path_to_inode(parent_path);
+    return parent && S_ISDIR(parent->mode) ? parent : NULL;
+}
+
+/**
+ * @brief Make sure the slab has a chunk backing the given slot
+ * @pre alloc_lock is held
+ * @return 0 on success, -ENOMEM if the chunk could not be allocated
+ */
+static int ensure_inode_chunk(uint32_t slot)
+{
+    uint32_t chunk = slot >> INODE_CHUNK_SHIFT;
+    if (chunk < g_state->n_chunks)
+    {
+        return 0;
+    }
+    if (chunk >= INODE_MAX_CHUNKS)
+    {
+        return -ENOMEM;
+    }
+    int rc = itable_reserve(chunk + 1);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    fused_inode_t *inodes = calloc(INODE_CHUNK_SIZE, sizeof(fused_inode_t));
+    if (!inodes)
+    {
+        return -ENOMEM;
+    }
+    for (uint32_t i = 0; i < INODE_CHUNK_SIZE; i++)
+    {
+        pthread_rwlock_init(&inodes[i].lock, NULL);
+        pthread_mutex_init(&inodes[i].append_lock, NULL);
+    }
+
+    // Lock-free lookups see the chunk once n_slots covers it
+    g_state->inode_chunks[chunk] = inodes;
+    g_state->n_chunks++;
+    return 0;
+}
+
+/**
+ * @brief Zero an inode slot, keeping its locks and setting its generation
+ */
+static void reset_inode(fused_inode_t *inode, uint32_t generation)
+{
+    INODE_STORE(inode->ino, 0);
+    memset((char *)inode + offsetof(fused_inode_t, generation), 0,
+           sizeof(fused_inode_t) - offsetof(fused_inode_t, generation));
+    inode->generation = generation;
+}
+
+/**
+ * @brief Allocate a new inode
+ * Reuses a released slot when one is available, otherwise takes the next
+ * slot from the slab, growing it by one chunk when needed.
+ * @return pointer to new inode, write-locked, or NULL if no memory
+ */
+static fused_inode_t *alloc_inode(void)
+{
+    uint32_t slot;
+
+    pthread_mutex_lock(&g_state->alloc_lock);
+    if (g_state->n_free > 0)
+    {
+        slot = g_state->free_slots[--g_state->n_free];
+    }
+    else
+    {
+        slot = g_state->n_slots;
+        if (ensure_inode_chunk(slot) != 0)
+        {
+            pthread_mutex_unlock(&g_state->alloc_lock);
+            return NULL;
+        }
+        INODE_STORE(g_state->n_slots, slot + 1);
+    }
+    g_state->n_inodes++;
+    pthread_mutex_unlock(&g_state->alloc_lock);
+
+    fused_inode_t *inode = &g_state->inode_chunks[slot >> INODE_CHUNK_SHIFT]
+                                                 [slot & (INODE_CHUNK_SIZE - 1)];
+
+    // A slot pushed by free_inode() may still be locked by the freeing thread
+    inode_wrlock(inode);
+
+    // Clear entire inode slot, keeping the generation it was left with
+    reset_inode(inode, inode->generation);
+
+    uint64_t ino = ((uint64_t)inode->generation << 32) | (slot + 1);
+    generate_backing_path(inode, ino);
+    INODE_STORE(inode->ino, ino);
+
+    return inode;
+}
+
+/**
+ * @brief Free an inode and put its slot on the free list
+ * The slot's generation is bumped so stale inode numbers stop resolving.
+ * @pre inode is write-locked; it stays locked for the caller to release
+ */
+static void free_inode(fused_inode_t *inode)
+{
+    if (!inode || inode->ino == 0)
+        return;
+
+    // Clean up backing file if it exists; buffered appends die with it
+    wb_discard(inode);
+    crc_discard(inode);
+    cold_discard(inode);
+    if (inode->seg_map)
+    {
+        seg_detach(inode, true);
+    }
+    else
+    {
+        fd_cache_drop(inode->ino);
+        if (inode->backing_path[0] != '\0')
+        {
+            unlink(inode->backing_path);
+        }
+    }
+
+    dir_free(inode);
+
+    uint32_t slot = (uint32_t)((inode->ino & INODE_SLOT_MASK) - 1);
+
+    // Clear the inode slot
+    reset_inode(inode, inode->generation + 1);
+    itable_free(slot, inode->generation);
+
+    pthread_mutex_lock(&g_state->alloc_lock);
+    g_state->n_inodes--;
+    push_free_slot(slot);
+    pthread_mutex_unlock(&g_state->alloc_lock);
+}
+
+/**
+ * @brief Put a slot on the free stack for alloc_inode() to reuse
+ * @pre alloc_lock is held
+ */
+static void push_free_slot(uint32_t slot)
+{
+    if (g_state->n_free == g_state->free_capacity)
+    {
+        uint32_t new_capacity = g_state->free_capacity ? g_state->free_capacity * 2 : 64;
+        uint32_t *free_slots = realloc(g_state->free_slots,
+                                       new_capacity * sizeof(*free_slots));
+        if (!free_slots)
+        {
+            // Slot leaks until restart; the inode itself is already gone
+            return;
+        }
+        g_state->free_slots = free_slots;
+        g_state->free_capacity = new_capacity;
+    }
+    g_state->free_slots[g_state->n_free++] = slot;
+}
+
+static fused_inode_t *slot_inode(uint32_t slot)
+{
+    return &g_state->inode_chunks[slot >> INODE_CHUNK_SHIFT][slot & (INODE_CHUNK_SIZE - 1)];
+}
+
+/**
+ * @brief Bring one inode back from its record
+ * Sizes come from the backing file, which may have grown since the record
+ * was written; mtime then follows the file too. Segmented files get an
+ * empty extent map here and their size from seg_load().
+ * @return 0, or negative errno if the record or its backing file is unusable
+ */
+static int load_inode(fused_inode_t *inode, uint32_t slot, const itable_rec_t *rec)
+{
+    if ((rec->ino & INODE_SLOT_MASK) != (uint64_t)slot + 1 ||
+        (uint32_t)(rec->ino >> 32) != rec->generation)
+    {
+        return -EINVAL;
+    }
+
+    inode->mode = rec->mode;
+    inode->uid = rec->uid;
+    inode->gid = rec->gid;
+    inode->atime = rec->atime;
+    inode->mtime = rec->mtime;
+    inode->ctime = rec->ctime;
+    generate_backing_path(inode, rec->ino);
+
+    if (S_ISDIR(rec->mode))
+    {
+        inode->size = 4096;
+        if (dir_alloc(inode) != 0)
+        {
+            return -ENOMEM;
+        }
+    }
+    else if (S_ISREG(rec->mode) && (rec->flags & ITABLE_REC_SEGMENTS))
+    {
+        if (seg_attach(inode) != 0)
+        {
+            return -ENOMEM;
+        }
+    }
+    else if (S_ISREG(rec->mode) && (rec->flags & ITABLE_REC_COMPRESSED))
+    {
+        int rc = cold_load(inode, rec->ino);
+        if (rc != 0)
+        {
+            return rc;
+        }
+    }
+    else if (S_ISREG(rec->mode))
+    {
+        struct stat st;
+        if (stat(inode->backing_path, &st) != 0)
+        {
+            return -errno;
+        }
+        inode->size = st.st_size;
+        inode->durable = st.st_size;
+        inode->sparse = (off_t)st.st_blocks * 512 < st.st_size;
+        if ((uint64_t)st.st_size != rec->size)
+        {
+            inode->mtime = st.st_mtime;
+            inode->ctime = st.st_mtime;
+        }
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    INODE_STORE(inode->ino, rec->ino);
+    return 0;
+}
+
+/**
+ * @brief Recreate an empty root if its record was lost
+ */
+static int load_root(void)
+{
+    fused_inode_t *root = slot_inode(0);
+    itable_rec_t rec;
+    if (itable_get(0, &rec) == 0 && rec.ino == FUSE_ROOT_ID && S_ISDIR(rec.mode) &&
+        load_inode(root, 0, &rec) == 0)
+    {
+        return 0;
+    }
+
+    log_warn("itable: root directory record lost, recreating it");
+    dir_free(root);
+    reset_inode(root, 0);
+    root->mode = S_IFDIR | 0755;
+    root->uid = getuid();
+    root->gid = getgid();
+    root->size = 4096;
+    root->atime = root->mtime = root->ctime = time(NULL);
+    generate_backing_path(root, FUSE_ROOT_ID);
+    if (dir_alloc(root) != 0)
+    {
+        return -ENOMEM;
+    }
+    INODE_STORE(root->ino, FUSE_ROOT_ID);
+    itable_put(root, 0, "");
+    return 0;
+}
+
+/**
+ * @brief Link every loaded inode under the parent its record names
+ * Two records claiming one name cannot come from a completed operation;
+ * the newer one wins. Inodes whose parent is gone stay unlinked.
+ */
+static void link_loaded_inodes(const uint64_t *seqs)
+{
+    for (uint32_t slot = 1; slot < g_state->n_slots; slot++)
+    {
+        fused_inode_t *inode = slot_inode(slot);
+        itable_rec_t rec;
+        if (inode->ino == 0 || itable_get(slot, &rec) != 0)
+        {
+            continue;
+        }
+
+        fused_inode_t *parent = lookup_inode(rec.parent);
+        if (!parent || parent == inode || !parent->dirents)
+        {
+            continue;
+        }
+
+        int rc = dir_insert(parent->dirents, rec.name, inode->ino);
+        if (rc == -EEXIST)
+        {
+            fused_inode_t *other = dir_lookup_locked(parent, rec.name);
+            uint32_t other_slot = (uint32_t)((other->ino & INODE_SLOT_MASK) - 1);
+            if (seqs[slot] > seqs[other_slot])
+            {
+                dir_rm_locked(parent, rec.name, other);
+                rc = dir_insert(parent->dirents, rec.name, inode->ino);
+            }
+        }
+        if (rc != 0)
+        {
+            log_warn("itable: cannot link inode %lu as '%s' in %lu: %s", inode->ino,
+                     rec.name, rec.parent, strerror(-rc));
+        }
+    }
+}
+
+/**
+ * @brief Free every inode the root cannot reach (lost parent or cycle)
+ */
+static void free_unreachable(void)
+{
+    uint32_t n = g_state->n_slots;
+    uint8_t *reached = calloc(n, 1);
+    uint32_t *stack = malloc(n * sizeof(*stack));
+    if (!reached || !stack)
+    {
+        // Keep everything; the orphans only cost memory
+        free(reached);
+        free(stack);
+        return;
+    }
+
+    uint32_t depth = 0;
+    reached[0] = 1;
+    stack[depth++] = 0;
+    while (depth > 0)
+    {
+        const fused_dir_t *d = slot_inode(stack[--depth])->dirents;
+        for (uint32_t i = 0; d && i < d->n_used; i++)
+        {
+            if (d->entries[i].ino == 0)
+                continue;
+            uint32_t child = (uint32_t)((d->entries[i].ino & INODE_SLOT_MASK) - 1);
+            if (!reached[child])
+            {
+                reached[child] = 1;
+                stack[depth++] = child;
+            }
+        }
+    }
+
+    for (uint32_t slot = 1; slot < n; slot++)
+    {
+        fused_inode_t *inode = slot_inode(slot);
+        if (inode->ino != 0 && !reached[slot])
+        {
+            log_warn("itable: dropping unreachable inode %lu", inode->ino);
+            inode_wrlock(inode);
+            free_inode(inode);
+            inode_unlock(inode);
+        }
+    }
+    free(reached);
+    free(stack);
+}
+
+/**
+ * @brief Delete backing files that no inode owns
+ * Left behind by a crash between creating or freeing an inode and
+ * updating its record, or while a file was compressed or written back out:
+ * then the copy the record does not name goes.
+ */
+static void sweep_backing_dir(void)
+{
+    DIR *dir = opendir(g_state->backing_dir);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        unsigned long ino;
+        char tail[4];
+        int n = sscanf(entry->d_name, "inode_%lu%3s", &ino, tail);
+        bool packed = n == 2 && strcmp(tail, COLD_SUFFIX) == 0;
+        fused_inode_t *inode = n == 1 || packed ? lookup_inode(ino) : NULL;
+        if ((n != 1 && !packed) || (inode && inode->compressed == packed))
+        {
+            continue;
+        }
+
+        // Relative to the open directory, so no joined path can be truncated
+        log_info("itable: removing orphaned backing file %s/%s", g_state->backing_dir,
+                 entry->d_name);
+        unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Rebuild the inode slab and directories from the persistent table
+ * @return 0 on success, negative errno on failure
+ */
+static int load_inode_table(void)
+{
+    uint32_t n_slots = itable_chunks() * INODE_CHUNK_SIZE;
+    if (n_slots == 0)
+    {
+        n_slots = 1;
+    }
+    uint64_t *seqs = calloc(n_slots, sizeof(*seqs));
+    if (!seqs)
+    {
+        return -ENOMEM;
+    }
+
+    int rc = 0;
+    pthread_mutex_lock(&g_state->alloc_lock);
+    for (uint32_t slot = 0; slot < n_slots && rc == 0; slot += INODE_CHUNK_SIZE)
+    {
+        rc = ensure_inode_chunk(slot);
+    }
+    pthread_mutex_unlock(&g_state->alloc_lock);
+    if (rc == 0)
+    {
+        rc = load_root();
+    }
+    if (rc != 0)
+    {
+        free(seqs);
+        return rc;
+    }
+
+    // Every slot gets the generation its record kept, live or free
+    uint32_t high = 1;
+    for (uint32_t slot = 1; slot < n_slots; slot++)
+    {
+        fused_inode_t *inode = slot_inode(slot);
+        itable_rec_t rec;
+        if (itable_get(slot, &rec) != 0)
+        {
+            continue;
+        }
+        inode->generation = rec.generation;
+        if (rec.ino == 0)
+        {
+            continue;
+        }
+
+        rc = load_inode(inode, slot, &rec);
+        if (rc != 0)
+        {
+            log_error("itable: dropping inode %lu '%s': %s", rec.ino, rec.name,
+                      strerror(-rc));
+            dir_free(inode);
+            reset_inode(inode, rec.generation + 1);
+            itable_free(slot, inode->generation);
+            continue;
+        }
+        seqs[slot] = rec.seq;
+        g_state->n_inodes++;
+        high = slot + 1;
+    }
+    g_state->n_inodes++;    // The root
+    INODE_STORE(g_state->n_slots, high);
+
+    pthread_mutex_lock(&g_state->alloc_lock);
+    for (uint32_t slot = high; slot-- > 1;)
+    {
+        if (slot_inode(slot)->ino == 0)
+        {
+            push_free_slot(slot);
         }
     }
+    pthread_mutex_unlock(&g_state->alloc_lock);
 
-    if (!found)
-        return -ENOENT;
-
-    parent->mtime = time(NULL);
-    parent->ctime = parent->mtime;
+    link_loaded_inodes(seqs);
+    free(seqs);
+    free_unreachable();
 
-    // delete inode
-    memset(inode, 0, sizeof(fused_inode_t));
+    if (!itable_was_clean())
+    {
+        sweep_backing_dir();
+    }
 
-    log_message("rmdir: successfully removed %s", path);
+    log_info("itable: loaded %d inodes from %s", g_state->n_inodes, g_state->backing_dir);
     return 0;
 }
 
 /**
- * @brief Rename a file or directory
+ * @brief Split full path into parent path and child name
  */
-int fused_rename(const char *from, const char *to)
+static void split_path(const char *path, char *parent_path, char *child_name)
 {
-    if (strcmp(from, to) == 0){
-    return 0;
-  }
-    fused_inode_t *inode = path_to_inode(from);
-    if (!inode)
-    {
-        return -ENOENT;
-    }
-    fused_inode_t *existing = path_to_inode(to);
-    if (existing)
+    if (strcmp(path, "/") == 0)
     {
-        return -EEXIST;
+        strcpy(parent_path, "/");
+        strcpy(child_name, "");
+        return;
     }
 
+    char temp[MAX_PATH];
+    strncpy(temp, path, MAX_PATH - 1);
+    temp[MAX_PATH - 1] = '\0';
 
-    char src_path[MAX_PATH];
-    char dest_path[MAX_PATH];
-    char src_name[MAX_NAME];
-    char dest_name[MAX_NAME];
-
+    char *last_slash = strrchr(temp, '/');
 
-    split_path(from, src_path, src_name);
-    split_path(to, dest_path, dest_name);
-    fused_inode_t *src_parent = path_to_inode(src_path);
-    fused_inode_t *dest_parent = path_to_inode(dest_path);
+    if (!last_slash)
+    {
+        strcpy(parent_path, "/");
+        strcpy(child_name, temp);
+        return;
+    }
 
-    int rc = dir_add_entry(dest_parent, dest_name, inode);
-    if (rc != 0)
+    if (last_slash == temp)
     {
-        return rc;
+        // Parent is root
+        strcpy(parent_path, "/");
+        strcpy(child_name, last_slash + 1);
     }
-    rc = dir_rm_entry(src_parent, src_name, inode);
-    if (rc != 0)
+    else
     {
-        dir_rm_entry(dest_parent, dest_name, inode);
-        return rc;
+        *last_slash = '\0';
+        strcpy(parent_path, temp);
+        strcpy(child_name, last_slash + 1);
     }
-    // accessed, and modified now
-    inode->atime = time(NULL);
-    inode->mtime = inode->atime;
-    return 0;
 }
 
 /**
- * @brief Called to remove a file
+ * @brief FNV-1a hash of a directory entry name
  */
-int fused_unlink(const char* path)
+static uint32_t dir_name_hash(const char *name)
 {
-    fused_inode_t *inode = path_to_inode(path);
-    if (!inode)
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++)
     {
-        return -ENOENT;
+        hash ^= *p;
+        hash *= 16777619u;
     }
-    char parent_path[MAX_PATH];
-    char child_name[MAX_NAME];
-    split_path(path, parent_path, child_name);
-
-    fused_inode_t *parent = path_to_inode(parent_path);
+    return hash;
+}
 
-    if (!parent || !S_ISDIR(parent->mode))
+/**
+ * @brief Allocate an empty dirent store for a directory inode
+ * @return 0 on success, -ENOMEM on failure
+ */
+static int dir_alloc(fused_inode_t *inode)
+{
+    fused_dir_t *dir = calloc(1, sizeof(fused_dir_t));
+    if (!dir)
     {
-        return -ENOENT;
+        return -ENOMEM;
     }
 
-    int rc = dir_rm_entry(parent, child_name, inode);
-    if (rc == 0){
-      free_inode(inode);
+    dir->entries = malloc(DIR_INITIAL_ENTRIES * sizeof(fused_dirent_t));
+    dir->names = malloc(DIR_INITIAL_ENTRIES * 32);
+    dir->index = calloc(DIR_INITIAL_ENTRIES * 2, sizeof(uint32_t));
+    if (!dir->entries || !dir->names || !dir->index)
+    {
+        free(dir->entries);
+        free(dir->names);
+        free(dir->index);
+        free(dir);
+        return -ENOMEM;
     }
+    dir->entries_capacity = DIR_INITIAL_ENTRIES;
+    dir->names_capacity = DIR_INITIAL_ENTRIES * 32;
+    dir->index_slots = DIR_INITIAL_ENTRIES * 2;
+    dir->next_cookie = DIR_FIRST_COOKIE;
 
-
-    return rc;
+    inode->dirents = dir;
+    return 0;
 }
 
-void log_message(const char *fmt, ...)
+/**
+ * @brief Release a directory's dirent store
+ */
+static void dir_free(fused_inode_t *inode)
 {
-    va_list args;
-    va_start(args, fmt);
-    fprintf(stderr, "[FUSED] ");
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
-    va_end(args);
+    fused_dir_t *dir = inode->dirents;
+    if (!dir)
+        return;
+
+    free(dir->entries);
+    free(dir->names);
+    free(dir->index);
+    free(dir);
+    inode->dirents = NULL;
 }
 
 /**
- * @brief Find inode by inode number
+ * @brief Probe the directory name index for an entry
+ * @param index_slot receives the index slot holding the entry (may be NULL)
+ * @return entry slot, or -1 if the name is not present
  */
-fused_inode_t *lookup_inode(uint64_t ino)
+static int dir_index_find(const fused_dir_t *dir, const char *name, uint32_t hash,
+                          uint32_t *index_slot)
 {
-    for (int i = 0; i < g_state->n_inodes; i++)
+    uint32_t mask = dir->index_slots - 1;
+    uint32_t pos = hash & mask;
+
+    // Linear probing; tombstones keep the chain intact, empty slots end it
+    for (uint32_t probes = 0; probes < dir->index_slots; probes++)
     {
-        if (g_state->inodes[i].ino == ino)
+        uint32_t entry = dir->index[pos];
+        if (entry == 0)
         {
-            return &g_state->inodes[i];
+            return -1;
         }
+        if (entry != DIR_INDEX_TOMBSTONE &&
+            dir->entries[entry - 1].hash == hash &&
+            strcmp(dirent_name(dir, &dir->entries[entry - 1]), name) == 0)
+        {
+            if (index_slot)
+                *index_slot = pos;
+            return entry - 1;
+        }
+        pos = (pos + 1) & mask;
     }
-    return NULL;
+    return -1;
 }
 
 /**
- * @brief Generate backing file path for an inode
+ * @brief Insert an existing entry slot into the directory name index
  */
-static void generate_backing_path(fused_inode_t *inode, uint64_t ino)
+static void dir_index_insert(fused_dir_t *dir, uint32_t entry_slot)
 {
-    snprintf(inode->backing_path, MAX_PATH, "%s/inode_%lu",
-             g_state->backing_dir, ino);
+    uint32_t mask = dir->index_slots - 1;
+    uint32_t pos = dir->entries[entry_slot].hash & mask;
+
+    while (dir->index[pos] != 0 && dir->index[pos] != DIR_INDEX_TOMBSTONE)
+    {
+        pos = (pos + 1) & mask;
+    }
+    if (dir->index[pos] == DIR_INDEX_TOMBSTONE)
+    {
+        dir->index_tombstones--;
+    }
+    dir->index[pos] = entry_slot + 1;
 }
 
 /**
- * @brief Resolve path to inode
+ * @brief Rebuild the name index at the given size, dropping all tombstones
+ * @return 0 on success, -ENOMEM if the new index could not be allocated
  */
-fused_inode_t *path_to_inode(const char *path)
+static int dir_index_rebuild(fused_dir_t *dir, uint32_t slots)
 {
-    if (strcmp(path, "/") == 0)
+    uint32_t *index = calloc(slots, sizeof(uint32_t));
+    if (!index)
     {
-        return lookup_inode(FUSE_ROOT_ID);
+        return -ENOMEM;
     }
 
-    fused_inode_t *current = lookup_inode(FUSE_ROOT_ID);
-    if (!current)
-        return NULL;
-
-    char path_copy[MAX_PATH];
-    strncpy(path_copy, path, MAX_PATH - 1);
-    path_copy[MAX_PATH - 1] = '\0';
+    dir_index_install(dir, index, slots);
+    return 0;
+}
 
-    char *saveptr;
-    char *token = strtok_r(path_copy + 1, "/", &saveptr); // Skip leading '/'
+/**
+ * @brief Replace the name index with an empty one and index every live entry
+ */
+static void dir_index_install(fused_dir_t *dir, uint32_t *index, uint32_t slots)
+{
+    free(dir->index);
+    dir->index = index;
+    dir->index_slots = slots;
+    dir->index_tombstones = 0;
 
-    while (token != NULL)
+    for (uint32_t i = 0; i < dir->n_used; i++)
     {
-        if (!S_ISDIR(current->mode))
-        {
-            return NULL;
-        }
-
-        // Search for child with matching name
-        int found = 0;
-        for (int i = 0; i < current->n_children; i++)
-        {
-            if (strcmp(current->child_names[i], token) == 0)
-            {
-                current = lookup_inode(current->child_inodes[i]);
-                if (!current)
-                    return NULL;
-                found = 1;
-                break;
-            }
-        }
-
-        if (!found)
-        {
-            return NULL;
-        }
-
-        token = strtok_r(NULL, "/", &saveptr);
+        if (dir->entries[i].ino != 0)
+            dir_index_insert(dir, i);
     }
-
-    return current;
 }
 
 /**
- * @brief Allocate a new inode
- * @return pointer to new inode, or NULL if no space
+ * @brief Repack the name arena so it only holds live entry names
  */
-static fused_inode_t *alloc_inode(void)
+static void dir_compact_names(fused_dir_t *dir)
 {
-    if (g_state->n_inodes >= MAX_INODES)
+    char *names = malloc(dir->names_capacity);
+    if (!names)
     {
-        return NULL;
+        // Keep the fragmented arena; it is still valid
+        return;
     }
 
-    fused_inode_t *inode = &g_state->inodes[g_state->n_inodes];
-
-    // Clear entire inode slot
-    memset(inode, 0, sizeof(fused_inode_t));
-
-    inode->ino = g_state->n_inodes + 1;
-    generate_backing_path(inode, inode->ino);
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < dir->n_used; i++)
+    {
+        if (dir->entries[i].ino == 0)
+            continue;
+        const char *name = dirent_name(dir, &dir->entries[i]);
+        size_t name_size = strlen(name) + 1;
+        memcpy(names + len, name, name_size);
+        dir->entries[i].name_off = len;
+        len += name_size;
+    }
 
-    // Note: n_inodes is incremented here, so if the caller fails,
-    // they must call free_inode() which will handle rollback
-    g_state->n_inodes++;
-    return inode;
+    free(dir->names);
+    dir->names = names;
+    dir->names_len = len;
+    dir->names_dead = 0;
 }
 
 /**
- * @brief Free an inode (mark as unused)
- * This implementation handles rollback if the inode was just allocated.
- * Fixed: Now properly decrements n_inodes to prevent zombie inodes.
+ * @brief Squeeze the holes out of the entry array, keeping cookie order
+ * Entry slots move, so the name index is rebuilt along with them.
  */
-static void free_inode(fused_inode_t *inode)
+static void dir_compact_entries(fused_dir_t *dir)
 {
-    if (!inode)
+    uint32_t *index = calloc(dir->index_slots, sizeof(uint32_t));
+    if (!index)
+    {
+        // Keep the holes; lookups and listings skip them
         return;
+    }
 
-    // Clean up backing file if it exists
-    if (inode->backing_path[0] != '\0')
+    uint32_t live = 0;
+    for (uint32_t i = 0; i < dir->n_used; i++)
     {
-        unlink(inode->backing_path);
+        if (dir->entries[i].ino != 0)
+            dir->entries[live++] = dir->entries[i];
     }
+    dir->n_used = live;
+    dir_index_install(dir, index, dir->index_slots);
+}
 
-    // If this is the most recently allocated inode, we can safely roll back
-    // by decrementing n_inodes. This prevents "holes" in the inode array.
-    if (inode == &g_state->inodes[g_state->n_inodes - 1])
+/**
+ * @brief First entry slot whose cookie is past offset
+ * Holes keep their cookies, so the whole used range is sorted.
+ */
+static uint32_t dir_seek(const fused_dir_t *dir, off_t offset)
+{
+    uint32_t lo = 0;
+    uint32_t hi = dir->n_used;
+    while (lo < hi)
     {
-        g_state->n_inodes--;
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((off_t)dir->entries[mid].cookie <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-
-    // Clear the inode slot
-    memset(inode, 0, sizeof(fused_inode_t));
+    return lo;
 }
 
 /**
- * @brief Split full path into parent path and child name
+ * @brief Find a child of a directory by name
+ * @pre dir is locked
+ * @return child inode, or NULL if not found
  */
-static void split_path(const char *path, char *parent_path, char *child_name)
+static fused_inode_t *dir_lookup_locked(fused_inode_t *dir, const char *name)
 {
-    if (strcmp(path, "/") == 0)
+    if (!dir || !S_ISDIR(dir->mode) || !dir->dirents)
     {
-        strcpy(parent_path, "/");
-        strcpy(child_name, "");
-        return;
+        return NULL;
     }
 
-    char temp[MAX_PATH];
-    strncpy(temp, path, MAX_PATH - 1);
-    temp[MAX_PATH - 1] = '\0';
+    int slot = dir_index_find(dir->dirents, name, dir_name_hash(name), NULL);
+    if (slot < 0)
+    {
+        return NULL;
+    }
+    return lookup_inode(dir->dirents->entries[slot].ino);
+}
 
-    char *last_slash = strrchr(temp, '/');
+/**
+ * @brief Insert a name into a dirent store
+ * @return 0, -EEXIST, -ENAMETOOLONG or -ENOMEM
+ */
+static int dir_insert(fused_dir_t *d, const char *name, uint64_t ino)
+{
+    size_t name_size = strlen(name) + 1;
+    if (name_size > MAX_NAME)
+    {
+        return -ENAMETOOLONG;
+    }
 
-    if (!last_slash)
+    uint32_t hash = dir_name_hash(name);
+
+    // Check duplicate name
+    if (dir_index_find(d, name, hash, NULL) >= 0)
     {
-        strcpy(parent_path, "/");
-        strcpy(child_name, temp);
-        return;
+        return -EEXIST;
     }
 
-    if (last_slash == temp)
+    // Grow the entry array, the name arena and the index as needed
+    if (d->n_used == d->entries_capacity)
     {
-        // Parent is root
-        strcpy(parent_path, "/");
-        strcpy(child_name, last_slash + 1);
+        uint32_t capacity = d->entries_capacity * 2;
+        fused_dirent_t *entries = realloc(d->entries, capacity * sizeof(*entries));
+        if (!entries)
+        {
+            return -ENOMEM;
+        }
+        d->entries = entries;
+        d->entries_capacity = capacity;
     }
-    else
+    if (d->names_len + name_size > d->names_capacity)
     {
-        *last_slash = '\0';
-        strcpy(parent_path, temp);
-        strcpy(child_name, last_slash + 1);
+        uint32_t capacity = d->names_capacity * 2;
+        while (d->names_len + name_size > capacity)
+        {
+            capacity *= 2;
+        }
+        char *names = realloc(d->names, capacity);
+        if (!names)
+        {
+            return -ENOMEM;
+        }
+        d->names = names;
+        d->names_capacity = capacity;
+    }
+    // Keep the load factor (live entries plus tombstones) at or below 1/2
+    if ((d->n_entries + d->index_tombstones + 1) * 2 > d->index_slots)
+    {
+        uint32_t slots = d->index_slots;
+        while ((d->n_entries + 1) * 2 > slots)
+        {
+            slots *= 2;
+        }
+        int rc = dir_index_rebuild(d, slots);
+        if (rc != 0)
+        {
+            return rc;
+        }
     }
+
+    uint32_t slot = d->n_used;
+    memcpy(d->names + d->names_len, name, name_size);
+    d->entries[slot].ino = ino;
+    d->entries[slot].cookie = d->next_cookie++;
+    d->entries[slot].name_off = d->names_len;
+    d->entries[slot].hash = hash;
+    d->names_len += name_size;
+
+    d->n_used++;
+    d->n_entries++;
+    dir_index_insert(d, slot);
+    return 0;
 }
 
 /**
- * @brief Add a child entry to a directory
+ * @brief Add a child entry to a directory and record it in the inode table
+ * @pre dir is write-locked, and so is child unless nothing else can see it
  */
-static int dir_add_entry(fused_inode_t *dir, const char *name, fused_inode_t *child)
+static int dir_add_locked(fused_inode_t *dir, const char *name, fused_inode_t *child)
 {
-    if (!dir || !S_ISDIR(dir->mode))
+    if (!dir || !S_ISDIR(dir->mode) || !dir->dirents)
     {
         return -ENOTDIR;
     }
 
-    if (dir->n_children >= MAX_CHILDREN)
+    int rc = dir_insert(dir->dirents, name, child->ino);
+    if (rc != 0)
     {
-        return -ENOSPC;
+        return rc;
     }
 
-    // Check duplicate name
-    for (int i = 0; i < dir->n_children; i++)
+    dir->mtime = time(NULL);
+    dir->ctime = dir->mtime;
+    __atomic_add_fetch(&dir->dir_version, 1, __ATOMIC_RELEASE);
+
+    // The child's record carries the link; the directory's only its times
+    itable_put(child, dir->ino, name);
+    itable_update(dir);
+    return 0;
+}
+
+/**
+ * @brief Remove a child entry from a directory
+ * @pre dir is write-locked
+ */
+static int dir_rm_locked(fused_inode_t *dir, const char *name, fused_inode_t *child)
+{
+    if (!dir || !S_ISDIR(dir->mode) || !dir->dirents)
     {
-        if (strcmp(dir->child_names[i], name) == 0)
-        {
-            return -EEXIST;
-        }
+        return -ENOTDIR;
+    }
+
+    fused_dir_t *d = dir->dirents;
+    uint32_t index_slot;
+    int slot = dir_index_find(d, name, dir_name_hash(name), &index_slot);
+    if (slot < 0 || d->entries[slot].ino != child->ino)
+    {
+        return -ENOENT;
     }
 
-    strncpy(dir->child_names[dir->n_children], name, MAX_NAME - 1);
-    dir->child_names[dir->n_children][MAX_NAME - 1] = '\0';
+    d->index[index_slot] = DIR_INDEX_TOMBSTONE;
+    d->index_tombstones++;
+    d->names_dead += strlen(name) + 1;
 
-    dir->child_inodes[dir->n_children] = child->ino;
+    // Leave a hole: moving another entry here would change its position in
+    // listings that are in progress
+    d->entries[slot].ino = 0;
+    d->n_entries--;
+    while (d->n_used > 0 && d->entries[d->n_used - 1].ino == 0)
+    {
+        d->n_used--;
+    }
 
-    dir->n_children++;
+    // Squeeze out holes once they are half the array
+    if (d->n_used - d->n_entries > d->n_used / 2)
+    {
+        dir_compact_entries(d);
+    }
+    // Too many tombstones lengthen probe chains; compact the index
+    else if (d->index_tombstones > d->index_slots / 4)
+    {
+        dir_index_rebuild(d, d->index_slots);
+    }
+    // Reclaim arena space once most of it belongs to removed names
+    if (d->names_dead > d->names_capacity / 2)
+    {
+        dir_compact_names(d);
+    }
 
     dir->mtime = time(NULL);
     dir->ctime = dir->mtime;
+    __atomic_add_fetch(&dir->dir_version, 1, __ATOMIC_RELEASE);
 
+    itable_unlink(child, dir->ino, name);
+    itable_update(dir);
     return 0;
 }
 
 /**
- * @brief Remove a child entry from a directory
+ * @brief Find a child of a directory by name
+ * @return child inode, or NULL if not found
  */
-static int dir_rm_entry(fused_inode_t *dir, const char *name, fused_inode_t *child)
+fused_inode_t *dir_lookup(fused_inode_t *dir, const char *name)
 {
-    if (!dir || !S_ISDIR(dir->mode))
+    if (!dir)
     {
-        return -ENOTDIR;
+        return NULL;
     }
 
-    for (int i = 0; i < dir->n_children; i++)
-    {
-        if (strcmp(dir->child_names[i], name) == 0 &&
-            dir->child_inodes[i] == child->ino)
-        {
-
-            // Shift left
-            for (int j = i; j < dir->n_children - 1; j++)
-            {
-                strncpy(dir->child_names[j],
-                        dir->child_names[j + 1],
-                        MAX_NAME);
+    inode_rdlock(dir);
+    fused_inode_t *child = dir_lookup_locked(dir, name);
+    inode_unlock(dir);
+    return child;
+}
 
-                dir->child_inodes[j] =
-                    dir->child_inodes[j + 1];
-            }
+/**
+ * @brief Find a child of a directory and take a kernel lookup reference
+ * The reference is taken under the directory lock, so the child cannot be
+ * unlinked and its slot reused in between; once held, an unlink leaves the
+ * inode for the matching forget.
+ * @return child inode, or NULL if not found
+ */
+fused_inode_t *dir_lookup_ref(fused_inode_t *dir, const char *name)
+{
+    inode_rdlock(dir);
+    fused_inode_t *child = dir_lookup_locked(dir, name);
+    if (child)
+        inode_ref(child);
+    inode_unlock(dir);
+    return child;
+}
 
-            dir->n_children--;
+/**
+ * @brief Add a child entry to a directory
+ */
+int dir_add_entry(fused_inode_t *dir, const char *name, fused_inode_t *child)
+{
+    if (!dir)
+    {
+        return -ENOTDIR;
+    }
 
-            dir->mtime = time(NULL);
-            dir->ctime = dir->mtime;
+    inode_wrlock(dir);
+    int rc = dir_add_locked(dir, name, child);
+    inode_unlock(dir);
+    return rc;
+}
 
-            return 0;
-        }
+/**
+ * @brief Remove a child entry from a directory
+ */
+int dir_rm_entry(fused_inode_t *dir, const char *name, fused_inode_t *child)
+{
+    if (!dir)
+    {
+        return -ENOTDIR;
     }
 
-    return -ENOENT;
+    inode_wrlock(dir);
+    int rc = dir_rm_locked(dir, name, child);
+    inode_unlock(dir);
+    return rc;
 }
@@ -0,0 +1,218 @@
+/**
+ * @file fused_pathcache.c
+ * @brief Path lookup cache: sets, validation and replacement
+ */
+
+#include "fused_fs.h"
+#include "fused_pathcache.h"
+
+/**
+ * @brief Where one walk of a path ended
+ */
+typedef struct {
+    uint64_t hash;                  // 0 = unused way
+    uint64_t ino;                   // 0 = the path does not exist
+    uint64_t dir;                   // Directory searched for the last component
+    uint32_t version;               // dir->dir_version when it was searched
+    uint64_t epoch;                 // Cache epoch the entry was filled in
+    uint64_t last_use;              // Replacement clock
+    char path[MAX_PATH];
+} pc_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pc_entry_t ways[PC_WAYS];
+} pc_set_t;
+
+static struct {
+    bool enabled;                   // Atomic
+    uint64_t epoch;                 // Atomic; bumped to drop every entry
+    uint64_t clock;                 // Stamps entry use for replacement
+    pathcache_stats_t stats;        // Updated atomically
+    pc_set_t sets[PC_SETS];
+} g_pc = {
+    .enabled = true,
+    .epoch = 1,
+};
+
+/**
+ * @brief FNV-1a of the path, never 0 so that 0 can mark unused ways
+ */
+static uint64_t path_hash(const char *path)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++)
+    {
+        h ^= *p;
+        h *= 0x100000001b3ull;
+    }
+    return h ? h : 1;
+}
+
+static pc_set_t *path_set(uint64_t hash)
+{
+    return &g_pc.sets[(hash >> 32) % PC_SETS];
+}
+
+/**
+ * @brief Entry for path in a set, or NULL
+ * @pre the set's lock is held
+ */
+static pc_entry_t *find_entry(pc_set_t *set, uint64_t hash, const char *path)
+{
+    for (int i = 0; i < PC_WAYS; i++)
+    {
+        pc_entry_t *e = &set->ways[i];
+        if (e->hash == hash && strcmp(e->path, path) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Least recently used way of a set, for a new entry
+ * @pre the set's lock is held
+ */
+static pc_entry_t *victim_entry(pc_set_t *set)
+{
+    pc_entry_t *victim = &set->ways[0];
+    for (int i = 1; i < PC_WAYS; i++)
+    {
+        if (set->ways[i].last_use < victim->last_use)
+            victim = &set->ways[i];
+    }
+    return victim;
+}
+
+/**
+ * @brief Whether an entry still says what a walk would find now
+ * The directory is checked by inode number, so a freed or reused slot
+ * fails; its version is read before the number is checked again, so the
+ * version belongs to the directory the entry was filled from.
+ */
+static bool entry_valid(const pc_entry_t *e)
+{
+    if (e->epoch != __atomic_load_n(&g_pc.epoch, __ATOMIC_ACQUIRE))
+        return false;
+
+    fused_inode_t *dir = lookup_inode(e->dir);
+    if (!dir || __atomic_load_n(&dir->dir_version, __ATOMIC_ACQUIRE) != e->version ||
+        INODE_LOAD(dir->ino) != e->dir)
+        return false;
+
+    return e->ino == 0 || lookup_inode(e->ino) != NULL;
+}
+
+void pathcache_init(void)
+{
+    // A new namespace may reuse inode numbers and versions of the old one
+    for (int i = 0; i < PC_SETS; i++)
+    {
+        pthread_mutex_init(&g_pc.sets[i].lock, NULL);
+        memset(g_pc.sets[i].ways, 0, sizeof(g_pc.sets[i].ways));
+    }
+    pathcache_configure(fused_env_size("pathcache", "FUSED_PATH_CACHE", 1) != 0);
+}
+
+void pathcache_destroy(void)
+{
+    for (int i = 0; i < PC_SETS; i++)
+    {
+        pthread_mutex_destroy(&g_pc.sets[i].lock);
+    }
+}
+
+void pathcache_configure(bool enabled)
+{
+    __atomic_add_fetch(&g_pc.epoch, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_pc.enabled, enabled, __ATOMIC_RELAXED);
+}
+
+uint64_t pathcache_epoch(void)
+{
+    return __atomic_load_n(&g_pc.epoch, __ATOMIC_ACQUIRE);
+}
+
+pathcache_result_t pathcache_get(const char *path, fused_inode_t **inode)
+{
+    if (!__atomic_load_n(&g_pc.enabled, __ATOMIC_RELAXED))
+        return PC_MISS;
+
+    uint64_t hash = path_hash(path);
+    pc_set_t *set = path_set(hash);
+    pathcache_result_t result = PC_MISS;
+
+    pthread_mutex_lock(&set->lock);
+    pc_entry_t *e = find_entry(set, hash, path);
+    if (e && entry_valid(e))
+    {
+        e->last_use = __atomic_add_fetch(&g_pc.clock, 1, __ATOMIC_RELAXED);
+        if (e->ino)
+        {
+            *inode = lookup_inode(e->ino);
+            result = *inode ? PC_HIT : PC_MISS;
+        }
+        else
+        {
+            result = PC_NEGATIVE;
+        }
+    }
+    else if (e)
+    {
+        e->hash = 0;
+        e->last_use = 0;
+        __atomic_add_fetch(&g_pc.stats.stale, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    if (result == PC_HIT)
+        __atomic_add_fetch(&g_pc.stats.hits, 1, __ATOMIC_RELAXED);
+    else if (result == PC_NEGATIVE)
+        __atomic_add_fetch(&g_pc.stats.negative_hits, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&g_pc.stats.misses, 1, __ATOMIC_RELAXED);
+    return result;
+}
+
+void pathcache_put(const char *path, const fused_inode_t *inode, const fused_inode_t *dir,
+                   uint32_t version, uint64_t epoch)
+{
+    if (!__atomic_load_n(&g_pc.enabled, __ATOMIC_RELAXED) || strlen(path) >= MAX_PATH)
+        return;
+    // A directory moved during the walk: what it found may be neither old nor new
+    if (epoch != pathcache_epoch())
+        return;
+
+    uint64_t hash = path_hash(path);
+    pc_set_t *set = path_set(hash);
+
+    pthread_mutex_lock(&set->lock);
+    pc_entry_t *e = find_entry(set, hash, path);
+    if (!e)
+    {
+        e = victim_entry(set);
+        e->hash = hash;
+        snprintf(e->path, MAX_PATH, "%s", path);
+    }
+    e->ino = inode ? INODE_LOAD(inode->ino) : 0;
+    e->dir = INODE_LOAD(dir->ino);
+    e->version = version;
+    e->epoch = epoch;
+    e->last_use = __atomic_add_fetch(&g_pc.clock, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&set->lock);
+}
+
+void pathcache_invalidate(void)
+{
+    __atomic_add_fetch(&g_pc.epoch, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_pc.stats.invalidations, 1, __ATOMIC_RELAXED);
+}
+
+void pathcache_get_stats(pathcache_stats_t *stats)
+{
+    stats->hits = __atomic_load_n(&g_pc.stats.hits, __ATOMIC_RELAXED);
+    stats->negative_hits = __atomic_load_n(&g_pc.stats.negative_hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&g_pc.stats.misses, __ATOMIC_RELAXED);
+    stats->stale = __atomic_load_n(&g_pc.stats.stale, __ATOMIC_RELAXED);
+    stats->invalidations = __atomic_load_n(&g_pc.stats.invalidations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,299 @@
+/**
+ * @file fused_prefetch.c
+ * @brief Stream table, window sizing and the thread that issues read-ahead
+ */
+
+#include "fused_fs.h"
+#include "fused_fdcache.h"
+#include "fused_prefetch.h"
+
+#define PF_SETS 64                  // Stream table sets, each with its own lock
+#define PF_WAYS 4                   // Streams tracked per set
+#define PF_QUEUE_LEN 64             // Windows waiting for the prefetch thread
+
+/**
+ * @brief One reader moving sequentially through a file
+ */
+typedef struct {
+    uint64_t ino;                   // 0 = unused way
+    off_t next;                     // Where the next sequential read starts
+    off_t ra_end;                   // End of the prefetched range, 0 = none yet
+    size_t last_window;             // Size of the window issued last
+    uint32_t seq_reads;             // Reads in the stream, the first included
+    uint64_t last_use;              // Replacement clock
+} pf_stream_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pf_stream_t ways[PF_WAYS];
+} pf_set_t;
+
+typedef struct {
+    uint64_t ino;
+    off_t offset;
+    size_t len;
+} pf_request_t;
+
+static struct {
+    pthread_mutex_t lock;           // Guards the queue and the thread state
+    pthread_cond_t wake;
+    pf_request_t queue[PF_QUEUE_LEN];
+    uint32_t head;                  // Oldest queued request
+    uint32_t count;
+    size_t window;                  // First window of a stream
+    size_t max_window;              // 0 = prefetching off
+    uint64_t clock;                 // Stamps stream use for replacement
+    prefetch_stats_t stats;         // Updated atomically
+    pthread_t worker;
+    bool running;
+    pf_set_t sets[PF_SETS];
+} g_pf = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .window = PF_DEFAULT_WINDOW,
+    .max_window = PF_DEFAULT_MAX,
+    .sets = { [0 ... PF_SETS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER } },
+};
+
+static pf_set_t *stream_set(uint64_t ino)
+{
+    // Fibonacci hashing spreads slot and generation bits alike
+    return &g_pf.sets[(uint32_t)((ino * 0x9E3779B97F4A7C15ull) >> 32) % PF_SETS];
+}
+
+/**
+ * @brief Stream of ino that a read at offset continues, or NULL
+ * @pre the set's lock is held
+ */
+static pf_stream_t *find_stream(pf_set_t *set, uint64_t ino, off_t offset)
+{
+    for (int i = 0; i < PF_WAYS; i++)
+    {
+        pf_stream_t *s = &set->ways[i];
+        if (s->ino == ino && offset >= s->next - PF_MATCH_SLACK &&
+            offset <= s->next + PF_MATCH_SLACK)
+            return s;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Least recently used way of a set, for a new stream
+ * @pre the set's lock is held
+ */
+static pf_stream_t *victim_stream(pf_set_t *set)
+{
+    pf_stream_t *victim = &set->ways[0];
+    for (int i = 1; i < PF_WAYS; i++)
+    {
+        if (set->ways[i].last_use < victim->last_use)
+            victim = &set->ways[i];
+    }
+    return victim;
+}
+
+static bool enqueue(const pf_request_t *req)
+{
+    pthread_mutex_lock(&g_pf.lock);
+    bool queued = g_pf.running && g_pf.count < PF_QUEUE_LEN;
+    if (queued)
+    {
+        g_pf.queue[(g_pf.head + g_pf.count) % PF_QUEUE_LEN] = *req;
+        g_pf.count++;
+        pthread_cond_signal(&g_pf.wake);
+    }
+    pthread_mutex_unlock(&g_pf.lock);
+    return queued;
+}
+
+void prefetch_note_read(uint64_t ino, off_t offset, size_t size, off_t file_size)
+{
+    size_t max_window = __atomic_load_n(&g_pf.max_window, __ATOMIC_RELAXED);
+    if (max_window == 0 || size == 0)
+        return;
+
+    off_t end = offset + (off_t)size;
+    uint64_t now = __atomic_add_fetch(&g_pf.clock, 1, __ATOMIC_RELAXED);
+    pf_set_t *set = stream_set(ino);
+    pf_request_t req = {ino, 0, 0};
+
+    pthread_mutex_lock(&set->lock);
+    pf_stream_t *s = find_stream(set, ino, offset);
+    if (!s)
+    {
+        // Random access, or the first read of a stream: just remember it
+        s = victim_stream(set);
+        memset(s, 0, sizeof(*s));
+        s->ino = ino;
+        s->next = end;
+        s->seq_reads = 1;
+        s->last_use = now;
+        pthread_mutex_unlock(&set->lock);
+        return;
+    }
+
+    s->last_use = now;
+    if (s->ra_end > 0 && end <= s->ra_end)
+        __atomic_add_fetch(&g_pf.stats.hits, 1, __ATOMIC_RELAXED);
+    if (end > s->next)
+        s->next = end;
+    if (++s->seq_reads == PF_TRIGGER_READS)
+        __atomic_add_fetch(&g_pf.stats.streams, 1, __ATOMIC_RELAXED);
+
+    // Issue the next window once the reader is into the second half of the
+    // last one; every window the reader keeps up with doubles the next
+    off_t ahead = s->ra_end - end;
+    if (s->seq_reads >= PF_TRIGGER_READS && ahead < (off_t)(s->last_window / 2))
+    {
+        size_t window = s->last_window ? s->last_window * 2
+                                       : __atomic_load_n(&g_pf.window, __ATOMIC_RELAXED);
+        if (window > max_window)
+            window = max_window;
+        off_t start = s->ra_end > end ? s->ra_end : end;
+        if (start < file_size)
+        {
+            req.offset = start;
+            req.len = (size_t)(file_size - start) < window ? (size_t)(file_size - start)
+                                                           : window;
+            s->ra_end = start + (off_t)req.len;
+            s->last_window = window;
+        }
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    if (req.len == 0)
+        return;
+    if (enqueue(&req))
+        __atomic_add_fetch(&g_pf.stats.windows, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&g_pf.stats.dropped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Ask the kernel to read a window of a backing file
+ * The inode may have been freed or reused since the window was queued.
+ */
+static void prefetch_window(const pf_request_t *req)
+{
+    fused_inode_t *inode = lookup_inode(req->ino);
+    if (!inode)
+        return;
+
+    // Segmented files have no backing file of their own to read ahead in,
+    // and offsets in a compressed one are not file offsets
+    inode_rdlock(inode);
+    if (INODE_LOAD(inode->ino) != req->ino || inode->seg_map || inode->compressed)
+    {
+        inode_unlock(inode);
+        return;
+    }
+    // Appends still in the write-back buffer are not in the backing file
+    off_t durable = INODE_LOAD(inode->durable);
+    int fd = fd_cache_get(req->ino, inode->backing_path, 0);
+    inode_unlock(inode);
+    if (fd < 0)
+        return;
+
+    off_t end = req->offset + (off_t)req->len;
+    if (end > durable)
+        end = durable;
+    if (end > req->offset &&
+        posix_fadvise(fd, req->offset, end - req->offset, POSIX_FADV_WILLNEED) == 0)
+    {
+        __atomic_add_fetch(&g_pf.stats.bytes, (uint64_t)(end - req->offset),
+                           __ATOMIC_RELAXED);
+    }
+    fd_cache_put(req->ino);
+}
+
+static void *prefetch_thread(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&g_pf.lock);
+    while (g_pf.running)
+    {
+        if (g_pf.count == 0)
+        {
+            pthread_cond_wait(&g_pf.wake, &g_pf.lock);
+            continue;
+        }
+
+        pf_request_t req = g_pf.queue[g_pf.head];
+        g_pf.head = (g_pf.head + 1) % PF_QUEUE_LEN;
+        g_pf.count--;
+
+        pthread_mutex_unlock(&g_pf.lock);
+        prefetch_window(&req);
+        pthread_mutex_lock(&g_pf.lock);
+    }
+    pthread_mutex_unlock(&g_pf.lock);
+    return NULL;
+}
+
+void prefetch_configure(size_t window, size_t max_window)
+{
+    __atomic_store_n(&g_pf.window, window ? window : PF_DEFAULT_WINDOW, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_pf.max_window, max_window, __ATOMIC_RELAXED);
+}
+
+void prefetch_get_stats(prefetch_stats_t *stats)
+{
+    stats->streams = __atomic_load_n(&g_pf.stats.streams, __ATOMIC_RELAXED);
+    stats->windows = __atomic_load_n(&g_pf.stats.windows, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&g_pf.stats.bytes, __ATOMIC_RELAXED);
+    stats->hits = __atomic_load_n(&g_pf.stats.hits, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&g_pf.stats.dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Read the configuration from the environment and start the thread
+ * @return 0 on success, negative errno on failure
+ */
+int prefetch_init(void)
+{
+    prefetch_configure(fused_env_size("prefetch", "FUSED_PREFETCH_WINDOW", PF_DEFAULT_WINDOW),
+                       fused_env_size("prefetch", "FUSED_PREFETCH_MAX", PF_DEFAULT_MAX));
+
+    for (int i = 0; i < PF_SETS; i++)
+    {
+        pthread_mutex_lock(&g_pf.sets[i].lock);
+        memset(g_pf.sets[i].ways, 0, sizeof(g_pf.sets[i].ways));
+        pthread_mutex_unlock(&g_pf.sets[i].lock);
+    }
+
+    pthread_mutex_lock(&g_pf.lock);
+    g_pf.head = 0;
+    g_pf.count = 0;
+    g_pf.running = true;
+    int rc = pthread_create(&g_pf.worker, NULL, prefetch_thread, NULL);
+    if (rc != 0)
+    {
+        g_pf.running = false;
+    }
+    pthread_mutex_unlock(&g_pf.lock);
+    return -rc;
+}
+
+/**
+ * @brief Stop the thread and drop the windows still queued
+ * Readers still in prefetch_note_read() see prefetching off and return;
+ * the set locks are static and stay usable.
+ */
+void prefetch_destroy(void)
+{
+    __atomic_store_n(&g_pf.max_window, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_pf.lock);
+    if (!g_pf.running)
+    {
+        pthread_mutex_unlock(&g_pf.lock);
+        return;
+    }
+    g_pf.running = false;
+    g_pf.count = 0;
+    pthread_cond_signal(&g_pf.wake);
+    pthread_mutex_unlock(&g_pf.lock);
+
+    pthread_join(g_pf.worker, NULL);
+}
@@ -12,6 +12,8 @@
 extern "C"
 {
 #include "fused_fs.h"
+#include "fused_crc.h"
+#include "fused_stats.h"
 }
 
 using fused::CreateRequest;
@@ -22,10 +24,13 @@ using fused::GetRequest;
 using fused::GetResponse;
 using fused::MkdirRequest;
 using fused::MkdirResponse;
+using fused::OpStats;
 using fused::ReadDirectoryRequest;
 using fused::ReadDirectoryResponse;
 using fused::RemoveRequest;
 using fused::RemoveResponse;
+using fused::StatsRequest;
+using fused::StatsResponse;
 using fused::WriteRequest;
 using fused::WriteResponse;
 using grpc::Server;
@@ -33,6 +38,9 @@ using grpc::ServerBuilder;
 using grpc::ServerContext;
 using grpc::Status;
 
+#define RPC_READDIR_DEFAULT_PAGE 1024   // Entries per ReadDirectory page unless asked
+#define RPC_READDIR_MAX_PAGE 8192       // Cap on max_entries, bounds the response size
+
 /**
  * @brief Normalize path by removing /mnt/fused prefix if present
  */
@@ -61,6 +69,41 @@ std::string normalize_path(const std::string &path)
     return normalized;
 }
 
+/**
+ * @brief Cursor state for one ReadDirectory page
+ */
+struct ReadDirPage
+{
+    ReadDirectoryResponse *response;
+    uint32_t remaining;     // Entries the page still has room for
+    off_t next;             // Cookie after the last entry added
+    bool eof;               // Cleared when the page fills before the listing ends
+};
+
+static int fill_dir_page(void *ctx, const char *name, const struct stat *st, off_t next)
+{
+    ReadDirPage *page = static_cast<ReadDirPage *>(ctx);
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    {
+        page->next = next;
+        return 0;
+    }
+    if (page->remaining == 0)
+    {
+        page->eof = false;
+        return 1;
+    }
+
+    FileEntry *entry = page->response->add_entries();
+    entry->set_name(name);
+    entry->set_is_directory(S_ISDIR(st->st_mode));
+    entry->set_size(st->st_size);
+    entry->set_mtime(st->st_mtime);
+    page->remaining--;
+    page->next = next;
+    return 0;
+}
+
 class FileSystemServiceImpl final : public FileSystemService::Service
 {
 public:
@@ -76,15 +119,15 @@ public:
         const std::string &data = request->data();
         off_t offset = request->offset();
 
-        log_message("RPC Write: path=%s, size=%zu, offset=%ld",
-                    path.c_str(), data.size(), offset);
+        log_debug("RPC Write: path=%s, size=%zu, offset=%ld",
+                  path.c_str(), data.size(), offset);
 
         // Look up inode to get file handle
         fused_inode_t *inode = path_to_inode(path.c_str());
         if (!inode)
         {
             // File doesn't exist yet - create it
-            log_message("RPC Write: File %s not found, creating it", path.c_str());
+            log_debug("RPC Write: File %s not found, creating it", path.c_str());
             
             // Create the file with default permissions
             struct fuse_file_info fi_create;
@@ -96,9 +139,11 @@ public:
                 response->set_status_code(create_result);
                 response->set_error_message("Failed to create file");
                 response->set_bytes_written(0);
-                log_message("RPC Write: Failed to create file: %s", strerror(-create_result));
+                log_warn("RPC Write: Failed to create file: %s", strerror(-create_result));
                 return Status::OK;
             }
+            // No open handle outlives the RPC; unpin the backing descriptor
+            fused_release(path.c_str(), &fi_create);
             
             // Now look up the newly created inode
             inode = path_to_inode(path.c_str());
@@ -109,7 +154,7 @@ public:
                 return Status::OK;
             }
             
-            log_message("RPC Write: File created successfully");
+            log_debug("RPC Write: File created successfully");
         }
 
         struct fuse_file_info fi;
@@ -129,7 +174,7 @@ public:
         {
             response->set_status_code(0);
             response->set_bytes_written(result);
-            log_message("RPC Write success: %d bytes", result);
+            log_debug("RPC Write success: %d bytes", result);
         }
 
         return Status::OK;
@@ -147,8 +192,8 @@ public:
         off_t offset = request->offset();
         size_t size = request->size();
 
-        log_message("RPC Get: path=%s, offset=%ld, size=%zu",
-                    path.c_str(), offset, size);
+        log_debug("RPC Get: path=%s, offset=%ld, size=%zu",
+                  path.c_str(), offset, size);
 
         // Look up inode
         fused_inode_t *inode = path_to_inode(path.c_str());
@@ -160,10 +205,38 @@ public:
             return Status::OK;
         }
 
-        // If size=0, read entire file
-        if (size == 0)
+        // If size=0, read entire file; reads stop at EOF either way
+        off_t file_size = inode_size(inode);
+        size_t available = (offset < file_size) ? (file_size - offset) : 0;
+        if (size == 0 || size > available)
+        {
+            size = available;
+        }
+
+        // Checksums first: bytes below the end they were taken at never
+        // change, so the data read next matches them
+        std::vector<uint32_t> crcs;
+        if (offset % CRC_BLOCK_SIZE == 0)
         {
-            size = (offset < inode->size) ? (inode->size - offset) : 0;
+            crcs.resize(size / CRC_BLOCK_SIZE + 1);
+            off_t end = offset + size;
+            int n = inode_block_crcs(inode, offset, &end, crcs.data(), crcs.size());
+            crcs.resize(n > 0 ? n : 0);
+            if (n >= 0)
+            {
+                size = end - offset;
+            }
+        }
+        if (request->checksums_only())
+        {
+            response->set_crc_block_size(crcs.empty() ? 0 : CRC_BLOCK_SIZE);
+            for (uint32_t crc : crcs)
+            {
+                response->add_block_crcs(crc);
+            }
+            response->set_bytes_read(size);
+            response->set_status_code(0);
+            return Status::OK;
         }
 
         // Allocate buffer
@@ -187,7 +260,15 @@ public:
             response->set_data(buffer.data(), result);
             response->set_bytes_read(result);
             response->set_status_code(0);
-            log_message("RPC Get success: %d bytes", result);
+            if ((size_t)result == size && !crcs.empty())
+            {
+                response->set_crc_block_size(CRC_BLOCK_SIZE);
+                for (uint32_t crc : crcs)
+                {
+                    response->add_block_crcs(crc);
+                }
+            }
+            log_debug("RPC Get success: %d bytes", result);
         }
         return Status::OK;
     }
@@ -202,7 +283,7 @@ public:
 
         std::string path = normalize_path(request->pathname());
 
-        log_message("RPC ReadDirectory: path=%s", path.c_str());
+        log_debug("RPC ReadDirectory: path=%s", path.c_str());
 
         // Look up the directory
         fused_inode_t *dir = path_to_inode(path.c_str());
@@ -221,23 +302,28 @@ public:
             return Status::OK;
         }
 
-        // Add all children to response
-        for (int i = 0; i < dir->n_children; i++)
+        // One page of children, resuming after the client's cookie
+        uint32_t max_entries = request->max_entries();
+        if (max_entries == 0)
+            max_entries = RPC_READDIR_DEFAULT_PAGE;
+        else if (max_entries > RPC_READDIR_MAX_PAGE)
+            max_entries = RPC_READDIR_MAX_PAGE;
+
+        ReadDirPage page = {response, max_entries, (off_t)request->cookie(), true};
+        int rc = inode_readdir(dir, page.next, fill_dir_page, &page);
+        if (rc != 0)
         {
-            fused_inode_t *child = lookup_inode(dir->child_inodes[i]);
-            if (!child)
-                continue;
-
-            FileEntry *entry = response->add_entries();
-            entry->set_name(dir->child_names[i]);
-            entry->set_is_directory(S_ISDIR(child->mode));
-            entry->set_size(child->size);
-            entry->set_mtime(child->mtime);
+            response->set_status_code(rc);
+            response->set_error_message("Directory not found");
+            return Status::OK;
         }
 
+        response->set_next_cookie(page.next);
+        response->set_eof(page.eof);
         response->set_status_code(0);
 
-        log_message("RPC ReadDirectory success: %d entries", dir->n_children);
+        log_debug("RPC ReadDirectory success: %d entries%s", response->entries_size(),
+                  page.eof ? "" : " (more)");
         return Status::OK;
     }
 
@@ -251,18 +337,18 @@ public:
         (void)context;
 
         std::string path = normalize_path(request->pathname());
-        log_message("RPC Remove: %s", path.c_str());
+        log_debug("RPC Remove: %s", path.c_str());
 
         int res = fused_unlink(path.c_str());
         response->set_status_code(res);
         if (res < 0)
         {
             response->set_error_message(strerror(-res));
-            log_message("RPC Remove failed: %s (%d)", path.c_str(), res);
+            log_warn("RPC Remove failed: %s (%d)", path.c_str(), res);
         }
         else
         {
-            log_message("RPC Remove success: %s", path.c_str());
+            log_debug("RPC Remove success: %s", path.c_str());
         }
 
         return Status::OK;
@@ -287,7 +373,7 @@ public:
             full_path += "/";
         full_path += filename;
 
-        log_message("RPC Create: %s (mode=0%o)", full_path.c_str(), mode);
+        log_debug("RPC Create: %s (mode=0%o)", full_path.c_str(), mode);
 
         // Create file info struct
         struct fuse_file_info fi;
@@ -300,6 +386,10 @@ public:
         {
             response->set_error_message(strerror(-res));
         }
+        else
+        {
+            fused_release(full_path.c_str(), &fi);
+        }
 
         return Status::OK;
     }
@@ -323,7 +413,7 @@ public:
             full_path += "/";
         full_path += dirname;
 
-        log_message("RPC Mkdir: %s (mode=0%o)", full_path.c_str(), mode);
+        log_debug("RPC Mkdir: %s (mode=0%o)", full_path.c_str(), mode);
 
         int res = fused_mkdir(full_path.c_str(), mode);
         response->set_status_code(res);
@@ -334,6 +424,37 @@ public:
 
         return Status::OK;
     }
+
+    /**
+     * Stats - Per-operation counters and latency percentiles of this server
+     */
+    Status Stats(ServerContext *context,
+                 const StatsRequest *request,
+                 StatsResponse *response) override
+    {
+        (void)context;
+        (void)request;
+
+        for (int op = 0; op < STATS_OPS; op++)
+        {
+            stats_summary_t summary;
+            stats_summary(static_cast<stats_op_t>(op), &summary);
+
+            OpStats *entry = response->add_ops();
+            entry->set_op(stats_op_name(static_cast<stats_op_t>(op)));
+            entry->set_count(summary.count);
+            entry->set_errors(summary.errors);
+            entry->set_mean_ns(summary.mean_ns);
+            entry->set_p50_ns(summary.p50_ns);
+            entry->set_p99_ns(summary.p99_ns);
+            entry->set_max_ns(summary.max_ns);
+        }
+
+        std::string report(stats_render(nullptr, 0) + 1, '\0');
+        report.resize(stats_render(&report[0], report.size()));
+        response->set_report(report);
+        return Status::OK;
+    }
 };
 
 // ============================================================================
@@ -342,33 +463,14 @@ public:
 void RunServer(const std::string &server_address)
 {
     // Initialize in-memory filesystem state for RPC mode (no FUSE mount context).
-    g_state = (fused_state_t *)calloc(1, sizeof(fused_state_t));
-    if (!g_state) {
-        std::cerr << "Failed to allocate filesystem state" << std::endl;
+    int init_result = fused_state_init(FUSED_BACKING_DIR);
+    if (init_result != 0) {
+        log_error("Failed to initialize filesystem state in %s errno=%d",
+                  FUSED_BACKING_DIR, -init_result);
         return;
     }
 
-    snprintf(g_state->backing_dir, MAX_PATH, "/tmp/fused_backing");
-    if (mkdir(g_state->backing_dir, 0755) != 0 && errno != EEXIST) {
-        std::cerr << "Failed to create backing dir: " << g_state->backing_dir
-                  << " errno=" << errno << std::endl;
-        free(g_state);
-        g_state = nullptr;
-        return;
-    }
-
-    // Create root inode.
-    fused_inode_t *root = &g_state->inodes[0];
-    root->ino = FUSE_ROOT_ID;
-    root->mode = S_IFDIR | 0755;
-    root->uid = getuid();
-    root->gid = getgid();
-    root->size = 4096;
-    root->atime = root->mtime = root->ctime = time(NULL);
-    root->n_children = 0;
-    g_state->n_inodes = 1;
-
-    log_message("Filesystem initialized");
+    log_info("Filesystem initialized");
 
     // Start gRPC server
     FileSystemServiceImpl service;
@@ -382,12 +484,13 @@ void RunServer(const std::string &server_address)
 
     std::unique_ptr<Server> server(builder.BuildAndStart());
     if (!server) {
-        std::cerr << "Failed to start gRPC server on " << server_address << std::endl;
+        log_error("Failed to start gRPC server on %s", server_address.c_str());
         return;
     }
-    std::cout << "Server listening on " << server_address << std::endl;
+    log_info("Server listening on %s", server_address.c_str());
 
     server->Wait();
+    fused_state_destroy();
 }
 
 int main(int argc, char **argv)
@@ -396,6 +499,8 @@ int main(int argc, char **argv)
     std::string port = port_env ? port_env : "50051";
     std::string server_address = "0.0.0.0:" + port;
 
+    fused_log_init("fused-rpc");
     RunServer(server_address);
+    fused_log_shutdown();
     return 0;
 }
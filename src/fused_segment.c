@@ -0,0 +1,1447 @@
+/**
+ * @file fused_segment.c
+ * @brief Segment files, per-inode extent maps and the compactor
+ *
+ * Locking: inode lock, then a head's lock, then an extent map's lock, then
+ * the chunk table's lock. Readers pin a segment under the map (or chunk
+ * table) lock before using its descriptor; the compactor moves every
+ * extent and chunk off a segment under the same locks and waits for the
+ * pins to drain before closing it.
+ *
+ * With dedup, an append's whole SEG_CHUNK_SIZE chunks are looked up by
+ * fingerprint. A new chunk is written once as a chunk record, named by a
+ * serial number; the file gets a reference record naming the serial, and
+ * its extent points at the chunk. Chunks count their references in memory;
+ * mounting recounts them from the reference records of live inodes.
+ */
+
+#include "fused_fs.h"
+#include "fused_segment.h"
+#include "fused_io.h"
+#include <dirent.h>
+#include <sys/uio.h>
+
+#define SEG_REC_MAGIC 0x47455346u   // "FSEG"
+#define SEG_COMPACT_HEAD SEG_HEADS  // The extra head compaction copies into
+#define SEG_REC_CHUNK 0x1           // Shared chunk: ino 0, file_off = serial
+#define SEG_REC_REF 0x2             // File data held by a chunk, see seg_ref_t
+#define SEG_NONE UINT32_MAX         // Chunk whose record has not been found yet
+
+/**
+ * @brief Record header; the data follows it directly
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t len;           // Data bytes
+    uint64_t ino;           // Owner, generation included
+    uint64_t file_off;      // Where the data belongs in the file
+    uint32_t flags;         // SEG_REC_*
+    uint32_t checksum;      // Over every byte before it
+} seg_rec_hdr_t;
+
+_Static_assert(sizeof(seg_rec_hdr_t) == 32, "record header layout changed");
+
+/* A chunk record's data starts with the fingerprint of the rest */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} seg_fp_t;
+
+/* Payload of a reference record */
+typedef struct {
+    uint64_t serial;        // The chunk holding the data
+    uint32_t len;           // Bytes of it the file uses (all of them)
+    uint32_t reserved;
+} seg_ref_t;
+
+typedef struct {
+    uint32_t id;
+    int fd;
+    off_t size;             // End of the last record; grows under the head lock
+    uint64_t live;          // Data bytes some extent still points at (atomic)
+    uint32_t pins;          // Readers using fd (atomic)
+    bool sealed;            // Takes no more appends (atomic)
+} seg_file_t;
+
+typedef struct {
+    pthread_mutex_t lock;   // Serializes appends to seg
+    seg_file_t *seg;        // Active segment, NULL until the first append
+} seg_head_t;
+
+typedef struct {
+    off_t file_off;
+    off_t seg_off;          // Payload position in the segment: the data, or a seg_ref_t
+    uint32_t seg;
+    uint32_t len;
+    uint32_t chunk;         // Chunk holding the data, 0 = the record itself
+} seg_extent_t;
+
+typedef struct {
+    uint64_t serial;        // Names the chunk in reference records; 0 = free entry
+    seg_fp_t fp;
+    off_t seg_off;          // Where the data starts, past the fingerprint
+    uint32_t seg;           // SEG_NONE while loading, until its record turns up
+    uint32_t len;
+    uint32_t refs;          // Extents standing for it
+    uint32_t fp_next;       // Fingerprint chain; the free list for free entries
+    uint32_t serial_next;   // Serial chain
+    bool indexed;           // On the fingerprint chain, so appends find it
+} seg_chunk_t;
+
+struct seg_map {
+    pthread_mutex_t lock;
+    seg_extent_t *extents;  // Sorted by file_off, never overlapping
+    uint32_t n_extents;
+    uint32_t capacity;
+    uint64_t bytes;         // Sum of extent lengths (atomic)
+};
+
+typedef struct {
+    int engine;             // -1 = not given, 0 = files, 1 = segments
+    int dedup;              // -1 = not given
+    bool resolved;          // Applied once; tests reconfigure across restarts
+} seg_opts_t;
+
+static seg_opts_t g_seg_opts = { .engine = -1, .dedup = -1 };
+
+static const struct fuse_opt seg_opts[] = {
+    { "storage=files", offsetof(seg_opts_t, engine), 0 },
+    { "storage=segments", offsetof(seg_opts_t, engine), 1 },
+    { "dedup", offsetof(seg_opts_t, dedup), 1 },
+    { "no_dedup", offsetof(seg_opts_t, dedup), 0 },
+    FUSE_OPT_END
+};
+
+static struct {
+    pthread_mutex_t lock;           // Guards next_id and publishing segs[]
+    pthread_mutex_t compact_lock;   // One compaction pass at a time
+    seg_file_t **segs;              // By id; NULL = no such segment
+    uint32_t next_id;
+    seg_head_t heads[SEG_HEADS + 1];
+    char dir[MAX_PATH];
+    size_t seg_size;
+    bool enabled;
+    bool dedup;
+    uint64_t compacted;
+    periodic_t compactor;
+} g_seg = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .compact_lock = PTHREAD_MUTEX_INITIALIZER,
+    .seg_size = SEG_DEFAULT_SIZE,
+    .compactor = PERIODIC_INIT(SEG_COMPACT_MS, seg_compact),
+};
+
+/**
+ * @brief Shared chunks, found by id (extents), fingerprint (appends) and
+ * serial (records)
+ */
+static struct {
+    pthread_rwlock_t lock;
+    seg_chunk_t *chunks;            // By id; id 0 is never handed out
+    uint32_t n_ids;                 // Ids handed out so far, id 0 included
+    uint32_t capacity;
+    uint32_t free_head;             // Freed ids, chained through fp_next
+    uint32_t *fp_buckets;
+    uint32_t *serial_buckets;
+    uint32_t n_buckets;             // Power of two
+    uint32_t n_chunks;
+    uint64_t next_serial;           // Atomic
+    uint64_t bytes;                 // Data held by the chunks
+    uint64_t ref_bytes;             // File data they stand for
+    uint64_t hits;                  // Appended chunks found stored (atomic)
+} g_chunks = {
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+};
+
+/**
+ * @brief Path of a segment file in the backing directory
+ * @return 0, or -ENAMETOOLONG if it does not fit in MAX_PATH
+ */
+static int seg_path(uint32_t id, char *path)
+{
+    int n = snprintf(path, MAX_PATH, "%s/" SEG_FILE_PREFIX "%08u", g_seg.dir, id);
+    return n >= 0 && n < MAX_PATH ? 0 : -ENAMETOOLONG;
+}
+
+static seg_file_t *seg_get(uint32_t id)
+{
+    return __atomic_load_n(&g_seg.segs[id], __ATOMIC_ACQUIRE);
+}
+
+static void seg_publish(seg_file_t *seg)
+{
+    __atomic_store_n(&g_seg.segs[seg->id], seg, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Pin the segment an extent points at
+ * @pre the extent's map lock is held
+ */
+static seg_file_t *seg_pin(uint32_t id)
+{
+    seg_file_t *seg = seg_get(id);
+    __atomic_add_fetch(&seg->pins, 1, __ATOMIC_ACQ_REL);
+    return seg;
+}
+
+static void seg_unpin(seg_file_t *seg)
+{
+    __atomic_sub_fetch(&seg->pins, 1, __ATOMIC_ACQ_REL);
+}
+
+/* Write the header and payload of a record with as few calls as the kernel allows */
+static int write_record(int fd, off_t pos, const seg_rec_hdr_t *hdr,
+                        const struct iovec *parts, int n_parts)
+{
+    struct iovec iov[3] = { { (void *)hdr, sizeof(*hdr) } };
+    memcpy(&iov[1], parts, n_parts * sizeof(*parts));
+    struct iovec *v = iov;
+    int cnt = n_parts + 1;
+    while (cnt > 0)
+    {
+        ssize_t n = pwritev(fd, v, cnt, pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? -errno : -EIO;
+        pos += n;
+        while (cnt > 0 && (size_t)n >= v->iov_len)
+        {
+            n -= v->iov_len;
+            v++;
+            cnt--;
+        }
+        if (cnt > 0)
+        {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Read and check the record header at pos
+ * @return 0, or -EINVAL at the end of the valid records
+ */
+static int read_header(const seg_file_t *seg, off_t pos, off_t end, seg_rec_hdr_t *hdr)
+{
+    if (pos + (off_t)sizeof(*hdr) > end || io_pread_full(seg->fd, hdr, sizeof(*hdr), pos) != 0)
+        return -EINVAL;
+    if (hdr->magic != SEG_REC_MAGIC ||
+        hdr->checksum != fused_checksum(hdr, offsetof(seg_rec_hdr_t, checksum)) ||
+        pos + (off_t)sizeof(*hdr) + hdr->len > end)
+        return -EINVAL;
+    return 0;
+}
+
+static seg_file_t *seg_file_new(uint32_t id, int fd)
+{
+    seg_file_t *seg = calloc(1, sizeof(*seg));
+    if (seg)
+    {
+        seg->id = id;
+        seg->fd = fd;
+    }
+    return seg;
+}
+
+/**
+ * @brief Create the next segment file
+ * @pre the head's lock is held
+ */
+static int seg_create(seg_file_t **out)
+{
+    pthread_mutex_lock(&g_seg.lock);
+    if (g_seg.next_id >= SEG_MAX_SEGMENTS)
+    {
+        pthread_mutex_unlock(&g_seg.lock);
+        log_ratelimited(FUSED_LOG_ERROR, 1000, "segment: out of segment ids");
+        return -ENOSPC;
+    }
+    uint32_t id = g_seg.next_id;
+    __atomic_store_n(&g_seg.next_id, id + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_seg.lock);
+
+    char path[MAX_PATH];
+    int rc = seg_path(id, path);
+    int fd = rc == 0 ? open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644) : -1;
+    if (fd < 0)
+    {
+        rc = rc ? rc : -errno;
+        log_error("segment: cannot create %s: %s", path, strerror(-rc));
+        return rc;
+    }
+
+    // The name has to survive a crash as long as the records in the file
+    int dir_fd = open(g_seg.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    seg_file_t *seg = seg_file_new(id, fd);
+    if (!seg)
+    {
+        close(fd);
+        unlink(path);
+        return -ENOMEM;
+    }
+    seg_publish(seg);
+    *out = seg;
+    return 0;
+}
+
+/**
+ * @brief Append one record through a head
+ * The payload is gathered from up to two parts; it counts as live.
+ * @param seg_id, seg_off receive where the payload landed
+ * @return 0, or negative errno with nothing appended
+ */
+static int log_write(seg_head_t *head, uint64_t ino, uint64_t file_off, uint32_t flags,
+                     const struct iovec *parts, int n_parts, uint32_t *seg_id, off_t *seg_off)
+{
+    uint32_t len = 0;
+    for (int i = 0; i < n_parts; i++)
+        len += (uint32_t)parts[i].iov_len;
+
+    seg_rec_hdr_t hdr = {
+        .magic = SEG_REC_MAGIC,
+        .len = len,
+        .ino = ino,
+        .file_off = file_off,
+        .flags = flags,
+    };
+    hdr.checksum = fused_checksum(&hdr, offsetof(seg_rec_hdr_t, checksum));
+    off_t rec_len = (off_t)sizeof(hdr) + len;
+
+    pthread_mutex_lock(&head->lock);
+    seg_file_t *seg = head->seg;
+    size_t limit = __atomic_load_n(&g_seg.seg_size, __ATOMIC_RELAXED);
+    if (seg && seg->size > 0 && seg->size + rec_len > (off_t)limit)
+    {
+        // Seal the full segment; its records are now as durable as the log
+        fdatasync(seg->fd);
+        __atomic_store_n(&seg->sealed, true, __ATOMIC_RELEASE);
+        seg = head->seg = NULL;
+    }
+    if (!seg)
+    {
+        int rc = seg_create(&seg);
+        if (rc != 0)
+        {
+            pthread_mutex_unlock(&head->lock);
+            return rc;
+        }
+        head->seg = seg;
+    }
+
+    // A failed write leaves size alone, so the next record overwrites it
+    int rc = write_record(seg->fd, seg->size, &hdr, parts, n_parts);
+    if (rc == 0)
+    {
+        *seg_id = seg->id;
+        *seg_off = seg->size + (off_t)sizeof(hdr);
+        __atomic_add_fetch(&seg->live, len, __ATOMIC_RELAXED);
+        __atomic_store_n(&seg->size, seg->size + rec_len, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&head->lock);
+    return rc;
+}
+
+/**
+ * @brief Index of the first extent ending after offset (n_extents if none)
+ * @pre the map's lock is held
+ */
+static uint32_t map_find(const struct seg_map *map, off_t offset)
+{
+    uint32_t lo = 0, hi = map->n_extents;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const seg_extent_t *e = &map->extents[mid];
+        if (e->file_off + (off_t)e->len <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief Add an extent in file order
+ * A copy of an extent the map already holds (same range) replaces it.
+ * @param old receives the replaced extent; its len stays 0 if none was
+ * @pre the map's lock is held
+ * @return 0, -EEXIST for a partial overlap, or -ENOMEM
+ */
+static int map_insert(struct seg_map *map, const seg_extent_t *ext, seg_extent_t *old)
+{
+    old->len = 0;
+    uint32_t i = map_find(map, ext->file_off);
+    if (i < map->n_extents && map->extents[i].file_off < ext->file_off + (off_t)ext->len)
+    {
+        seg_extent_t *cur = &map->extents[i];
+        if (cur->file_off != ext->file_off || cur->len != ext->len)
+            return -EEXIST;
+        *old = *cur;
+        *cur = *ext;
+        return 0;
+    }
+
+    if (map->n_extents == map->capacity)
+    {
+        uint32_t capacity = map->capacity ? map->capacity * 2 : 4;
+        seg_extent_t *extents = realloc(map->extents, capacity * sizeof(*extents));
+        if (!extents)
+            return -ENOMEM;
+        map->extents = extents;
+        map->capacity = capacity;
+    }
+    memmove(&map->extents[i + 1], &map->extents[i],
+            (map->n_extents - i) * sizeof(*map->extents));
+    map->extents[i] = *ext;
+    map->n_extents++;
+    __atomic_add_fetch(&map->bytes, ext->len, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Live payload bytes an extent's record accounts for */
+static uint32_t ext_live(const seg_extent_t *ext)
+{
+    return ext->chunk ? (uint32_t)sizeof(seg_ref_t) : ext->len;
+}
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDull;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+/**
+ * @brief 128-bit fingerprint of a chunk, two 64-bit lanes per 16 bytes
+ * Not collision resistant by design: a match is confirmed by comparing
+ * the bytes before a chunk is shared.
+ */
+static seg_fp_t fingerprint(const void *data, size_t len)
+{
+    const uint64_t k1 = 0x87C37B91114253D5ull, k2 = 0x4CF5AD432745937Full;
+    uint64_t a = 0x9E3779B97F4A7C15ull ^ len, b = 0xC2B2AE3D27D4EB4Full;
+    const unsigned char *p = data;
+    for (; len >= 16; p += 16, len -= 16)
+    {
+        uint64_t x, y;
+        memcpy(&x, p, 8);
+        memcpy(&y, p + 8, 8);
+        a = rotl64(a ^ (x * k1), 31) * k2 + b;
+        b = rotl64(b ^ (y * k2), 33) * k1 + a;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, len);
+    a ^= tail * k1;
+    seg_fp_t fp = { fmix64(a + b), fmix64(b ^ rotl64(a, 17)) };
+    return fp;
+}
+
+static uint32_t chunk_bucket(uint64_t key)
+{
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (g_chunks.n_buckets - 1);
+}
+
+/**
+ * @brief Rebuild both hash chains with n_buckets buckets
+ * @pre the chunk table is write-locked
+ */
+static int chunk_rehash(uint32_t n_buckets)
+{
+    uint32_t *fp_buckets = calloc(n_buckets, sizeof(*fp_buckets));
+    uint32_t *serial_buckets = calloc(n_buckets, sizeof(*serial_buckets));
+    if (!fp_buckets || !serial_buckets)
+    {
+        free(fp_buckets);
+        free(serial_buckets);
+        return -ENOMEM;
+    }
+    free(g_chunks.fp_buckets);
+    free(g_chunks.serial_buckets);
+    g_chunks.fp_buckets = fp_buckets;
+    g_chunks.serial_buckets = serial_buckets;
+    g_chunks.n_buckets = n_buckets;
+
+    for (uint32_t id = 1; id < g_chunks.n_ids; id++)
+    {
+        seg_chunk_t *c = &g_chunks.chunks[id];
+        if (c->serial == 0)
+            continue;
+        uint32_t b = chunk_bucket(c->serial);
+        c->serial_next = serial_buckets[b];
+        serial_buckets[b] = id;
+        if (c->indexed)
+        {
+            b = chunk_bucket(c->fp.lo);
+            c->fp_next = fp_buckets[b];
+            fp_buckets[b] = id;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Chunk with this serial, or 0
+ * @pre the chunk table is locked
+ */
+static uint32_t chunk_by_serial(uint64_t serial)
+{
+    if (g_chunks.n_buckets == 0)
+        return 0;
+    uint32_t id = g_chunks.serial_buckets[chunk_bucket(serial)];
+    while (id && g_chunks.chunks[id].serial != serial)
+        id = g_chunks.chunks[id].serial_next;
+    return id;
+}
+
+/**
+ * @brief Indexed chunk with this fingerprint, or 0
+ * @pre the chunk table is locked
+ */
+static uint32_t chunk_by_fp(const seg_fp_t *fp)
+{
+    if (g_chunks.n_buckets == 0)
+        return 0;
+    uint32_t id = g_chunks.fp_buckets[chunk_bucket(fp->lo)];
+    while (id && (g_chunks.chunks[id].fp.lo != fp->lo || g_chunks.chunks[id].fp.hi != fp->hi))
+        id = g_chunks.chunks[id].fp_next;
+    return id;
+}
+
+/**
+ * @brief Make a chunk findable by fingerprint
+ * @pre the chunk table is write-locked and no indexed chunk has its fingerprint
+ */
+static void chunk_index(uint32_t id)
+{
+    seg_chunk_t *c = &g_chunks.chunks[id];
+    uint32_t b = chunk_bucket(c->fp.lo);
+    c->fp_next = g_chunks.fp_buckets[b];
+    g_chunks.fp_buckets[b] = id;
+    c->indexed = true;
+}
+
+/**
+ * @brief New chunk entry under serial, with no location and no references
+ * @pre the chunk table is write-locked
+ * @return its id, or 0 if out of memory
+ */
+static uint32_t chunk_alloc(uint64_t serial)
+{
+    if (g_chunks.n_chunks + 1 > g_chunks.n_buckets &&
+        chunk_rehash(g_chunks.n_buckets ? g_chunks.n_buckets * 2 : 256) != 0)
+        return 0;
+
+    uint32_t id = g_chunks.free_head;
+    if (id)
+    {
+        g_chunks.free_head = g_chunks.chunks[id].fp_next;
+    }
+    else
+    {
+        if (g_chunks.n_ids >= g_chunks.capacity)
+        {
+            uint32_t capacity = g_chunks.capacity ? g_chunks.capacity * 2 : 256;
+            seg_chunk_t *chunks = realloc(g_chunks.chunks, capacity * sizeof(*chunks));
+            if (!chunks)
+                return 0;
+            g_chunks.chunks = chunks;
+            g_chunks.capacity = capacity;
+        }
+        id = g_chunks.n_ids++;
+    }
+
+    seg_chunk_t *c = &g_chunks.chunks[id];
+    memset(c, 0, sizeof(*c));
+    c->serial = serial;
+    c->seg = SEG_NONE;
+    uint32_t b = chunk_bucket(serial);
+    c->serial_next = g_chunks.serial_buckets[b];
+    g_chunks.serial_buckets[b] = id;
+    g_chunks.n_chunks++;
+    return id;
+}
+
+/* Unlink id from a chain whose next field is at offset next_off */
+static void chain_remove(uint32_t *bucket, uint32_t id, size_t next_off)
+{
+    uint32_t *link = bucket;
+    while (*link && *link != id)
+        link = (uint32_t *)((char *)&g_chunks.chunks[*link] + next_off);
+    if (*link == id)
+        *link = *(uint32_t *)((char *)&g_chunks.chunks[id] + next_off);
+}
+
+/**
+ * @brief Forget a chunk; its record becomes garbage
+ * @pre the chunk table is write-locked
+ */
+static void chunk_free(uint32_t id)
+{
+    seg_chunk_t *c = &g_chunks.chunks[id];
+    if (c->indexed)
+        chain_remove(&g_chunks.fp_buckets[chunk_bucket(c->fp.lo)], id,
+                     offsetof(seg_chunk_t, fp_next));
+    chain_remove(&g_chunks.serial_buckets[chunk_bucket(c->serial)], id,
+                 offsetof(seg_chunk_t, serial_next));
+    c->serial = 0;
+    c->indexed = false;
+    c->fp_next = g_chunks.free_head;
+    g_chunks.free_head = id;
+    g_chunks.n_chunks--;
+}
+
+/**
+ * @brief Drop one reference; the last one frees the chunk
+ * @pre the chunk table is write-locked
+ */
+static void chunk_unref(uint32_t id)
+{
+    seg_chunk_t *c = &g_chunks.chunks[id];
+    g_chunks.ref_bytes -= c->len;
+    if (--c->refs > 0)
+        return;
+
+    __atomic_sub_fetch(&seg_get(c->seg)->live, sizeof(seg_fp_t) + c->len, __ATOMIC_RELAXED);
+    g_chunks.bytes -= c->len;
+    chunk_free(id);
+}
+
+static void chunks_reset(void)
+{
+    free(g_chunks.chunks);
+    free(g_chunks.fp_buckets);
+    free(g_chunks.serial_buckets);
+    g_chunks.chunks = NULL;
+    g_chunks.fp_buckets = g_chunks.serial_buckets = NULL;
+    g_chunks.n_ids = 1;
+    g_chunks.capacity = g_chunks.free_head = g_chunks.n_buckets = g_chunks.n_chunks = 0;
+    g_chunks.next_serial = 1;
+    g_chunks.bytes = g_chunks.ref_bytes = 0;
+}
+
+static seg_head_t *head_for(uint64_t ino)
+{
+    return &g_seg.heads[(uint32_t)((ino * 0x9E3779B97F4A7C15ull) >> 32) % SEG_HEADS];
+}
+
+int seg_parse_args(struct fuse_args *args)
+{
+    return fuse_opt_parse(args, &g_seg_opts, seg_opts, NULL);
+}
+
+void seg_configure(bool enabled, bool dedup, size_t segment_size)
+{
+    __atomic_store_n(&g_seg.enabled, enabled, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_seg.dedup, dedup, __ATOMIC_RELAXED);
+    if (segment_size)
+        __atomic_store_n(&g_seg.seg_size, segment_size, __ATOMIC_RELAXED);
+}
+
+bool seg_enabled(void)
+{
+    return __atomic_load_n(&g_seg.enabled, __ATOMIC_RELAXED);
+}
+
+int seg_attach(fused_inode_t *inode)
+{
+    struct seg_map *map = calloc(1, sizeof(*map));
+    if (!map)
+        return -ENOMEM;
+    pthread_mutex_init(&map->lock, NULL);
+    inode->seg_map = map;
+    return 0;
+}
+
+void seg_detach(fused_inode_t *inode, bool garbage)
+{
+    struct seg_map *map = inode->seg_map;
+    if (!map)
+        return;
+
+    if (garbage)
+        pthread_rwlock_wrlock(&g_chunks.lock);
+    for (uint32_t i = 0; garbage && i < map->n_extents; i++)
+    {
+        const seg_extent_t *e = &map->extents[i];
+        __atomic_sub_fetch(&seg_get(e->seg)->live, ext_live(e), __ATOMIC_RELAXED);
+        if (e->chunk)
+            chunk_unref(e->chunk);
+    }
+    if (garbage)
+        pthread_rwlock_unlock(&g_chunks.lock);
+    pthread_mutex_destroy(&map->lock);
+    free(map->extents);
+    free(map);
+    inode->seg_map = NULL;
+}
+
+/**
+ * @brief Store a whole chunk of file data, sharing an identical stored one
+ * @param ext receives the extent for the reference record
+ * @return 0, 1 if the data must be stored plainly (fingerprint collision),
+ *         or negative errno
+ */
+static int append_chunk(fused_inode_t *inode, const char *data, off_t offset,
+                        seg_extent_t *ext)
+{
+    seg_head_t *head = head_for(inode->ino);
+    seg_fp_t fp = fingerprint(data, SEG_CHUNK_SIZE);
+    seg_file_t *seg = NULL;
+    off_t seg_off = 0;
+    uint64_t serial = 0;
+
+    // Take the reference up front so the chunk cannot go away while checked
+    pthread_rwlock_wrlock(&g_chunks.lock);
+    uint32_t id = chunk_by_fp(&fp);
+    if (id)
+    {
+        seg_chunk_t *c = &g_chunks.chunks[id];
+        c->refs++;
+        g_chunks.ref_bytes += c->len;
+        serial = c->serial;
+        seg = seg_pin(c->seg);
+        seg_off = c->seg_off;
+    }
+    pthread_rwlock_unlock(&g_chunks.lock);
+
+    if (id)
+    {
+        char *stored = malloc(SEG_CHUNK_SIZE);
+        int rc = stored ? io_pread_full(seg->fd, stored, SEG_CHUNK_SIZE, seg_off) : -ENOMEM;
+        seg_unpin(seg);
+        bool same = rc == 0 && memcmp(stored, data, SEG_CHUNK_SIZE) == 0;
+        free(stored);
+        if (!same)
+        {
+            pthread_rwlock_wrlock(&g_chunks.lock);
+            chunk_unref(id);
+            pthread_rwlock_unlock(&g_chunks.lock);
+            if (rc == 0)
+                log_warn("segment: fingerprint collision at inode %lu offset %ld",
+                         inode->ino, (long)offset);
+            return 1;
+        }
+        __atomic_add_fetch(&g_chunks.hits, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        serial = __atomic_fetch_add(&g_chunks.next_serial, 1, __ATOMIC_RELAXED);
+        struct iovec parts[2] = {
+            { &fp, sizeof(fp) },
+            { (void *)data, SEG_CHUNK_SIZE },
+        };
+        uint32_t chunk_seg;
+        off_t chunk_off;
+        int rc = log_write(head, 0, serial, SEG_REC_CHUNK, parts, 2, &chunk_seg, &chunk_off);
+        if (rc != 0)
+            return rc;
+
+        pthread_rwlock_wrlock(&g_chunks.lock);
+        id = chunk_alloc(serial);
+        if (id)
+        {
+            seg_chunk_t *c = &g_chunks.chunks[id];
+            c->fp = fp;
+            c->seg = chunk_seg;
+            c->seg_off = chunk_off + (off_t)sizeof(fp);
+            c->len = SEG_CHUNK_SIZE;
+            c->refs = 1;
+            g_chunks.bytes += c->len;
+            g_chunks.ref_bytes += c->len;
+            // A concurrent append of the same data may have indexed its copy
+            if (!chunk_by_fp(&fp))
+                chunk_index(id);
+        }
+        pthread_rwlock_unlock(&g_chunks.lock);
+        if (!id)
+        {
+            __atomic_sub_fetch(&seg_get(chunk_seg)->live, sizeof(fp) + SEG_CHUNK_SIZE,
+                               __ATOMIC_RELAXED);
+            return -ENOMEM;
+        }
+    }
+
+    seg_ref_t ref = { serial, SEG_CHUNK_SIZE, 0 };
+    struct iovec part = { &ref, sizeof(ref) };
+    int rc = log_write(head, inode->ino, offset, SEG_REC_REF, &part, 1, &ext->seg,
+                       &ext->seg_off);
+    if (rc != 0)
+    {
+        pthread_rwlock_wrlock(&g_chunks.lock);
+        chunk_unref(id);
+        pthread_rwlock_unlock(&g_chunks.lock);
+        return rc;
+    }
+    ext->file_off = offset;
+    ext->len = SEG_CHUNK_SIZE;
+    ext->chunk = id;
+    return 0;
+}
+
+int seg_append(fused_inode_t *inode, const void *buf, size_t size, off_t offset)
+{
+    struct seg_map *map = inode->seg_map;
+    const char *data = buf;
+    bool dedup = __atomic_load_n(&g_seg.dedup, __ATOMIC_RELAXED);
+
+    while (size > 0)
+    {
+        seg_extent_t ext = { 0 };
+        int rc = 1;
+        if (dedup && offset % SEG_CHUNK_SIZE == 0 && size >= SEG_CHUNK_SIZE)
+        {
+            rc = append_chunk(inode, data, offset, &ext);
+        }
+        if (rc == 1)
+        {
+            // Plain record; with dedup it ends at a chunk boundary so the
+            // chunks after it line up. Records carry a 32-bit length.
+            size_t len = size > UINT32_MAX / 2 ? UINT32_MAX / 2 : size;
+            if (dedup && len > SEG_CHUNK_SIZE - (size_t)(offset % SEG_CHUNK_SIZE))
+                len = SEG_CHUNK_SIZE - (size_t)(offset % SEG_CHUNK_SIZE);
+            struct iovec part = { (void *)data, len };
+            ext.file_off = offset;
+            ext.len = (uint32_t)len;
+            rc = log_write(head_for(inode->ino), inode->ino, offset, 0, &part, 1, &ext.seg,
+                           &ext.seg_off);
+        }
+        if (rc != 0)
+            return rc;
+
+        seg_extent_t old;
+        pthread_mutex_lock(&map->lock);
+        rc = map_insert(map, &ext, &old);
+        pthread_mutex_unlock(&map->lock);
+        if (rc != 0)
+        {
+            __atomic_sub_fetch(&seg_get(ext.seg)->live, ext_live(&ext), __ATOMIC_RELAXED);
+            if (ext.chunk)
+            {
+                pthread_rwlock_wrlock(&g_chunks.lock);
+                chunk_unref(ext.chunk);
+                pthread_rwlock_unlock(&g_chunks.lock);
+            }
+            return rc;
+        }
+        data += ext.len;
+        offset += ext.len;
+        size -= ext.len;
+    }
+    return 0;
+}
+
+int seg_read(fused_inode_t *inode, char *buf, size_t size, off_t offset)
+{
+    struct seg_map *map = inode->seg_map;
+    off_t end = offset + (off_t)size;
+    off_t pos = offset;
+
+    while (pos < end)
+    {
+        pthread_mutex_lock(&map->lock);
+        uint32_t i = map_find(map, pos);
+        if (i == map->n_extents || map->extents[i].file_off >= end)
+        {
+            pthread_mutex_unlock(&map->lock);
+            memset(buf + (pos - offset), 0, end - pos);
+            break;
+        }
+        const seg_extent_t *e = &map->extents[i];
+        if (e->file_off > pos)
+        {
+            // A hole up to the next extent
+            off_t gap = e->file_off - pos;
+            pthread_mutex_unlock(&map->lock);
+            memset(buf + (pos - offset), 0, gap);
+            pos += gap;
+            continue;
+        }
+
+        off_t ext_end = e->file_off + (off_t)e->len;
+        size_t chunk = (ext_end < end ? ext_end : end) - pos;
+        off_t seg_off;
+        seg_file_t *seg;
+        if (e->chunk)
+        {
+            pthread_rwlock_rdlock(&g_chunks.lock);
+            const seg_chunk_t *c = &g_chunks.chunks[e->chunk];
+            seg_off = c->seg_off + (pos - e->file_off);
+            seg = seg_pin(c->seg);
+            pthread_rwlock_unlock(&g_chunks.lock);
+        }
+        else
+        {
+            seg_off = e->seg_off + (pos - e->file_off);
+            seg = seg_pin(e->seg);
+        }
+        pthread_mutex_unlock(&map->lock);
+
+        int rc = io_pread_full(seg->fd, buf + (pos - offset), chunk, seg_off);
+        seg_unpin(seg);
+        if (rc != 0)
+        {
+            log_error("segment: read of inode %lu from segment %u failed: %s", inode->ino,
+                      seg->id, strerror(-rc));
+            return -EIO;
+        }
+        pos += chunk;
+    }
+    return 0;
+}
+
+uint64_t seg_bytes(fused_inode_t *inode)
+{
+    return __atomic_load_n(&inode->seg_map->bytes, __ATOMIC_RELAXED);
+}
+
+int seg_sync(fused_inode_t *inode)
+{
+    struct seg_map *map = inode->seg_map;
+
+    pthread_mutex_lock(&map->lock);
+    seg_file_t **pinned = malloc((2 * map->n_extents + 1) * sizeof(*pinned));
+    if (!pinned)
+    {
+        pthread_mutex_unlock(&map->lock);
+        return -ENOMEM;
+    }
+    // A shared chunk's data is synced along with the reference to it
+    pthread_rwlock_rdlock(&g_chunks.lock);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < 2 * map->n_extents; i++)
+    {
+        const seg_extent_t *e = &map->extents[i / 2];
+        if (i % 2 == 1 && !e->chunk)
+            continue;
+        uint32_t id = i % 2 == 0 ? e->seg : g_chunks.chunks[e->chunk].seg;
+
+        // Extents of a file mostly share a few segments; skip repeats
+        bool seen = false;
+        for (uint32_t j = n; j-- > 0 && !seen;)
+            seen = pinned[j]->id == id;
+        if (!seen)
+            pinned[n++] = seg_pin(id);
+    }
+    pthread_rwlock_unlock(&g_chunks.lock);
+    pthread_mutex_unlock(&map->lock);
+
+    int rc = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (fdatasync(pinned[i]->fd) != 0 && rc == 0)
+            rc = -errno;
+        seg_unpin(pinned[i]);
+    }
+    free(pinned);
+    return rc;
+}
+
+/**
+ * @brief Register a chunk record found while loading
+ * Copies left by compaction all hold the same data; the last one scanned wins.
+ */
+static void load_chunk(seg_file_t *seg, off_t data, const seg_rec_hdr_t *hdr)
+{
+    seg_fp_t fp;
+    if (hdr->len < sizeof(fp) || io_pread_full(seg->fd, &fp, sizeof(fp), data) != 0)
+        return;
+
+    uint32_t id = chunk_by_serial(hdr->file_off);
+    if (!id && !(id = chunk_alloc(hdr->file_off)))
+        return;
+    seg_chunk_t *c = &g_chunks.chunks[id];
+    c->fp = fp;
+    c->seg = seg->id;
+    c->seg_off = data + (off_t)sizeof(fp);
+    c->len = hdr->len - (uint32_t)sizeof(fp);
+    if (hdr->file_off >= g_chunks.next_serial)
+        g_chunks.next_serial = hdr->file_off + 1;
+}
+
+/**
+ * @brief Add a data or reference record to its inode's map
+ */
+static void load_extent(seg_file_t *seg, off_t data, const seg_rec_hdr_t *hdr)
+{
+    fused_inode_t *inode = lookup_inode(hdr->ino);
+    if (!inode || !inode->seg_map)
+        return;
+
+    seg_extent_t ext = { (off_t)hdr->file_off, data, seg->id, hdr->len, 0 };
+    if (hdr->flags & SEG_REC_REF)
+    {
+        seg_ref_t ref;
+        if (hdr->len != sizeof(ref) || io_pread_full(seg->fd, &ref, sizeof(ref), data) != 0)
+            return;
+        ext.chunk = chunk_by_serial(ref.serial);
+        ext.len = ref.len;
+        if (!ext.chunk || g_chunks.chunks[ext.chunk].seg == SEG_NONE ||
+            ref.len > g_chunks.chunks[ext.chunk].len)
+        {
+            // The chunk's record was lost with the tail of its segment
+            log_warn("segment: inode %lu lost the chunk at offset %lu", hdr->ino,
+                     (unsigned long)hdr->file_off);
+            return;
+        }
+    }
+
+    seg_extent_t old;
+    int rc = map_insert(inode->seg_map, &ext, &old);
+    if (rc != 0)
+    {
+        log_warn("segment: skipping record of inode %lu at %u:%ld: %s", hdr->ino,
+                 seg->id, (long)data, strerror(-rc));
+        return;
+    }
+    seg->live += hdr->len;
+    if (ext.chunk)
+        g_chunks.chunks[ext.chunk].refs++;
+    if (old.len)
+    {
+        seg_get(old.seg)->live -= ext_live(&old);
+        if (old.chunk)
+            g_chunks.chunks[old.chunk].refs--;
+    }
+
+    off_t end = ext.file_off + (off_t)ext.len;
+    if (end > inode->size)
+        inode->size = inode->durable = end;
+}
+
+/**
+ * @brief Feed the valid records of a segment to the loader
+ * The first pass finds the chunks, the second the records of live inodes,
+ * which may refer to chunks in later segments. Stops at the first damaged
+ * or incomplete record, which ends the segment. Single-threaded, so the
+ * maps and the chunk table are used without their locks.
+ */
+static void load_segment(seg_file_t *seg, bool chunks)
+{
+    struct stat st;
+    if (fstat(seg->fd, &st) != 0)
+        return;
+
+    if (chunks)
+        seg->live = 0;
+    off_t pos = 0;
+    seg_rec_hdr_t hdr;
+    while (read_header(seg, pos, st.st_size, &hdr) == 0)
+    {
+        off_t data = pos + (off_t)sizeof(hdr);
+        pos = data + hdr.len;
+        if (chunks && (hdr.flags & SEG_REC_CHUNK))
+            load_chunk(seg, data, &hdr);
+        else if (!chunks && !(hdr.flags & SEG_REC_CHUNK))
+            load_extent(seg, data, &hdr);
+    }
+    if (!chunks && pos < st.st_size)
+        log_warn("segment: %u ends in %ld bytes of incomplete records", seg->id,
+                 (long)(st.st_size - pos));
+    seg->size = pos;
+}
+
+/**
+ * @brief Rebuild the extent maps, then start the compactor
+ * Chunks nothing refers to any more are dropped; the rest count as live
+ * and become findable for dedup again.
+ * @pre runs before the filesystem serves requests
+ */
+int seg_load(void)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (uint32_t id = 0; id < g_seg.next_id; id++)
+        {
+            seg_file_t *seg = seg_get(id);
+            if (seg)
+                load_segment(seg, pass == 0);
+        }
+    }
+
+    for (uint32_t id = 1; id < g_chunks.n_ids; id++)
+    {
+        seg_chunk_t *c = &g_chunks.chunks[id];
+        if (c->serial == 0)
+            continue;
+        if (c->refs == 0 || c->seg == SEG_NONE)
+        {
+            chunk_free(id);
+            continue;
+        }
+        seg_get(c->seg)->live += sizeof(seg_fp_t) + c->len;
+        g_chunks.bytes += c->len;
+        g_chunks.ref_bytes += (uint64_t)c->refs * c->len;
+        if (!chunk_by_fp(&c->fp))
+            chunk_index(id);
+    }
+
+    return periodic_start(&g_seg.compactor);
+}
+
+/**
+ * @brief Copy one record to the compaction head if its extent still points at it
+ * @return 0 (also when the record is garbage), or negative errno
+ */
+static int relocate(seg_file_t *seg, off_t data, const seg_rec_hdr_t *hdr)
+{
+    fused_inode_t *inode = lookup_inode(hdr->ino);
+    if (!inode)
+        return 0;
+
+    // Deleting the file needs the write lock, so the map stays attached
+    inode_rdlock(inode);
+    struct seg_map *map = inode->seg_map;
+    if (INODE_LOAD(inode->ino) != hdr->ino || !map)
+    {
+        inode_unlock(inode);
+        return 0;
+    }
+
+    pthread_mutex_lock(&map->lock);
+    uint32_t i = map_find(map, (off_t)hdr->file_off);
+    bool live = i < map->n_extents && map->extents[i].seg == seg->id &&
+                map->extents[i].seg_off == data;
+    pthread_mutex_unlock(&map->lock);
+    if (!live)
+    {
+        inode_unlock(inode);
+        return 0;
+    }
+
+    int rc = -ENOMEM;
+    char *buf = malloc(hdr->len ? hdr->len : 1);
+    if (buf)
+        rc = io_pread_full(seg->fd, buf, hdr->len, data);
+
+    uint32_t new_seg;
+    off_t new_off;
+    struct iovec part = { buf, hdr->len };
+    if (rc == 0)
+        rc = log_write(&g_seg.heads[SEG_COMPACT_HEAD], hdr->ino, hdr->file_off, hdr->flags,
+                       &part, 1, &new_seg, &new_off);
+    if (rc == 0)
+    {
+        // Appends only add extents past this one, so it is still at i
+        pthread_mutex_lock(&map->lock);
+        map->extents[i].seg = new_seg;
+        map->extents[i].seg_off = new_off;
+        pthread_mutex_unlock(&map->lock);
+        __atomic_sub_fetch(&seg->live, hdr->len, __ATOMIC_RELAXED);
+    }
+    free(buf);
+    inode_unlock(inode);
+    return rc;
+}
+
+/**
+ * @brief Copy a chunk record to the compaction head if the chunk still lives there
+ * @return 0 (also when the record is garbage), or negative errno
+ */
+static int relocate_chunk(seg_file_t *seg, off_t data, const seg_rec_hdr_t *hdr)
+{
+    off_t chunk_off = data + (off_t)sizeof(seg_fp_t);
+
+    pthread_rwlock_rdlock(&g_chunks.lock);
+    uint32_t id = chunk_by_serial(hdr->file_off);
+    bool live = id && g_chunks.chunks[id].seg == seg->id &&
+                g_chunks.chunks[id].seg_off == chunk_off;
+    pthread_rwlock_unlock(&g_chunks.lock);
+    if (!live)
+        return 0;
+
+    char *buf = malloc(hdr->len);
+    int rc = buf ? io_pread_full(seg->fd, buf, hdr->len, data) : -ENOMEM;
+    uint32_t new_seg;
+    off_t new_off;
+    struct iovec part = { buf, hdr->len };
+    if (rc == 0)
+        rc = log_write(&g_seg.heads[SEG_COMPACT_HEAD], 0, hdr->file_off, hdr->flags, &part, 1,
+                       &new_seg, &new_off);
+    free(buf);
+    if (rc != 0)
+        return rc;
+
+    // The last reference may have gone while the copy was written
+    pthread_rwlock_wrlock(&g_chunks.lock);
+    id = chunk_by_serial(hdr->file_off);
+    if (id && g_chunks.chunks[id].seg == seg->id && g_chunks.chunks[id].seg_off == chunk_off)
+    {
+        g_chunks.chunks[id].seg = new_seg;
+        g_chunks.chunks[id].seg_off = new_off + (off_t)sizeof(seg_fp_t);
+        __atomic_sub_fetch(&seg->live, hdr->len, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_sub_fetch(&seg_get(new_seg)->live, hdr->len, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&g_chunks.lock);
+    return 0;
+}
+
+/**
+ * @brief Close and delete a segment nothing points at any more
+ */
+static void retire(seg_file_t *seg)
+{
+    pthread_mutex_lock(&g_seg.lock);
+    __atomic_store_n(&g_seg.segs[seg->id], NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_seg.lock);
+
+    // Readers that pinned it before their extent moved finish first
+    while (__atomic_load_n(&seg->pins, __ATOMIC_ACQUIRE) > 0)
+        usleep(1000);
+
+    char path[MAX_PATH];
+    close(seg->fd);
+    if (seg_path(seg->id, path) == 0)
+        unlink(path);
+    free(seg);
+    __atomic_add_fetch(&g_seg.compacted, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Move the live records out of a sealed segment and delete it
+ * @return 0, or negative errno with the segment kept
+ */
+static int compact_segment(seg_file_t *seg)
+{
+    off_t end = __atomic_load_n(&seg->size, __ATOMIC_ACQUIRE);
+    off_t pos = 0;
+    seg_rec_hdr_t hdr;
+    while (__atomic_load_n(&seg->live, __ATOMIC_RELAXED) > 0 &&
+           read_header(seg, pos, end, &hdr) == 0)
+    {
+        off_t data = pos + (off_t)sizeof(hdr);
+        int rc = (hdr.flags & SEG_REC_CHUNK) ? relocate_chunk(seg, data, &hdr)
+                                             : relocate(seg, data, &hdr);
+        if (rc != 0)
+        {
+            log_ratelimited(FUSED_LOG_ERROR, 1000, "segment: compaction of %u failed: %s",
+                            seg->id, strerror(-rc));
+            return rc;
+        }
+        pos = data + hdr.len;
+    }
+    if (__atomic_load_n(&seg->live, __ATOMIC_RELAXED) > 0)
+    {
+        log_warn("segment: %u still has live data after compaction", seg->id);
+        return -EBUSY;
+    }
+
+    // The copies must be on disk before the originals go
+    seg_head_t *head = &g_seg.heads[SEG_COMPACT_HEAD];
+    pthread_mutex_lock(&head->lock);
+    int rc = head->seg && fdatasync(head->seg->fd) != 0 ? -errno : 0;
+    pthread_mutex_unlock(&head->lock);
+    if (rc != 0)
+        return rc;
+
+    retire(seg);
+    return 0;
+}
+
+int seg_compact(void)
+{
+    int reclaimed = 0;
+
+    pthread_mutex_lock(&g_seg.compact_lock);
+    uint32_t n = __atomic_load_n(&g_seg.next_id, __ATOMIC_ACQUIRE);
+    for (uint32_t id = 0; g_seg.segs && id < n; id++)
+    {
+        // Only this pass retires segments, so the pointer stays valid
+        seg_file_t *seg = seg_get(id);
+        if (!seg || !__atomic_load_n(&seg->sealed, __ATOMIC_ACQUIRE))
+            continue;
+        uint64_t size = (uint64_t)__atomic_load_n(&seg->size, __ATOMIC_ACQUIRE);
+        uint64_t live = __atomic_load_n(&seg->live, __ATOMIC_RELAXED);
+        if (live * 100 >= size * SEG_COMPACT_LIVE_PCT)
+            continue;
+        if (compact_segment(seg) == 0)
+            reclaimed++;
+    }
+    pthread_mutex_unlock(&g_seg.compact_lock);
+    return reclaimed;
+}
+
+/**
+ * @brief Register the segments a previous run left; all of them are sealed
+ */
+static int find_segments(void)
+{
+    DIR *dir = opendir(g_seg.dir);
+    if (!dir)
+        return -errno;
+
+    int rc = 0;
+    struct dirent *entry;
+    while (rc == 0 && (entry = readdir(dir)) != NULL)
+    {
+        unsigned int id;
+        char tail;
+        if (sscanf(entry->d_name, SEG_FILE_PREFIX "%u%c", &id, &tail) != 1 ||
+            id >= SEG_MAX_SEGMENTS)
+            continue;
+
+        char path[MAX_PATH];
+        rc = seg_path(id, path);
+        int fd = rc == 0 ? open(path, O_RDWR | O_CLOEXEC) : -1;
+        if (fd < 0)
+        {
+            rc = rc ? rc : -errno;
+            log_error("segment: cannot open %s: %s", path, strerror(-rc));
+            break;
+        }
+        seg_file_t *seg = seg_file_new(id, fd);
+        if (!seg)
+        {
+            close(fd);
+            rc = -ENOMEM;
+            break;
+        }
+        // seg_load() counts the live bytes; a segment it never sees (the
+        // table was lost) is all garbage
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+            seg->size = st.st_size;
+        seg->sealed = true;
+        seg_publish(seg);
+        if (id >= g_seg.next_id)
+            g_seg.next_id = id + 1;
+    }
+    closedir(dir);
+    return rc;
+}
+
+/**
+ * @brief Close every segment; the unsealed ones are synced first
+ */
+static void close_segments(void)
+{
+    if (g_chunks.n_chunks)
+        log_info("segment: %u chunks, %lu bytes stored for %lu (dedup ratio %.2f)",
+                 g_chunks.n_chunks, (unsigned long)g_chunks.bytes,
+                 (unsigned long)g_chunks.ref_bytes,
+                 (double)g_chunks.ref_bytes / (double)g_chunks.bytes);
+    chunks_reset();
+    for (uint32_t id = 0; id < g_seg.next_id; id++)
+    {
+        seg_file_t *seg = g_seg.segs[id];
+        if (!seg)
+            continue;
+        if (!seg->sealed)
+            fdatasync(seg->fd);
+        close(seg->fd);
+        free(seg);
+    }
+    for (int i = 0; i <= SEG_HEADS; i++)
+    {
+        g_seg.heads[i].seg = NULL;
+        pthread_mutex_destroy(&g_seg.heads[i].lock);
+    }
+    free(g_seg.segs);
+    g_seg.segs = NULL;
+    g_seg.next_id = 0;
+}
+
+/**
+ * @brief Read the configuration, find existing segments and start the compactor
+ * @return 0 on success, negative errno on failure
+ */
+int seg_open(const char *backing_dir)
+{
+    if (!g_seg_opts.resolved)
+    {
+        if (g_seg_opts.engine < 0)
+        {
+            const char *engine = getenv("FUSED_STORAGE");
+            g_seg_opts.engine = engine && strcmp(engine, "segments") == 0;
+            if (engine && !g_seg_opts.engine && strcmp(engine, "files") != 0)
+                log_warn("segment: ignoring invalid FUSED_STORAGE=%s", engine);
+        }
+        if (g_seg_opts.dedup < 0)
+            g_seg_opts.dedup = fused_env_size("segment", "FUSED_DEDUP", 0) != 0;
+        if (g_seg_opts.dedup && !g_seg_opts.engine)
+            log_warn("segment: dedup only applies to storage=segments");
+        seg_configure(g_seg_opts.engine, g_seg_opts.dedup,
+                      fused_env_size("segment", "FUSED_SEG_SIZE", SEG_DEFAULT_SIZE));
+        g_seg_opts.resolved = true;
+    }
+
+    snprintf(g_seg.dir, sizeof(g_seg.dir), "%s", backing_dir);
+    g_seg.segs = calloc(SEG_MAX_SEGMENTS, sizeof(*g_seg.segs));
+    if (!g_seg.segs)
+        return -ENOMEM;
+    g_seg.next_id = 0;
+    chunks_reset();
+    for (int i = 0; i <= SEG_HEADS; i++)
+    {
+        pthread_mutex_init(&g_seg.heads[i].lock, NULL);
+        g_seg.heads[i].seg = NULL;
+    }
+
+    int rc = find_segments();
+    if (rc != 0)
+        close_segments();
+    return rc;
+}
+
+void seg_stop_compaction(void)
+{
+    periodic_stop(&g_seg.compactor);
+}
+
+/**
+ * @brief Stop the compactor, then sync and close the segments
+ * Must only run once nothing appends or reads any more.
+ */
+void seg_close(void)
+{
+    seg_stop_compaction();
+    if (g_seg.segs)
+        close_segments();
+}
+
+void seg_get_stats(seg_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->compacted = __atomic_load_n(&g_seg.compacted, __ATOMIC_RELAXED);
+
+    uint32_t n = __atomic_load_n(&g_seg.next_id, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&g_seg.compact_lock);
+    for (uint32_t id = 0; g_seg.segs && id < n; id++)
+    {
+        seg_file_t *seg = seg_get(id);
+        if (!seg)
+            continue;
+        stats->segments++;
+        stats->bytes += (uint64_t)__atomic_load_n(&seg->size, __ATOMIC_ACQUIRE);
+        stats->live += __atomic_load_n(&seg->live, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_seg.compact_lock);
+
+    pthread_rwlock_rdlock(&g_chunks.lock);
+    stats->chunks = g_chunks.n_chunks;
+    stats->chunk_bytes = g_chunks.bytes;
+    stats->chunk_ref_bytes = g_chunks.ref_bytes;
+    stats->dedup_hits = __atomic_load_n(&g_chunks.hits, __ATOMIC_RELAXED);
+    stats->dedup_ratio = g_chunks.bytes ? (double)g_chunks.ref_bytes / (double)g_chunks.bytes
+                                        : 1.0;
+    pthread_rwlock_unlock(&g_chunks.lock);
+}
@@ -0,0 +1,206 @@
+/**
+ * @file fused_stats.c
+ * @brief Sharded operation counters, histograms and the report
+ */
+
+#include "fused_fs.h"
+#include "fused_stats.h"
+
+#define STATS_REPORT_MAX 4096       // The report fits, one line per operation
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_BUCKETS];
+} stats_counters_t;
+
+/**
+ * @brief One thread group's counters, on lines of their own
+ */
+typedef struct {
+    stats_counters_t ops[STATS_OPS];
+} __attribute__((aligned(64))) stats_shard_t;
+
+static stats_shard_t g_shards[STATS_SHARDS];
+static uint32_t g_next_shard;       // Round-robin shard assignment (atomic)
+static __thread stats_shard_t *t_shard;
+
+static const char *const g_op_names[STATS_OPS] = {
+    [STATS_LOOKUP] = "lookup",
+    [STATS_GETATTR] = "getattr",
+    [STATS_READDIR] = "readdir",
+    [STATS_OPEN] = "open",
+    [STATS_READ] = "read",
+    [STATS_WRITE] = "write",
+    [STATS_CREATE] = "create",
+    [STATS_MKDIR] = "mkdir",
+    [STATS_UNLINK] = "unlink",
+    [STATS_RENAME] = "rename",
+};
+
+uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t bucket_of(uint64_t ns)
+{
+    uint32_t b = 63 - __builtin_clzll(ns | 1);
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+int stats_record(stats_op_t op, uint64_t start, int rc)
+{
+    uint64_t ns = stats_now() - start;
+
+    stats_shard_t *shard = t_shard;
+    if (!shard)
+    {
+        uint32_t n = __atomic_fetch_add(&g_next_shard, 1, __ATOMIC_RELAXED);
+        shard = t_shard = &g_shards[n % STATS_SHARDS];
+    }
+
+    stats_counters_t *c = &shard->ops[op];
+    __atomic_add_fetch(&c->count, 1, __ATOMIC_RELAXED);
+    if (rc < 0)
+        __atomic_add_fetch(&c->errors, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&c->max_ns, &max, ns, true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+    {
+    }
+    return rc;
+}
+
+const char *stats_op_name(stats_op_t op)
+{
+    return op < STATS_OPS ? g_op_names[op] : "unknown";
+}
+
+/**
+ * @brief Upper bound of the bucket holding the q-th latency, capped at max
+ */
+static uint64_t percentile(const stats_counters_t *sum, double q)
+{
+    uint64_t rank = (uint64_t)(q * sum->count);
+    if (rank >= sum->count)
+        rank = sum->count - 1;
+
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < STATS_BUCKETS; b++)
+    {
+        seen += sum->buckets[b];
+        if (seen > rank)
+        {
+            uint64_t bound = (2ull << b) - 1;
+            return bound < sum->max_ns ? bound : sum->max_ns;
+        }
+    }
+    return sum->max_ns;
+}
+
+void stats_summary(stats_op_t op, stats_summary_t *summary)
+{
+    stats_counters_t sum = {0};
+    for (int s = 0; s < STATS_SHARDS; s++)
+    {
+        const stats_counters_t *c = &g_shards[s].ops[op];
+        sum.count += __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+        sum.errors += __atomic_load_n(&c->errors, __ATOMIC_RELAXED);
+        sum.total_ns += __atomic_load_n(&c->total_ns, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED);
+        if (max > sum.max_ns)
+            sum.max_ns = max;
+        for (int b = 0; b < STATS_BUCKETS; b++)
+            sum.buckets[b] += __atomic_load_n(&c->buckets[b], __ATOMIC_RELAXED);
+    }
+
+    // The buckets are read after count, so they may hold a few more records
+    uint64_t counted = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++)
+        counted += sum.buckets[b];
+    if (counted > sum.count)
+        sum.count = counted;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->count = sum.count;
+    summary->errors = sum.errors;
+    summary->max_ns = sum.max_ns;
+    if (sum.count > 0)
+    {
+        summary->mean_ns = sum.total_ns / sum.count;
+        summary->p50_ns = percentile(&sum, 0.50);
+        summary->p99_ns = percentile(&sum, 0.99);
+    }
+}
+
+void stats_reset(void)
+{
+    for (int s = 0; s < STATS_SHARDS; s++)
+    {
+        for (int op = 0; op < STATS_OPS; op++)
+        {
+            stats_counters_t *c = &g_shards[s].ops[op];
+            __atomic_store_n(&c->count, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->errors, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->total_ns, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->max_ns, 0, __ATOMIC_RELAXED);
+            for (int b = 0; b < STATS_BUCKETS; b++)
+                __atomic_store_n(&c->buckets[b], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+size_t stats_render(char *buf, size_t size)
+{
+    size_t len = 0;
+    int n = snprintf(buf, size, "%-8s %12s %10s %10s %10s %10s %10s\n", "op", "count",
+                     "errors", "mean_us", "p50_us", "p99_us", "max_us");
+    len += n > 0 ? n : 0;
+
+    for (int op = 0; op < STATS_OPS; op++)
+    {
+        stats_summary_t s;
+        stats_summary(op, &s);
+        n = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0,
+                     "%-8s %12lu %10lu %10.1f %10.1f %10.1f %10.1f\n", stats_op_name(op),
+                     s.count, s.errors, s.mean_ns / 1e3, s.p50_ns / 1e3, s.p99_ns / 1e3,
+                     s.max_ns / 1e3);
+        len += n > 0 ? n : 0;
+    }
+    return len;
+}
+
+void stats_stat(struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_ino = FUSED_STATS_INO;
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_size = stats_render(NULL, 0);
+    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = time(NULL);
+}
+
+int stats_read(char *buf, size_t size, off_t offset)
+{
+    char report[STATS_REPORT_MAX];
+    size_t len = stats_render(report, sizeof(report));
+    if (len >= sizeof(report))
+        len = sizeof(report) - 1;
+    if (offset < 0 || (size_t)offset >= len)
+        return 0;
+
+    size_t n = len - offset < size ? len - offset : size;
+    memcpy(buf, report + offset, n);
+    return n;
+}
@@ -0,0 +1,530 @@
+/**
+ * @file fused_wbuf.c
+ * @brief Write-back append buffers and the thread that ages them out
+ */
+
+#define _GNU_SOURCE             // O_DIRECT
+#include "fused_fs.h"
+#include "fused_fdcache.h"
+#include "fused_io.h"
+#include "fused_wbuf.h"
+#include "fused_segment.h"
+
+#define WB_FLUSH_BATCH 64           // Inodes the flusher handles per pass
+
+#define ALIGN_DOWN(x) ((x) & ~(off_t)(WB_INGEST_ALIGN - 1))
+#define ALIGN_UP(x) ALIGN_DOWN((x) + WB_INGEST_ALIGN - 1)
+
+typedef struct {
+    int ingest;                 // direct_ingest given
+    unsigned long ingest_min;   // Its size, 0 without one
+} wb_opts_t;
+
+static wb_opts_t g_wb_opts;
+
+static const struct fuse_opt wb_opts[] = {
+    { "direct_ingest", offsetof(wb_opts_t, ingest), 1 },
+    { "direct_ingest=", offsetof(wb_opts_t, ingest), 1 },
+    { "direct_ingest=%lu", offsetof(wb_opts_t, ingest_min), 0 },
+    FUSE_OPT_END
+};
+
+static struct {
+    pthread_mutex_t lock;           // Guards the dirty list and the flusher state
+    pthread_cond_t wake;
+    fused_inode_t *dirty_head;      // Dirty buffers, oldest first
+    fused_inode_t *dirty_tail;
+    size_t threshold;               // Per-inode buffer size, 0 = buffering off
+    size_t budget;                  // Bound on allocated
+    uint32_t flush_ms;              // Max age of buffered data, 0 = no timer
+    size_t allocated;               // Bytes held by all buffers
+    size_t ingest_min;              // Files this large are ingested, WB_INGEST_OFF = never
+    bool direct_failed;             // O_DIRECT refused by the backing filesystem (atomic)
+    wb_stats_t stats;               // Atomic counters
+    pthread_t flusher;
+    bool running;
+} g_wb = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .threshold = WB_DEFAULT_THRESHOLD,
+    .budget = WB_DEFAULT_BUDGET,
+    .flush_ms = WB_DEFAULT_FLUSH_MS,
+    .ingest_min = WB_INGEST_OFF,
+};
+
+static uint64_t wb_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Dirty list maintenance; caller holds g_wb.lock */
+static void dirty_unlink(fused_inode_t *inode)
+{
+    if (inode->wb_prev)
+        inode->wb_prev->wb_next = inode->wb_next;
+    else
+        g_wb.dirty_head = inode->wb_next;
+    if (inode->wb_next)
+        inode->wb_next->wb_prev = inode->wb_prev;
+    else
+        g_wb.dirty_tail = inode->wb_prev;
+    inode->wb_prev = inode->wb_next = NULL;
+    inode->wb_queued = false;
+}
+
+static void dirty_push_tail(fused_inode_t *inode)
+{
+    inode->wb_next = NULL;
+    inode->wb_prev = g_wb.dirty_tail;
+    if (g_wb.dirty_tail)
+        g_wb.dirty_tail->wb_next = inode;
+    else
+        g_wb.dirty_head = inode;
+    g_wb.dirty_tail = inode;
+    inode->wb_queued = true;
+}
+
+/**
+ * @brief Take bytes from the global budget
+ * @return true if they fit
+ */
+static bool wb_charge(size_t bytes)
+{
+    size_t used = __atomic_add_fetch(&g_wb.allocated, bytes, __ATOMIC_RELAXED);
+    if (used > g_wb.budget)
+    {
+        __atomic_sub_fetch(&g_wb.allocated, bytes, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+static void wb_free(fused_inode_t *inode)
+{
+    if (!inode->wb_data)
+        return;
+
+    // An ingest buffer starts somewhere in the first block of its allocation
+    if (inode->wb_ingest)
+        free(inode->wb_data - ((uintptr_t)inode->wb_data & (WB_INGEST_ALIGN - 1)));
+    else
+        free(inode->wb_data);
+    __atomic_sub_fetch(&g_wb.allocated, inode->wb_cap, __ATOMIC_RELAXED);
+    inode->wb_data = NULL;
+    inode->wb_cap = 0;
+    inode->wb_len = 0;
+    inode->wb_ingest = false;
+}
+
+/**
+ * @brief Write whole aligned blocks around the page cache
+ * Falls back to the cached descriptor when the backing filesystem refuses
+ * O_DIRECT, and for good once it refuses to open a file with it.
+ * @pre buf, size and offset are multiples of WB_INGEST_ALIGN
+ */
+static int write_direct(const fused_inode_t *inode, int fd, const char *buf, size_t size,
+                        off_t offset)
+{
+    int dfd = -1;
+    if (!__atomic_load_n(&g_wb.direct_failed, __ATOMIC_RELAXED))
+    {
+        dfd = open(inode->backing_path, O_WRONLY | O_DIRECT);
+        if (dfd < 0 && errno == EINVAL &&
+            !__atomic_exchange_n(&g_wb.direct_failed, true, __ATOMIC_RELAXED))
+        {
+            log_warn("wbuf: backing filesystem does not support O_DIRECT, "
+                     "ingesting through the page cache");
+        }
+    }
+
+    if (dfd >= 0)
+    {
+        int rc = io_pwrite_full(dfd, buf, size, offset);
+        close(dfd);
+        if (rc == 0)
+        {
+            __atomic_add_fetch(&g_wb.stats.direct_bytes, size, __ATOMIC_RELAXED);
+            return 0;
+        }
+        // Rewriting the range through the page cache is harmless
+        log_ratelimited(FUSED_LOG_WARN, 1000, "wbuf: direct write to inode %lu failed",
+                        inode->ino);
+    }
+
+    int rc = io_pwrite_full(fd, buf, size, offset);
+    if (rc == 0)
+        __atomic_add_fetch(&g_wb.stats.buffered_bytes, size, __ATOMIC_RELAXED);
+    return rc;
+}
+
+/**
+ * @brief Write out an ingest buffer
+ * The unaligned head up to the first block boundary goes through the page
+ * cache, whole blocks go around it. The unaligned tail is written as well
+ * when all is set, otherwise it waits for the next appends to complete its
+ * block. What is left is moved to durable's offset in the first block of
+ * the allocation, so the blocks appended next stay aligned in memory.
+ * @param all write the tail too
+ */
+static int ingest_writeout(fused_inode_t *inode, bool all)
+{
+    off_t start = inode->durable;
+    off_t end = start + (off_t)inode->wb_len;
+    off_t head_end = ALIGN_UP(start) < end ? ALIGN_UP(start) : end;
+    off_t body_end = ALIGN_DOWN(end) > head_end ? ALIGN_DOWN(end) : head_end;
+    off_t stop = all ? end : body_end;
+    if (stop == start)
+        return 0;
+
+    int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+    if (fd < 0)
+    {
+        log_error("wbuf: failed to open backing file %s", inode->backing_path);
+        return -EIO;
+    }
+
+    const char *data = inode->wb_data;
+    int rc = io_pwrite_full(fd, data, head_end - start, start);
+    if (rc == 0 && body_end > head_end)
+        rc = write_direct(inode, fd, data + (head_end - start), body_end - head_end, head_end);
+    if (rc == 0 && stop > body_end)
+        rc = io_pwrite_full(fd, data + (body_end - start), stop - body_end, body_end);
+    fd_cache_put(inode->ino);
+
+    if (rc != 0)
+    {
+        log_ratelimited(FUSED_LOG_ERROR, 1000, "wbuf: flush of inode %lu failed: %s",
+                        inode->ino, strerror(-rc));
+        return rc;
+    }
+    __atomic_add_fetch(&g_wb.stats.buffered_bytes,
+                       (head_end - start) + (stop - body_end), __ATOMIC_RELAXED);
+
+    // Rebase even when nothing is kept: durable's offset in its block changed
+    size_t kept = end - stop;
+    char *block = inode->wb_data - ((uintptr_t)inode->wb_data & (WB_INGEST_ALIGN - 1));
+    char *rebased = block + (stop & (WB_INGEST_ALIGN - 1));
+    memmove(rebased, inode->wb_data + (stop - start), kept);
+    inode->wb_data = rebased;
+    INODE_STORE(inode->durable, stop);
+    inode->wb_len = kept;
+    return 0;
+}
+
+/**
+ * @brief Write the buffered bytes at durable, keeping the allocation
+ * A failed write leaves everything buffered; retrying rewrites the same
+ * range, so partial progress is harmless. A segmented file gets the
+ * buffer as one record.
+ * @param all also write the unaligned tail of an ingest buffer
+ */
+static int wb_writeout(fused_inode_t *inode, bool all)
+{
+    if (inode->wb_len == 0)
+        return 0;
+    if (inode->wb_ingest)
+        return ingest_writeout(inode, all);
+
+    if (inode->seg_map)
+    {
+        int rc = seg_append(inode, inode->wb_data, inode->wb_len, inode->durable);
+        if (rc != 0)
+        {
+            log_ratelimited(FUSED_LOG_ERROR, 1000, "wbuf: flush of inode %lu failed: %s",
+                            inode->ino, strerror(-rc));
+            return rc;
+        }
+        INODE_STORE(inode->durable, inode->durable + (off_t)inode->wb_len);
+        inode->wb_len = 0;
+        return 0;
+    }
+
+    int fd = fd_cache_get(inode->ino, inode->backing_path, 0);
+    if (fd < 0)
+    {
+        log_error("wbuf: failed to open backing file %s", inode->backing_path);
+        return -EIO;
+    }
+
+    off_t offset = inode->durable;
+    int rc = io_pwrite_full(fd, inode->wb_data, inode->wb_len, offset);
+    fd_cache_put(inode->ino);
+
+    if (rc != 0)
+    {
+        log_ratelimited(FUSED_LOG_ERROR, 1000, "wbuf: flush of inode %lu (%zu bytes) failed",
+                        inode->ino, inode->wb_len);
+        return rc;
+    }
+
+    INODE_STORE(inode->durable, offset + (off_t)inode->wb_len);
+    inode->wb_len = 0;
+    return 0;
+}
+
+int wb_flush_locked(fused_inode_t *inode)
+{
+    int rc = wb_writeout(inode, true);
+    if (rc != 0)
+        return rc;
+
+    if (inode->wb_queued)
+    {
+        pthread_mutex_lock(&g_wb.lock);
+        dirty_unlink(inode);
+        pthread_mutex_unlock(&g_wb.lock);
+    }
+    wb_free(inode);
+    return 0;
+}
+
+void wb_discard(fused_inode_t *inode)
+{
+    if (inode->wb_queued)
+    {
+        pthread_mutex_lock(&g_wb.lock);
+        dirty_unlink(inode);
+        pthread_mutex_unlock(&g_wb.lock);
+    }
+    wb_free(inode);
+}
+
+/**
+ * @brief Allocate an empty buffer of the given kind
+ * @return false when it does not fit the budget or memory
+ */
+static bool wb_alloc(fused_inode_t *inode, size_t cap, bool ingest)
+{
+    if (!wb_charge(cap))
+        return false;
+
+    if (ingest)
+    {
+        // One extra block, so the data can start at durable's offset in its block
+        void *block;
+        if (posix_memalign(&block, WB_INGEST_ALIGN, cap + WB_INGEST_ALIGN) == 0)
+            inode->wb_data = (char *)block + (inode->durable & (WB_INGEST_ALIGN - 1));
+    }
+    else
+        inode->wb_data = malloc(cap);
+    if (!inode->wb_data)
+    {
+        __atomic_sub_fetch(&g_wb.allocated, cap, __ATOMIC_RELAXED);
+        return false;
+    }
+    inode->wb_cap = cap;
+    inode->wb_ingest = ingest;
+    return true;
+}
+
+int wb_reserve(fused_inode_t *inode, size_t size, char **dst)
+{
+    *dst = NULL;
+
+    // Files that have grown to the ingest size are staged for O_DIRECT;
+    // room for a kept tail (under a block) is left in the ingest buffer
+    size_t ingest_min = __atomic_load_n(&g_wb.ingest_min, __ATOMIC_RELAXED);
+    bool ingest = !inode->seg_map && ingest_min != WB_INGEST_OFF &&
+                  (size_t)inode->durable + inode->wb_len + size >= ingest_min;
+    size_t cap = ingest ? WB_INGEST_BUFFER : g_wb.threshold;
+    size_t limit = ingest ? WB_INGEST_BUFFER - WB_INGEST_ALIGN : cap;
+    if (size == 0 || size >= limit)
+    {
+        // Large appends are already sequential; keep them in order behind
+        // anything buffered and write them straight through
+        return wb_flush_locked(inode);
+    }
+
+    if (inode->wb_data && inode->wb_ingest != ingest)
+    {
+        // The file just reached the ingest size (or ingest was turned off)
+        int rc = wb_flush_locked(inode);
+        if (rc != 0)
+            return rc;
+    }
+
+    if (inode->wb_len + size > inode->wb_cap)
+    {
+        // Buffer full: write it out and reuse the allocation
+        int rc = wb_writeout(inode, false);
+        if (rc != 0)
+            return rc;
+
+        if (inode->wb_cap < inode->wb_len + size)
+        {
+            wb_free(inode);
+            if (!wb_alloc(inode, cap, ingest))
+                return wb_flush_locked(inode);
+        }
+    }
+
+    *dst = inode->wb_data + inode->wb_len;
+    return 0;
+}
+
+void wb_commit(fused_inode_t *inode, size_t size)
+{
+    bool was_clean = inode->wb_len == 0;
+    inode->wb_len += size;
+
+    if (was_clean && size > 0)
+    {
+        // Age is measured from the oldest byte still buffered
+        pthread_mutex_lock(&g_wb.lock);
+        if (inode->wb_queued)
+            dirty_unlink(inode);
+        inode->wb_dirty_ms = wb_now_ms();
+        dirty_push_tail(inode);
+        pthread_mutex_unlock(&g_wb.lock);
+    }
+}
+
+/**
+ * @brief Flush one inode picked by the flusher, if it is still due
+ * The inode may have been flushed, freed or reused since it was picked.
+ */
+static void flush_aged(uint64_t ino, uint64_t now, uint32_t flush_ms)
+{
+    fused_inode_t *inode = lookup_inode(ino);
+    if (!inode)
+        return;
+
+    inode_rdlock(inode);
+    if (INODE_LOAD(inode->ino) == ino)
+    {
+        pthread_mutex_lock(&inode->append_lock);
+        // An emptied buffer still on the list is just freed
+        if (inode->wb_queued && inode->wb_dirty_ms + flush_ms <= now &&
+            wb_flush_locked(inode) != 0)
+        {
+            // Back off: retry after another interval, behind younger buffers
+            pthread_mutex_lock(&g_wb.lock);
+            dirty_unlink(inode);
+            inode->wb_dirty_ms = now;
+            dirty_push_tail(inode);
+            pthread_mutex_unlock(&g_wb.lock);
+        }
+        pthread_mutex_unlock(&inode->append_lock);
+    }
+    inode_unlock(inode);
+}
+
+static void *flusher_thread(void *arg)
+{
+    (void)arg;
+    uint64_t due[WB_FLUSH_BATCH];
+
+    pthread_mutex_lock(&g_wb.lock);
+    while (g_wb.running)
+    {
+        // Pick the buffers that have aged out; inode locks are taken
+        // without g_wb.lock held, which writers take under them
+        uint64_t now = wb_now_ms();
+        int n_due = 0;
+        for (fused_inode_t *inode = g_wb.dirty_head;
+             inode && n_due < WB_FLUSH_BATCH && g_wb.flush_ms > 0 &&
+             inode->wb_dirty_ms + g_wb.flush_ms <= now;
+             inode = inode->wb_next)
+        {
+            due[n_due++] = INODE_LOAD(inode->ino);
+        }
+
+        if (n_due > 0)
+        {
+            uint32_t flush_ms = g_wb.flush_ms;
+            pthread_mutex_unlock(&g_wb.lock);
+            for (int i = 0; i < n_due; i++)
+                flush_aged(due[i], now, flush_ms);
+            pthread_mutex_lock(&g_wb.lock);
+            if (n_due == WB_FLUSH_BATCH)
+                continue;
+        }
+
+        if (g_wb.flush_ms == 0)
+        {
+            pthread_cond_wait(&g_wb.wake, &g_wb.lock);
+            continue;
+        }
+
+        // Wake twice per interval so no buffer outlives it by much
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t nsec = deadline.tv_nsec + (uint64_t)(g_wb.flush_ms / 2 + 1) * 1000000;
+        deadline.tv_sec += nsec / 1000000000;
+        deadline.tv_nsec = nsec % 1000000000;
+        pthread_cond_timedwait(&g_wb.wake, &g_wb.lock, &deadline);
+    }
+    pthread_mutex_unlock(&g_wb.lock);
+    return NULL;
+}
+
+int wb_parse_args(struct fuse_args *args)
+{
+    return fuse_opt_parse(args, &g_wb_opts, wb_opts, NULL);
+}
+
+void wb_configure_ingest(size_t min_size)
+{
+    __atomic_store_n(&g_wb.ingest_min, min_size, __ATOMIC_RELAXED);
+}
+
+void wb_get_stats(wb_stats_t *stats)
+{
+    stats->direct_bytes = __atomic_load_n(&g_wb.stats.direct_bytes, __ATOMIC_RELAXED);
+    stats->buffered_bytes = __atomic_load_n(&g_wb.stats.buffered_bytes, __ATOMIC_RELAXED);
+}
+
+void wb_configure(size_t threshold, size_t budget, uint32_t flush_ms)
+{
+    pthread_mutex_lock(&g_wb.lock);
+    g_wb.threshold = threshold;
+    g_wb.budget = budget;
+    g_wb.flush_ms = flush_ms;
+    pthread_cond_signal(&g_wb.wake);
+    pthread_mutex_unlock(&g_wb.lock);
+}
+
+/**
+ * @brief Read the configuration from the environment and start the flusher
+ * @return 0 on success, negative errno on failure
+ */
+int wb_init(void)
+{
+    wb_configure(fused_env_size("wbuf", "FUSED_WB_THRESHOLD", WB_DEFAULT_THRESHOLD),
+                 fused_env_size("wbuf", "FUSED_WB_BUDGET", WB_DEFAULT_BUDGET),
+                 (uint32_t)fused_env_size("wbuf", "FUSED_WB_FLUSH_MS", WB_DEFAULT_FLUSH_MS));
+    wb_configure_ingest(g_wb_opts.ingest
+                            ? g_wb_opts.ingest_min
+                            : fused_env_size("wbuf", "FUSED_DIRECT_INGEST", WB_INGEST_OFF));
+    __atomic_store_n(&g_wb.direct_failed, false, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_wb.lock);
+    g_wb.running = true;
+    int rc = pthread_create(&g_wb.flusher, NULL, flusher_thread, NULL);
+    if (rc != 0)
+    {
+        g_wb.running = false;
+    }
+    pthread_mutex_unlock(&g_wb.lock);
+    return -rc;
+}
+
+/**
+ * @brief Stop the flusher; buffers are left for wb_discard()
+ */
+void wb_destroy(void)
+{
+    pthread_mutex_lock(&g_wb.lock);
+    if (!g_wb.running)
+    {
+        pthread_mutex_unlock(&g_wb.lock);
+        return;
+    }
+    g_wb.running = false;
+    pthread_cond_signal(&g_wb.wake);
+    pthread_mutex_unlock(&g_wb.lock);
+
+    pthread_join(g_wb.flusher, NULL);
+}
@@ -5,12 +5,16 @@
 
 #include <grpcpp/grpcpp.h>
 #include "filesystem.grpc.pb.h"
+#include "fused_log.h"
+#include "fused_crc32c.h"
+#include <vector>
 
 extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -48,8 +52,7 @@ public:
         Status status = stub_->Write(&ctx, req, &resp);
         
         if (!status.ok() || resp.status_code() != 0) {
-            fprintf(stderr, "[gRPC] Write failed: %s\n", 
-                    resp.error_message().c_str());
+            log_warn("[gRPC] Write failed: %s", resp.error_message().c_str());
             return -1;
         }
         
@@ -69,10 +72,22 @@ public:
         Status status = stub_->Get(&ctx, req, &resp);
         
         if (!status.ok() || resp.status_code() != 0) {
-            fprintf(stderr, "[gRPC] Read failed: %s\n",
-                    resp.error_message().c_str());
+            log_warn("[gRPC] Read failed: %s", resp.error_message().c_str());
             return -1;
         }
+
+        // Blocks that came with checksums must match them; a replica whose
+        // disk returns other bytes fails the read instead of outvoting
+        if (resp.crc_block_size() > 0) {
+            ssize_t bad = crc32c_verify_blocks(resp.data().data(), resp.bytes_read(),
+                                               resp.block_crcs().data(), resp.block_crcs_size(),
+                                               resp.crc_block_size());
+            if (bad >= 0) {
+                log_error("[gRPC] Read of %s: block at %lu does not match its checksum",
+                          file_id, offset + (uint64_t)bad * resp.crc_block_size());
+                return -1;
+            }
+        }
         
         *data_out = (uint8_t*)malloc(resp.bytes_read());
         memcpy(*data_out, resp.data().data(), resp.bytes_read());
@@ -80,6 +95,30 @@ public:
         return resp.bytes_read();
     }
 
+    int Checksums(const char* file_id, uint64_t offset, uint64_t length,
+                  uint64_t* covered, uint32_t* block_size, std::vector<uint32_t>* crcs) {
+        fused::GetRequest req;
+        req.set_pathname(file_id);
+        req.set_offset(offset);
+        req.set_size(length);
+        req.set_checksums_only(true);
+
+        fused::GetResponse resp;
+        ClientContext ctx;
+
+        Status status = stub_->Get(&ctx, req, &resp);
+
+        if (!status.ok() || resp.status_code() != 0) {
+            log_warn("[gRPC] Checksums failed: %s", resp.error_message().c_str());
+            return -1;
+        }
+
+        *covered = resp.bytes_read();
+        *block_size = resp.crc_block_size();
+        crcs->assign(resp.block_crcs().begin(), resp.block_crcs().end());
+        return 0;
+    }
+
     int Delete(const char* file_id) {
         fused::RemoveRequest req;
         req.set_pathname(file_id);
@@ -90,14 +129,14 @@ public:
         Status status = stub_->Remove(&ctx, req, &resp);
 
         if (!status.ok()) {
-            fprintf(stderr, "[gRPC] Delete RPC transport failed: code=%d msg=%s\n",
-                    (int)status.error_code(), status.error_message().c_str());
+            log_warn("[gRPC] Delete RPC transport failed: code=%d msg=%s",
+                     (int)status.error_code(), status.error_message().c_str());
             return -1;
         }
 
         if (resp.status_code() != 0) {
-            fprintf(stderr, "[gRPC] Delete failed: status=%d msg=%s\n",
-                    resp.status_code(), resp.error_message().c_str());
+            log_warn("[gRPC] Delete failed: status=%d msg=%s",
+                     resp.status_code(), resp.error_message().c_str());
             return -1;
         }
 
@@ -114,22 +153,18 @@ extern "C" void* handle_client(void* arg) {
     int client_fd = *(int*)arg;
     free(arg);
     
-    fprintf(stderr, "[TCP Handler] Handling client fd=%d\n", client_fd);
-    fflush(stderr);
+    log_debug("[TCP Handler] Handling client fd=%d", client_fd);
     
     char buffer[MAX_BUFFER];
     ssize_t n = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
     if (n <= 0) {
-        fprintf(stderr, "[TCP Handler] recv returned %zd\n", n);
-        fflush(stderr);
+        log_debug("[TCP Handler] recv returned %zd", n);
         close(client_fd);
         return NULL;
     }
     buffer[n] = '\0';
     
-    printf("[TCP] Received: %.*s", (int)strcspn(buffer, "\n"), buffer);
-    fprintf(stderr, "[TCP Handler] Received %zd bytes: %.*s\n", n, (int)strcspn(buffer, "\n"), buffer);
-    fflush(stderr);
+    log_debug("[TCP Handler] Received %zd bytes: %.*s", n, (int)strcspn(buffer, "\n"), buffer);
     
     // Parse command
     if (strncmp(buffer, "WRITE|", 6) == 0) {
@@ -139,8 +174,7 @@ extern "C" void* handle_client(void* arg) {
         // Find the end of the header line
         char* newline = strchr(buffer, '\n');
         if (!newline) {
-            fprintf(stderr, "[TCP] No newline found in header\n");
-            fflush(stderr);
+            log_warn("[TCP] No newline found in header");
             send(client_fd, "ERROR|Invalid header\n", 21, 0);
             close(client_fd);
             return NULL;
@@ -149,16 +183,14 @@ extern "C" void* handle_client(void* arg) {
         if (sscanf(buffer, "WRITE|%63[^|]|%lu|%lu\n", 
                    file_id, &offset, &length) == 3) {
             
-            fprintf(stderr, "[TCP] Parsed: file_id=%s, offset=%lu, length=%lu\n", file_id, offset, length);
-            fflush(stderr);
+            log_debug("[TCP] Parsed: file_id=%s, offset=%lu, length=%lu", file_id, offset, length);
             
             // Calculate how much data was already received after the header
             size_t header_len = (newline - buffer) + 1;  // Include the newline
             size_t data_in_buffer = n - header_len;
             
-            fprintf(stderr, "[TCP] header_len=%zu, data_in_buffer=%zu, total received=%zd\n", 
-                    header_len, data_in_buffer, n);
-            fflush(stderr);
+            log_debug("[TCP] header_len=%zu, data_in_buffer=%zu, total received=%zd",
+                      header_len, data_in_buffer, n);
             
             // Allocate buffer for full payload
             uint8_t* data = (uint8_t*)malloc(length);
@@ -169,52 +201,38 @@ extern "C" void* handle_client(void* arg) {
                 size_t to_copy = data_in_buffer < length ? data_in_buffer : length;
                 memcpy(data, buffer + header_len, to_copy);
                 total = to_copy;
-                fprintf(stderr, "[TCP] Copied %zu bytes from initial buffer\n", to_copy);
-                fflush(stderr);
+                log_debug("[TCP] Copied %zu bytes from initial buffer", to_copy);
             }
             
             // Receive remaining data
             while (total < length) {
                 ssize_t r = recv(client_fd, data + total, length - total, 0);
                 if (r <= 0) {
-                    fprintf(stderr, "[TCP] recv failed while reading data: %zd\n", r);
-                    fflush(stderr);
+                    log_warn("[TCP] recv failed while reading data: %zd", r);
                     break;
                 }
                 total += r;
-                fprintf(stderr, "[TCP] Received %zd more bytes, total=%lu/%lu\n", r, total, length);
-                fflush(stderr);
+                log_debug("[TCP] Received %zd more bytes, total=%lu/%lu", r, total, length);
             }
             
-            printf(" → Write: %s, %lu bytes at offset %lu\n", 
-                   file_id, total, offset);
-            fprintf(stderr, "[TCP] Calling gRPC Write...\n");
-            fflush(stderr);
+            log_debug("[TCP] Write: %s, %lu bytes at offset %lu", file_id, total, offset);
             
             // Call gRPC
             int bytes_written = g_client->Write(file_id, offset, data, total);
             free(data);
             
-            fprintf(stderr, "[TCP] gRPC Write returned %d\n", bytes_written);
-            fflush(stderr);
-            
             // Send response
             if (bytes_written > 0) {
                 char resp[128];
                 snprintf(resp, sizeof(resp), "OK|%d\n", bytes_written);
                 send(client_fd, resp, strlen(resp), 0);
-                printf("[TCP] Write OK: %d bytes\n", bytes_written);
-                fprintf(stderr, "[TCP] Sent response: %s", resp);
-                fflush(stderr);
+                log_debug("[TCP] Write OK: %d bytes", bytes_written);
             } else {
                 send(client_fd, "ERROR|Write failed\n", 19, 0);
-                printf("[TCP] Write FAILED\n");
-                fprintf(stderr, "[TCP] Write failed, sent error response\n");
-                fflush(stderr);
+                log_warn("[TCP] Write of %s failed, sent error response", file_id);
             }
         } else {
-            fprintf(stderr, "[TCP] Failed to parse WRITE command\n");
-            fflush(stderr);
+            log_warn("[TCP] Failed to parse WRITE command");
             send(client_fd, "ERROR|Invalid WRITE syntax\n", 27, 0);
         }
     }
@@ -225,8 +243,7 @@ extern "C" void* handle_client(void* arg) {
         if (sscanf(buffer, "READ|%63[^|]|%lu|%lu\n", 
                    file_id, &offset, &length) == 3) {
             
-            printf(" → Read: %s, %lu bytes at offset %lu\n",
-                   file_id, offset, length);
+            log_debug("[TCP] Read: %s, %lu bytes at offset %lu", file_id, length, offset);
             
             // Call gRPC
             uint8_t* data = nullptr;
@@ -235,37 +252,67 @@ extern "C" void* handle_client(void* arg) {
             if (bytes_read > 0) {
                 send(client_fd, data, bytes_read, 0);
                 free(data);
-                printf("[TCP] Read OK: %d bytes\n", bytes_read);
+                log_debug("[TCP] Read OK: %d bytes", bytes_read);
             } else if (bytes_read == 0) {
                 // Empty read is OK
-                printf("[TCP] Read OK: 0 bytes (EOF)\n");
+                log_debug("[TCP] Read OK: 0 bytes (EOF)");
+            } else {
+                log_warn("[TCP] Read of %s FAILED", file_id);
+            }
+        }
+    }
+    else if (strncmp(buffer, "CRCS|", 5) == 0) {
+        char file_id[MAX_FILE_ID];
+        uint64_t offset, length;
+
+        if (sscanf(buffer, "CRCS|%63[^|]|%lu|%lu\n",
+                   file_id, &offset, &length) == 3) {
+            log_debug("[TCP] Checksums: %s, %lu bytes at offset %lu", file_id, length, offset);
+
+            uint64_t covered = 0;
+            uint32_t block_size = 0;
+            std::vector<uint32_t> crcs;
+            if (g_client->Checksums(file_id, offset, length, &covered, &block_size, &crcs) == 0) {
+                // Header line, then the checksums in network byte order
+                char header[128];
+                int header_len = snprintf(header, sizeof(header), "OK|%lu|%u|%zu\n",
+                                          covered, block_size, crcs.size());
+                for (uint32_t &crc : crcs) {
+                    crc = htonl(crc);
+                }
+                send(client_fd, header, header_len, 0);
+                send(client_fd, crcs.data(), crcs.size() * sizeof(uint32_t), 0);
+                log_debug("[TCP] Checksums OK: %zu blocks", crcs.size());
             } else {
-                printf("[TCP] Read FAILED\n");
+                send(client_fd, "ERROR|Checksums failed\n", 23, 0);
+                log_warn("[TCP] Checksums of %s FAILED", file_id);
             }
+        } else {
+            send(client_fd, "ERROR|Invalid CRCS syntax\n", 26, 0);
         }
     }
     else if (strncmp(buffer, "DELETE|", 7) == 0) {
         char file_id[MAX_FILE_ID];
         if (sscanf(buffer, "DELETE|%63[^\n]\n", file_id) == 1) {
-            printf(" → Delete: %s\n", file_id);
+            log_debug("[TCP] Delete: %s", file_id);
             int rc = g_client->Delete(file_id);
             if (rc == 0) {
                 send(client_fd, "OK\n", 3, 0);
-                printf("[TCP] Delete OK\n");
+                log_debug("[TCP] Delete OK");
             } else {
                 send(client_fd, "ERROR|Delete failed\n", 20, 0);
-                printf("[TCP] Delete FAILED\n");
+                log_warn("[TCP] Delete of %s FAILED", file_id);
             }
         } else {
             send(client_fd, "ERROR|Invalid DELETE syntax\n", 28, 0);
         }
     }
     else if (strncmp(buffer, "PING\n", 5) == 0) {
-        printf(" → Ping\n");
+        log_debug("[TCP] Ping");
         send(client_fd, "PONG\n", 5, 0);
     }
     else {
-        printf(" → Unknown command\n");
+        log_warn("[TCP] Unknown command");
         send(client_fd, "ERROR|Unknown command\n", 22, 0);
     }
     
@@ -283,12 +330,8 @@ int main(int argc, char** argv) {
     const char* grpc_env = getenv("GRPC_SERVER");
     const char* grpc_addr = grpc_env ? grpc_env : GRPC_SERVER;
     
-    printf("=========================================\n");
-    printf(" TCP Storage Adapter\n");
-    printf("=========================================\n");
-    printf(" TCP Port:    %d\n", port);
-    printf(" gRPC Server: %s\n", grpc_addr);
-    printf("=========================================\n\n");
+    fused_log_init("tcp-adapter");
+    log_info("TCP Storage Adapter: TCP port %d, gRPC server %s", port, grpc_addr);
     
     // Initialize gRPC client
     g_client = new StorageClient(
@@ -298,7 +341,7 @@ int main(int argc, char** argv) {
     // Create TCP socket
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
-        perror("socket failed");
+        log_error("socket failed: %s", strerror(errno));
         return 1;
     }
     
@@ -312,29 +355,25 @@ int main(int argc, char** argv) {
     addr.sin_port = htons(port);
     
     if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind failed");
+        log_error("bind failed: %s", strerror(errno));
         close(server_fd);
         return 1;
     }
     
     if (listen(server_fd, 10) < 0) {
-        perror("listen failed");
+        log_error("listen failed: %s", strerror(errno));
         close(server_fd);
         return 1;
     }
     
-    printf("[TCP] Listening on 0.0.0.0:%d...\n\n", port);
-    fprintf(stderr, "[TCP] TCP Adapter listening on 0.0.0.0:%d...\n", port);
-    fflush(stdout);
-    fflush(stderr);
+    log_info("[TCP] Listening on 0.0.0.0:%d...", port);
     
     // Accept loop
     while (1) {
         int* client_fd = (int*)malloc(sizeof(int));
         *client_fd = accept(server_fd, NULL, NULL);
         
-        fprintf(stderr, "[TCP] Accepted connection fd=%d\n", *client_fd);
-        fflush(stderr);
+        log_debug("[TCP] Accepted connection fd=%d", *client_fd);
         
         if (*client_fd < 0) {
             free(client_fd);
@@ -7,82 +7,77 @@
 #include <CUnit/CUnit.h>
 #include <CUnit/Basic.h>
 #include "../include/fused_fs.h"
+#include "../include/fused_fdcache.h"
+#include "../include/fused_wbuf.h"
+#include "../include/fused_cache.h"
+#include "../include/fused_itable.h"
+#include "../include/fused_prefetch.h"
+#include "../include/fused_segment.h"
+#include "../include/fused_hotcache.h"
+#include "../include/fused_io.h"
+#include "../include/fused_stats.h"
+#include "../include/fused_pathcache.h"
+#include "../include/fused_crc.h"
+#include "../include/fused_cold.h"
 #include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <errno.h>
 #include <string.h>
 
+#define TEST_BACKING_DIR "/tmp/fused_test_backing"
+
+// Helper: delete the backing files and inode table the filesystem persists
+static void wipe_backing_dir(void)
+{
+    DIR *dir = opendir(TEST_BACKING_DIR);
+    if (!dir)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[MAX_PATH * 2];
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", TEST_BACKING_DIR, entry->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+    rmdir(TEST_BACKING_DIR);
+}
+
 // Test fixture: initialize filesystem before each test
 int init_suite(void)
 {
-    // Initialize filesystem state
-    g_state = calloc(1, sizeof(fused_state_t));
-    snprintf(g_state->backing_dir, MAX_PATH, "/tmp/fused_test_backing");
-    mkdir(g_state->backing_dir, 0755);
-    
-    // Create root inode
-    fused_inode_t *root = &g_state->inodes[0];
-    root->ino = FUSE_ROOT_ID;
-    root->mode = S_IFDIR | 0755;
-    root->uid = getuid();
-    root->gid = getgid();
-    root->size = 4096;
-    root->atime = root->mtime = root->ctime = time(NULL);
-    root->n_children = 0;
-    g_state->n_inodes = 1;
-    
-    return 0;
+    // Start from an empty namespace: state persists across restarts
+    wipe_backing_dir();
+    return fused_state_init(TEST_BACKING_DIR);
 }
 
 // Test fixture: cleanup after each test
 int clean_suite(void)
 {
-    if (g_state)
-    {
-        // Remove backing files
-        for (int i = 0; i < g_state->n_inodes; i++)
-        {
-            if (g_state->inodes[i].backing_path[0] != '\0')
-            {
-                unlink(g_state->inodes[i].backing_path);
-            }
-        }
-        free(g_state);
-        g_state = NULL;
-    }
-    rmdir("/tmp/fused_test_backing");
+    // Frees the inode table, then removes what it left on disk
+    fused_state_destroy();
+    wipe_backing_dir();
     return 0;
 }
 
 // Helper: create a test file inode
 static fused_inode_t* create_test_file(const char *name, const char *parent_path)
 {
-    if (g_state->n_inodes >= MAX_INODES)
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s%s%s", parent_path,
+             parent_path[strlen(parent_path) - 1] == '/' ? "" : "/", name);
+
+    // Creates the inode, the backing file and the directory entry
+    struct fuse_file_info fi = {0};
+    if (fused_create(path, 0644, &fi) != 0)
         return NULL;
-    
-    fused_inode_t *file = &g_state->inodes[g_state->n_inodes];
-    memset(file, 0, sizeof(fused_inode_t));
-    
-    file->ino = g_state->n_inodes + 1;
-    snprintf(file->backing_path, MAX_PATH, "%s/inode_%lu",
-             g_state->backing_dir, file->ino);
-    file->mode = S_IFREG | 0644;
-    file->uid = getuid();
-    file->gid = getgid();
+
+    fused_inode_t *file = lookup_inode(fi.fh);
     file->size = 100;  // Arbitrary size
-    file->atime = file->mtime = file->ctime = time(NULL);
-    
-    // Add to parent directory
-    fused_inode_t *parent = &g_state->inodes[0];  // Root
-    strncpy(parent->child_names[parent->n_children], name, MAX_NAME - 1);
-    parent->child_inodes[parent->n_children] = file->ino;
-    parent->n_children++;
-    
-    g_state->n_inodes++;
-    
-    // Create actual backing file
-    FILE *fp = fopen(file->backing_path, "wb");
-    if (fp) fclose(fp);
-    
     return file;
 }
 
@@ -165,23 +160,59 @@ void test_getattr_block_calculation(void)
 // ============================================================================
 
 // Helper to capture filler calls
+#define CAPTURE_MAX_NAMES 512
 typedef struct {
-    char names[MAX_CHILDREN][MAX_NAME];
+    char names[CAPTURE_MAX_NAMES][MAX_NAME];
+    struct stat attrs[CAPTURE_MAX_NAMES];
     int count;
+    int limit;      // Report a full buffer after this many names, 0 = no limit
+    off_t next;     // Offset of the last captured name
 } readdir_capture_t;
 
 static int test_filler(void *buf, const char *name, const struct stat *stbuf, off_t off)
 {
-    (void)stbuf;
-    (void)off;
-    
     readdir_capture_t *capture = (readdir_capture_t *)buf;
+    if (capture->count >= CAPTURE_MAX_NAMES || (capture->limit && capture->count >= capture->limit))
+        return 1;
     strncpy(capture->names[capture->count], name, MAX_NAME - 1);
     capture->names[capture->count][MAX_NAME - 1] = '\0';
+    if (stbuf)
+        capture->attrs[capture->count] = *stbuf;
+    capture->next = off;
     capture->count++;
     return 0;
 }
 
+// Count how often name appears in a capture
+static int capture_count(const readdir_capture_t *capture, const char *name)
+{
+    int n = 0;
+    for (int i = 0; i < capture->count; i++)
+    {
+        if (strcmp(capture->names[i], name) == 0)
+            n++;
+    }
+    return n;
+}
+
+// List path page by page, appending every page to all
+static void readdir_pages(const char *path, off_t offset, int page_size, readdir_capture_t *all)
+{
+    static readdir_capture_t page;
+    do
+    {
+        memset(&page, 0, sizeof(page));
+        page.limit = page_size;
+        CU_ASSERT_EQUAL_FATAL(fused_readdir(path, &page, test_filler, offset, NULL), 0);
+        for (int i = 0; i < page.count && all->count < CAPTURE_MAX_NAMES; i++)
+        {
+            strcpy(all->names[all->count], page.names[i]);
+            all->attrs[all->count++] = page.attrs[i];
+        }
+        offset = page.next;
+    } while (page.count == page_size);
+}
+
 void test_readdir_empty_root(void)
 {
     readdir_capture_t capture = {0};
@@ -220,6 +251,100 @@ void test_readdir_with_files(void)
     CU_ASSERT_TRUE(found_file3);
 }
 
+void test_readdir_fills_attributes(void)
+{
+    fused_inode_t *file = create_test_file("sized.mp4", "/");
+    CU_ASSERT_EQUAL(fused_mkdir("/subdir", 0755), 0);
+
+    readdir_capture_t capture = {0};
+    CU_ASSERT_EQUAL(fused_readdir("/", &capture, test_filler, 0, NULL), 0);
+
+    int seen = 0;
+    for (int i = 0; i < capture.count; i++)
+    {
+        if (strcmp(capture.names[i], "sized.mp4") == 0)
+        {
+            CU_ASSERT_EQUAL(capture.attrs[i].st_ino, file->ino);
+            CU_ASSERT_TRUE(S_ISREG(capture.attrs[i].st_mode));
+            CU_ASSERT_EQUAL(capture.attrs[i].st_size, 100);
+            seen++;
+        }
+        if (strcmp(capture.names[i], "subdir") == 0)
+        {
+            CU_ASSERT_TRUE(S_ISDIR(capture.attrs[i].st_mode));
+            seen++;
+        }
+        // Offsets are nonzero so libfuse can page the listing
+        CU_ASSERT_NOT_EQUAL(capture.next, 0);
+    }
+    CU_ASSERT_EQUAL(seen, 2);
+}
+
+void test_readdir_paged_resume(void)
+{
+    char name[32];
+    CU_ASSERT_EQUAL(fused_mkdir("/paged", 0755), 0);
+    for (int i = 0; i < 40; i++)
+    {
+        snprintf(name, sizeof(name), "clip%02d.mp4", i);
+        CU_ASSERT_PTR_NOT_NULL(create_test_file(name, "/paged"));
+    }
+
+    // First page, then remove one listed and one unlisted name
+    static readdir_capture_t first, rest;
+    memset(&first, 0, sizeof(first));
+    memset(&rest, 0, sizeof(rest));
+    first.limit = 12;
+    CU_ASSERT_EQUAL(fused_readdir("/paged", &first, test_filler, 0, NULL), 0);
+    CU_ASSERT_EQUAL(first.count, 12);
+    CU_ASSERT_EQUAL(fused_unlink("/paged/clip00.mp4"), 0);
+    CU_ASSERT_EQUAL(fused_unlink("/paged/clip30.mp4"), 0);
+    readdir_pages("/paged", first.next, 7, &rest);
+
+    // Every name that stayed is listed exactly once
+    for (int i = 0; i < 40; i++)
+    {
+        snprintf(name, sizeof(name), "clip%02d.mp4", i);
+        int seen = capture_count(&first, name) + capture_count(&rest, name);
+        CU_ASSERT_EQUAL(seen, i == 30 ? 0 : 1);
+    }
+    CU_ASSERT_EQUAL(first.count + rest.count, 2 + 39);
+}
+
+void test_readdir_resume_after_compaction(void)
+{
+    char name[32];
+    CU_ASSERT_EQUAL(fused_mkdir("/compact", 0755), 0);
+    for (int i = 0; i < 64; i++)
+    {
+        snprintf(name, sizeof(name), "v%02d", i);
+        CU_ASSERT_PTR_NOT_NULL(create_test_file(name, "/compact"));
+    }
+
+    static readdir_capture_t first, rest;
+    memset(&first, 0, sizeof(first));
+    memset(&rest, 0, sizeof(rest));
+    first.limit = 2 + 10;
+    CU_ASSERT_EQUAL(fused_readdir("/compact", &first, test_filler, 0, NULL), 0);
+
+    // Enough removals to squeeze the holes out of the entry array
+    for (int i = 0; i < 40; i++)
+    {
+        snprintf(name, sizeof(name), "/compact/v%02d", i);
+        CU_ASSERT_EQUAL(fused_unlink(name), 0);
+    }
+    fused_inode_t *dir = path_to_inode("/compact");
+    CU_ASSERT_TRUE(dir->dirents->n_used < 64);
+
+    readdir_pages("/compact", first.next, 5, &rest);
+    CU_ASSERT_EQUAL(rest.count, 24);
+    for (int i = 40; i < 64; i++)
+    {
+        snprintf(name, sizeof(name), "v%02d", i);
+        CU_ASSERT_EQUAL(capture_count(&rest, name), 1);
+    }
+}
+
 void test_readdir_nonexistent_directory(void)
 {
     readdir_capture_t capture = {0};
@@ -443,6 +568,47 @@ void test_read_empty_file(void)
     CU_ASSERT_EQUAL(bytes_read, 0);
 }
 
+void test_read_buf_points_at_backing_file(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/splice.mp4", 0644, &fi), 0);
+    const char *test_data = "0123456789ABCDEFGHIJ";
+    fused_write("/splice.mp4", test_data, strlen(test_data), 0, &fi);
+
+    // Request runs past EOF: clamped, and described by fd + offset
+    struct fuse_bufvec *bufv = NULL;
+    CU_ASSERT_EQUAL(fused_read_buf("/splice.mp4", &bufv, 100, 10, &fi), 0);
+    CU_ASSERT_PTR_NOT_NULL(bufv);
+    CU_ASSERT_EQUAL(fuse_buf_size(bufv), 10);
+    CU_ASSERT_TRUE(bufv->buf[0].flags & FUSE_BUF_IS_FD);
+    CU_ASSERT_EQUAL(bufv->buf[0].pos, 10);
+
+    // What libfuse does with the buffer after the callback returns
+    char buf[16] = {0};
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(sizeof(buf));
+    dst.buf[0].mem = buf;
+    CU_ASSERT_EQUAL(fuse_buf_copy(&dst, bufv, 0), 10);
+    CU_ASSERT_STRING_EQUAL(buf, "ABCDEFGHIJ");
+    free(bufv);
+
+    fused_release("/splice.mp4", &fi);
+}
+
+void test_read_buf_at_eof(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/eof.mp4", 0644, &fi), 0);
+
+    struct fuse_bufvec *bufv = NULL;
+    CU_ASSERT_EQUAL(fused_read_buf("/eof.mp4", &bufv, 4096, 0, &fi), 0);
+    CU_ASSERT_EQUAL(fuse_buf_size(bufv), 0);
+    free(bufv);
+    fused_release("/eof.mp4", &fi);
+
+    fi.fh = 0;
+    CU_ASSERT_EQUAL(fused_read_buf("/eof.mp4", &bufv, 4096, 0, &fi), -ENOENT);
+}
+
 // ============================================================================
 // fused_write Tests
 // ============================================================================
@@ -621,6 +787,71 @@ void test_read_after_multiple_writes(void)
     CU_ASSERT_STRING_EQUAL(buf, "Line1\nLine2\nLine3\n");
 }
 
+void test_write_past_eof_leaves_hole(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/sparse.mp4", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/sparse.mp4", "head", 4, 0, &fi), 4);
+
+    // Seek ahead by 1 GB: no zero-fill I/O, only the tail is allocated
+    off_t tail = (off_t)1 << 30;
+    CU_ASSERT_EQUAL(fused_write("/sparse.mp4", "tail", 4, tail, &fi), 4);
+
+    struct stat stbuf;
+    CU_ASSERT_EQUAL(fused_getattr("/sparse.mp4", &stbuf), 0);
+    CU_ASSERT_EQUAL(stbuf.st_size, tail + 4);
+    CU_ASSERT_TRUE(stbuf.st_blocks < 1024);
+
+    // The hole reads back as zeros
+    char buf[8];
+    memset(buf, 'x', sizeof(buf));
+    CU_ASSERT_EQUAL(fused_read("/sparse.mp4", buf, sizeof(buf), tail - 4, &fi), 8);
+    CU_ASSERT_EQUAL(memcmp(buf, "\0\0\0\0tail", 8), 0);
+    fused_release("/sparse.mp4", &fi);
+}
+
+void test_write_buf_from_pipe(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/upload.mp4", 0644, &fi), 0);
+
+    // libfuse hands write_buf the request data as a pipe when splicing
+    int pipefd[2];
+    CU_ASSERT_EQUAL(pipe(pipefd), 0);
+    const char *data = "spliced frames";
+    CU_ASSERT_EQUAL(write(pipefd[1], data, strlen(data)), (ssize_t)strlen(data));
+
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(strlen(data));
+    bufv.buf[0].flags = FUSE_BUF_IS_FD;
+    bufv.buf[0].fd = pipefd[0];
+    CU_ASSERT_EQUAL(fused_write_buf("/upload.mp4", &bufv, 0, &fi), (int)strlen(data));
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    // Memory buffers append the same way
+    struct fuse_bufvec mem = FUSE_BUFVEC_INIT(1);
+    mem.buf[0].mem = "!";
+    CU_ASSERT_EQUAL(fused_write_buf("/upload.mp4", &mem, strlen(data), &fi), 1);
+
+    char buf[32] = {0};
+    CU_ASSERT_EQUAL(fused_read("/upload.mp4", buf, sizeof(buf), 0, &fi), (int)strlen(data) + 1);
+    CU_ASSERT_STRING_EQUAL(buf, "spliced frames!");
+    fused_release("/upload.mp4", &fi);
+}
+
+void test_write_buf_rejects_non_append(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/fixed.mp4", 0644, &fi), 0);
+    fused_write("/fixed.mp4", "abcd", 4, 0, &fi);
+
+    struct fuse_bufvec mem = FUSE_BUFVEC_INIT(2);
+    mem.buf[0].mem = "xy";
+    CU_ASSERT_EQUAL(fused_write_buf("/fixed.mp4", &mem, 1, &fi), -EPERM);
+    CU_ASSERT_EQUAL(lookup_inode(fi.fh)->size, 4);
+    fused_release("/fixed.mp4", &fi);
+}
+
 // ============================================================================
 // fused_mkdir Tests
 // ============================================================================
@@ -719,32 +950,10 @@ void test_rmdir_nonempty(void)
     fused_inode_t *child = create_test_file("child.txt", "/");
     CU_ASSERT_PTR_NOT_NULL(child);
 
-    // Remove child from root's entries
-    fused_inode_t *root = &g_state->inodes[0];
-    int idx = -1;
-    for (int i = 0; i < root->n_children; i++)
-    {
-        if (root->child_inodes[i] == child->ino)
-        {
-            idx = i;
-            break;
-        }
-    }
-    if (idx != -1)
-    {
-        for (int j = idx; j < root->n_children - 1; j++)
-        {
-            strncpy(root->child_names[j], root->child_names[j + 1], MAX_NAME);
-            root->child_inodes[j] = root->child_inodes[j + 1];
-        }
-        root->n_children--;
-    }
-
-    // Add child to parent
-    strncpy(parent->child_names[parent->n_children], "child.txt", MAX_NAME - 1);
-    parent->child_names[parent->n_children][MAX_NAME - 1] = '\0';
-    parent->child_inodes[parent->n_children] = child->ino;
-    parent->n_children++;
+    // Move child from root's entries to parent
+    fused_inode_t *root = lookup_inode(FUSE_ROOT_ID);
+    CU_ASSERT_EQUAL(dir_rm_entry(root, "child.txt", child), 0);
+    CU_ASSERT_EQUAL(dir_add_entry(parent, "child.txt", child), 0);
 
     // Now attempt to remove non-empty directory
     result = fused_rmdir("/parent");
@@ -934,109 +1143,2237 @@ void test_remove_successful(void)
     result = fused_unlink(path);
     CU_ASSERT_NOT_EQUAL(result, 0);
 }
-// Main Test Runner
+
+// ============================================================================
+// Directory index Tests
 // ============================================================================
 
-int main()
+void test_dir_index_many_entries(void)
 {
-    CU_pSuite suite_getattr = NULL;
-    CU_pSuite suite_readdir = NULL;
-    CU_pSuite suite_open = NULL;
-    CU_pSuite suite_read = NULL;
-    CU_pSuite suite_write = NULL;
-    CU_pSuite suite_mkdir = NULL;
-    CU_pSuite suite_rmdir = NULL;
-    CU_pSuite suite_create = NULL;
-    CU_pSuite suite_rename = NULL;
-    CU_pSuite suite_unlink = NULL;
-    
-    // Initialize CUnit
-    if (CUE_SUCCESS != CU_initialize_registry())
+    CU_ASSERT_EQUAL(fused_mkdir("/bigdir", 0755), 0);
+
+    char path[MAX_PATH];
+    struct fuse_file_info fi = {0};
+    for (int i = 0; i < 200; i++)
     {
-        return CU_get_error();
+        snprintf(path, sizeof(path), "/bigdir/short_%03d.mp4", i);
+        CU_ASSERT_EQUAL(fused_create(path, 0644, &fi), 0);
+        fused_release(path, &fi);
     }
-    
-    // Create test suites
-    suite_getattr = CU_add_suite("fused_getattr Tests", init_suite, clean_suite);
-    suite_readdir = CU_add_suite("fused_readdir Tests", init_suite, clean_suite);
-    suite_open = CU_add_suite("fused_open Tests", init_suite, clean_suite);
-    suite_read = CU_add_suite("fused_read Tests", init_suite, clean_suite);
-    suite_write = CU_add_suite("fused_write Tests", init_suite, clean_suite);
-    suite_mkdir = CU_add_suite("fused_mkdir Tests", init_suite, clean_suite);
-    suite_rmdir = CU_add_suite("fused_rmdir Tests", init_suite, clean_suite);
-    suite_create = CU_add_suite("fused_create Tests", init_suite, clean_suite);
-    suite_rename = CU_add_suite("fused_rename Tests", init_suite, clean_suite);
-    suite_unlink = CU_add_suite("fused_unlink Tests", init_suite, clean_suite);
 
-    
-    if (!suite_getattr || !suite_readdir || !suite_open || !suite_read || !suite_write || !suite_mkdir || !suite_rmdir)
+    // Remove every other entry; swapped-in entries must stay reachable
+    for (int i = 0; i < 200; i += 2)
     {
-        CU_cleanup_registry();
-        return CU_get_error();
+        snprintf(path, sizeof(path), "/bigdir/short_%03d.mp4", i);
+        CU_ASSERT_EQUAL(fused_unlink(path), 0);
     }
-    
-    // Add getattr tests
-    CU_add_test(suite_getattr, "Root directory", test_getattr_root_directory);
-    CU_add_test(suite_getattr, "Nonexistent file", test_getattr_nonexistent_file);
-    CU_add_test(suite_getattr, "Regular file", test_getattr_regular_file);
-    CU_add_test(suite_getattr, "File attributes", test_getattr_file_attributes);
-    CU_add_test(suite_getattr, "Block calculation", test_getattr_block_calculation);
-    
-    // Add readdir tests
-    CU_add_test(suite_readdir, "Empty root directory", test_readdir_empty_root);
-    CU_add_test(suite_readdir, "Directory with files", test_readdir_with_files);
-    CU_add_test(suite_readdir, "Nonexistent directory", test_readdir_nonexistent_directory);
-    CU_add_test(suite_readdir, "File not directory", test_readdir_file_not_directory);
-    
-    // Add open tests
-    CU_add_test(suite_open, "Open for reading", test_open_file_for_reading);
-    CU_add_test(suite_open, "Open for append", test_open_file_for_append);
-    CU_add_test(suite_open, "Reject non-append write", test_open_reject_non_append_write);
-    CU_add_test(suite_open, "Reject RDWR without append", test_open_reject_rdwr_without_append);
-    CU_add_test(suite_open, "Nonexistent file", test_open_nonexistent_file);
-    CU_add_test(suite_open, "Directory as file", test_open_directory_as_file);
-    CU_add_test(suite_open, "Updates atime", test_open_updates_atime);
-    
-    // Add read tests
-    CU_add_test(suite_read, "Basic file read", test_read_basic_file);
-    CU_add_test(suite_read, "Read with offset", test_read_with_offset);
-    CU_add_test(suite_read, "Read beyond file size", test_read_beyond_file_size);
-    CU_add_test(suite_read, "Read partial data", test_read_partial_data);
-    CU_add_test(suite_read, "Read empty file", test_read_empty_file);
-    
-    // Add write tests
-    CU_add_test(suite_write, "Basic append write", test_write_basic_append);
-    CU_add_test(suite_write, "Multiple appends", test_write_multiple_appends);
-    CU_add_test(suite_write, "Reject non-append", test_write_reject_non_append);
-    CU_add_test(suite_write, "Updates metadata", test_write_updates_metadata);
-    CU_add_test(suite_write, "Write and read consistency", test_write_and_read_consistency);
-    CU_add_test(suite_write, "Write large data", test_write_large_data);
-    CU_add_test(suite_write, "Read after multiple writes", test_read_after_multiple_writes);
 
-    // Add mkdir tests
-    CU_add_test(suite_mkdir, "Create directory (success)", test_mkdir_success);
-    CU_add_test(suite_mkdir, "Create directory (existing)", test_mkdir_existing);
-    CU_add_test(suite_mkdir, "Create directory (parent nonexistent)", test_mkdir_parent_nonexistent);
-    CU_add_test(suite_mkdir, "Create directory (parent not dir)", test_mkdir_parent_not_directory);
-    
-    // Add rmdir tests
-    CU_add_test(suite_rmdir, "Remove empty directory (success)", test_rmdir_success);
-    CU_add_test(suite_rmdir, "Remove non-empty directory", test_rmdir_nonempty);
-    CU_add_test(suite_rmdir, "Remove nonexistent directory", test_rmdir_nonexistent);
-    CU_add_test(suite_rmdir, "Remove root (busy)", test_rmdir_root_busy);
-    CU_add_test(suite_rmdir, "Remove not a directory", test_rmdir_not_directory);
+    for (int i = 0; i < 200; i++)
+    {
+        snprintf(path, sizeof(path), "/bigdir/short_%03d.mp4", i);
+        if (i % 2 == 0)
+            CU_ASSERT_PTR_NULL(path_to_inode(path));
+        else
+            CU_ASSERT_PTR_NOT_NULL(path_to_inode(path));
+    }
 
-    // add create tests
-    CU_add_test(suite_create, "Successful create", test_create_successful);
-    CU_add_test(suite_create, "Create to invalid path", test_create_parent_dne);
-    CU_add_test(suite_create, "Create existing path", test_create_file_exists);
+    fused_inode_t *dir = path_to_inode("/bigdir");
+    CU_ASSERT_PTR_NOT_NULL(dir);
+    CU_ASSERT_EQUAL(dir->dirents->n_entries, 100);
+}
 
-    CU_add_test(suite_rename, "Working rename", test_rename_successful);
-    CU_add_test(suite_rename, "Rename to an invalid path", test_rename_invalid_dest);
-    CU_add_test(suite_rename, "Rename a file that does not exist", test_rename_invalid_source);
-    CU_add_test(suite_rename, "Rename a file to itself", test_rename_same_source_as_dest);
+void test_dir_index_duplicate_and_reuse(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/dup.txt", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_create("/dup.txt", 0644, &fi), -EEXIST);
 
-    CU_add_test(suite_unlink, "Remove a file, and a nonexistant file", test_remove_successful);
+    // Repeated create/unlink churns tombstones without losing lookups
+    for (int i = 0; i < 300; i++)
+    {
+        CU_ASSERT_EQUAL(fused_create("/churn.txt", 0644, &fi), 0);
+        CU_ASSERT_EQUAL(fused_unlink("/churn.txt"), 0);
+    }
+    CU_ASSERT_PTR_NULL(path_to_inode("/churn.txt"));
+    CU_ASSERT_PTR_NOT_NULL(path_to_inode("/dup.txt"));
+}
+
+void test_dir_grows_past_256_entries(void)
+{
+    CU_ASSERT_EQUAL(fused_mkdir("/huge", 0755), 0);
+
+    char path[MAX_PATH];
+    struct fuse_file_info fi = {0};
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(path, sizeof(path), "/huge/upload_%04d.mp4", i);
+        CU_ASSERT_EQUAL(fused_create(path, 0644, &fi), 0);
+        fused_release(path, &fi);
+    }
+
+    fused_inode_t *dir = path_to_inode("/huge");
+    CU_ASSERT_PTR_NOT_NULL(dir);
+    CU_ASSERT_EQUAL(dir->dirents->n_entries, 1000);
+    CU_ASSERT_PTR_NOT_NULL(path_to_inode("/huge/upload_0999.mp4"));
+
+    // Regular files carry no dirent store and stay small
+    fused_inode_t *file = path_to_inode("/huge/upload_0000.mp4");
+    CU_ASSERT_PTR_NULL(file->dirents);
+    CU_ASSERT_TRUE(sizeof(fused_inode_t) < 512);
+
+    // Removing most entries compacts the name arena
+    for (int i = 0; i < 900; i++)
+    {
+        snprintf(path, sizeof(path), "/huge/upload_%04d.mp4", i);
+        CU_ASSERT_EQUAL(fused_unlink(path), 0);
+    }
+    CU_ASSERT_EQUAL(dir->dirents->n_entries, 100);
+    CU_ASSERT_TRUE(dir->dirents->names_len < 1000 * 16 / 2);
+    CU_ASSERT_EQUAL(dir->dirents->names_len - dir->dirents->names_dead, 100 * 16);
+    CU_ASSERT_PTR_NOT_NULL(path_to_inode("/huge/upload_0950.mp4"));
+    CU_ASSERT_PTR_NULL(path_to_inode("/huge/upload_0500.mp4"));
+}
+
+void test_dir_rejects_long_names(void)
+{
+    char path[MAX_PATH + 16];
+    memset(path, 'n', sizeof(path) - 1);
+    path[0] = '/';
+    path[MAX_NAME + 1] = '\0';
+
+    fused_inode_t *root = lookup_inode(FUSE_ROOT_ID);
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/short.txt", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(dir_add_entry(root, path + 1, lookup_inode(fi.fh)), -ENAMETOOLONG);
+}
+
+// ============================================================================
+// Inode allocator Tests
+// ============================================================================
+
+void test_inode_slot_reuse_bumps_generation(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/gen.txt", 0644, &fi), 0);
+    uint64_t old_ino = fi.fh;
+
+    CU_ASSERT_EQUAL(fused_unlink("/gen.txt"), 0);
+    CU_ASSERT_PTR_NULL(lookup_inode(old_ino));
+
+    // The freed slot is reused, but under a new generation
+    CU_ASSERT_EQUAL(fused_create("/gen2.txt", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fi.fh & INODE_SLOT_MASK, old_ino & INODE_SLOT_MASK);
+    CU_ASSERT_NOT_EQUAL(fi.fh, old_ino);
+    CU_ASSERT_PTR_NULL(lookup_inode(old_ino));
+    CU_ASSERT_PTR_NOT_NULL(lookup_inode(fi.fh));
+
+    // A stale handle is rejected by the data path
+    char buf[8];
+    struct fuse_file_info stale = {0};
+    stale.fh = old_ino;
+    CU_ASSERT_EQUAL(fused_read("/gen.txt", buf, sizeof(buf), 0, &stale), -ENOENT);
+}
+
+void test_inode_table_grows_past_one_chunk(void)
+{
+    char path[MAX_PATH];
+    struct fuse_file_info fi = {0};
+    int created = 0;
+
+    for (int d = 0; d < 5; d++)
+    {
+        snprintf(path, sizeof(path), "/grow%d", d);
+        CU_ASSERT_EQUAL(fused_mkdir(path, 0755), 0);
+        for (int i = 0; i < 220; i++)
+        {
+            snprintf(path, sizeof(path), "/grow%d/f%d", d, i);
+            if (fused_create(path, 0644, &fi) == 0)
+                created++;
+            fused_release(path, &fi);
+        }
+    }
+
+    CU_ASSERT_EQUAL(created, 1100);
+    CU_ASSERT_TRUE(g_state->n_chunks >= 2);
+    CU_ASSERT_PTR_NOT_NULL(path_to_inode("/grow4/f219"));
+    CU_ASSERT_PTR_NOT_NULL(lookup_inode(fi.fh));
+}
+
+// ============================================================================
+// Backing fd cache Tests
+// ============================================================================
+
+// Helper: number of descriptors open in this process
+static int count_open_fds(void)
+{
+    int count = 0;
+    DIR *d = opendir("/proc/self/fd");
+    if (!d)
+        return -1;
+    while (readdir(d))
+        count++;
+    closedir(d);
+    return count;
+}
+
+void test_fd_cache_idle_bound(void)
+{
+    int baseline = count_open_fds();
+    char path[MAX_PATH];
+
+    // Create and release far more files than the idle bound
+    for (int i = 0; i < FD_CACHE_MAX_IDLE * 2; i++)
+    {
+        struct fuse_file_info fi = {0};
+        snprintf(path, sizeof(path), "/idle_%d", i);
+        CU_ASSERT_EQUAL(fused_create(path, 0644, &fi), 0);
+        fused_write(path, "x", 1, 0, &fi);
+        CU_ASSERT_EQUAL(fused_release(path, &fi), 0);
+    }
+    CU_ASSERT_TRUE(count_open_fds() <= baseline + FD_CACHE_MAX_IDLE);
+
+    // Evicted descriptors are reopened transparently on the data path
+    struct fuse_file_info fi = {0};
+    fi.flags = O_RDONLY;
+    CU_ASSERT_EQUAL(fused_open("/idle_0", &fi), 0);
+    char buf[4] = {0};
+    CU_ASSERT_EQUAL(fused_read("/idle_0", buf, sizeof(buf), 0, &fi), 1);
+    CU_ASSERT_EQUAL(buf[0], 'x');
+    fused_release("/idle_0", &fi);
+}
+
+void test_fd_cache_release_closes_unlinked(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/gone.txt", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/gone.txt", "spliced", 7, 0, &fi), 7);
+    fused_inode_t *inode = lookup_inode(fi.fh);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    int fd = -1;
+    CU_ASSERT_EQUAL(inode_read_fd(inode, 7, 0, &fd), 7);
+    uint64_t ino = inode->ino;
+    int with_file = count_open_fds();
+
+    // The open handle keeps the descriptor a zero-copy reply splices from
+    CU_ASSERT_EQUAL(fused_unlink("/gone.txt"), 0);
+    CU_ASSERT_EQUAL(count_open_fds(), with_file);
+    char buf[8] = {0};
+    CU_ASSERT_EQUAL(pread(fd, buf, 7, 0), 7);
+    CU_ASSERT_EQUAL(memcmp(buf, "spliced", 7), 0);
+    CU_ASSERT_EQUAL(fd_cache_get(ino, "/nonexistent", 0), -ENOENT);
+
+    // Releasing the handle of the deleted file closes it
+    CU_ASSERT_EQUAL(fused_release("/gone.txt", &fi), 0);
+    CU_ASSERT_EQUAL(count_open_fds(), with_file - 1);
+}
+
+// Helper: one thread pinning a descriptor that others may be opening too
+typedef struct {
+    fused_inode_t *inode;
+    int fd;
+} fd_race_arg_t;
+
+static void *fd_race_worker(void *arg)
+{
+    fd_race_arg_t *race = arg;
+    race->fd = fd_cache_get(race->inode->ino, race->inode->backing_path, 0);
+    return NULL;
+}
+
+void test_fd_cache_concurrent_miss(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/race.txt", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_release("/race.txt", &fi), 0);
+    fused_inode_t *inode = path_to_inode("/race.txt");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    CU_ASSERT_EQUAL(fd_cache_drop_idle(inode->ino), 0);
+    int baseline = count_open_fds();
+
+    // Every thread misses at once; only one descriptor may stay cached
+    enum { RACERS = 8 };
+    pthread_t threads[RACERS];
+    fd_race_arg_t races[RACERS];
+    for (int t = 0; t < RACERS; t++)
+    {
+        races[t].inode = inode;
+        pthread_create(&threads[t], NULL, fd_race_worker, &races[t]);
+    }
+    for (int t = 0; t < RACERS; t++)
+        pthread_join(threads[t], NULL);
+
+    CU_ASSERT_TRUE(races[0].fd >= 0);
+    for (int t = 1; t < RACERS; t++)
+        CU_ASSERT_EQUAL(races[t].fd, races[0].fd);
+    CU_ASSERT_EQUAL(count_open_fds(), baseline + 1);
+    CU_ASSERT_TRUE(fcntl(races[0].fd, F_GETFD) & FD_CLOEXEC);
+
+    for (int t = 0; t < RACERS; t++)
+        fd_cache_put(inode->ino);
+    CU_ASSERT_EQUAL(fd_cache_drop_idle(inode->ino), 0);
+}
+
+// ============================================================================
+// Inode-level operation Tests
+// ============================================================================
+
+void test_inode_ops_without_paths(void)
+{
+    fused_inode_t *root = lookup_inode(FUSE_ROOT_ID);
+    fused_inode_t *dir;
+    fused_inode_t *file;
+
+    CU_ASSERT_EQUAL(inode_mkdir(root, "videos", 0755, getuid(), getgid(), false, &dir), 0);
+    CU_ASSERT_EQUAL(inode_create(dir, "clip.mp4", 0644, getuid(), getgid(), false, &file), 0);
+    CU_ASSERT_EQUAL(inode_create(dir, "clip.mp4", 0644, getuid(), getgid(), false, &file),
+                    -EEXIST);
+    CU_ASSERT_PTR_EQUAL(dir_lookup(dir, "clip.mp4"), file);
+
+    CU_ASSERT_EQUAL(inode_write(file, "frame", 5, 0), 5);
+    char buf[8] = {0};
+    CU_ASSERT_EQUAL(inode_read(file, buf, sizeof(buf), 0), 5);
+    CU_ASSERT_STRING_EQUAL(buf, "frame");
+    inode_release(file->ino, O_RDONLY);
+
+    CU_ASSERT_EQUAL(inode_rename(dir, "clip.mp4", root, "moved.mp4"), 0);
+    CU_ASSERT_PTR_EQUAL(path_to_inode("/moved.mp4"), file);
+    CU_ASSERT_EQUAL(inode_rmdir(root, "videos"), 0);
+    CU_ASSERT_EQUAL(inode_unlink(root, "videos"), -ENOENT);
+}
+
+void test_inode_forget_defers_free(void)
+{
+    fused_inode_t *root = lookup_inode(FUSE_ROOT_ID);
+    fused_inode_t *file;
+
+    // One reference from the create, one from a later lookup
+    CU_ASSERT_EQUAL(inode_create(root, "held.mp4", 0644, getuid(), getgid(), true, &file), 0);
+    uint64_t ino = file->ino;
+    CU_ASSERT_PTR_EQUAL(dir_lookup_ref(root, "held.mp4"), file);
+    CU_ASSERT_PTR_NULL(dir_lookup_ref(root, "missing.mp4"));
+
+    // Still referenced by the kernel: gone from the namespace, data intact
+    CU_ASSERT_EQUAL(inode_write(file, "abc", 3, 0), 3);
+    CU_ASSERT_EQUAL(inode_unlink(root, "held.mp4"), 0);
+    CU_ASSERT_PTR_NULL(path_to_inode("/held.mp4"));
+    CU_ASSERT_PTR_EQUAL(lookup_inode(ino), file);
+
+    char buf[4] = {0};
+    CU_ASSERT_EQUAL(inode_read(file, buf, 3, 0), 3);
+    CU_ASSERT_STRING_EQUAL(buf, "abc");
+
+    inode_forget(file, 1);
+    CU_ASSERT_PTR_NOT_NULL(lookup_inode(ino));
+    inode_forget(file, 1);
+    CU_ASSERT_PTR_NULL(lookup_inode(ino));
+}
+
+// ============================================================================
+// Concurrency Tests
+// ============================================================================
+
+#define CONC_THREADS 4
+#define CONC_FILES_PER_THREAD 200
+#define CONC_CHUNK 64
+#define CONC_CHUNKS 500
+
+static void *create_unlink_worker(void *arg)
+{
+    long id = (long)arg;
+    char path[MAX_PATH];
+
+    for (int i = 0; i < CONC_FILES_PER_THREAD; i++)
+    {
+        struct fuse_file_info fi = {0};
+        snprintf(path, sizeof(path), "/t%ld_%d", id, i);
+        if (fused_create(path, 0644, &fi) == 0)
+            fused_release(path, &fi);
+    }
+    // Remove every other file while the other threads keep creating
+    for (int i = 0; i < CONC_FILES_PER_THREAD; i += 2)
+    {
+        snprintf(path, sizeof(path), "/t%ld_%d", id, i);
+        fused_unlink(path);
+    }
+    return NULL;
+}
+
+void test_concurrent_create_unlink(void)
+{
+    pthread_t threads[CONC_THREADS];
+    for (long t = 0; t < CONC_THREADS; t++)
+        pthread_create(&threads[t], NULL, create_unlink_worker, (void *)t);
+    for (int t = 0; t < CONC_THREADS; t++)
+        pthread_join(threads[t], NULL);
+
+    fused_inode_t *root = lookup_inode(FUSE_ROOT_ID);
+    CU_ASSERT_EQUAL(root->dirents->n_entries, CONC_THREADS * CONC_FILES_PER_THREAD / 2);
+    CU_ASSERT_EQUAL(g_state->n_inodes, 1 + CONC_THREADS * CONC_FILES_PER_THREAD / 2);
+    CU_ASSERT_PTR_NOT_NULL(path_to_inode("/t0_1"));
+    CU_ASSERT_PTR_NULL(path_to_inode("/t3_0"));
+}
+
+static void *append_worker(void *arg)
+{
+    fused_inode_t *file = arg;
+    char chunk[CONC_CHUNK];
+
+    for (int i = 0; i < CONC_CHUNKS; i++)
+    {
+        memset(chunk, 'a' + i % 26, sizeof(chunk));
+        inode_write(file, chunk, sizeof(chunk), (off_t)i * CONC_CHUNK);
+    }
+    return NULL;
+}
+
+static void *read_worker(void *arg)
+{
+    fused_inode_t *file = arg;
+    static char buf[CONC_THREADS][CONC_CHUNK * CONC_CHUNKS];
+    static int next_reader;
+    char *mine = buf[__atomic_fetch_add(&next_reader, 1, __ATOMIC_RELAXED) % CONC_THREADS];
+    long bad = 0;
+
+    while (inode_size(file) < CONC_CHUNK * CONC_CHUNKS)
+    {
+        // Everything below the published size must already be written
+        int n = inode_read(file, mine, CONC_CHUNK * CONC_CHUNKS, 0);
+        for (int i = 0; i < n; i++)
+        {
+            if (mine[i] != 'a' + (i / CONC_CHUNK) % 26)
+                bad++;
+        }
+    }
+    return (void *)bad;
+}
+
+void test_concurrent_reads_during_append(void)
+{
+    fused_inode_t *root = lookup_inode(FUSE_ROOT_ID);
+    fused_inode_t *file;
+    CU_ASSERT_EQUAL(inode_create(root, "live.mp4", 0644, getuid(), getgid(), false, &file), 0);
+
+    pthread_t writer;
+    pthread_t readers[CONC_THREADS - 1];
+    for (int t = 0; t < CONC_THREADS - 1; t++)
+        pthread_create(&readers[t], NULL, read_worker, file);
+    pthread_create(&writer, NULL, append_worker, file);
+
+    pthread_join(writer, NULL);
+    for (int t = 0; t < CONC_THREADS - 1; t++)
+    {
+        void *bad;
+        pthread_join(readers[t], &bad);
+        CU_ASSERT_EQUAL((long)bad, 0);
+    }
+    CU_ASSERT_EQUAL(inode_size(file), CONC_CHUNK * CONC_CHUNKS);
+    inode_release(file->ino, O_RDONLY);
+}
+
+// ============================================================================
+// Write-back buffer Tests
+// ============================================================================
+
+static off_t backing_size(const fused_inode_t *inode)
+{
+    struct stat st;
+    return stat(inode->backing_path, &st) == 0 ? st.st_size : -1;
+}
+
+void test_wbuf_coalesces_small_appends(void)
+{
+    wb_configure(4096, WB_DEFAULT_BUDGET, 0);
+
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/chunks.mp4", 0644, &fi), 0);
+    fused_inode_t *inode = lookup_inode(fi.fh);
+
+    char chunk[100];
+    for (int i = 0; i < 10; i++)
+    {
+        memset(chunk, 'a' + i, sizeof(chunk));
+        CU_ASSERT_EQUAL(fused_write("/chunks.mp4", chunk, sizeof(chunk), i * 100, &fi), 100);
+    }
+
+    // The size is visible at once, the backing file is written later
+    struct stat stbuf;
+    CU_ASSERT_EQUAL(fused_getattr("/chunks.mp4", &stbuf), 0);
+    CU_ASSERT_EQUAL(stbuf.st_size, 1000);
+    CU_ASSERT_EQUAL(backing_size(inode), 0);
+
+    // Reading buffered bytes writes them out first
+    char buf[1000];
+    CU_ASSERT_EQUAL(fused_read("/chunks.mp4", buf, sizeof(buf), 0, &fi), 1000);
+    CU_ASSERT_EQUAL(buf[0], 'a');
+    CU_ASSERT_EQUAL(buf[999], 'j');
+    CU_ASSERT_EQUAL(backing_size(inode), 1000);
+
+    // Filling the buffer writes it out as one append
+    char big[3000];
+    memset(big, 'z', sizeof(big));
+    CU_ASSERT_EQUAL(fused_write("/chunks.mp4", big, sizeof(big), 1000, &fi), 3000);
+    CU_ASSERT_EQUAL(fused_write("/chunks.mp4", big, 2000, 4000, &fi), 2000);
+    CU_ASSERT_EQUAL(backing_size(inode), 4000);
+
+    // Appends at or above the threshold bypass the buffer, in order
+    char huge[4096];
+    memset(huge, 'h', sizeof(huge));
+    CU_ASSERT_EQUAL(fused_write("/chunks.mp4", huge, sizeof(huge), 6000, &fi), 4096);
+    CU_ASSERT_EQUAL(backing_size(inode), 6000 + 4096);
+
+    fused_release("/chunks.mp4", &fi);
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, WB_DEFAULT_FLUSH_MS);
+}
+
+void test_wbuf_flush_fsync_release(void)
+{
+    wb_configure(4096, WB_DEFAULT_BUDGET, 0);
+
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/synced.mp4", 0644, &fi), 0);
+    fused_inode_t *inode = lookup_inode(fi.fh);
+
+    CU_ASSERT_EQUAL(fused_write("/synced.mp4", "abc", 3, 0, &fi), 3);
+    CU_ASSERT_EQUAL(backing_size(inode), 0);
+    CU_ASSERT_EQUAL(fused_flush("/synced.mp4", &fi), 0);
+    CU_ASSERT_EQUAL(backing_size(inode), 3);
+
+    CU_ASSERT_EQUAL(fused_write("/synced.mp4", "def", 3, 3, &fi), 3);
+    CU_ASSERT_EQUAL(fused_fsync("/synced.mp4", 1, &fi), 0);
+    CU_ASSERT_EQUAL(backing_size(inode), 6);
+
+    CU_ASSERT_EQUAL(fused_write("/synced.mp4", "ghi", 3, 6, &fi), 3);
+    fused_release("/synced.mp4", &fi);
+    CU_ASSERT_EQUAL(backing_size(inode), 9);
+
+    // A gap past EOF goes after the buffered bytes
+    fi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_open("/synced.mp4", &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/synced.mp4", "j", 1, 9, &fi), 1);
+    CU_ASSERT_EQUAL(fused_write("/synced.mp4", "k", 1, 20, &fi), 1);
+    char buf[21];
+    CU_ASSERT_EQUAL(fused_read("/synced.mp4", buf, sizeof(buf), 0, &fi), 21);
+    CU_ASSERT_EQUAL(memcmp(buf, "abcdefghij\0", 11), 0);
+    CU_ASSERT_EQUAL(buf[20], 'k');
+    fused_release("/synced.mp4", &fi);
+
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, WB_DEFAULT_FLUSH_MS);
+}
+
+void test_wbuf_timer_and_budget(void)
+{
+    // An exhausted budget sends appends straight to the backing file
+    wb_configure(4096, 0, 20);
+
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/aged.mp4", 0644, &fi), 0);
+    fused_inode_t *inode = lookup_inode(fi.fh);
+    CU_ASSERT_EQUAL(fused_write("/aged.mp4", "abc", 3, 0, &fi), 3);
+    CU_ASSERT_EQUAL(backing_size(inode), 3);
+
+    // Buffered appends are written out once they are older than the interval
+    wb_configure(4096, WB_DEFAULT_BUDGET, 20);
+    CU_ASSERT_EQUAL(fused_write("/aged.mp4", "def", 3, 3, &fi), 3);
+    for (int i = 0; i < 200 && backing_size(inode) != 6; i++)
+        usleep(5000);
+    CU_ASSERT_EQUAL(backing_size(inode), 6);
+
+    fused_release("/aged.mp4", &fi);
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, WB_DEFAULT_FLUSH_MS);
+}
+
+static char ingest_byte(off_t offset)
+{
+    return (char)((offset * 7 + offset / 4099) % 251);
+}
+
+void test_wbuf_direct_ingest(void)
+{
+    // Files from 64K on are staged for O_DIRECT; only the flusher's timer is off
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, 0);
+    wb_configure_ingest(64 << 10);
+    wb_stats_t before, after;
+    wb_get_stats(&before);
+
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/ingest.mp4", 0644, &fi), 0);
+    fused_inode_t *inode = lookup_inode(fi.fh);
+
+    // Odd-sized appends past a full ingest buffer
+    const off_t total = WB_INGEST_BUFFER + (WB_INGEST_BUFFER >> 1) + 1234;
+    char piece[3001];
+    off_t offset = 0;
+    while (offset < total)
+    {
+        size_t n = total - offset < (off_t)sizeof(piece) ? (size_t)(total - offset) : sizeof(piece);
+        for (size_t i = 0; i < n; i++)
+            piece[i] = ingest_byte(offset + i);
+        CU_ASSERT_EQUAL_FATAL(fused_write("/ingest.mp4", piece, n, offset, &fi), (int)n);
+        offset += n;
+    }
+
+    // Whole blocks are out; the unaligned tail waits for more appends
+    off_t written = backing_size(inode);
+    CU_ASSERT(written > WB_INGEST_BUFFER / 2 && written < total);
+    CU_ASSERT_EQUAL(written % WB_INGEST_ALIGN, 0);
+
+    // Release writes the tail; a later append starts mid-block
+    fused_release("/ingest.mp4", &fi);
+    CU_ASSERT_EQUAL(backing_size(inode), total);
+    fi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_open("/ingest.mp4", &fi), 0);
+    for (size_t i = 0; i < sizeof(piece); i++)
+        piece[i] = ingest_byte(total + i);
+    CU_ASSERT_EQUAL(fused_write("/ingest.mp4", piece, sizeof(piece), total, &fi), 3001);
+    fused_release("/ingest.mp4", &fi);
+    CU_ASSERT_EQUAL(backing_size(inode), total + 3001);
+
+    wb_get_stats(&after);
+    uint64_t direct = after.direct_bytes - before.direct_bytes;
+    uint64_t buffered = after.buffered_bytes - before.buffered_bytes;
+    CU_ASSERT_EQUAL(direct % WB_INGEST_ALIGN, 0);
+    CU_ASSERT(direct + buffered >= (uint64_t)total - (64 << 10));
+    CU_ASSERT(direct + buffered <= (uint64_t)total + 3001);
+    if (direct > 0)
+    {
+        // Heads and tails only: entering ingest, one kept tail, release, the last append
+        CU_ASSERT(buffered < 4 * WB_INGEST_ALIGN);
+    }
+
+    // Every byte landed where it belongs
+    fi.flags = O_RDONLY;
+    CU_ASSERT_EQUAL(fused_open("/ingest.mp4", &fi), 0);
+    char *buf = malloc(total + 3001);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+    CU_ASSERT_EQUAL(fused_read("/ingest.mp4", buf, total + 3001, 0, &fi), total + 3001);
+    off_t bad = -1;
+    for (off_t i = 0; i < total + 3001 && bad < 0; i++)
+        if (buf[i] != ingest_byte(i))
+            bad = i;
+    CU_ASSERT_EQUAL(bad, -1);
+    free(buf);
+    fused_release("/ingest.mp4", &fi);
+
+    wb_configure_ingest(WB_INGEST_OFF);
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, WB_DEFAULT_FLUSH_MS);
+}
+
+// Helper: append [offset, end) in pieces of at most piece bytes
+static void ingest_append(const char *path, struct fuse_file_info *fi, off_t offset, off_t end,
+                          size_t piece)
+{
+    char buf[4096];
+    while (offset < end)
+    {
+        size_t n = end - offset < (off_t)piece ? (size_t)(end - offset) : piece;
+        for (size_t i = 0; i < n; i++)
+            buf[i] = ingest_byte(offset + i);
+        CU_ASSERT_EQUAL_FATAL(fused_write(path, buf, n, offset, fi), (int)n);
+        offset += n;
+    }
+}
+
+void test_wbuf_direct_ingest_realigns(void)
+{
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, 0);
+    wb_configure_ingest(64 << 10);
+
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/realign.mp4", 0644, &fi), 0);
+    fused_inode_t *inode = lookup_inode(fi.fh);
+
+    // Enter ingest mid-block, then complete that block so every full
+    // buffer ends on a block boundary and keeps no tail
+    const off_t entry = (64 << 10) - 536;
+    ingest_append("/realign.mp4", &fi, 0, entry, 4096);
+    ingest_append("/realign.mp4", &fi, entry, 64 << 10, 4096);
+
+    wb_stats_t s0, s1;
+    off_t offset = 64 << 10;
+    wb_get_stats(&s0);
+    for (int round = 0; round < 3; round++)
+    {
+        ingest_append("/realign.mp4", &fi, offset, offset + WB_INGEST_BUFFER, 4096);
+        offset += WB_INGEST_BUFFER;
+        wb_get_stats(&s1);
+        if (round > 0 && s0.direct_bytes > 0)
+        {
+            // Each buffer after the first still goes around the page cache
+            CU_ASSERT(s1.direct_bytes >= s0.direct_bytes + WB_INGEST_BUFFER - WB_INGEST_ALIGN);
+        }
+        s0 = s1;
+    }
+    fused_release("/realign.mp4", &fi);
+    CU_ASSERT_EQUAL(backing_size(inode), offset);
+
+    fi.flags = O_RDONLY;
+    CU_ASSERT_EQUAL(fused_open("/realign.mp4", &fi), 0);
+    char *buf = malloc(offset);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+    CU_ASSERT_EQUAL(fused_read("/realign.mp4", buf, offset, 0, &fi), offset);
+    off_t bad = -1;
+    for (off_t i = 0; i < offset && bad < 0; i++)
+        if (buf[i] != ingest_byte(i))
+            bad = i;
+    CU_ASSERT_EQUAL(bad, -1);
+    free(buf);
+    fused_release("/realign.mp4", &fi);
+
+    wb_configure_ingest(WB_INGEST_OFF);
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, WB_DEFAULT_FLUSH_MS);
+}
+
+// ============================================================================
+// Kernel cache policy Tests
+// ============================================================================
+
+static int invalidations;
+
+static void count_invalidation(uint64_t ino)
+{
+    (void)ino;
+    invalidations++;
+}
+
+void test_cache_keep_cache_on_completed_files(void)
+{
+    struct fuse_file_info wfi = {0};
+    struct fuse_file_info rfi = {0};
+
+    // While the upload is open, readers must not keep stale pages
+    wfi.flags = O_WRONLY | O_CREAT;
+    CU_ASSERT_EQUAL(fused_create("/upload.mp4", 0644, &wfi), 0);
+    CU_ASSERT_EQUAL(wfi.keep_cache, 0);
+    CU_ASSERT_EQUAL(wfi.direct_io, 0);
+    rfi.flags = O_RDONLY;
+    CU_ASSERT_EQUAL(fused_open("/upload.mp4", &rfi), 0);
+    CU_ASSERT_EQUAL(rfi.keep_cache, 0);
+    fused_release("/upload.mp4", &rfi);
+
+    // Once the last writer is gone the video is complete
+    fused_release("/upload.mp4", &wfi);
+    CU_ASSERT_EQUAL(fused_open("/upload.mp4", &rfi), 0);
+    CU_ASSERT_EQUAL(rfi.keep_cache, 1);
+    fused_release("/upload.mp4", &rfi);
+
+    g_cache_policy.keep_cache = 0;
+    g_cache_policy.direct_io_writes = 1;
+    CU_ASSERT_EQUAL(fused_open("/upload.mp4", &rfi), 0);
+    CU_ASSERT_EQUAL(rfi.keep_cache, 0);
+    fused_release("/upload.mp4", &rfi);
+    wfi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_open("/upload.mp4", &wfi), 0);
+    CU_ASSERT_EQUAL(wfi.direct_io, 1);
+    fused_release("/upload.mp4", &wfi);
+
+    g_cache_policy.keep_cache = 1;
+    g_cache_policy.direct_io_writes = 0;
+}
+
+void test_cache_invalidates_on_growth(void)
+{
+    struct fuse_file_info wfi = {0};
+    struct fuse_file_info rfi = {0};
+    invalidations = 0;
+    fused_cache_set_invalidator(count_invalidation);
+
+    wfi.flags = O_WRONLY | O_CREAT;
+    CU_ASSERT_EQUAL(fused_create("/grow.mp4", 0644, &wfi), 0);
+    CU_ASSERT_EQUAL(fused_write("/grow.mp4", "abc", 3, 0, &wfi), 3);
+    fused_release("/grow.mp4", &wfi);
+    CU_ASSERT_EQUAL(invalidations, 0);
+
+    // A cached reader exists: the next growth invalidates, once
+    rfi.flags = O_RDONLY;
+    CU_ASSERT_EQUAL(fused_open("/grow.mp4", &rfi), 0);
+    CU_ASSERT_EQUAL(rfi.keep_cache, 1);
+    wfi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_open("/grow.mp4", &wfi), 0);
+    CU_ASSERT_EQUAL(fused_write("/grow.mp4", "def", 3, 3, &wfi), 3);
+    CU_ASSERT_EQUAL(fused_write("/grow.mp4", "ghi", 3, 6, &wfi), 3);
+    CU_ASSERT_EQUAL(invalidations, 1);
+
+    fused_release("/grow.mp4", &wfi);
+    fused_release("/grow.mp4", &rfi);
+    fused_cache_set_invalidator(NULL);
+}
+
+#ifdef FUSED_FUSE3
+void test_cache_conn_init(void)
+{
+    struct fuse_conn_info conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.capable = FUSE_CAP_READDIRPLUS | FUSE_CAP_READDIRPLUS_AUTO |
+                   FUSE_CAP_PARALLEL_DIROPS | FUSE_CAP_WRITEBACK_CACHE;
+    fused_cache_conn_init(&conn);
+    CU_ASSERT_EQUAL(conn.want, conn.capable & ~FUSE_CAP_WRITEBACK_CACHE);
+
+    g_cache_policy.writeback_cache = 1;
+    conn.want = 0;
+    fused_cache_conn_init(&conn);
+    CU_ASSERT_EQUAL(conn.want, conn.capable);
+
+    // Nothing the kernel lacks is requested
+    memset(&conn, 0, sizeof(conn));
+    fused_cache_conn_init(&conn);
+    CU_ASSERT_EQUAL(conn.want, 0);
+    CU_ASSERT_EQUAL(g_cache_policy.writeback_cache, 0);
+}
+#else
+void test_cache_conn_init(void)
+{
+    struct fuse_conn_info conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.capable = FUSE_CAP_BIG_WRITES | FUSE_CAP_ASYNC_READ | FUSE_CAP_AUTO_INVAL_DATA;
+    conn.async_read = 1;
+    fused_cache_conn_init(&conn);
+    CU_ASSERT_EQUAL(conn.want, conn.capable);
+
+    // -o sync_read wins, and nothing the kernel lacks is requested
+    memset(&conn, 0, sizeof(conn));
+    conn.capable = FUSE_CAP_ASYNC_READ;
+    fused_cache_conn_init(&conn);
+    CU_ASSERT_EQUAL(conn.want, 0);
+}
+#endif
+
+void test_cache_writeback_resends(void)
+{
+    struct fuse_file_info fi = {0};
+    char buf[16] = {0};
+    g_cache_policy.writeback_cache = 1;
+
+    fi.flags = O_WRONLY | O_CREAT;
+    CU_ASSERT_EQUAL(fused_create("/wb.mp4", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/wb.mp4", "abcd", 4, 0, &fi), 4);
+
+    // The kernel flushes the whole page again, with new bytes after it
+    CU_ASSERT_EQUAL(fused_write("/wb.mp4", "abcdef", 6, 0, &fi), 6);
+    CU_ASSERT_EQUAL(fused_write("/wb.mp4", "cd", 2, 2, &fi), 2);
+    CU_ASSERT_EQUAL(fused_read("/wb.mp4", buf, sizeof(buf), 0, &fi), 6);
+    CU_ASSERT_EQUAL(memcmp(buf, "abcdef", 6), 0);
+
+    // Stored bytes still never change
+    CU_ASSERT_EQUAL(fused_write("/wb.mp4", "abXdefgh", 8, 0, &fi), -EPERM);
+    CU_ASSERT_EQUAL(fused_read("/wb.mp4", buf, sizeof(buf), 0, &fi), 6);
+
+    fused_release("/wb.mp4", &fi);
+    g_cache_policy.writeback_cache = 0;
+}
+
+// ============================================================================
+// Persistent inode table Tests
+// ============================================================================
+
+static void restart_filesystem(void)
+{
+    fused_state_destroy();
+    CU_ASSERT_EQUAL(fused_state_init(TEST_BACKING_DIR), 0);
+}
+
+void test_itable_restart_restores_namespace(void)
+{
+    struct fuse_file_info fi = {0};
+    fi.flags = O_WRONLY | O_CREAT;
+
+    CU_ASSERT_EQUAL(fused_mkdir("/videos", 0750), 0);
+    CU_ASSERT_EQUAL(fused_create("/videos/a.mp4", 0640, &fi), 0);
+    uint64_t a_ino = fi.fh;
+    CU_ASSERT_EQUAL(fused_write("/videos/a.mp4", "hello", 5, 0, &fi), 5);
+    fused_release("/videos/a.mp4", &fi);
+    CU_ASSERT_EQUAL(fused_create("/b.mp4", 0644, &fi), 0);
+    fused_release("/b.mp4", &fi);
+    CU_ASSERT_EQUAL(fused_rename("/b.mp4", "/videos/c.mp4"), 0);
+    CU_ASSERT_EQUAL(fused_create("/gone.mp4", 0644, &fi), 0);
+    uint64_t gone_ino = fi.fh;
+    fused_release("/gone.mp4", &fi);
+    CU_ASSERT_EQUAL(fused_unlink("/gone.mp4"), 0);
+    struct timespec tv[2] = {{1000, 0}, {2000, 0}};
+    CU_ASSERT_EQUAL(fused_utimens("/videos/c.mp4", tv), 0);
+
+    restart_filesystem();
+
+    fused_inode_t *a = path_to_inode("/videos/a.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(a);
+    CU_ASSERT_EQUAL(a->ino, a_ino);
+    CU_ASSERT_EQUAL(a->mode, S_IFREG | 0640);
+    CU_ASSERT_EQUAL(inode_size(a), 5);
+    char buf[8] = {0};
+    CU_ASSERT_EQUAL(inode_read(a, buf, sizeof(buf), 0), 5);
+    CU_ASSERT_STRING_EQUAL(buf, "hello");
+    CU_ASSERT_EQUAL(path_to_inode("/videos")->mode, S_IFDIR | 0750);
+
+    fused_inode_t *c = path_to_inode("/videos/c.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(c);
+    CU_ASSERT_EQUAL(c->mtime, 2000);
+    CU_ASSERT_PTR_NULL(path_to_inode("/b.mp4"));
+    CU_ASSERT_PTR_NULL(path_to_inode("/gone.mp4"));
+
+    // The freed slot comes back with a new generation
+    CU_ASSERT_EQUAL(fused_create("/new.mp4", 0644, &fi), 0);
+    CU_ASSERT_NOT_EQUAL(fi.fh, gone_ino);
+    CU_ASSERT_PTR_NULL(lookup_inode(gone_ino));
+    fused_release("/new.mp4", &fi);
+}
+
+void test_itable_recovers_after_crash(void)
+{
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/before.mp4", 0644, &fi), 0);
+    fused_release("/before.mp4", &fi);
+    uint32_t slot = (uint32_t)((fi.fh & INODE_SLOT_MASK) - 1);
+    CU_ASSERT_EQUAL(fused_rename("/before.mp4", "/after.mp4"), 0);
+    fused_state_destroy();
+
+    // Tear the copy holding the rename and leave the table marked dirty
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", TEST_BACKING_DIR, ITABLE_FILE_NAME);
+    int fd = open(path, O_RDWR);
+    CU_ASSERT_FATAL(fd >= 0);
+    off_t base = ITABLE_HEADER_SIZE + (off_t)slot * ITABLE_SLOT_SIZE;
+    itable_rec_t copies[2];
+    CU_ASSERT_EQUAL(pread(fd, &copies[0], sizeof(itable_rec_t), base), sizeof(itable_rec_t));
+    CU_ASSERT_EQUAL(pread(fd, &copies[1], sizeof(itable_rec_t), base + ITABLE_REC_SIZE),
+                    sizeof(itable_rec_t));
+    int newer = copies[1].seq > copies[0].seq;
+    CU_ASSERT_STRING_EQUAL(copies[newer].name, "after.mp4");
+    CU_ASSERT_EQUAL(pwrite(fd, "X", 1, base + newer * ITABLE_REC_SIZE +
+                           offsetof(itable_rec_t, name)), 1);
+    uint32_t dirty = 0;
+    CU_ASSERT_EQUAL(pwrite(fd, &dirty, sizeof(dirty), 24), sizeof(dirty));  // superblock clean flag
+    close(fd);
+
+    // A backing file nothing refers to, as left by a crash during create
+    snprintf(path, sizeof(path), "%s/inode_%lu", TEST_BACKING_DIR, 999ul);
+    close(open(path, O_CREAT | O_WRONLY, 0644));
+
+    CU_ASSERT_EQUAL(fused_state_init(TEST_BACKING_DIR), 0);
+    CU_ASSERT_PTR_NOT_NULL(path_to_inode("/before.mp4"));
+    CU_ASSERT_PTR_NULL(path_to_inode("/after.mp4"));
+    CU_ASSERT_EQUAL(access(path, F_OK), -1);
+}
+
+void test_itable_rejects_foreign_table(void)
+{
+    fused_state_destroy();
+
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", TEST_BACKING_DIR, ITABLE_FILE_NAME);
+    int fd = open(path, O_WRONLY);
+    CU_ASSERT_FATAL(fd >= 0);
+    CU_ASSERT_EQUAL(pwrite(fd, "NOTATABL", 8, 0), 8);
+    close(fd);
+
+    CU_ASSERT_EQUAL(fused_state_init(TEST_BACKING_DIR), -EINVAL);
+    CU_ASSERT_PTR_NULL(g_state);
+
+    // Leave a usable filesystem for the suite cleanup
+    wipe_backing_dir();
+    CU_ASSERT_EQUAL(fused_state_init(TEST_BACKING_DIR), 0);
+}
+
+// ============================================================================
+// Prefetch Tests
+// ============================================================================
+
+#define PF_TEST_FILE_SIZE (4 << 20)
+#define PF_TEST_READ (128 << 10)
+
+// Create a video of PF_TEST_FILE_SIZE bytes and return its open handle
+static void create_prefetch_video(const char *path, struct fuse_file_info *fi)
+{
+    static char chunk[1 << 20];
+    memset(chunk, 'v', sizeof(chunk));
+    fi->flags = O_WRONLY | O_CREAT | O_APPEND;
+    CU_ASSERT_EQUAL_FATAL(fused_create(path, 0644, fi), 0);
+    for (off_t off = 0; off < PF_TEST_FILE_SIZE; off += sizeof(chunk))
+    {
+        CU_ASSERT_EQUAL(fused_write(path, chunk, sizeof(chunk), off, fi), (int)sizeof(chunk));
+    }
+    CU_ASSERT_EQUAL(fused_flush(path, fi), 0);
+}
+
+void test_prefetch_sequential_playback(void)
+{
+    struct fuse_file_info fi = {0};
+    create_prefetch_video("/play.mp4", &fi);
+    prefetch_configure(256 << 10, 1 << 20);
+
+    prefetch_stats_t before, after;
+    prefetch_get_stats(&before);
+    static char buf[PF_TEST_READ];
+    int reads = 0;
+    for (off_t off = 0; off < PF_TEST_FILE_SIZE; off += PF_TEST_READ, reads++)
+    {
+        CU_ASSERT_EQUAL(fused_read("/play.mp4", buf, sizeof(buf), off, &fi), PF_TEST_READ);
+    }
+
+    // Wait for the prefetch thread to hand the windows to the kernel
+    for (int i = 0; i < 200; i++)
+    {
+        prefetch_get_stats(&after);
+        if (after.bytes - before.bytes >= PF_TEST_FILE_SIZE - 2 * PF_TEST_READ)
+            break;
+        usleep(5000);
+    }
+
+    CU_ASSERT_EQUAL(after.streams - before.streams, 1);
+    CU_ASSERT_EQUAL(after.dropped, before.dropped);
+    // Windows grow, so far fewer of them than reads, and they cover the file
+    CU_ASSERT_TRUE(after.windows - before.windows >= 3);
+    CU_ASSERT_TRUE(after.windows - before.windows < (uint64_t)reads / 2);
+    CU_ASSERT_TRUE(after.bytes - before.bytes >= PF_TEST_FILE_SIZE - 2 * PF_TEST_READ);
+    // Everything after the detecting reads was already prefetched
+    CU_ASSERT_TRUE(after.hits - before.hits >= (uint64_t)reads - PF_TRIGGER_READS);
+    fused_release("/play.mp4", &fi);
+}
+
+void test_prefetch_ignores_random_reads(void)
+{
+    struct fuse_file_info fi = {0};
+    create_prefetch_video("/seek.mp4", &fi);
+    prefetch_configure(256 << 10, 1 << 20);
+
+    prefetch_stats_t before, after;
+    prefetch_get_stats(&before);
+    static char buf[PF_TEST_READ];
+    // Scrubbing backwards in 1 MiB steps never continues a stream
+    for (off_t off = PF_TEST_FILE_SIZE - PF_TEST_READ; off >= 0; off -= 1 << 20)
+    {
+        CU_ASSERT_EQUAL(fused_read("/seek.mp4", buf, sizeof(buf), off, &fi), PF_TEST_READ);
+    }
+    prefetch_get_stats(&after);
+
+    CU_ASSERT_EQUAL(after.streams, before.streams);
+    CU_ASSERT_EQUAL(after.windows, before.windows);
+    fused_release("/seek.mp4", &fi);
+}
+
+void test_prefetch_interleaved_viewers(void)
+{
+    struct fuse_file_info fi = {0};
+    create_prefetch_video("/shared.mp4", &fi);
+    prefetch_configure(256 << 10, 1 << 20);
+
+    prefetch_stats_t before, after;
+    prefetch_get_stats(&before);
+    static char buf[PF_TEST_READ];
+    // Two viewers of one video, one from the start and one from the middle
+    for (off_t off = 0; off < PF_TEST_FILE_SIZE / 2; off += PF_TEST_READ)
+    {
+        CU_ASSERT_EQUAL(fused_read("/shared.mp4", buf, sizeof(buf), off, &fi), PF_TEST_READ);
+        CU_ASSERT_EQUAL(fused_read("/shared.mp4", buf, sizeof(buf),
+                                   PF_TEST_FILE_SIZE / 2 + off, &fi), PF_TEST_READ);
+    }
+    prefetch_get_stats(&after);
+
+    CU_ASSERT_EQUAL(after.streams - before.streams, 2);
+    CU_ASSERT_TRUE(after.hits - before.hits > 0);
+    fused_release("/shared.mp4", &fi);
+}
+
+void test_prefetch_disabled(void)
+{
+    struct fuse_file_info fi = {0};
+    create_prefetch_video("/off.mp4", &fi);
+    prefetch_configure(0, 0);
+
+    prefetch_stats_t before, after;
+    prefetch_get_stats(&before);
+    static char buf[PF_TEST_READ];
+    for (off_t off = 0; off < PF_TEST_FILE_SIZE; off += PF_TEST_READ)
+    {
+        CU_ASSERT_EQUAL(fused_read("/off.mp4", buf, sizeof(buf), off, &fi), PF_TEST_READ);
+    }
+    prefetch_get_stats(&after);
+
+    CU_ASSERT_EQUAL(after.streams, before.streams);
+    CU_ASSERT_EQUAL(after.windows, before.windows);
+    prefetch_configure(PF_DEFAULT_WINDOW, PF_DEFAULT_MAX);
+    fused_release("/off.mp4", &fi);
+}
+
+// ============================================================================
+// Segment store Tests
+// ============================================================================
+
+// Fill buf with a pattern that differs per file and per offset
+static void seg_pattern(char *buf, size_t len, int file, off_t offset)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = (char)('a' + (file * 7 + offset + i) % 26);
+}
+
+// Create path and append len bytes of its pattern in two writes
+static uint64_t seg_create_file(const char *path, int file, size_t len)
+{
+    struct fuse_file_info fi = {0};
+    fi.flags = O_WRONLY | O_APPEND;
+    char buf[8192];
+    CU_ASSERT_FATAL(len <= sizeof(buf));
+    seg_pattern(buf, len, file, 0);
+
+    CU_ASSERT_EQUAL(fused_create(path, 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_write(path, buf, len / 2, 0, &fi), (int)(len / 2));
+    CU_ASSERT_EQUAL(fused_write(path, buf + len / 2, len - len / 2, len / 2, &fi),
+                    (int)(len - len / 2));
+    fused_release(path, &fi);
+    return fi.fh;
+}
+
+static void seg_check_file(const char *path, int file, size_t len)
+{
+    fused_inode_t *inode = path_to_inode(path);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    CU_ASSERT_PTR_NOT_NULL(inode->seg_map);
+    CU_ASSERT_EQUAL(inode_size(inode), (off_t)len);
+
+    char expect[8192], buf[8192];
+    seg_pattern(expect, len, file, 0);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, sizeof(buf), 0), (int)len);
+    CU_ASSERT_EQUAL(memcmp(buf, expect, len), 0);
+}
+
+void test_segment_small_files(void)
+{
+    seg_configure(true, false, 64 << 10);
+
+    char path[MAX_PATH];
+    CU_ASSERT_EQUAL(fused_mkdir("/clips", 0755), 0);
+    for (int i = 0; i < 50; i++)
+    {
+        snprintf(path, sizeof(path), "/clips/clip_%02d.mp4", i);
+        seg_create_file(path, i, 1000 + i * 100);
+    }
+
+    // No backing file per clip; the data is in the segments
+    fused_inode_t *clip = path_to_inode("/clips/clip_07.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(clip);
+    CU_ASSERT_EQUAL(access(clip->backing_path, F_OK), -1);
+    seg_stats_t stats;
+    seg_get_stats(&stats);
+    CU_ASSERT_TRUE(stats.segments >= 1);
+    CU_ASSERT_TRUE(stats.live >= 50 * 1000);
+
+    struct stat st;
+    CU_ASSERT_EQUAL(fused_getattr("/clips/clip_07.mp4", &st), 0);
+    CU_ASSERT_EQUAL(st.st_size, 1700);
+    CU_ASSERT_EQUAL(st.st_blocks, (1700 + 511) / 512);
+
+    // Without a descriptor to splice, read_buf hands back memory
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_open("/clips/clip_07.mp4", &fi), 0);
+    struct fuse_bufvec *bufv = NULL;
+    CU_ASSERT_EQUAL(fused_read_buf("/clips/clip_07.mp4", &bufv, 4096, 100, &fi), 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bufv);
+    CU_ASSERT_EQUAL(bufv->buf[0].size, 1600);
+    char expect[1600];
+    seg_pattern(expect, sizeof(expect), 7, 100);
+    CU_ASSERT_EQUAL(memcmp(bufv->buf[0].mem, expect, sizeof(expect)), 0);
+    free(bufv->buf[0].mem);
+    free(bufv);
+    fused_release("/clips/clip_07.mp4", &fi);
+
+    // A write past EOF leaves a hole that reads as zeros
+    fi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_open("/clips/clip_00.mp4", &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/clips/clip_00.mp4", "tail", 4, 3000, &fi), 4);
+    fused_release("/clips/clip_00.mp4", &fi);
+    char buf[3004];
+    CU_ASSERT_EQUAL(inode_read(path_to_inode("/clips/clip_00.mp4"), buf, sizeof(buf), 0),
+                    3004);
+    CU_ASSERT_EQUAL(buf[1000], 0);
+    CU_ASSERT_EQUAL(buf[2999], 0);
+    CU_ASSERT_EQUAL(memcmp(buf + 3000, "tail", 4), 0);
+
+    // Files keep their engine when the option changes, also across a restart
+    seg_configure(false, false, 0);
+    fused_inode_t *plain = create_test_file("plain.mp4", "/");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(plain);
+    CU_ASSERT_PTR_NULL(plain->seg_map);
+    restart_filesystem();
+
+    for (int i = 1; i < 50; i++)
+    {
+        snprintf(path, sizeof(path), "/clips/clip_%02d.mp4", i);
+        seg_check_file(path, i, 1000 + i * 100);
+    }
+    CU_ASSERT_EQUAL(inode_size(path_to_inode("/clips/clip_00.mp4")), 3004);
+    CU_ASSERT_PTR_NULL(path_to_inode("/plain.mp4")->seg_map);
+    seg_configure(false, false, SEG_DEFAULT_SIZE);
+}
+
+void test_segment_compaction(void)
+{
+    seg_configure(true, false, 16 << 10);
+
+    char path[MAX_PATH];
+    for (int i = 0; i < 40; i++)
+    {
+        snprintf(path, sizeof(path), "/c_%02d.mp4", i);
+        seg_create_file(path, i, 4000);
+    }
+    seg_stats_t before;
+    seg_get_stats(&before);
+    CU_ASSERT_TRUE(before.segments > SEG_HEADS);
+
+    // Three files in four become garbage; every sealed segment is now
+    // mostly garbage and gets rewritten
+    for (int i = 0; i < 40; i++)
+    {
+        snprintf(path, sizeof(path), "/c_%02d.mp4", i);
+        if (i % 4 != 0)
+            CU_ASSERT_EQUAL(fused_unlink(path), 0);
+    }
+    seg_compact();
+    seg_stats_t after;
+    seg_get_stats(&after);
+    CU_ASSERT_TRUE(after.compacted > before.compacted);
+    CU_ASSERT_TRUE(after.bytes < before.bytes);
+    CU_ASSERT_EQUAL(after.live, before.live - 30 * 4000);
+
+    for (int i = 0; i < 40; i += 4)
+    {
+        snprintf(path, sizeof(path), "/c_%02d.mp4", i);
+        seg_check_file(path, i, 4000);
+    }
+
+    // The relocated records are what the next mount finds
+    restart_filesystem();
+    for (int i = 0; i < 40; i += 4)
+    {
+        snprintf(path, sizeof(path), "/c_%02d.mp4", i);
+        seg_check_file(path, i, 4000);
+    }
+    CU_ASSERT_PTR_NULL(path_to_inode("/c_01.mp4"));
+    seg_get_stats(&after);
+    CU_ASSERT_EQUAL(after.live, before.live - 30 * 4000);
+    seg_configure(false, false, SEG_DEFAULT_SIZE);
+}
+
+void test_segment_torn_tail(void)
+{
+    seg_configure(true, false, 0);
+
+    struct fuse_file_info fi = {0};
+    fi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_create("/torn.mp4", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/torn.mp4", "first-record", 12, 0, &fi), 12);
+    CU_ASSERT_EQUAL(fused_flush("/torn.mp4", &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/torn.mp4", "SECOND-RECORD", 13, 12, &fi), 13);
+    fused_release("/torn.mp4", &fi);
+    fused_state_destroy();
+
+    // Cut the last record short, as a crash in the middle of writing it would
+    int torn = 0;
+    DIR *dir = opendir(TEST_BACKING_DIR);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(dir);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, SEG_FILE_PREFIX, strlen(SEG_FILE_PREFIX)) != 0)
+            continue;
+        char path[MAX_PATH * 2];
+        snprintf(path, sizeof(path), "%s/%s", TEST_BACKING_DIR, entry->d_name);
+        struct stat st;
+        char tail[13];
+        int fd = open(path, O_RDWR);
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= 13 &&
+            pread(fd, tail, sizeof(tail), st.st_size - 13) == 13 &&
+            memcmp(tail, "SECOND-RECORD", 13) == 0)
+        {
+            CU_ASSERT_EQUAL(ftruncate(fd, st.st_size - 3), 0);
+            torn++;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+    closedir(dir);
+    CU_ASSERT_EQUAL(torn, 1);
+
+    CU_ASSERT_EQUAL(fused_state_init(TEST_BACKING_DIR), 0);
+    fused_inode_t *inode = path_to_inode("/torn.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    CU_ASSERT_EQUAL(inode_size(inode), 12);
+    char buf[32] = {0};
+    CU_ASSERT_EQUAL(inode_read(inode, buf, sizeof(buf), 0), 12);
+    CU_ASSERT_STRING_EQUAL(buf, "first-record");
+
+    // The torn bytes are overwritten by nothing: new appends go to a new segment
+    fi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_open("/torn.mp4", &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/torn.mp4", "!", 1, 12, &fi), 1);
+    fused_release("/torn.mp4", &fi);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, sizeof(buf), 0), 13);
+    CU_ASSERT_STRING_EQUAL(buf, "first-record!");
+    seg_configure(false, false, SEG_DEFAULT_SIZE);
+}
+
+// Bytes that never repeat within a chunk, so only real copies deduplicate
+static void dedup_fill(char *buf, size_t len, uint32_t seed)
+{
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < len; i++)
+    {
+        x = x * 1103515245u + 12345u;
+        buf[i] = (char)(x >> 24);
+    }
+}
+
+// Write len bytes at offset in pieces of at most piece bytes
+static void dedup_write(const char *path, const char *buf, size_t len, off_t offset,
+                        size_t piece)
+{
+    struct fuse_file_info fi = {0};
+    fi.flags = O_WRONLY | O_APPEND;
+    if (fused_open(path, &fi) != 0)
+        CU_ASSERT_EQUAL_FATAL(fused_create(path, 0644, &fi), 0);
+    for (size_t done = 0; done < len; done += piece)
+    {
+        size_t n = len - done < piece ? len - done : piece;
+        CU_ASSERT_EQUAL(fused_write(path, buf + done, n, offset + (off_t)done, &fi), (int)n);
+    }
+    fused_release(path, &fi);
+}
+
+static void dedup_check(const char *path, const char *expect, size_t len)
+{
+    fused_inode_t *inode = path_to_inode(path);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    CU_ASSERT_EQUAL(inode_size(inode), (off_t)len);
+    char *buf = malloc(len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, len, 0), (int)len);
+    CU_ASSERT_EQUAL(memcmp(buf, expect, len), 0);
+    free(buf);
+}
+
+void test_segment_dedup_reupload(void)
+{
+    seg_configure(true, true, 0);
+
+    const size_t len = 4 * SEG_CHUNK_SIZE + 1000;
+    char *movie = malloc(len), *other = malloc(len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(movie);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(other);
+    dedup_fill(movie, len, 1);
+
+    seg_stats_t s0, s1, s2;
+    seg_get_stats(&s0);
+    dedup_write("/movie.mp4", movie, len, 0, SEG_CHUNK_SIZE);
+    seg_get_stats(&s1);
+    CU_ASSERT_EQUAL(s1.chunks, s0.chunks + 4);
+    CU_ASSERT_EQUAL(s1.dedup_hits, s0.dedup_hits);
+
+    // The same upload again in smaller pieces, which the write-back buffer
+    // joins: the chunks are shared
+    dedup_write("/copy.mp4", movie, len, 0, 48 << 10);
+    seg_get_stats(&s2);
+    CU_ASSERT_EQUAL(s2.chunks, s1.chunks);
+    CU_ASSERT_EQUAL(s2.dedup_hits, s1.dedup_hits + 4);
+    CU_ASSERT_TRUE(s2.dedup_ratio >= 2.0);
+    CU_ASSERT_TRUE(s2.live - s1.live < SEG_CHUNK_SIZE);
+    dedup_check("/copy.mp4", movie, len);
+
+    // An edited copy shares every chunk but the changed one
+    memcpy(other, movie, len);
+    other[2 * SEG_CHUNK_SIZE + 5] ^= 1;
+    dedup_write("/edit.mp4", other, len, 0, SEG_CHUNK_SIZE);
+    seg_get_stats(&s1);
+    CU_ASSERT_EQUAL(s1.chunks, s2.chunks + 1);
+    CU_ASSERT_EQUAL(s1.dedup_hits, s2.dedup_hits + 3);
+    dedup_check("/edit.mp4", other, len);
+
+    // Chunks outlive the file that wrote them, and mounting recounts them
+    CU_ASSERT_EQUAL(fused_unlink("/movie.mp4"), 0);
+    dedup_check("/copy.mp4", movie, len);
+    restart_filesystem();
+    dedup_check("/copy.mp4", movie, len);
+    dedup_check("/edit.mp4", other, len);
+    seg_get_stats(&s2);
+    CU_ASSERT_EQUAL(s2.chunks, 5);
+    CU_ASSERT_EQUAL(s2.chunk_ref_bytes, 8 * SEG_CHUNK_SIZE);
+
+    // The last reference frees a chunk
+    CU_ASSERT_EQUAL(fused_unlink("/edit.mp4"), 0);
+    seg_get_stats(&s1);
+    CU_ASSERT_EQUAL(s1.chunks, 4);
+    CU_ASSERT_EQUAL(fused_unlink("/copy.mp4"), 0);
+    seg_get_stats(&s1);
+    CU_ASSERT_EQUAL(s1.chunks, 0);
+    CU_ASSERT_EQUAL(s1.live, s0.live);
+
+    free(movie);
+    free(other);
+    seg_configure(false, false, SEG_DEFAULT_SIZE);
+}
+
+void test_segment_dedup_compaction(void)
+{
+    wb_configure(0, WB_DEFAULT_BUDGET, WB_DEFAULT_FLUSH_MS);
+    seg_configure(true, true, 300 << 10);
+
+    // Small writes stay plain records, so the chunk shares its segment with
+    // garbage-to-be; more small writes then seal it
+    const size_t len = 4 * SEG_CHUNK_SIZE;
+    char *data = malloc(len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+    dedup_fill(data, len, 2);
+    dedup_write("/raw.mp4", data, 3 * SEG_CHUNK_SIZE, 0, 1024);
+    dedup_write("/raw.mp4", data + 3 * SEG_CHUNK_SIZE, SEG_CHUNK_SIZE, 3 * SEG_CHUNK_SIZE,
+                SEG_CHUNK_SIZE);
+    dedup_write("/raw.mp4", data, 48 << 10, len, 1024);
+    dedup_write("/clip.mp4", data + 3 * SEG_CHUNK_SIZE, SEG_CHUNK_SIZE, 0, SEG_CHUNK_SIZE);
+
+    seg_stats_t before, after;
+    seg_get_stats(&before);
+    CU_ASSERT_EQUAL(before.chunks, 1);
+    CU_ASSERT_EQUAL(before.chunk_ref_bytes, 2 * SEG_CHUNK_SIZE);
+
+    // The chunk is all that is left of its segment and moves
+    CU_ASSERT_EQUAL(fused_unlink("/raw.mp4"), 0);
+    seg_compact();
+    seg_get_stats(&after);
+    CU_ASSERT_TRUE(after.compacted > before.compacted);
+    CU_ASSERT_EQUAL(after.chunks, 1);
+    dedup_check("/clip.mp4", data + 3 * SEG_CHUNK_SIZE, SEG_CHUNK_SIZE);
+
+    restart_filesystem();
+    dedup_check("/clip.mp4", data + 3 * SEG_CHUNK_SIZE, SEG_CHUNK_SIZE);
+    seg_get_stats(&after);
+    CU_ASSERT_EQUAL(after.chunks, 1);
+    CU_ASSERT_EQUAL(after.chunk_ref_bytes, SEG_CHUNK_SIZE);
+
+    free(data);
+    seg_configure(false, false, SEG_DEFAULT_SIZE);
+    wb_configure(WB_DEFAULT_THRESHOLD, WB_DEFAULT_BUDGET, WB_DEFAULT_FLUSH_MS);
+}
+
+// ============================================================================
+// Hot cache Tests
+// ============================================================================
+
+void test_hotcache_hits_and_appends(void)
+{
+    hotcache_configure(16 << 20);
+
+    const size_t len = 3 * HC_BLOCK_SIZE + 1000;
+    char *data = malloc(len + 500), *buf = malloc(len + 500);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+    dedup_fill(data, len + 500, 3);
+    dedup_write("/hot.mp4", data, len, 0, 32 << 10);
+    fused_inode_t *inode = path_to_inode("/hot.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+
+    // The first read goes to the backing file and keeps the blocks
+    hotcache_stats_t s0, s1;
+    hotcache_get_stats(&s0);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, len, 0), (int)len);
+    CU_ASSERT_EQUAL(memcmp(buf, data, len), 0);
+    hotcache_get_stats(&s1);
+    CU_ASSERT_EQUAL(s1.misses, s0.misses + 1);
+    CU_ASSERT_EQUAL(s1.blocks, s0.blocks + 4);
+
+    // Later reads, unaligned ones included, come from memory
+    memset(buf, 0, len);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, 100000, 12345), 100000);
+    CU_ASSERT_EQUAL(memcmp(buf, data + 12345, 100000), 0);
+    hotcache_get_stats(&s0);
+    CU_ASSERT_EQUAL(s0.hits, s1.hits + 1);
+    CU_ASSERT_EQUAL(s0.misses, s1.misses);
+
+    // The zero-copy path copies cached ranges instead of splicing them
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_open("/hot.mp4", &fi), 0);
+    struct fuse_bufvec *bufv = NULL;
+    CU_ASSERT_EQUAL(fused_read_buf("/hot.mp4", &bufv, 4096, HC_BLOCK_SIZE, &fi), 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bufv);
+    CU_ASSERT_FALSE(bufv->buf[0].flags & FUSE_BUF_IS_FD);
+    CU_ASSERT_EQUAL(memcmp(bufv->buf[0].mem, data + HC_BLOCK_SIZE, 4096), 0);
+    free(bufv->buf[0].mem);
+    free(bufv);
+    fused_release("/hot.mp4", &fi);
+
+    // An append extends the cached EOF block on the next read past it
+    dedup_write("/hot.mp4", data + len, 500, len, 500);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, 2000, len - 1500), 2000);
+    CU_ASSERT_EQUAL(memcmp(buf, data + len - 1500, 2000), 0);
+    hotcache_get_stats(&s1);
+    CU_ASSERT_EQUAL(s1.misses, s0.misses + 1);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, len + 500, 0), (int)(len + 500));
+    CU_ASSERT_EQUAL(memcmp(buf, data, len + 500), 0);
+    hotcache_get_stats(&s0);
+    CU_ASSERT_EQUAL(s0.hits, s1.hits + 1);
+
+    // A file that reuses the freed slot never sees the old blocks
+    uint64_t old_ino = inode->ino;
+    CU_ASSERT_EQUAL(fused_unlink("/hot.mp4"), 0);
+    dedup_fill(data, len, 4);
+    dedup_write("/hot.mp4", data, len, 0, 32 << 10);
+    inode = path_to_inode("/hot.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    CU_ASSERT_NOT_EQUAL(inode->ino, old_ino);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, len, 0), (int)len);
+    CU_ASSERT_EQUAL(memcmp(buf, data, len), 0);
+    hotcache_get_stats(&s1);
+    CU_ASSERT_EQUAL(s1.misses, s0.misses + 1);
+    CU_ASSERT_EQUAL(fused_unlink("/hot.mp4"), 0);
+
+    free(data);
+    free(buf);
+    hotcache_configure(HC_DEFAULT_SIZE);
+}
+
+void test_hotcache_scan_resistance(void)
+{
+    // Four blocks per shard, one of them for new blocks
+    hotcache_configure(4 << 20);
+
+    const size_t hot_len = 4 * HC_BLOCK_SIZE;
+    const int rounds = 10, scan_blocks = 16;
+    char *hot = malloc(hot_len), *buf = malloc(hot_len);
+    char *scan = malloc((size_t)rounds * scan_blocks * HC_BLOCK_SIZE);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(hot);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(scan);
+    dedup_fill(hot, hot_len, 4);
+    dedup_fill(scan, (size_t)rounds * scan_blocks * HC_BLOCK_SIZE, 5);
+    dedup_write("/popular.mp4", hot, hot_len, 0, HC_BLOCK_SIZE);
+    dedup_write("/archive.mp4", scan, (size_t)rounds * scan_blocks * HC_BLOCK_SIZE, 0,
+                HC_BLOCK_SIZE);
+    fused_inode_t *popular = path_to_inode("/popular.mp4");
+    fused_inode_t *archive = path_to_inode("/archive.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(popular);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(archive);
+
+    // The popular clip is watched between stretches of a one-off scan
+    for (int r = 0; r < rounds; r++)
+    {
+        CU_ASSERT_EQUAL(inode_read(popular, buf, hot_len, 0), (int)hot_len);
+        for (int b = 0; b < scan_blocks; b++)
+        {
+            off_t off = ((off_t)r * scan_blocks + b) * HC_BLOCK_SIZE;
+            CU_ASSERT_EQUAL(inode_read(archive, buf, HC_BLOCK_SIZE, off), HC_BLOCK_SIZE);
+        }
+    }
+
+    // The scan went through without evicting the clip
+    hotcache_stats_t before, after;
+    hotcache_get_stats(&before);
+    CU_ASSERT_TRUE(before.promotions > 0);
+    CU_ASSERT_EQUAL(inode_read(popular, buf, hot_len, 0), (int)hot_len);
+    CU_ASSERT_EQUAL(memcmp(buf, hot, hot_len), 0);
+    CU_ASSERT_EQUAL(inode_read(archive, buf, HC_BLOCK_SIZE, 0), HC_BLOCK_SIZE);
+    hotcache_get_stats(&after);
+    CU_ASSERT_EQUAL(after.hits, before.hits + 1);
+    CU_ASSERT_EQUAL(after.misses, before.misses + 1);
+
+    free(hot);
+    free(buf);
+    free(scan);
+    hotcache_configure(HC_DEFAULT_SIZE);
+}
+
+// ============================================================================
+// Backing I/O Tests
+// ============================================================================
+
+void test_io_roundtrip(void)
+{
+    hotcache_configure(0);
+    const size_t len = 300 << 10;
+    char *data = malloc(len), *buf = malloc(len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+    dedup_fill(data, len, 6);
+    dedup_write("/io.mp4", data, len, 0, 100 << 10);
+
+    // Write-back, fsync and reads of the backing file
+    fused_inode_t *inode = path_to_inode("/io.mp4");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    CU_ASSERT_EQUAL(inode_fsync(inode, 1), 0);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, len, 0), (int)len);
+    CU_ASSERT_EQUAL(memcmp(buf, data, len), 0);
+    CU_ASSERT_EQUAL(inode_read(inode, buf, 1000, len - 10), 10);
+    CU_ASSERT_EQUAL(memcmp(buf, data + len - 10, 10), 0);
+
+    // Whole-range reads fail instead of coming back short
+    int fd = open(inode->backing_path, O_RDONLY | O_CLOEXEC);
+    CU_ASSERT_FATAL(fd >= 0);
+    CU_ASSERT_EQUAL(io_pread_full(fd, buf, len, 0), 0);
+    CU_ASSERT_EQUAL(io_pread_full(fd, buf, 1000, len - 10), -EIO);
+    CU_ASSERT_EQUAL(io_pwrite(fd, buf, 1, 0), -EBADF);
+    close(fd);
+
+    free(data);
+    free(buf);
+    hotcache_configure(HC_DEFAULT_SIZE);
+}
+
+// ============================================================================
+// Operation stats Tests
+// ============================================================================
+
+void test_stats_histogram_percentiles(void)
+{
+    stats_reset();
+
+    // 98 fast reads, one slow one and one slow failure
+    uint64_t now = stats_now();
+    for (int i = 0; i < 98; i++)
+        CU_ASSERT_EQUAL(stats_record(STATS_READ, now - 1000, 10), 10);
+    stats_record(STATS_READ, stats_now() - 5000000, 10);
+    CU_ASSERT_EQUAL(stats_record(STATS_READ, stats_now() - 5000000, -EIO), -EIO);
+
+    stats_summary_t s;
+    stats_summary(STATS_READ, &s);
+    CU_ASSERT_EQUAL(s.count, 100);
+    CU_ASSERT_EQUAL(s.errors, 1);
+    CU_ASSERT_TRUE(s.max_ns >= 5000000);
+
+    // A percentile is within a factor of two above the latencies it covers
+    CU_ASSERT_TRUE(s.p50_ns >= 1000 && s.p50_ns < s.max_ns);
+    CU_ASSERT_TRUE(s.p99_ns >= 5000000 && s.p99_ns <= s.max_ns);
+    CU_ASSERT_TRUE(s.mean_ns >= 100000);
+
+    stats_summary(STATS_RENAME, &s);
+    CU_ASSERT_EQUAL(s.count, 0);
+    CU_ASSERT_EQUAL(s.p99_ns, 0);
+}
+
+void test_stats_virtual_file(void)
+{
+    stats_reset();
+
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/measured.mp4", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/measured.mp4", "abc", 3, 0, &fi), 3);
+    fused_release("/measured.mp4", &fi);
+    struct stat st;
+    CU_ASSERT_EQUAL(fused_getattr("/missing.mp4", &st), -ENOENT);
+
+    // A read-only regular file in the root, not listed and not replaceable
+    CU_ASSERT_EQUAL(fused_getattr("/" FUSED_STATS_NAME, &st), 0);
+    CU_ASSERT_TRUE(S_ISREG(st.st_mode));
+    CU_ASSERT_EQUAL(st.st_mode & 0777, 0444);
+    CU_ASSERT_TRUE(st.st_size > 0);
+    CU_ASSERT_EQUAL(fused_create("/" FUSED_STATS_NAME, 0644, &fi), -EEXIST);
+    CU_ASSERT_EQUAL(fused_mkdir("/" FUSED_STATS_NAME, 0755), -EEXIST);
+    fi.flags = O_WRONLY;
+    CU_ASSERT_EQUAL(fused_open("/" FUSED_STATS_NAME, &fi), -EACCES);
+
+    fi.flags = O_RDONLY;
+    CU_ASSERT_EQUAL(fused_open("/" FUSED_STATS_NAME, &fi), 0);
+    CU_ASSERT_TRUE(fi.direct_io);
+    char report[4096];
+    int len = fused_read("/" FUSED_STATS_NAME, report, sizeof(report) - 1, 0, &fi);
+    CU_ASSERT_TRUE(len > 0);
+    report[len > 0 ? len : 0] = '\0';
+    CU_ASSERT_EQUAL(fused_read("/" FUSED_STATS_NAME, report, sizeof(report), len, &fi), 0);
+    CU_ASSERT_EQUAL(fused_flush("/" FUSED_STATS_NAME, &fi), 0);
+    fused_release("/" FUSED_STATS_NAME, &fi);
+
+    // The calls above are in it, errors included
+    unsigned long count, errors;
+    const char *line = strstr(report, "\ncreate ");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(line);
+    CU_ASSERT_EQUAL(sscanf(line, " create %lu %lu", &count, &errors), 2);
+    CU_ASSERT_EQUAL(count, 2);
+    CU_ASSERT_EQUAL(errors, 1);
+    line = strstr(report, "\ngetattr ");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(line);
+    CU_ASSERT_EQUAL(sscanf(line, " getattr %lu %lu", &count, &errors), 2);
+    CU_ASSERT_EQUAL(count, 2);
+    CU_ASSERT_EQUAL(errors, 1);
+
+    readdir_capture_t capture = {0};
+    CU_ASSERT_EQUAL(fused_readdir("/", &capture, test_filler, 0, NULL), 0);
+    CU_ASSERT_EQUAL(capture_count(&capture, "measured.mp4"), 1);
+    CU_ASSERT_EQUAL(capture_count(&capture, FUSED_STATS_NAME), 0);
+}
+
+// ============================================================================
+// Path cache Tests
+// ============================================================================
+
+void test_pathcache_negative_entries(void)
+{
+    struct stat st;
+    pathcache_stats_t before, after;
+    pathcache_get_stats(&before);
+
+    // The first miss walks, the second is answered by the negative entry
+    CU_ASSERT_EQUAL(fused_getattr("/later.mp4", &st), -ENOENT);
+    CU_ASSERT_EQUAL(fused_getattr("/later.mp4", &st), -ENOENT);
+    pathcache_get_stats(&after);
+    CU_ASSERT_EQUAL(after.negative_hits - before.negative_hits, 1);
+
+    // Creating the file outdates it, as removing it outdates the positive one
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_create("/later.mp4", 0644, &fi), 0);
+    fused_release("/later.mp4", &fi);
+    CU_ASSERT_EQUAL(fused_getattr("/later.mp4", &st), 0);
+    CU_ASSERT_EQUAL(fused_getattr("/later.mp4", &st), 0);
+    CU_ASSERT_EQUAL(fused_create("/later.mp4", 0644, &fi), -EEXIST);
+    CU_ASSERT_EQUAL(fused_unlink("/later.mp4"), 0);
+    CU_ASSERT_EQUAL(fused_getattr("/later.mp4", &st), -ENOENT);
+
+    pathcache_get_stats(&after);
+    CU_ASSERT_TRUE(after.hits - before.hits >= 1);
+    CU_ASSERT_TRUE(after.stale - before.stale >= 2);
+
+    // Turned off, every lookup walks
+    pathcache_configure(false);
+    CU_ASSERT_EQUAL(fused_getattr("/later.mp4", &st), -ENOENT);
+    pathcache_get_stats(&before);
+    CU_ASSERT_EQUAL(fused_getattr("/later.mp4", &st), -ENOENT);
+    pathcache_get_stats(&after);
+    CU_ASSERT_EQUAL(after.negative_hits, before.negative_hits);
+    pathcache_configure(true);
+}
+
+void test_pathcache_directory_rename(void)
+{
+    struct stat st;
+    struct fuse_file_info fi = {0};
+    CU_ASSERT_EQUAL(fused_mkdir("/shows", 0755), 0);
+    CU_ASSERT_EQUAL(fused_mkdir("/shows/s01", 0755), 0);
+    CU_ASSERT_EQUAL(fused_create("/shows/s01/e01.mp4", 0644, &fi), 0);
+    fused_release("/shows/s01/e01.mp4", &fi);
+    CU_ASSERT_EQUAL(fused_getattr("/shows/s01/e01.mp4", &st), 0);
+    CU_ASSERT_EQUAL(fused_getattr("/archive/s01/e01.mp4", &st), -ENOENT);
+
+    // Entries deep below the moved directory go stale at once
+    pathcache_stats_t before, after;
+    pathcache_get_stats(&before);
+    CU_ASSERT_EQUAL(fused_rename("/shows", "/archive"), 0);
+    pathcache_get_stats(&after);
+    CU_ASSERT_EQUAL(after.invalidations - before.invalidations, 1);
+    CU_ASSERT_EQUAL(fused_getattr("/shows/s01/e01.mp4", &st), -ENOENT);
+    CU_ASSERT_EQUAL(fused_getattr("/archive/s01/e01.mp4", &st), 0);
+
+    // A new directory under the old name does not bring the old paths back
+    CU_ASSERT_EQUAL(fused_mkdir("/shows", 0755), 0);
+    CU_ASSERT_EQUAL(fused_getattr("/shows/s01", &st), -ENOENT);
+    CU_ASSERT_EQUAL(fused_mkdir("/shows/s01", 0755), 0);
+    CU_ASSERT_EQUAL(fused_getattr("/shows/s01", &st), 0);
+    CU_ASSERT_EQUAL(fused_getattr("/shows/s01/e01.mp4", &st), -ENOENT);
+
+    // Renaming a file moves no subtree
+    pathcache_get_stats(&before);
+    CU_ASSERT_EQUAL(fused_rename("/archive/s01/e01.mp4", "/shows/s01/e01.mp4"), 0);
+    pathcache_get_stats(&after);
+    CU_ASSERT_EQUAL(after.invalidations, before.invalidations);
+    CU_ASSERT_EQUAL(fused_getattr("/archive/s01/e01.mp4", &st), -ENOENT);
+    CU_ASSERT_EQUAL(fused_getattr("/shows/s01/e01.mp4", &st), 0);
+}
+
+// ============================================================================
+// Block checksum Tests
+// ============================================================================
+
+void test_crc32c_values(void)
+{
+    // The standard check value, and chaining equals one pass
+    CU_ASSERT_EQUAL(crc32c(0, "123456789", 9), 0xE3069283);
+    CU_ASSERT_EQUAL(crc32c(crc32c(0, "1234", 4), "56789", 5), 0xE3069283);
+    CU_ASSERT_EQUAL(crc32c(0, "", 0), 0);
+
+    char data[300];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i * 7);
+    uint32_t crcs[3] = {crc32c(0, data, 128), crc32c(0, data + 128, 128),
+                        crc32c(0, data + 256, 44)};
+    CU_ASSERT_EQUAL(crc32c_verify_blocks(data, sizeof(data), crcs, 3, 128), -1);
+    data[200] ^= 1;
+    CU_ASSERT_EQUAL(crc32c_verify_blocks(data, sizeof(data), crcs, 3, 128), 1);
+    CU_ASSERT_EQUAL(crc32c_verify_blocks(data, 256, crcs, 3, 128), 1);
+}
+
+void test_crc_blocks_follow_appends(void)
+{
+    struct fuse_file_info fi = {0};
+    size_t total = CRC_BLOCK_SIZE + 5000;
+    char *data = malloc(total);
+    for (size_t i = 0; i < total; i++)
+        data[i] = (char)(i * 31 + 3);
+
+    // Uneven appends, some crossing the block boundary
+    fi.flags = O_WRONLY | O_CREAT;
+    CU_ASSERT_EQUAL(fused_create("/crc.mp4", 0644, &fi), 0);
+    for (size_t done = 0; done < total;)
+    {
+        size_t n = total - done < 7000 ? total - done : 7000;
+        CU_ASSERT_EQUAL(fused_write("/crc.mp4", data + done, n, done, &fi), (int)n);
+        done += n;
+    }
+
+    fused_inode_t *inode = path_to_inode("/crc.mp4");
+    uint32_t crcs[4];
+    off_t end = 1 << 30;
+    CU_ASSERT_EQUAL(inode_block_crcs(inode, 0, &end, crcs, 4), 2);
+    CU_ASSERT_EQUAL(end, (off_t)total);
+    CU_ASSERT_EQUAL(crcs[0], crc32c(0, data, CRC_BLOCK_SIZE));
+    CU_ASSERT_EQUAL(crcs[1], crc32c(0, data + CRC_BLOCK_SIZE, 5000));
+
+    // A block the read ends inside has none, unless it ends at EOF
+    end = CRC_BLOCK_SIZE + 100;
+    CU_ASSERT_EQUAL(inode_block_crcs(inode, 0, &end, crcs, 4), 1);
+    end = total;
+    CU_ASSERT_EQUAL(inode_block_crcs(inode, CRC_BLOCK_SIZE, &end, crcs, 4), 1);
+    CU_ASSERT_EQUAL(crcs[0], crc32c(0, data + CRC_BLOCK_SIZE, 5000));
+    CU_ASSERT_EQUAL(inode_block_crcs(inode, 100, &end, crcs, 4), -EINVAL);
+
+    // The partial block keeps growing with the file
+    CU_ASSERT_EQUAL(fused_write("/crc.mp4", "tail", 4, total, &fi), 4);
+    end = total + 4;
+    CU_ASSERT_EQUAL(inode_block_crcs(inode, CRC_BLOCK_SIZE, &end, crcs, 4), 1);
+    CU_ASSERT_EQUAL(crcs[0], crc32c(crc32c(0, data + CRC_BLOCK_SIZE, 5000), "tail", 4));
+
+    fused_release("/crc.mp4", &fi);
+    free(data);
+}
+
+void test_crc_blocks_summed_from_storage(void)
+{
+    struct fuse_file_info fi = {0};
+    char zeros[100] = {0};
+
+    // A write past EOF leaves a hole that the checksum must count as zeros
+    fi.flags = O_WRONLY | O_CREAT;
+    CU_ASSERT_EQUAL(fused_create("/holey.mp4", 0644, &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/holey.mp4", "head", 4, 0, &fi), 4);
+    CU_ASSERT_EQUAL(fused_write("/holey.mp4", "tail", 4, 104, &fi), 4);
+    fused_release("/holey.mp4", &fi);
+
+    uint32_t expected = crc32c(crc32c(crc32c(0, "head", 4), zeros, 100), "tail", 4);
+    uint32_t crc = 0;
+    off_t end = 108;
+    CU_ASSERT_EQUAL(inode_block_crcs(path_to_inode("/holey.mp4"), 0, &end, &crc, 1), 1);
+    CU_ASSERT_EQUAL(crc, expected);
+
+    // Checksums are not persisted: after a restart they come from the file
+    restart_filesystem();
+    crc = 0;
+    CU_ASSERT_EQUAL(inode_block_crcs(path_to_inode("/holey.mp4"), 0, &end, &crc, 1), 1);
+    CU_ASSERT_EQUAL(crc, expected);
+}
+
+// ============================================================================
+// Cold storage Tests
+// ============================================================================
+
+// Helper: a file of len bytes, text-like (compressible) or random
+static char *write_cold_file(const char *path, size_t len, bool random)
+{
+    char *data = malloc(len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < len; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        data[i] = random ? (char)state
+                         : (char)("metadata: title, tags, caption\n"[i % 31] + (i / 4096) % 3);
+    }
+
+    struct fuse_file_info fi = {0};
+    fi.flags = O_WRONLY | O_CREAT;
+    CU_ASSERT_EQUAL(fused_create(path, 0644, &fi), 0);
+    for (size_t done = 0; done < len;)
+    {
+        size_t n = len - done < 50000 ? len - done : 50000;
+        CU_ASSERT_EQUAL(fused_write(path, data + done, n, done, &fi), (int)n);
+        done += n;
+    }
+    fused_release(path, &fi);
+    return data;
+}
+
+// Helper: read ranges that start and end inside frames, across frames and at EOF
+static void check_cold_reads(const char *path, const char *data, size_t len)
+{
+    char *buf = malloc(len);
+    const size_t ranges[][2] = {
+        {0, len}, {1, 10}, {COLD_FRAME_SIZE - 5, 10}, {COLD_FRAME_SIZE, COLD_FRAME_SIZE},
+        {100, 3 * COLD_FRAME_SIZE}, {len - 7, 7},
+    };
+    fused_inode_t *inode = path_to_inode(path);
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+    {
+        size_t n = ranges[i][0] + ranges[i][1] > len ? len - ranges[i][0] : ranges[i][1];
+        CU_ASSERT_EQUAL(inode_read(inode, buf, n, ranges[i][0]), (int)n);
+        CU_ASSERT_EQUAL(memcmp(buf, data + ranges[i][0], n), 0);
+    }
+    free(buf);
+}
+
+static bool backing_file_exists(uint64_t ino, const char *suffix)
+{
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/inode_%lu%s", TEST_BACKING_DIR, ino, suffix);
+    return access(path, F_OK) == 0;
+}
+
+void test_cold_compress_and_read(void)
+{
+    size_t len = 4 * COLD_FRAME_SIZE + 1234;
+    char *text = write_cold_file("/captions.txt", len, false);
+    char *noise = write_cold_file("/clip.mp4", len, true);
+    fused_inode_t *text_inode = path_to_inode("/captions.txt");
+    fused_inode_t *noise_inode = path_to_inode("/clip.mp4");
+
+    // Nothing is cold until it has been left alone for the age
+    cold_configure(false, 3600);
+    CU_ASSERT_EQUAL(cold_scan(), 0);
+    CU_ASSERT_FALSE(text_inode->compressed);
+
+    cold_stats_t before, after;
+    cold_get_stats(&before);
+    cold_configure(false, 0);
+    CU_ASSERT_TRUE(cold_scan() >= 1);
+    cold_get_stats(&after);
+    CU_ASSERT_TRUE(text_inode->compressed);
+    CU_ASSERT_FALSE(noise_inode->compressed);
+    CU_ASSERT_TRUE(after.skipped_entropy > before.skipped_entropy);
+    CU_ASSERT_TRUE(after.bytes_out - before.bytes_out < (after.bytes_in - before.bytes_in) / 4);
+    CU_ASSERT_TRUE(backing_file_exists(text_inode->ino, COLD_SUFFIX));
+    CU_ASSERT_FALSE(backing_file_exists(text_inode->ino, ""));
+
+    struct stat st;
+    CU_ASSERT_EQUAL(fused_getattr("/captions.txt", &st), 0);
+    CU_ASSERT_EQUAL(st.st_size, (off_t)len);
+    CU_ASSERT_TRUE(st.st_blocks * 512 < (off_t)len / 4);
+    check_cold_reads("/captions.txt", text, len);
+    check_cold_reads("/clip.mp4", noise, len);
+
+    // The random file is not sampled again until it grows
+    cold_get_stats(&before);
+    cold_scan();
+    cold_get_stats(&after);
+    CU_ASSERT_EQUAL(after.skipped_entropy, before.skipped_entropy);
+
+    cold_configure(false, COLD_DEFAULT_AGE);
+    free(text);
+    free(noise);
+}
+
+void test_cold_skips_open_files(void)
+{
+    size_t len = 2 * COLD_FRAME_SIZE;
+    char *text = write_cold_file("/open.txt", len, false);
+    fused_inode_t *inode = path_to_inode("/open.txt");
+
+    struct fuse_file_info fi = {0};
+    fi.flags = O_RDONLY;
+    CU_ASSERT_EQUAL(fused_open("/open.txt", &fi), 0);
+    cold_configure(false, 0);
+    cold_scan();
+    CU_ASSERT_FALSE(inode->compressed);
+
+    fused_release("/open.txt", &fi);
+    cold_scan();
+    CU_ASSERT_TRUE(inode->compressed);
+
+    // Handles opened on the compressed file read it through the frames
+    CU_ASSERT_EQUAL(fused_open("/open.txt", &fi), 0);
+    check_cold_reads("/open.txt", text, len);
+    fused_release("/open.txt", &fi);
+
+    cold_configure(false, COLD_DEFAULT_AGE);
+    free(text);
+}
+
+void test_cold_restart_and_append(void)
+{
+    size_t len = 3 * COLD_FRAME_SIZE + 99;
+    char *text = write_cold_file("/notes.txt", len, false);
+    cold_configure(false, 0);
+    cold_scan();
+    cold_configure(false, COLD_DEFAULT_AGE);
+
+    // The table records the compressed form, and the loader reads its index
+    restart_filesystem();
+    fused_inode_t *inode = path_to_inode("/notes.txt");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inode);
+    CU_ASSERT_TRUE(inode->compressed);
+    CU_ASSERT_EQUAL(inode_size(inode), (off_t)len);
+    check_cold_reads("/notes.txt", text, len);
+
+    // An append writes the data back out in plain form first
+    struct fuse_file_info fi = {0};
+    fi.flags = O_WRONLY | O_APPEND;
+    CU_ASSERT_EQUAL(fused_open("/notes.txt", &fi), 0);
+    CU_ASSERT_EQUAL(fused_write("/notes.txt", "more", 4, len, &fi), 4);
+    fused_release("/notes.txt", &fi);
+    CU_ASSERT_FALSE(inode->compressed);
+    CU_ASSERT_TRUE(backing_file_exists(inode->ino, ""));
+    CU_ASSERT_FALSE(backing_file_exists(inode->ino, COLD_SUFFIX));
+
+    char tail[8];
+    CU_ASSERT_EQUAL(inode_read(inode, tail, 8, len - 4), 8);
+    CU_ASSERT_EQUAL(memcmp(tail, text + len - 4, 4), 0);
+    CU_ASSERT_EQUAL(memcmp(tail + 4, "more", 4), 0);
+    check_cold_reads("/notes.txt", text, len);
+    free(text);
+}
+
+// ============================================================================
+// Logging Tests
+// ============================================================================
+
+void test_log_level_filter(void)
+{
+    fused_log_set_level(FUSED_LOG_WARN);
+    CU_ASSERT_FALSE(fused_log_enabled(FUSED_LOG_DEBUG));
+    CU_ASSERT_FALSE(fused_log_enabled(FUSED_LOG_INFO));
+    CU_ASSERT_TRUE(fused_log_enabled(FUSED_LOG_WARN));
+    CU_ASSERT_TRUE(fused_log_enabled(FUSED_LOG_ERROR));
+
+    CU_ASSERT_EQUAL(fused_log_parse_level("debug", FUSED_LOG_INFO), FUSED_LOG_DEBUG);
+    CU_ASSERT_EQUAL(fused_log_parse_level("ERROR", FUSED_LOG_INFO), FUSED_LOG_ERROR);
+    CU_ASSERT_EQUAL(fused_log_parse_level("bogus", FUSED_LOG_INFO), FUSED_LOG_INFO);
+    CU_ASSERT_EQUAL(fused_log_parse_level(NULL, FUSED_LOG_WARN), FUSED_LOG_WARN);
+
+    fused_log_set_level(FUSED_LOG_INFO);
+}
+
+void test_log_ratelimit(void)
+{
+    uint64_t next_ns = 0;
+
+    // One message per interval gets through, the rest are suppressed
+    CU_ASSERT_TRUE(fused_log_ratelimit_pass(&next_ns, 60000));
+    CU_ASSERT_FALSE(fused_log_ratelimit_pass(&next_ns, 60000));
+    CU_ASSERT_FALSE(fused_log_ratelimit_pass(&next_ns, 60000));
+
+    next_ns = 0;
+    CU_ASSERT_TRUE(fused_log_ratelimit_pass(&next_ns, 0));
+}
+
+// Main Test Runner
+// ============================================================================
+
+int main()
+{
+    CU_pSuite suite_getattr = NULL;
+    CU_pSuite suite_readdir = NULL;
+    CU_pSuite suite_open = NULL;
+    CU_pSuite suite_read = NULL;
+    CU_pSuite suite_write = NULL;
+    CU_pSuite suite_mkdir = NULL;
+    CU_pSuite suite_rmdir = NULL;
+    CU_pSuite suite_create = NULL;
+    CU_pSuite suite_rename = NULL;
+    CU_pSuite suite_unlink = NULL;
+    CU_pSuite suite_dir_index = NULL;
+    CU_pSuite suite_inode_alloc = NULL;
+    CU_pSuite suite_fd_cache = NULL;
+    CU_pSuite suite_inode_ops = NULL;
+    CU_pSuite suite_concurrency = NULL;
+    CU_pSuite suite_wbuf = NULL;
+    CU_pSuite suite_log = NULL;
+    CU_pSuite suite_cache = NULL;
+    CU_pSuite suite_itable = NULL;
+    CU_pSuite suite_prefetch = NULL;
+    CU_pSuite suite_segment = NULL;
+    CU_pSuite suite_hotcache = NULL;
+    CU_pSuite suite_io = NULL;
+    CU_pSuite suite_stats = NULL;
+    CU_pSuite suite_pathcache = NULL;
+    CU_pSuite suite_crc = NULL;
+    CU_pSuite suite_cold = NULL;
+    
+    // Initialize CUnit
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+    
+    // Create test suites
+    suite_getattr = CU_add_suite("fused_getattr Tests", init_suite, clean_suite);
+    suite_readdir = CU_add_suite("fused_readdir Tests", init_suite, clean_suite);
+    suite_open = CU_add_suite("fused_open Tests", init_suite, clean_suite);
+    suite_read = CU_add_suite("fused_read Tests", init_suite, clean_suite);
+    suite_write = CU_add_suite("fused_write Tests", init_suite, clean_suite);
+    suite_mkdir = CU_add_suite("fused_mkdir Tests", init_suite, clean_suite);
+    suite_rmdir = CU_add_suite("fused_rmdir Tests", init_suite, clean_suite);
+    suite_create = CU_add_suite("fused_create Tests", init_suite, clean_suite);
+    suite_rename = CU_add_suite("fused_rename Tests", init_suite, clean_suite);
+    suite_unlink = CU_add_suite("fused_unlink Tests", init_suite, clean_suite);
+    suite_dir_index = CU_add_suite("Directory index Tests", init_suite, clean_suite);
+    suite_inode_alloc = CU_add_suite("Inode allocator Tests", init_suite, clean_suite);
+    suite_fd_cache = CU_add_suite("Backing fd cache Tests", init_suite, clean_suite);
+    suite_inode_ops = CU_add_suite("Inode-level operation Tests", init_suite, clean_suite);
+    suite_concurrency = CU_add_suite("Concurrency Tests", init_suite, clean_suite);
+    suite_wbuf = CU_add_suite("Write-back buffer Tests", init_suite, clean_suite);
+    suite_log = CU_add_suite("Logging Tests", NULL, NULL);
+    suite_cache = CU_add_suite("Kernel cache policy Tests", init_suite, clean_suite);
+    suite_itable = CU_add_suite("Persistent inode table Tests", init_suite, clean_suite);
+    suite_prefetch = CU_add_suite("Prefetch Tests", init_suite, clean_suite);
+    suite_segment = CU_add_suite("Segment store Tests", init_suite, clean_suite);
+    suite_hotcache = CU_add_suite("Hot cache Tests", init_suite, clean_suite);
+    suite_io = CU_add_suite("Backing I/O Tests", init_suite, clean_suite);
+    suite_stats = CU_add_suite("Operation stats Tests", init_suite, clean_suite);
+    suite_pathcache = CU_add_suite("Path cache Tests", init_suite, clean_suite);
+    suite_crc = CU_add_suite("Block checksum Tests", init_suite, clean_suite);
+    suite_cold = CU_add_suite("Cold storage Tests", init_suite, clean_suite);
+
+    
+    if (!suite_getattr || !suite_readdir || !suite_open || !suite_read || !suite_write || !suite_mkdir || !suite_rmdir)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+    
+    // Add getattr tests
+    CU_add_test(suite_getattr, "Root directory", test_getattr_root_directory);
+    CU_add_test(suite_getattr, "Nonexistent file", test_getattr_nonexistent_file);
+    CU_add_test(suite_getattr, "Regular file", test_getattr_regular_file);
+    CU_add_test(suite_getattr, "File attributes", test_getattr_file_attributes);
+    CU_add_test(suite_getattr, "Block calculation", test_getattr_block_calculation);
+    
+    // Add readdir tests
+    CU_add_test(suite_readdir, "Empty root directory", test_readdir_empty_root);
+    CU_add_test(suite_readdir, "Directory with files", test_readdir_with_files);
+    CU_add_test(suite_readdir, "Attributes in the listing", test_readdir_fills_attributes);
+    CU_add_test(suite_readdir, "Paged listing resumes", test_readdir_paged_resume);
+    CU_add_test(suite_readdir, "Resume after compaction", test_readdir_resume_after_compaction);
+    CU_add_test(suite_readdir, "Nonexistent directory", test_readdir_nonexistent_directory);
+    CU_add_test(suite_readdir, "File not directory", test_readdir_file_not_directory);
+    
+    // Add open tests
+    CU_add_test(suite_open, "Open for reading", test_open_file_for_reading);
+    CU_add_test(suite_open, "Open for append", test_open_file_for_append);
+    CU_add_test(suite_open, "Reject non-append write", test_open_reject_non_append_write);
+    CU_add_test(suite_open, "Reject RDWR without append", test_open_reject_rdwr_without_append);
+    CU_add_test(suite_open, "Nonexistent file", test_open_nonexistent_file);
+    CU_add_test(suite_open, "Directory as file", test_open_directory_as_file);
+    CU_add_test(suite_open, "Updates atime", test_open_updates_atime);
+    
+    // Add read tests
+    CU_add_test(suite_read, "Basic file read", test_read_basic_file);
+    CU_add_test(suite_read, "Read with offset", test_read_with_offset);
+    CU_add_test(suite_read, "Read beyond file size", test_read_beyond_file_size);
+    CU_add_test(suite_read, "Read partial data", test_read_partial_data);
+    CU_add_test(suite_read, "Read empty file", test_read_empty_file);
+    CU_add_test(suite_read, "read_buf points at backing file", test_read_buf_points_at_backing_file);
+    CU_add_test(suite_read, "read_buf at EOF", test_read_buf_at_eof);
+    
+    // Add write tests
+    CU_add_test(suite_write, "Basic append write", test_write_basic_append);
+    CU_add_test(suite_write, "Multiple appends", test_write_multiple_appends);
+    CU_add_test(suite_write, "Reject non-append", test_write_reject_non_append);
+    CU_add_test(suite_write, "Updates metadata", test_write_updates_metadata);
+    CU_add_test(suite_write, "Write and read consistency", test_write_and_read_consistency);
+    CU_add_test(suite_write, "Write large data", test_write_large_data);
+    CU_add_test(suite_write, "Read after multiple writes", test_read_after_multiple_writes);
+    CU_add_test(suite_write, "Write past EOF leaves a hole", test_write_past_eof_leaves_hole);
+    CU_add_test(suite_write, "write_buf from pipe", test_write_buf_from_pipe);
+    CU_add_test(suite_write, "write_buf rejects non-append", test_write_buf_rejects_non_append);
+
+    // Add mkdir tests
+    CU_add_test(suite_mkdir, "Create directory (success)", test_mkdir_success);
+    CU_add_test(suite_mkdir, "Create directory (existing)", test_mkdir_existing);
+    CU_add_test(suite_mkdir, "Create directory (parent nonexistent)", test_mkdir_parent_nonexistent);
+    CU_add_test(suite_mkdir, "Create directory (parent not dir)", test_mkdir_parent_not_directory);
+    
+    // Add rmdir tests
+    CU_add_test(suite_rmdir, "Remove empty directory (success)", test_rmdir_success);
+    CU_add_test(suite_rmdir, "Remove non-empty directory", test_rmdir_nonempty);
+    CU_add_test(suite_rmdir, "Remove nonexistent directory", test_rmdir_nonexistent);
+    CU_add_test(suite_rmdir, "Remove root (busy)", test_rmdir_root_busy);
+    CU_add_test(suite_rmdir, "Remove not a directory", test_rmdir_not_directory);
+
+    // add create tests
+    CU_add_test(suite_create, "Successful create", test_create_successful);
+    CU_add_test(suite_create, "Create to invalid path", test_create_parent_dne);
+    CU_add_test(suite_create, "Create existing path", test_create_file_exists);
+
+    CU_add_test(suite_rename, "Working rename", test_rename_successful);
+    CU_add_test(suite_rename, "Rename to an invalid path", test_rename_invalid_dest);
+    CU_add_test(suite_rename, "Rename a file that does not exist", test_rename_invalid_source);
+    CU_add_test(suite_rename, "Rename a file to itself", test_rename_same_source_as_dest);
+
+    CU_add_test(suite_unlink, "Remove a file, and a nonexistant file", test_remove_successful);
+
+    CU_add_test(suite_dir_index, "Many entries with removal", test_dir_index_many_entries);
+    CU_add_test(suite_dir_index, "Duplicate names and churn", test_dir_index_duplicate_and_reuse);
+    CU_add_test(suite_dir_index, "Directory grows past 256 entries", test_dir_grows_past_256_entries);
+    CU_add_test(suite_dir_index, "Reject over-long names", test_dir_rejects_long_names);
+
+    CU_add_test(suite_inode_alloc, "Slot reuse bumps generation", test_inode_slot_reuse_bumps_generation);
+    CU_add_test(suite_inode_alloc, "Table grows past one chunk", test_inode_table_grows_past_one_chunk);
+
+    CU_add_test(suite_fd_cache, "Idle descriptors are bounded", test_fd_cache_idle_bound);
+    CU_add_test(suite_fd_cache, "Release closes a deleted file's descriptor",
+                test_fd_cache_release_closes_unlinked);
+    CU_add_test(suite_fd_cache, "Concurrent misses share one descriptor",
+                test_fd_cache_concurrent_miss);
+
+    CU_add_test(suite_inode_ops, "Operations without paths", test_inode_ops_without_paths);
+    CU_add_test(suite_inode_ops, "Forget defers free of unlinked inode", test_inode_forget_defers_free);
+
+    CU_add_test(suite_concurrency, "Parallel create and unlink", test_concurrent_create_unlink);
+    CU_add_test(suite_concurrency, "Reads during append", test_concurrent_reads_during_append);
+
+    CU_add_test(suite_wbuf, "Small appends are coalesced", test_wbuf_coalesces_small_appends);
+    CU_add_test(suite_wbuf, "flush, fsync and release write out", test_wbuf_flush_fsync_release);
+    CU_add_test(suite_wbuf, "Timer flush and memory budget", test_wbuf_timer_and_budget);
+    CU_add_test(suite_wbuf, "Direct ingest of large uploads", test_wbuf_direct_ingest);
+    CU_add_test(suite_wbuf, "Direct ingest realigns after a full buffer",
+                test_wbuf_direct_ingest_realigns);
+
+    CU_add_test(suite_log, "Level filter", test_log_level_filter);
+    CU_add_test(suite_log, "Rate limiter", test_log_ratelimit);
+
+    CU_add_test(suite_cache, "keep_cache only on completed files", test_cache_keep_cache_on_completed_files);
+    CU_add_test(suite_cache, "Growth invalidates cached inode", test_cache_invalidates_on_growth);
+    CU_add_test(suite_cache, "Init negotiation", test_cache_conn_init);
+    CU_add_test(suite_cache, "Writeback cache resends", test_cache_writeback_resends);
+
+    CU_add_test(suite_itable, "Restart restores the namespace", test_itable_restart_restores_namespace);
+    CU_add_test(suite_itable, "Torn record and orphan after a crash", test_itable_recovers_after_crash);
+    CU_add_test(suite_itable, "Reject a foreign table", test_itable_rejects_foreign_table);
+
+    CU_add_test(suite_prefetch, "Sequential playback", test_prefetch_sequential_playback);
+    CU_add_test(suite_prefetch, "Random reads", test_prefetch_ignores_random_reads);
+    CU_add_test(suite_prefetch, "Interleaved viewers", test_prefetch_interleaved_viewers);
+    CU_add_test(suite_prefetch, "Disabled", test_prefetch_disabled);
+
+    CU_add_test(suite_segment, "Small files share segments", test_segment_small_files);
+    CU_add_test(suite_segment, "Compaction reclaims garbage", test_segment_compaction);
+    CU_add_test(suite_segment, "Torn record at the tail", test_segment_torn_tail);
+    CU_add_test(suite_segment, "Dedup of a re-upload", test_segment_dedup_reupload);
+    CU_add_test(suite_segment, "Dedup chunks survive compaction",
+                test_segment_dedup_compaction);
+
+    // Add hot cache tests
+    CU_add_test(suite_hotcache, "Hits and appends", test_hotcache_hits_and_appends);
+    CU_add_test(suite_hotcache, "Scan resistance", test_hotcache_scan_resistance);
+
+    // Add backing I/O tests
+    CU_add_test(suite_io, "Backing file round-trip", test_io_roundtrip);
+
+    // Add operation stats tests
+    CU_add_test(suite_stats, "Histogram percentiles", test_stats_histogram_percentiles);
+    CU_add_test(suite_stats, "Virtual stats file", test_stats_virtual_file);
+
+    // Add path cache tests
+    CU_add_test(suite_pathcache, "Negative entries", test_pathcache_negative_entries);
+    CU_add_test(suite_pathcache, "Directory rename", test_pathcache_directory_rename);
+
+    // Add block checksum tests
+    CU_add_test(suite_crc, "CRC32C values", test_crc32c_values);
+    CU_add_test(suite_crc, "Blocks follow appends", test_crc_blocks_follow_appends);
+    CU_add_test(suite_crc, "Blocks summed from storage", test_crc_blocks_summed_from_storage);
+
+    // Add cold storage tests
+    CU_add_test(suite_cold, "Compress and read", test_cold_compress_and_read);
+    CU_add_test(suite_cold, "Skips open files", test_cold_skips_open_files);
+    CU_add_test(suite_cold, "Restart and append", test_cold_restart_and_append);
     
     // Run tests
     CU_basic_set_mode(CU_BRM_VERBOSE);